@@ -1,4 +1,5 @@
 import 'dart:async';
+import 'dart:typed_data';
 import 'package:flutter/services.dart';
 
 /// A class representing a scanner device with its ID and name.
@@ -6,13 +7,214 @@ class ScannerInfo {
   final String id; // Unique identifier for the scanner
   final String name; // Name of the scanner
 
-  ScannerInfo({required this.id, required this.name});
+  /// Whether the scanner is only known from an earlier run and discovery
+  /// has not found it again yet (Windows only).
+  final bool stale;
+
+  ScannerInfo({required this.id, required this.name, this.stale = false});
+}
+
+/// Output file formats a scanner can produce natively.
+enum ScanFormat { jpeg, png, tiff, pdf, dib, xps }
+
+ScanFormat? _parseScanFormat(Object? name) {
+  for (final format in ScanFormat.values) {
+    if (format.name == name) return format;
+  }
+  return null;
+}
+
+/// A scanned page together with how it was stored.
+class ScanPageResult {
+  /// The path of the scanned file.
+  final String path;
+
+  /// The format of the file at [path].
+  final ScanFormat? format;
+
+  /// `mono`, `gray` or `color` when the page was analyzed with `autoColor`.
+  final String? colorClass;
+
+  /// The page's ID in the scan store when it was scanned with `storeJob`.
+  final int? storeId;
+
+  ScanPageResult(
+      {required this.path, this.format, this.colorClass, this.storeId});
+}
+
+/// The outcome of a batch scan from the document feeder.
+class ScanBatchResult {
+  /// Scanned page paths grouped per document, in feeder order. Separator
+  /// sheets are not included.
+  final List<List<String>> documents;
+
+  /// Number of pages recovered from an interrupted run of the same job.
+  final int resumedPageCount;
+
+  /// Number of blank backs dropped by `dropBlankBacks`.
+  final int blankPageCount;
+
+  /// The format the device was asked to deliver pages in. Pages re-encoded
+  /// by `autoColor` are PNG regardless.
+  final ScanFormat? format;
+
+  ScanBatchResult(
+      {required this.documents,
+      this.resumedPageCount = 0,
+      this.blankPageCount = 0,
+      this.format});
+}
+
+/// A run of full-width rows of a page, delivered while the page is read.
+class ScanBand {
+  /// Sequence number of the page since [QuickScannerPlus.bands] was
+  /// listened to.
+  final int page;
+
+  /// Index of the first row of the band within the page.
+  final int y;
+
+  final int width;
+  final int height;
+
+  /// 1 for grayscale, 4 for BGRA.
+  final int bytesPerPixel;
+
+  /// Whether this band holds the bottom rows of the page.
+  final bool isLast;
+
+  /// `height` rows of `width * bytesPerPixel` bytes each.
+  final Uint8List pixels;
+
+  ScanBand({
+    required this.page,
+    required this.y,
+    required this.width,
+    required this.height,
+    required this.bytesPerPixel,
+    required this.isLast,
+    required this.pixels,
+  });
+}
+
+/// A page kept in the scan store opened by [QuickScannerPlus.openScanStore].
+class StoredPage {
+  final int id;
+
+  /// The `storeJob` the page was scanned with.
+  final String jobId;
+
+  /// 1-based position of the page within [jobId].
+  final int page;
+
+  final String deviceId;
+
+  /// When the page was stored.
+  final DateTime time;
+
+  final ScanFormat? format;
+
+  /// Size of the page in bytes.
+  final int size;
+
+  final bool hasThumbnail;
+
+  StoredPage({
+    required this.id,
+    required this.jobId,
+    required this.page,
+    required this.deviceId,
+    required this.time,
+    this.format,
+    required this.size,
+    required this.hasThumbnail,
+  });
+}
+
+/// Allocation statistics of the native page buffer pool.
+class BufferPoolStats {
+  /// Bytes currently held by pages in flight.
+  final int liveBytes;
+
+  /// Highest value [liveBytes] has reached.
+  final int peakLiveBytes;
+
+  /// Bytes kept for reuse by later pages.
+  final int cachedBytes;
+
+  /// Number of buffers handed out.
+  final int acquires;
+
+  /// Fraction of [acquires] served from recycled buffers.
+  final double reuseRate;
+
+  BufferPoolStats({
+    required this.liveBytes,
+    required this.peakLiveBytes,
+    required this.cachedBytes,
+    required this.acquires,
+    required this.reuseRate,
+  });
+}
+
+/// Statistics of the native dispatcher that delivers scan results and events
+/// on the platform thread.
+class DispatcherStats {
+  /// Results and events handed to the dispatcher.
+  final int posted;
+
+  /// Results and events delivered to Dart.
+  final int delivered;
+
+  /// Events dropped because a newer one replaced them within the same frame.
+  final int superseded;
+
+  /// Number of times the platform thread ran queued deliveries.
+  final int drains;
+
+  /// Total time the platform thread spent delivering, in microseconds.
+  final int busyMicros;
+
+  /// Longest single run of deliveries, in microseconds.
+  final int maxDrainMicros;
+
+  DispatcherStats({
+    required this.posted,
+    required this.delivered,
+    required this.superseded,
+    required this.drains,
+    required this.busyMicros,
+    required this.maxDrainMicros,
+  });
 }
 
 /// A class to interact with the QuickScanner plugin for scanning documents.
 class QuickScannerPlus {
   static const MethodChannel _channel =
       const MethodChannel('quick_scanner_plus');
+  static const EventChannel _bandChannel =
+      const EventChannel('quick_scanner_plus/bands');
+
+  /// Raw row bands of pages scanned with `streamBands` (Windows only).
+  ///
+  /// Bands arrive top to bottom while each page is read, so work can start
+  /// long before the scan call returns. Native buffering is bounded: a
+  /// listener that falls behind slows page processing down instead of
+  /// growing memory. Bands are only produced while this stream is listened
+  /// to. Bands read within the same frame reach Dart in one message.
+  static Stream<ScanBand> get bands =>
+      _bandChannel.receiveBroadcastStream().expand((event) {
+        List<dynamic> batch = event;
+        return batch.map((band) => ScanBand(
+              page: band['page'] as int,
+              y: band['y'] as int,
+              width: band['width'] as int,
+              height: band['height'] as int,
+              bytesPerPixel: band['bytesPerPixel'] as int,
+              isLast: band['last'] as bool,
+              pixels: band['pixels'] as Uint8List,
+            ));
+      });
 
   /// Gets the platform version of the app.
   ///
@@ -31,6 +233,8 @@ class QuickScannerPlus {
   ///
   /// This method sets up a listener to monitor the availability
   /// of scanners. Call this method before trying to access any scanners.
+  /// On Windows, network scanners that advertise eSCL (AirScan) over mDNS
+  /// are discovered as well; their IDs start with `escl:`.
   static Future<void> startWatch() async {
     try {
       await _channel.invokeMethod('startWatch');
@@ -56,6 +260,12 @@ class QuickScannerPlus {
   /// This method calls the native side to get a list of scanners and
   /// maps the data to a list of [ScannerInfo].
   ///
+  /// On Windows, the first call starts discovery in the background if
+  /// [startWatch] has not, and returns the scanners found by the previous
+  /// run right away, marked [ScannerInfo.stale]. Discovered scanners
+  /// replace them; those not found again are dropped once discovery has
+  /// looked everywhere.
+  ///
   /// Returns a [List<ScannerInfo>] containing the available scanners.
   static Future<List<ScannerInfo>> getScanners() async {
     try {
@@ -64,6 +274,7 @@ class QuickScannerPlus {
         return ScannerInfo(
           id: scanner['id'] as String,
           name: scanner['name'] as String,
+          stale: scanner['stale'] as bool? ?? false,
         );
       }).toList();
     } catch (e) {
@@ -79,17 +290,366 @@ class QuickScannerPlus {
   /// Parameters:
   /// - [deviceId]: The ID of the scanner device to use.
   /// - [directory]: The directory where the scanned file should be saved.
+  /// - [autoColor]: Whether a page without color is re-encoded as a 1-bit
+  ///   or grayscale PNG when that is smaller (Windows only).
+  /// - [format]: The output format to ask the device for. If the device
+  ///   cannot produce it, the closest format it supports is used instead
+  ///   (Windows only).
+  /// - [deviceTimeout]: How long to wait while other applications are
+  ///   scanning from the same device before failing with `DeviceBusy`
+  ///   (Windows only). Scans waiting for a device take turns in the order
+  ///   they were started. By default the scan waits as long as it takes. An
+  ///   eSCL scanner may also stay busy this long, or at least a minute,
+  ///   before the scan fails.
+  /// - [previewTextureId]: A texture from [createPreviewTexture] that shows
+  ///   the page while it is read (Windows only).
+  /// - [streamBands]: Whether the page's rows are delivered on [bands] while
+  ///   it is read (Windows only).
+  /// - [storeJob]: Also keeps the page, with a thumbnail, under this job in
+  ///   the scan store opened by [openScanStore] (Windows only).
   ///
   /// Returns the path of the scanned file as a [String].
-  static Future<String> scanFile(String deviceId, String directory) async {
+  static Future<String> scanFile(String deviceId, String directory,
+      {bool autoColor = false,
+      ScanFormat? format,
+      Duration? deviceTimeout,
+      int? previewTextureId,
+      bool streamBands = false,
+      String? storeJob}) async {
     try {
       String path = await _channel.invokeMethod('scanFile', {
         'deviceId': deviceId,
         'directory': directory,
+        'autoColor': autoColor,
+        if (format != null) 'format': format.name,
+        if (deviceTimeout != null)
+          'deviceTimeoutMs': deviceTimeout.inMilliseconds,
+        if (previewTextureId != null) 'previewTextureId': previewTextureId,
+        'streamBands': streamBands,
+        if (storeJob != null) 'storeJob': storeJob,
       });
       return path;
     } catch (e) {
       throw Exception('Failed to scan file: $e');
     }
   }
+
+  /// Scans a single page like [scanFile], and also reports the format the
+  /// device delivered it in and, with [autoColor], its color class
+  /// (Windows only).
+  static Future<ScanPageResult> scanPage(String deviceId, String directory,
+      {bool autoColor = false,
+      ScanFormat? format,
+      Duration? deviceTimeout,
+      int? previewTextureId,
+      bool streamBands = false,
+      String? storeJob}) async {
+    try {
+      Map<dynamic, dynamic> page = await _channel.invokeMethod('scanPage', {
+        'deviceId': deviceId,
+        'directory': directory,
+        'autoColor': autoColor,
+        if (format != null) 'format': format.name,
+        if (deviceTimeout != null)
+          'deviceTimeoutMs': deviceTimeout.inMilliseconds,
+        if (previewTextureId != null) 'previewTextureId': previewTextureId,
+        'streamBands': streamBands,
+        if (storeJob != null) 'storeJob': storeJob,
+      });
+      return ScanPageResult(
+        path: page['path'] as String,
+        format: _parseScanFormat(page['format']),
+        colorClass: page['colorClass'] as String?,
+        storeId: page['storeId'] as int?,
+      );
+    } catch (e) {
+      throw Exception('Failed to scan page: $e');
+    }
+  }
+
+  /// Scans every sheet in the document feeder and splits the batch into
+  /// documents at separator sheets (Windows only).
+  ///
+  /// Parameters:
+  /// - [deviceId]: The ID of the scanner device to use.
+  /// - [directory]: The directory where the scanned files should be saved.
+  /// - [splitOnPatchCodes]: Whether pages carrying a patch code are
+  ///   treated as separator sheets.
+  /// - [separatorBarcode]: A Code 39 value that marks separator sheets.
+  /// - [autoColor]: Whether pages without color are re-encoded as 1-bit or
+  ///   grayscale PNG when that is smaller.
+  /// - [jobId]: Identifies the batch in a journal kept in [directory]. If a
+  ///   previous run of the same job was interrupted, its committed pages are
+  ///   kept and scanning continues after them. Up to 64 letters, digits,
+  ///   `-`, `_` and `.`, not starting with `.`.
+  /// - [format]: The output format to ask the device for. If the device
+  ///   cannot produce it, the closest format it supports is used instead.
+  /// - [deviceTimeout]: How long to wait while other applications are
+  ///   scanning from the same device before failing with `DeviceBusy`.
+  ///   Scans waiting for a device take turns in the order they were started.
+  ///   By default the batch waits as long as it takes. An eSCL scanner may
+  ///   also stay busy this long, or at least a minute, before the scan fails.
+  /// - [previewTextureId]: A texture from [createPreviewTexture] that shows
+  ///   each page while it is read.
+  /// - [streamBands]: Whether the rows of each page are delivered on [bands]
+  ///   while it is read.
+  /// - [storeJob]: Also keeps every page other than separator sheets, with a
+  ///   thumbnail, under this job in the scan store opened by [openScanStore].
+  /// - [duplex]: Whether both sides of each sheet are scanned. The back of a
+  ///   sheet follows its front. Fails with `DuplexNotSupported` if the
+  ///   feeder cannot scan both sides.
+  /// - [dropBlankBacks]: Whether backs without content are deleted instead
+  ///   of returned, with [duplex].
+  ///
+  /// Separator sheets are deleted from [directory] and not returned.
+  static Future<ScanBatchResult> scanBatch(
+    String deviceId,
+    String directory, {
+    bool splitOnPatchCodes = true,
+    String? separatorBarcode,
+    bool autoColor = false,
+    String? jobId,
+    ScanFormat? format,
+    Duration? deviceTimeout,
+    int? previewTextureId,
+    bool streamBands = false,
+    String? storeJob,
+    bool duplex = false,
+    bool dropBlankBacks = false,
+  }) async {
+    try {
+      Map<dynamic, dynamic> batch = await _channel.invokeMethod('scanBatch', {
+        'deviceId': deviceId,
+        'directory': directory,
+        'splitOnPatchCodes': splitOnPatchCodes,
+        if (separatorBarcode != null) 'separatorBarcode': separatorBarcode,
+        'autoColor': autoColor,
+        if (jobId != null) 'jobId': jobId,
+        if (format != null) 'format': format.name,
+        if (deviceTimeout != null)
+          'deviceTimeoutMs': deviceTimeout.inMilliseconds,
+        if (previewTextureId != null) 'previewTextureId': previewTextureId,
+        'streamBands': streamBands,
+        if (storeJob != null) 'storeJob': storeJob,
+        'duplex': duplex,
+        'dropBlankBacks': dropBlankBacks,
+      });
+      List<dynamic> documents = batch['documents'];
+      return ScanBatchResult(
+        documents: documents
+            .map((document) => (document as List<dynamic>).cast<String>())
+            .toList(),
+        resumedPageCount: batch['resumedPages'] as int? ?? 0,
+        blankPageCount: batch['blankPages'] as int? ?? 0,
+        format: _parseScanFormat(batch['format']),
+      );
+    } catch (e) {
+      throw Exception('Failed to scan batch: $e');
+    }
+  }
+
+  /// Creates a texture that shows pages live while they are scanned and
+  /// processed (Windows only).
+  ///
+  /// Pass the returned ID to a `Texture` widget and as `previewTextureId` to
+  /// a scan. The texture holds one frame whose longer side is at most
+  /// [maxEdge] pixels; each page replaces the previous one. Release it with
+  /// [disposePreviewTexture].
+  static Future<int> createPreviewTexture({int maxEdge = 1024}) async {
+    try {
+      int textureId = await _channel
+          .invokeMethod('createPreviewTexture', {'maxEdge': maxEdge});
+      return textureId;
+    } catch (e) {
+      throw Exception('Failed to create preview texture: $e');
+    }
+  }
+
+  /// Releases a texture created by [createPreviewTexture] (Windows only).
+  static Future<void> disposePreviewTexture(int textureId) async {
+    try {
+      await _channel
+          .invokeMethod('disposePreviewTexture', {'textureId': textureId});
+    } catch (e) {
+      throw Exception('Failed to dispose preview texture: $e');
+    }
+  }
+
+  /// Sets the color correction applied to every page scanned from
+  /// [deviceId] (Windows only).
+  ///
+  /// [path] is a calibrated 3D LUT in `.cube` format that maps the device's
+  /// colors to normalized ones; pass `null` to scan without correction.
+  /// Corrected color pages are stored as PNG, or as grayscale or 1-bit PNG
+  /// with `autoColor`. A file used for several devices is loaded once.
+  ///
+  /// JPEG pages are left uncorrected unless [correctJpeg] is set, because a
+  /// corrected page is stored losslessly: a color page typically grows to
+  /// several times the size of the JPEG the device delivered.
+  static Future<void> setColorLut(String deviceId, String? path,
+      {bool correctJpeg = false}) async {
+    try {
+      await _channel.invokeMethod('setColorLut', {
+        'deviceId': deviceId,
+        if (path != null) 'path': path,
+        'correctJpeg': correctJpeg,
+      });
+    } catch (e) {
+      throw Exception('Failed to set color LUT: $e');
+    }
+  }
+
+  /// Opens the scan store in the directory [path], creating it if needed,
+  /// and returns the number of pages it holds (Windows only).
+  ///
+  /// Scans started with `storeJob` add their pages to the store. Opening a
+  /// store replaces the one that was open.
+  static Future<int> openScanStore(String path) async {
+    try {
+      int pageCount =
+          await _channel.invokeMethod('openScanStore', {'path': path});
+      return pageCount;
+    } catch (e) {
+      throw Exception('Failed to open scan store: $e');
+    }
+  }
+
+  /// Closes the store opened by [openScanStore] (Windows only).
+  static Future<void> closeScanStore() async {
+    try {
+      await _channel.invokeMethod('closeScanStore');
+    } catch (e) {
+      throw Exception('Failed to close scan store: $e');
+    }
+  }
+
+  /// Lists the stored pages that match every given filter, in the order they
+  /// were stored (Windows only).
+  ///
+  /// [from] and [to] are inclusive. [offset] and [limit] page
+  /// through the matches.
+  static Future<List<StoredPage>> queryScanStore({
+    String? jobId,
+    String? deviceId,
+    DateTime? from,
+    DateTime? to,
+    int offset = 0,
+    int? limit,
+  }) async {
+    try {
+      List<dynamic> pages = await _channel.invokeMethod('queryScanStore', {
+        if (jobId != null) 'jobId': jobId,
+        if (deviceId != null) 'deviceId': deviceId,
+        if (from != null) 'fromMs': from.millisecondsSinceEpoch,
+        if (to != null) 'toMs': to.millisecondsSinceEpoch,
+        'offset': offset,
+        if (limit != null) 'limit': limit,
+      });
+      return pages.map((page) {
+        Map<dynamic, dynamic> info = page as Map<dynamic, dynamic>;
+        return StoredPage(
+          id: info['id'] as int,
+          jobId: info['jobId'] as String,
+          page: info['page'] as int,
+          deviceId: info['deviceId'] as String,
+          time: DateTime.fromMillisecondsSinceEpoch(info['timeMs'] as int),
+          format: _parseScanFormat(info['format']),
+          size: info['size'] as int,
+          hasThumbnail: info['hasThumbnail'] as bool,
+        );
+      }).toList();
+    } catch (e) {
+      throw Exception('Failed to query scan store: $e');
+    }
+  }
+
+  /// Reads a stored page, or with [thumbnail] its PNG thumbnail, from the
+  /// store opened by [openScanStore] (Windows only).
+  static Future<Uint8List> readStoredPage(int id,
+      {bool thumbnail = false}) async {
+    try {
+      Uint8List bytes = await _channel
+          .invokeMethod('readStoredPage', {'id': id, 'thumbnail': thumbnail});
+      return bytes;
+    } catch (e) {
+      throw Exception('Failed to read stored page: $e');
+    }
+  }
+
+  /// Retrieves allocation statistics of the page buffer pool used by page
+  /// processing (Windows only).
+  static Future<BufferPoolStats> getBufferPoolStats() async {
+    try {
+      Map<dynamic, dynamic> stats =
+          await _channel.invokeMethod('getBufferPoolStats');
+      return BufferPoolStats(
+        liveBytes: stats['liveBytes'] as int,
+        peakLiveBytes: stats['peakLiveBytes'] as int,
+        cachedBytes: stats['cachedBytes'] as int,
+        acquires: stats['acquires'] as int,
+        reuseRate: stats['reuseRate'] as double,
+      );
+    } catch (e) {
+      throw Exception('Failed to retrieve buffer pool stats: $e');
+    }
+  }
+
+  /// Retrieves statistics of the dispatcher that moves scan results and
+  /// events onto the platform thread (Windows only).
+  static Future<DispatcherStats> getDispatcherStats() async {
+    try {
+      Map<dynamic, dynamic> stats =
+          await _channel.invokeMethod('getDispatcherStats');
+      return DispatcherStats(
+        posted: stats['posted'] as int,
+        delivered: stats['delivered'] as int,
+        superseded: stats['superseded'] as int,
+        drains: stats['drains'] as int,
+        busyMicros: stats['busyMicros'] as int,
+        maxDrainMicros: stats['maxDrainMicros'] as int,
+      );
+    } catch (e) {
+      throw Exception('Failed to retrieve dispatcher stats: $e');
+    }
+  }
+
+  /// Starts recording everything exchanged with scanners to a trace file at
+  /// [path] (Windows only).
+  ///
+  /// The trace holds scanner arrivals and removals, what each device reported
+  /// it supports, and every scanned page as the device delivered it, all
+  /// timestamped. Recording replaces any recording in progress and runs until
+  /// [stopRecording].
+  static Future<void> startRecording(String path) async {
+    try {
+      await _channel.invokeMethod('startRecording', {'path': path});
+    } catch (e) {
+      throw Exception('Failed to start recording: $e');
+    }
+  }
+
+  /// Stops the recording started by [startRecording] (Windows only).
+  static Future<void> stopRecording() async {
+    try {
+      await _channel.invokeMethod('stopRecording');
+    } catch (e) {
+      throw Exception('Failed to stop recording: $e');
+    }
+  }
+
+  /// Replays a trace written by [startRecording] (Windows only).
+  ///
+  /// The recorded scanners appear in [getScanners] with their IDs prefixed
+  /// by `replay:`. Scanning from one of them plays back the next recorded
+  /// scan of that device through the same page processing as a live scan,
+  /// so no scanner needs to be attached. With [realtime], the recorded
+  /// timing is kept; otherwise events are replayed as fast as possible.
+  static Future<void> replaySession(String path, {bool realtime = true}) async {
+    try {
+      await _channel
+          .invokeMethod('replaySession', {'path': path, 'realtime': realtime});
+    } catch (e) {
+      throw Exception('Failed to replay session: $e');
+    }
+  }
 }
@@ -0,0 +1,113 @@
+#include "band_stream.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace quick_scanner_plus
+{
+
+  RowBand MakeRowBand(uint64_t page, uint32_t width, const TileRow &row, bool last)
+  {
+    RowBand band;
+    band.page = page;
+    band.y = row.y();
+    band.width = width;
+    band.height = row.height();
+    band.format = row.tiles().empty() ? PixelFormat::kBgra8 : row.tiles().front()->format;
+    band.stride = width * BytesPerPixel(band.format);
+    band.pixels = BufferPool::Shared().Acquire(band.stride * band.height);
+    band.last = last;
+    for (uint32_t r = 0; r < band.height; r++)
+    {
+      row.CopyRow(r, band.pixels.data() + r * band.stride);
+    }
+    return band;
+  }
+
+  BandStream::BandStream(size_t capacity)
+      : capacity_(std::max<size_t>(capacity, 1)), thread_(&BandStream::Run, this)
+  {
+  }
+
+  BandStream::~BandStream()
+  {
+    Close();
+    thread_.join();
+  }
+
+  void BandStream::AddConsumer(Consumer consumer)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    consumers_.push_back(std::move(consumer));
+  }
+
+  uint64_t BandStream::BeginPage()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_page_++;
+  }
+
+  void BandStream::Push(RowBand band)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && queue_.size() >= capacity_)
+    {
+      stats_.producer_waits++;
+      not_full_.wait(lock, [this]
+                     { return closed_ || queue_.size() < capacity_; });
+    }
+    if (closed_)
+    {
+      return;
+    }
+    queue_.push_back(std::move(band));
+    stats_.peak_queued = std::max(stats_.peak_queued, queue_.size());
+    not_empty_.notify_one();
+  }
+
+  void BandStream::Close()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  BandStreamStats BandStream::stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  void BandStream::Run()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+      not_empty_.wait(lock, [this]
+                      { return closed_ || !queue_.empty(); });
+      if (queue_.empty())
+      {
+        return;
+      }
+
+      RowBand band = std::move(queue_.front());
+      queue_.pop_front();
+      not_full_.notify_one();
+      auto consumers = consumers_;
+      lock.unlock();
+
+      for (const auto &consumer : consumers)
+      {
+        consumer(band);
+      }
+      // Return the pixels to the pool before waiting for the next band.
+      band.pixels = PooledBuffer();
+
+      lock.lock();
+      stats_.bands++;
+      stats_.bytes += band.stride * band.height;
+    }
+  }
+
+} // namespace quick_scanner_plus
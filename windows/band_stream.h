@@ -0,0 +1,95 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BAND_STREAM_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BAND_STREAM_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "tiled_image.h"
+
+namespace quick_scanner_plus
+{
+
+  // A run of full-width page rows, in the page's pixel format.
+  struct RowBand
+  {
+    // Sequence number of the page within its stream, from BeginPage.
+    uint64_t page = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    PixelFormat format = PixelFormat::kBgra8;
+    size_t stride = 0;
+    PooledBuffer pixels;
+    // Set on the band holding the bottom rows of the page.
+    bool last = false;
+  };
+
+  // Copies the rows of |row| into a band of a page |width| pixels wide.
+  RowBand MakeRowBand(uint64_t page, uint32_t width, const TileRow &row, bool last);
+
+  struct BandStreamStats
+  {
+    uint64_t bands = 0;
+    uint64_t bytes = 0;
+    // Most bands ever waiting for consumers at once.
+    size_t peak_queued = 0;
+    // Pushes that had to wait because consumers fell behind.
+    uint64_t producer_waits = 0;
+  };
+
+  // Hands row bands from the page pass to every registered consumer on a
+  // dedicated thread, so consumers work on one band while the next is read.
+  // At most |capacity| bands are queued; a producer that gets that far
+  // ahead blocks until consumers catch up, which bounds memory no matter how
+  // slow a consumer is.
+  class BandStream
+  {
+  public:
+    using Consumer = std::function<void(const RowBand &band)>;
+
+    static constexpr size_t kDefaultCapacity = 4;
+
+    explicit BandStream(size_t capacity = kDefaultCapacity);
+    // Delivers what is queued, then stops the consumer thread.
+    ~BandStream();
+
+    BandStream(const BandStream &) = delete;
+    BandStream &operator=(const BandStream &) = delete;
+
+    void AddConsumer(Consumer consumer);
+
+    // Returns the sequence number for the next page's bands.
+    uint64_t BeginPage();
+    // Queues |band|, blocking while the queue is full. Bands pushed after
+    // Close are dropped.
+    void Push(RowBand band);
+    // Stops accepting bands. Queued bands are still delivered.
+    void Close();
+
+    BandStreamStats stats() const;
+
+  private:
+    void Run();
+
+    size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<RowBand> queue_;
+    std::vector<Consumer> consumers_;
+    bool closed_ = false;
+    uint64_t next_page_ = 0;
+    BandStreamStats stats_;
+    std::thread thread_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BAND_STREAM_H_
@@ -0,0 +1,189 @@
+#include "batch_journal.h"
+
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+#include "file_io.h"
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    const char kMagic[4] = {'Q', 'S', 'P', 'J'};
+    const uint8_t kVersion = 1;
+    const size_t kHeaderSize = sizeof(kMagic) + 1;
+
+    const uint8_t kRecordPage = 1;
+    const uint8_t kRecordSeparator = 2;
+    const uint8_t kRecordComplete = 3;
+
+    // Larger records can only come from a corrupted length field.
+    const uint32_t kMaxPayload = 64 * 1024;
+
+  } // namespace
+
+  bool IsValidJobId(const std::string &job_id)
+  {
+    if (job_id.empty() || job_id.size() > 64 || job_id[0] == '.')
+    {
+      return false;
+    }
+    for (char c : job_id)
+    {
+      bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' ||
+                     c == '_' || c == '.';
+      if (!allowed)
+      {
+        return false;
+      }
+    }
+
+    // Windows resolves these to devices whatever the extension.
+    std::string stem = job_id.substr(0, job_id.find('.'));
+    for (auto &c : stem)
+    {
+      c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    if (stem == "CON" || stem == "PRN" || stem == "AUX" || stem == "NUL")
+    {
+      return false;
+    }
+    bool numbered_port = stem.size() == 4 && (stem.compare(0, 3, "COM") == 0 || stem.compare(0, 3, "LPT") == 0) &&
+                         stem[3] >= '1' && stem[3] <= '9';
+    return !numbered_port;
+  }
+
+  BatchJournal::BatchJournal(const std::string &path, size_t sync_interval)
+      : path_(path), sync_interval_(sync_interval == 0 ? 1 : sync_interval)
+  {
+    fd_ = OpenFd(path_);
+    if (fd_ < 0)
+    {
+      throw std::runtime_error("Could not open batch journal " + path_);
+    }
+    Replay();
+  }
+
+  BatchJournal::~BatchJournal()
+  {
+    if (fd_ >= 0)
+    {
+      SyncFd(fd_);
+      CloseFd(fd_);
+    }
+  }
+
+  void BatchJournal::AppendPage(const std::string &path)
+  {
+    Append(kRecordPage, path);
+  }
+
+  void BatchJournal::AppendSeparator()
+  {
+    Append(kRecordSeparator, std::string());
+  }
+
+  void BatchJournal::Complete()
+  {
+    Append(kRecordComplete, std::string());
+    Sync();
+  }
+
+  void BatchJournal::Sync()
+  {
+    if (SyncFd(fd_) != 0)
+    {
+      throw std::runtime_error("Could not sync batch journal " + path_);
+    }
+    unsynced_ = 0;
+  }
+
+  void BatchJournal::Replay()
+  {
+    std::vector<uint8_t> contents = ReadAllFd(fd_);
+
+    size_t valid_end = 0;
+    bool completed = false;
+    if (contents.size() >= kHeaderSize && std::memcmp(contents.data(), kMagic, sizeof(kMagic)) == 0 &&
+        contents[sizeof(kMagic)] == kVersion)
+    {
+      size_t pos = kHeaderSize;
+      valid_end = pos;
+      // Record: payload length, type, payload, CRC-32 of type and payload.
+      while (contents.size() - pos >= 9)
+      {
+        auto length = static_cast<uint32_t>(LoadLittleEndian(&contents[pos], 4));
+        if (length > kMaxPayload || contents.size() - pos < 9 + static_cast<size_t>(length))
+        {
+          break;
+        }
+        const uint8_t *record = &contents[pos + 4];
+        if (Crc32(record, length + 1) != LoadLittleEndian(record + length + 1, 4))
+        {
+          break;
+        }
+
+        if (record[0] == kRecordPage)
+        {
+          recovered_.push_back({false, std::string(reinterpret_cast<const char *>(record + 1), length)});
+        }
+        else if (record[0] == kRecordSeparator)
+        {
+          recovered_.push_back({true, std::string()});
+        }
+        else if (record[0] == kRecordComplete)
+        {
+          completed = true;
+        }
+        pos += 9 + length;
+        valid_end = pos;
+      }
+    }
+
+    if (completed)
+    {
+      recovered_.clear();
+      valid_end = 0;
+    }
+    if (valid_end != contents.size() && TruncateFd(fd_, static_cast<long long>(valid_end)) != 0)
+    {
+      throw std::runtime_error("Could not truncate batch journal " + path_);
+    }
+    SeekEnd(fd_);
+    if (valid_end == 0)
+    {
+      std::vector<uint8_t> header(kMagic, kMagic + sizeof(kMagic));
+      header.push_back(kVersion);
+      WriteAll(header.data(), header.size());
+      Sync();
+    }
+  }
+
+  void BatchJournal::Append(uint8_t type, const std::string &payload)
+  {
+    std::vector<uint8_t> record;
+    record.reserve(payload.size() + 9);
+    AppendLittleEndian(record, payload.size(), 4);
+    record.push_back(type);
+    record.insert(record.end(), payload.begin(), payload.end());
+    AppendLittleEndian(record, Crc32(record.data() + 4, payload.size() + 1), 4);
+    WriteAll(record.data(), record.size());
+
+    if (++unsynced_ >= sync_interval_)
+    {
+      Sync();
+    }
+  }
+
+  void BatchJournal::WriteAll(const uint8_t *data, size_t size)
+  {
+    if (!WriteAllFd(fd_, data, size))
+    {
+      throw std::runtime_error("Could not write batch journal " + path_);
+    }
+  }
+
+} // namespace quick_scanner_plus
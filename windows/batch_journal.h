@@ -0,0 +1,69 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BATCH_JOURNAL_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BATCH_JOURNAL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  // One entry of a recovered journal, in the order it was committed.
+  struct JournalEntry
+  {
+    bool is_separator = false;
+    // Page file (UTF-8); empty for separators.
+    std::string path;
+  };
+
+  // Whether |job_id| can name a journal file: 1 to 64 ASCII letters, digits,
+  // '-', '_' or '.', not starting with '.' and not a Windows device name
+  // such as "CON" or "LPT1". IDs come from Dart and must not reach outside
+  // the batch directory.
+  bool IsValidJobId(const std::string &job_id);
+
+  // Append-only record of the pages a batch job has committed to disk, so a
+  // batch interrupted by a crash or a feeder jam can resume after the last
+  // good page instead of being rescanned.
+  //
+  // Every record is framed with its length and a CRC-32 and written through
+  // to the OS immediately, which is enough to survive the process dying.
+  // fsync is batched every |sync_interval| records (and on Complete) to
+  // bound what a power loss can take without paying a flush per page.
+  class BatchJournal
+  {
+  public:
+    // Opens or creates the journal at |path| (UTF-8) and replays it. A torn
+    // record at the end is cut off. A journal of a completed job is reset.
+    // Throws std::runtime_error if the file cannot be opened.
+    explicit BatchJournal(const std::string &path, size_t sync_interval = 8);
+    ~BatchJournal();
+
+    BatchJournal(const BatchJournal &) = delete;
+    BatchJournal &operator=(const BatchJournal &) = delete;
+
+    // Entries recovered when the journal was opened.
+    const std::vector<JournalEntry> &recovered() const { return recovered_; }
+
+    void AppendPage(const std::string &path);
+    void AppendSeparator();
+    // Marks the job as done and syncs.
+    void Complete();
+    void Sync();
+
+  private:
+    void Replay();
+    void Append(uint8_t type, const std::string &payload);
+    void WriteAll(const uint8_t *data, size_t size);
+
+    std::string path_;
+    size_t sync_interval_;
+    size_t unsynced_ = 0;
+    int fd_ = -1;
+    std::vector<JournalEntry> recovered_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BATCH_JOURNAL_H_
@@ -0,0 +1,370 @@
+#include "batch_separator.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // Bar widths of the supported patch codes, first bar in the most
+    // significant bit, 1 = wide bar.
+    const std::map<uint32_t, PatchCode> kPatchPatterns = {
+        {0b1001, PatchCode::kPatch1},
+        {0b1010, PatchCode::kPatch2},
+        {0b1100, PatchCode::kPatch3},
+        {0b0101, PatchCode::kPatch4},
+        {0b0011, PatchCode::kPatch6},
+        {0b1011, PatchCode::kPatchT},
+    };
+
+    // Code 39 element patterns, first element in the most significant bit,
+    // 1 = wide element.
+    const char kCode39Alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%";
+    const uint32_t kCode39Patterns[] = {
+        0x034, 0x121, 0x061, 0x160, 0x031, 0x130, 0x070, 0x025, 0x124, 0x064,
+        0x109, 0x049, 0x148, 0x019, 0x118, 0x058, 0x00D, 0x10C, 0x04C, 0x01C,
+        0x103, 0x043, 0x142, 0x013, 0x112, 0x052, 0x007, 0x106, 0x046, 0x016,
+        0x181, 0x0C1, 0x1C0, 0x091, 0x190, 0x0D0, 0x085, 0x184, 0x0C4, 0x0A8,
+        0x0A2, 0x08A, 0x02A};
+    const uint32_t kCode39Asterisk = 0x094;
+
+    // Minimum contrast between the darkest and lightest pixel of a scanline.
+    const int kMinContrast = 48;
+
+    bool IsDarkRun(const ScanlineRuns &runs, size_t index)
+    {
+      return (index % 2 == 0) == runs.first_dark;
+    }
+
+    // Classifies nine Code 39 elements so that exactly three are wide.
+    // Returns UINT32_MAX when no such split exists.
+    uint32_t ToNarrowWidePattern(const uint32_t *widths)
+    {
+      uint32_t max_narrow = 0;
+      while (true)
+      {
+        uint32_t min_over = UINT32_MAX;
+        for (size_t i = 0; i < 9; i++)
+        {
+          if (widths[i] > max_narrow && widths[i] < min_over)
+          {
+            min_over = widths[i];
+          }
+        }
+        if (min_over == UINT32_MAX)
+        {
+          return UINT32_MAX;
+        }
+        max_narrow = min_over;
+
+        uint32_t pattern = 0;
+        int wide_count = 0;
+        for (size_t i = 0; i < 9; i++)
+        {
+          pattern <<= 1;
+          if (widths[i] > max_narrow)
+          {
+            pattern |= 1;
+            wide_count++;
+          }
+        }
+        if (wide_count == 3)
+        {
+          return pattern;
+        }
+        if (wide_count < 3)
+        {
+          return UINT32_MAX;
+        }
+      }
+    }
+
+    char Code39Character(uint32_t pattern)
+    {
+      for (size_t i = 0; i < sizeof(kCode39Patterns) / sizeof(kCode39Patterns[0]); i++)
+      {
+        if (kCode39Patterns[i] == pattern)
+        {
+          return kCode39Alphabet[i];
+        }
+      }
+      return 0;
+    }
+
+    std::string DecodeCode39Forward(const ScanlineRuns &runs)
+    {
+      const auto &lengths = runs.lengths;
+      for (size_t start = 0; start + 9 <= lengths.size(); start++)
+      {
+        if (!IsDarkRun(runs, start) ||
+            ToNarrowWidePattern(&lengths[start]) != kCode39Asterisk)
+        {
+          continue;
+        }
+
+        std::string payload;
+        // Each character is nine elements followed by a narrow gap.
+        for (size_t pos = start + 10; pos + 9 <= lengths.size(); pos += 10)
+        {
+          auto pattern = ToNarrowWidePattern(&lengths[pos]);
+          if (pattern == kCode39Asterisk)
+          {
+            if (!payload.empty())
+            {
+              return payload;
+            }
+            break;
+          }
+          char c = Code39Character(pattern);
+          if (c == 0)
+          {
+            break;
+          }
+          payload.push_back(c);
+        }
+      }
+      return std::string();
+    }
+
+  } // namespace
+
+  const char *PatchCodeName(PatchCode code)
+  {
+    switch (code)
+    {
+    case PatchCode::kNone:
+      return "none";
+    case PatchCode::kPatch1:
+      return "patch1";
+    case PatchCode::kPatch2:
+      return "patch2";
+    case PatchCode::kPatch3:
+      return "patch3";
+    case PatchCode::kPatch4:
+      return "patch4";
+    case PatchCode::kPatch6:
+      return "patch6";
+    case PatchCode::kPatchT:
+      return "patchT";
+    }
+    return "none";
+  }
+
+  bool ToRuns(const std::vector<uint8_t> &luma, ScanlineRuns &runs)
+  {
+    runs.lengths.clear();
+    if (luma.empty())
+    {
+      return false;
+    }
+
+    auto range = std::minmax_element(luma.begin(), luma.end());
+    if (*range.second - *range.first < kMinContrast)
+    {
+      return false;
+    }
+    uint8_t threshold = static_cast<uint8_t>((*range.first + *range.second) / 2);
+
+    bool dark = luma[0] < threshold;
+    runs.first_dark = dark;
+    uint32_t length = 0;
+    for (auto value : luma)
+    {
+      if ((value < threshold) != dark)
+      {
+        runs.lengths.push_back(length);
+        dark = !dark;
+        length = 0;
+      }
+      length++;
+    }
+    runs.lengths.push_back(length);
+    return true;
+  }
+
+  PatchCode DecodePatchCode(const ScanlineRuns &runs)
+  {
+    const auto &lengths = runs.lengths;
+    // A patch code is four bars with three gaps between them, framed by light
+    // quiet zones on both sides.
+    for (size_t start = 1; start + 8 <= lengths.size(); start++)
+    {
+      if (!IsDarkRun(runs, start))
+      {
+        continue;
+      }
+
+      uint32_t bars[4] = {lengths[start], lengths[start + 2], lengths[start + 4], lengths[start + 6]};
+      uint32_t gaps[3] = {lengths[start + 1], lengths[start + 3], lengths[start + 5]};
+      auto bar_range = std::minmax_element(bars, bars + 4);
+      auto gap_range = std::minmax_element(gaps, gaps + 3);
+      uint32_t narrow = *bar_range.first;
+      uint32_t wide = *bar_range.second;
+
+      if (narrow < 2 || wide * 5 < narrow * 9 || wide > narrow * 5 ||
+          *gap_range.second > *gap_range.first * 2)
+      {
+        continue;
+      }
+      uint32_t quiet_zone = wide * 2;
+      if (lengths[start - 1] < quiet_zone || lengths[start + 7] < quiet_zone)
+      {
+        continue;
+      }
+
+      uint32_t pattern = 0;
+      for (auto bar : bars)
+      {
+        pattern = (pattern << 1) | (bar * 2 > narrow + wide ? 1u : 0u);
+      }
+      auto it = kPatchPatterns.find(pattern);
+      if (it != kPatchPatterns.end())
+      {
+        return it->second;
+      }
+    }
+    return PatchCode::kNone;
+  }
+
+  std::string DecodeCode39(const ScanlineRuns &runs)
+  {
+    auto payload = DecodeCode39Forward(runs);
+    if (!payload.empty())
+    {
+      return payload;
+    }
+
+    // Pages fed upside down carry the symbol right to left.
+    ScanlineRuns reversed;
+    reversed.lengths.assign(runs.lengths.rbegin(), runs.lengths.rend());
+    reversed.first_dark = runs.lengths.size() % 2 == 1 ? runs.first_dark : !runs.first_dark;
+    return DecodeCode39Forward(reversed);
+  }
+
+  SeparatorDetector::SeparatorDetector(const SeparatorOptions &options)
+      : options_(options)
+  {
+    if (options_.row_step == 0)
+    {
+      options_.row_step = 1;
+    }
+  }
+
+  void SeparatorDetector::Observe(const TileRow &row)
+  {
+    if (!options_.detect_patch_codes && options_.barcode.empty())
+    {
+      return;
+    }
+
+    size_t width = 0;
+    for (const auto &tile : row.tiles())
+    {
+      width += tile->width;
+    }
+    auto format = row.tiles().front()->format;
+    auto bpp = BytesPerPixel(format);
+    row_buffer_.resize(width * bpp);
+    luma_.resize(width);
+
+    auto first = (options_.row_step - row.y() % options_.row_step) % options_.row_step;
+    for (uint32_t r = first; r < row.height(); r += options_.row_step)
+    {
+      row.CopyRow(r, row_buffer_.data());
+      if (format == PixelFormat::kGray8)
+      {
+        luma_.assign(row_buffer_.begin(), row_buffer_.end());
+      }
+      else
+      {
+        for (size_t x = 0; x < width; x++)
+        {
+          const uint8_t *bgra = &row_buffer_[x * bpp];
+          luma_[x] = static_cast<uint8_t>((bgra[0] * 29 + bgra[1] * 150 + bgra[2] * 77) >> 8);
+        }
+      }
+      ScanLine(luma_);
+    }
+  }
+
+  void SeparatorDetector::ScanLine(const std::vector<uint8_t> &luma)
+  {
+    ScanlineRuns runs;
+    if (!ToRuns(luma, runs))
+    {
+      return;
+    }
+
+    if (options_.detect_patch_codes)
+    {
+      auto code = DecodePatchCode(runs);
+      if (code != PatchCode::kNone)
+      {
+        patch_votes_[code]++;
+      }
+    }
+    if (!options_.barcode.empty())
+    {
+      auto payload = DecodeCode39(runs);
+      if (!payload.empty())
+      {
+        barcode_votes_[payload]++;
+      }
+    }
+  }
+
+  SeparatorResult SeparatorDetector::Finish() const
+  {
+    SeparatorResult result;
+
+    uint32_t best_votes = 0;
+    for (const auto &entry : patch_votes_)
+    {
+      if (entry.second >= options_.min_votes && entry.second > best_votes)
+      {
+        best_votes = entry.second;
+        result.patch_code = entry.first;
+      }
+    }
+
+    auto barcode = barcode_votes_.find(options_.barcode);
+    if (barcode != barcode_votes_.end() && barcode->second >= options_.min_votes)
+    {
+      result.barcode = barcode->first;
+    }
+
+    result.is_separator = result.patch_code != PatchCode::kNone || !result.barcode.empty();
+    return result;
+  }
+
+  bool BatchSplitter::AddPage(const std::string &page, const SeparatorResult &separator)
+  {
+    if (separator.is_separator)
+    {
+      if (!documents_.back().empty())
+      {
+        documents_.emplace_back();
+      }
+      return false;
+    }
+    documents_.back().push_back(page);
+    return true;
+  }
+
+  std::vector<std::vector<std::string>> BatchSplitter::documents() const
+  {
+    std::vector<std::vector<std::string>> documents;
+    for (const auto &document : documents_)
+    {
+      if (!document.empty())
+      {
+        documents.push_back(document);
+      }
+    }
+    return documents;
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,102 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BATCH_SEPARATOR_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BATCH_SEPARATOR_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tiled_image.h"
+
+namespace quick_scanner_plus
+{
+
+  enum class PatchCode
+  {
+    kNone,
+    kPatch1,
+    kPatch2,
+    kPatch3,
+    kPatch4,
+    kPatch6,
+    kPatchT,
+  };
+
+  const char *PatchCodeName(PatchCode code);
+
+  struct SeparatorOptions
+  {
+    // Treat pages carrying any patch code as separator sheets.
+    bool detect_patch_codes = true;
+    // Code 39 value that marks a separator sheet. Empty disables barcodes.
+    std::string barcode;
+    // Distance in rows between sampled scanlines.
+    uint32_t row_step = 16;
+    // Number of scanlines that must agree before a page counts as a separator.
+    uint32_t min_votes = 3;
+  };
+
+  struct SeparatorResult
+  {
+    bool is_separator = false;
+    PatchCode patch_code = PatchCode::kNone;
+    std::string barcode;
+  };
+
+  // Looks for patch codes and Code 39 barcodes on sampled scanlines of a page.
+  // Fed from the same strip-by-strip pass as the other page stages, so finding
+  // separators never costs an extra decode of the page.
+  class SeparatorDetector
+  {
+  public:
+    explicit SeparatorDetector(const SeparatorOptions &options);
+
+    void Observe(const TileRow &row);
+    SeparatorResult Finish() const;
+
+  private:
+    void ScanLine(const std::vector<uint8_t> &luma);
+
+    SeparatorOptions options_;
+    std::vector<uint8_t> row_buffer_;
+    std::vector<uint8_t> luma_;
+    std::map<PatchCode, uint32_t> patch_votes_;
+    std::map<std::string, uint32_t> barcode_votes_;
+  };
+
+  // Splits a stream of pages into documents at separator sheets. Separator
+  // pages themselves are not part of any document.
+  class BatchSplitter
+  {
+  public:
+    // Returns false when |page| is a separator and should be dropped.
+    bool AddPage(const std::string &page, const SeparatorResult &separator);
+
+    // Documents in scan order. Empty documents (back-to-back separators) are
+    // skipped.
+    std::vector<std::vector<std::string>> documents() const;
+
+  private:
+    std::vector<std::vector<std::string>> documents_{{}};
+  };
+
+  // Run lengths of alternating dark/light pixels; |first_dark| tells which
+  // colour the first run has.
+  struct ScanlineRuns
+  {
+    bool first_dark = false;
+    std::vector<uint32_t> lengths;
+  };
+
+  // Binarizes |luma| around the midpoint of its range. Returns false when the
+  // line has too little contrast to hold any bars.
+  bool ToRuns(const std::vector<uint8_t> &luma, ScanlineRuns &runs);
+
+  PatchCode DecodePatchCode(const ScanlineRuns &runs);
+  // Returns the decoded Code 39 payload without start/stop characters, or an
+  // empty string.
+  std::string DecodeCode39(const ScanlineRuns &runs);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BATCH_SEPARATOR_H_
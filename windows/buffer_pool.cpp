@@ -0,0 +1,157 @@
+#include "buffer_pool.h"
+
+#include <algorithm>
+
+namespace quick_scanner_plus
+{
+
+  PooledBuffer::PooledBuffer(BufferPool *pool, std::unique_ptr<uint8_t[]> data, size_t size, size_t capacity)
+      : pool_(pool), data_(std::move(data)), size_(size), capacity_(capacity) {}
+
+  PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept
+      : pool_(other.pool_), data_(std::move(other.data_)), size_(other.size_), capacity_(other.capacity_)
+  {
+    other.pool_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+  }
+
+  PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept
+  {
+    if (this != &other)
+    {
+      Release();
+      pool_ = other.pool_;
+      data_ = std::move(other.data_);
+      size_ = other.size_;
+      capacity_ = other.capacity_;
+      other.pool_ = nullptr;
+      other.size_ = 0;
+      other.capacity_ = 0;
+    }
+    return *this;
+  }
+
+  PooledBuffer::~PooledBuffer()
+  {
+    Release();
+  }
+
+  void PooledBuffer::Release()
+  {
+    if (pool_ && data_)
+    {
+      pool_->Return(std::move(data_), capacity_);
+    }
+    pool_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+  }
+
+  BufferPool &BufferPool::Shared()
+  {
+    // Leaked on purpose: buffers may still be returned from other threads
+    // while static destructors run.
+    static BufferPool *pool = new BufferPool();
+    return *pool;
+  }
+
+  BufferPool::BufferPool(size_t max_cached_bytes)
+      : max_cached_bytes_(max_cached_bytes), last_used_(std::chrono::steady_clock::now()) {}
+
+  BufferPool::~BufferPool() = default;
+
+  size_t BufferPool::ClassIndex(size_t size)
+  {
+    size_t index = 0;
+    size_t class_size = kMinClassSize;
+    while (class_size < size)
+    {
+      class_size <<= 1;
+      index++;
+    }
+    return index;
+  }
+
+  PooledBuffer BufferPool::Acquire(size_t size)
+  {
+    if (size == 0)
+    {
+      return PooledBuffer();
+    }
+
+    size_t index = ClassIndex(size);
+    size_t capacity = kMinClassSize << index;
+    std::unique_ptr<uint8_t[]> data;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stats_.acquires++;
+      last_used_ = std::chrono::steady_clock::now();
+      if (index < free_lists_.size() && !free_lists_[index].empty())
+      {
+        data = std::move(free_lists_[index].back());
+        free_lists_[index].pop_back();
+        stats_.cached_bytes -= capacity;
+        stats_.reuses++;
+      }
+      stats_.live_bytes += capacity;
+      stats_.peak_live_bytes = std::max(stats_.peak_live_bytes, stats_.live_bytes);
+    }
+
+    if (!data)
+    {
+      data.reset(new uint8_t[capacity]);
+    }
+    return PooledBuffer(this, std::move(data), size, capacity);
+  }
+
+  void BufferPool::Return(std::unique_ptr<uint8_t[]> data, size_t capacity)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.live_bytes -= capacity;
+    last_used_ = std::chrono::steady_clock::now();
+    if (stats_.cached_bytes + capacity > max_cached_bytes_)
+    {
+      return; // |data| is freed on the way out.
+    }
+
+    size_t index = ClassIndex(capacity);
+    if (free_lists_.size() <= index)
+    {
+      free_lists_.resize(index + 1);
+    }
+    free_lists_[index].push_back(std::move(data));
+    stats_.cached_bytes += capacity;
+  }
+
+  size_t BufferPool::TrimIfIdle(std::chrono::steady_clock::duration idle_for)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::chrono::steady_clock::now() - last_used_ < idle_for)
+    {
+      return 0;
+    }
+    return TrimLocked();
+  }
+
+  size_t BufferPool::Trim()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return TrimLocked();
+  }
+
+  BufferPoolStats BufferPool::stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  size_t BufferPool::TrimLocked()
+  {
+    size_t released = stats_.cached_bytes;
+    free_lists_.clear();
+    stats_.cached_bytes = 0;
+    return released;
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,104 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BUFFER_POOL_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BUFFER_POOL_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  class BufferPool;
+
+  // A pooled byte buffer. Returns its storage to the pool when destroyed.
+  class PooledBuffer
+  {
+  public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer &&other) noexcept;
+    PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+    ~PooledBuffer();
+
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    uint8_t *data() { return data_.get(); }
+    const uint8_t *data() const { return data_.get(); }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+  private:
+    friend class BufferPool;
+
+    PooledBuffer(BufferPool *pool, std::unique_ptr<uint8_t[]> data, size_t size, size_t capacity);
+    void Release();
+
+    BufferPool *pool_ = nullptr;
+    std::unique_ptr<uint8_t[]> data_;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+  };
+
+  struct BufferPoolStats
+  {
+    // Bytes handed out and not yet returned.
+    size_t live_bytes = 0;
+    size_t peak_live_bytes = 0;
+    // Bytes parked in the free lists.
+    size_t cached_bytes = 0;
+    uint64_t acquires = 0;
+    uint64_t reuses = 0;
+
+    double reuse_rate() const { return acquires == 0 ? 0.0 : static_cast<double>(reuses) / static_cast<double>(acquires); }
+  };
+
+  // Recycles page-sized buffers across pages and jobs. Requests are rounded up
+  // to power-of-two size classes and served from per-class free lists, so a
+  // batch touches fresh memory only for its first pages. Thread-safe.
+  class BufferPool
+  {
+  public:
+    static constexpr size_t kMinClassSize = 4 * 1024;
+    static constexpr size_t kMaxCachedBytes = 256 * 1024 * 1024;
+
+    // The process-wide pool shared by all scan jobs.
+    static BufferPool &Shared();
+
+    explicit BufferPool(size_t max_cached_bytes = kMaxCachedBytes);
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // Returns a buffer of exactly |size| usable bytes. Contents are undefined.
+    PooledBuffer Acquire(size_t size);
+
+    // Frees all cached buffers when the pool has not been used for
+    // |idle_for|. Returns the number of bytes released.
+    size_t TrimIfIdle(std::chrono::steady_clock::duration idle_for);
+    // Frees all cached buffers.
+    size_t Trim();
+
+    BufferPoolStats stats() const;
+
+  private:
+    friend class PooledBuffer;
+
+    static size_t ClassIndex(size_t size);
+    void Return(std::unique_ptr<uint8_t[]> data, size_t capacity);
+    size_t TrimLocked();
+
+    size_t max_cached_bytes_;
+    mutable std::mutex mutex_;
+    std::vector<std::vector<std::unique_ptr<uint8_t[]>>> free_lists_;
+    BufferPoolStats stats_;
+    std::chrono::steady_clock::time_point last_used_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_BUFFER_POOL_H_
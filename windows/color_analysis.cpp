@@ -0,0 +1,159 @@
+#include "color_analysis.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define QUICK_SCANNER_PLUS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace quick_scanner_plus
+{
+
+  const char *ColorClassName(ColorClass color_class)
+  {
+    switch (color_class)
+    {
+    case ColorClass::kMono:
+      return "mono";
+    case ColorClass::kGray:
+      return "gray";
+    case ColorClass::kColor:
+      return "color";
+    }
+    return "color";
+  }
+
+  ColorAnalyzer::ColorAnalyzer(const ColorAnalysisOptions &options) : options_(options) {}
+
+  void ColorAnalyzer::Observe(const TileRow &row)
+  {
+    for (const auto &tile : row.tiles())
+    {
+      for (uint32_t r = 0; r < tile->height; r++)
+      {
+        if (tile->format == PixelFormat::kGray8)
+        {
+          AccumulateGray(tile->Row(r), tile->width);
+        }
+        else
+        {
+          AccumulateBgra(tile->Row(r), tile->width, chroma_, luma_);
+        }
+      }
+    }
+  }
+
+  ColorClass ColorAnalyzer::Finish() const
+  {
+    uint64_t total = 0;
+    for (auto count : luma_)
+    {
+      total += count;
+    }
+    if (total == 0)
+    {
+      return ColorClass::kMono;
+    }
+
+    uint64_t colored = 0;
+    for (size_t i = options_.chroma_threshold; i < chroma_.size(); i++)
+    {
+      colored += chroma_[i];
+    }
+    if (static_cast<double>(colored) > options_.max_color_fraction * static_cast<double>(total))
+    {
+      return ColorClass::kColor;
+    }
+
+    uint64_t midtones = 0;
+    for (size_t i = options_.midtone_low; i <= options_.midtone_high; i++)
+    {
+      midtones += luma_[i];
+    }
+    if (static_cast<double>(midtones) > options_.max_midtone_fraction * static_cast<double>(total))
+    {
+      return ColorClass::kGray;
+    }
+    return ColorClass::kMono;
+  }
+
+  bool ColorAnalyzer::IsBlank() const
+  {
+    uint64_t total = 0;
+    for (auto count : luma_)
+    {
+      total += count;
+    }
+
+    uint64_t content = 0;
+    for (size_t i = 0; i < options_.ink_threshold; i++)
+    {
+      content += luma_[i];
+    }
+    for (size_t i = options_.chroma_threshold; i < chroma_.size(); i++)
+    {
+      content += chroma_[i];
+    }
+    return static_cast<double>(content) <= options_.max_ink_fraction * static_cast<double>(total);
+  }
+
+  void AccumulateBgra(const uint8_t *pixels, size_t count, std::array<uint64_t, 256> &chroma,
+                      std::array<uint64_t, 256> &luma)
+  {
+    size_t i = 0;
+#ifdef QUICK_SCANNER_PLUS_SSE2
+    // Four pixels per step: channel spread via byte min/max across the shifted
+    // lanes, luminance via 16-bit multiply-add on the B/R and G pairs.
+    const __m128i low_bytes = _mm_set1_epi32(0x00FF00FF);
+    const __m128i br_weights = _mm_set1_epi32((77 << 16) | 29);
+    const __m128i g_weights = _mm_set1_epi32(150);
+    alignas(16) uint32_t spreads[4];
+    alignas(16) uint32_t lumas[4];
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i * 4));
+      __m128i g = _mm_srli_epi32(v, 8);
+      __m128i r = _mm_srli_epi32(v, 16);
+      __m128i hi = _mm_max_epu8(v, _mm_max_epu8(g, r));
+      __m128i lo = _mm_min_epu8(v, _mm_min_epu8(g, r));
+      __m128i spread = _mm_and_si128(_mm_sub_epi8(hi, lo), _mm_set1_epi32(0xFF));
+      _mm_store_si128(reinterpret_cast<__m128i *>(spreads), spread);
+
+      __m128i br = _mm_madd_epi16(_mm_and_si128(v, low_bytes), br_weights);
+      __m128i gg = _mm_madd_epi16(_mm_and_si128(g, low_bytes), g_weights);
+      _mm_store_si128(reinterpret_cast<__m128i *>(lumas), _mm_srli_epi32(_mm_add_epi32(br, gg), 8));
+
+      for (int k = 0; k < 4; k++)
+      {
+        chroma[spreads[k]]++;
+        luma[lumas[k]]++;
+      }
+    }
+#endif
+    AccumulateBgraScalar(pixels + i * 4, count - i, chroma, luma);
+  }
+
+  void AccumulateBgraScalar(const uint8_t *pixels, size_t count, std::array<uint64_t, 256> &chroma,
+                            std::array<uint64_t, 256> &luma)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      const uint8_t *p = pixels + i * 4;
+      uint8_t hi = p[0] > p[1] ? p[0] : p[1];
+      hi = hi > p[2] ? hi : p[2];
+      uint8_t lo = p[0] < p[1] ? p[0] : p[1];
+      lo = lo < p[2] ? lo : p[2];
+      chroma[hi - lo]++;
+      luma[Luma(p)]++;
+    }
+  }
+
+  void ColorAnalyzer::AccumulateGray(const uint8_t *pixels, size_t count)
+  {
+    chroma_[0] += count;
+    for (size_t i = 0; i < count; i++)
+    {
+      luma_[pixels[i]]++;
+    }
+  }
+
+} // namespace quick_scanner_plus
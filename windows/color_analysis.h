@@ -0,0 +1,82 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_COLOR_ANALYSIS_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_COLOR_ANALYSIS_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "tiled_image.h"
+
+namespace quick_scanner_plus
+{
+
+  enum class ColorClass
+  {
+    kMono,
+    kGray,
+    kColor,
+  };
+
+  const char *ColorClassName(ColorClass color_class);
+
+  struct ColorAnalysisOptions
+  {
+    // Pixels whose channel spread (max - min of B, G, R) reaches this are
+    // counted as colored.
+    uint8_t chroma_threshold = 40;
+    // A page is color once more than this fraction of its pixels is colored.
+    double max_color_fraction = 0.002;
+    // Luminance band that is lost when a page is stored as 1-bit.
+    uint8_t midtone_low = 80;
+    uint8_t midtone_high = 175;
+    // A page without color is mono while at most this fraction of its pixels
+    // falls into the midtone band.
+    double max_midtone_fraction = 0.04;
+    // Pixels darker than this are counted as ink when looking for blank
+    // pages. Show-through from the other side stays above it.
+    uint8_t ink_threshold = 160;
+    // A page is blank while at most this fraction of its pixels is ink or
+    // colored.
+    double max_ink_fraction = 0.002;
+  };
+
+  // Builds chroma and luminance histograms of a page from the strip-by-strip
+  // pass and decides the smallest color class that keeps its content.
+  class ColorAnalyzer
+  {
+  public:
+    explicit ColorAnalyzer(const ColorAnalysisOptions &options = ColorAnalysisOptions());
+
+    void Observe(const TileRow &row);
+    ColorClass Finish() const;
+    // Whether the page observed so far holds next to no content.
+    bool IsBlank() const;
+
+    const std::array<uint64_t, 256> &chroma_histogram() const { return chroma_; }
+    const std::array<uint64_t, 256> &luma_histogram() const { return luma_; }
+
+  private:
+    void AccumulateGray(const uint8_t *pixels, size_t count);
+
+    ColorAnalysisOptions options_;
+    std::array<uint64_t, 256> chroma_{};
+    std::array<uint64_t, 256> luma_{};
+  };
+
+  // Adds the channel spread and luminance of |count| BGRA pixels to the
+  // histograms. Uses SSE2 where the target has it; AccumulateBgraScalar is the
+  // plain version that it must match bit for bit.
+  void AccumulateBgra(const uint8_t *pixels, size_t count, std::array<uint64_t, 256> &chroma,
+                      std::array<uint64_t, 256> &luma);
+  void AccumulateBgraScalar(const uint8_t *pixels, size_t count, std::array<uint64_t, 256> &chroma,
+                            std::array<uint64_t, 256> &luma);
+
+  // Luminance of a BGRA pixel, weights in 1/256 (BT.601).
+  inline uint8_t Luma(const uint8_t *bgra)
+  {
+    return static_cast<uint8_t>((bgra[0] * 29 + bgra[1] * 150 + bgra[2] * 77) >> 8);
+  }
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_COLOR_ANALYSIS_H_
@@ -0,0 +1,300 @@
+#include "color_lut.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define QUICK_SCANNER_PLUS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // Interpolation weights sum to 1 << kWeightBits; nodes carry
+    // kNodeFractionBits below the output level.
+    const int kWeightBits = 12;
+    const int kNodeFractionBits = 4;
+    const int kShift = kWeightBits + kNodeFractionBits;
+
+    // The grid corners to blend for one pixel, and their weights.
+    struct Tetrahedron
+    {
+      const int16_t *vertex[4];
+      int32_t weight[4];
+    };
+
+    // Axes (0 = R, 1 = G, 2 = B) by descending fraction, indexed by the
+    // comparisons fr >= fg, fg >= fb and fr >= fb as bits 0 to 2. Two
+    // combinations contradict each other and never occur.
+    const uint8_t kAxisOrder[8][3] = {
+        {2, 1, 0}, // fb > fg > fr
+        {2, 0, 1}, // fb > fr >= fg
+        {1, 2, 0}, // fg >= fb > fr
+        {0, 0, 0},
+        {0, 0, 0},
+        {0, 2, 1}, // fr >= fb > fg
+        {1, 0, 2}, // fg > fr >= fb
+        {0, 1, 2}, // fr >= fg >= fb
+    };
+
+    // Orders the three axes by their fraction, largest first. The walk from
+    // the lower corner along them, in that order, visits the vertices of the
+    // tetrahedron that holds the pixel. Table driven, as the six cases are
+    // too mixed on real pages for branches to predict.
+    inline void Locate(const int16_t *base, const size_t stride[3], const int32_t fraction[3], Tetrahedron &t)
+    {
+      const uint8_t *order = kAxisOrder[(fraction[0] >= fraction[1]) | ((fraction[1] >= fraction[2]) << 1) |
+                                        ((fraction[0] >= fraction[2]) << 2)];
+      int32_t f1 = fraction[order[0]];
+      int32_t f2 = fraction[order[1]];
+      int32_t f3 = fraction[order[2]];
+      t.vertex[0] = base;
+      t.vertex[1] = base + stride[order[0]];
+      t.vertex[2] = t.vertex[1] + stride[order[1]];
+      t.vertex[3] = t.vertex[2] + stride[order[2]];
+      t.weight[0] = (1 << kWeightBits) - f1;
+      t.weight[1] = f1 - f2;
+      t.weight[2] = f2 - f3;
+      t.weight[3] = f3;
+    }
+
+    std::runtime_error CubeError(const std::string &path, const std::string &what)
+    {
+      return std::runtime_error("Invalid color LUT " + path + ": " + what);
+    }
+
+  } // namespace
+
+  constexpr uint32_t ColorLut::kMinSize;
+  constexpr uint32_t ColorLut::kMaxSize;
+
+  ColorLut::ColorLut(uint32_t size, const std::vector<float> &nodes) : size_(size)
+  {
+    size_t count = static_cast<size_t>(size) * size * size;
+    if (size < kMinSize || size > kMaxSize || nodes.size() != count * 3)
+    {
+      throw std::invalid_argument("Color LUT size does not match its nodes.");
+    }
+
+    nodes_.resize(count * 4);
+    const float scale = static_cast<float>(255 << kNodeFractionBits);
+    for (size_t i = 0; i < count; i++)
+    {
+      for (size_t c = 0; c < 3; c++)
+      {
+        float value = std::min(std::max(nodes[i * 3 + c], 0.0f), 1.0f);
+        // RGB in, BGR out.
+        nodes_[i * 4 + 2 - c] = static_cast<int16_t>(std::lround(value * scale));
+      }
+    }
+
+    for (uint32_t level = 0; level < 256; level++)
+    {
+      uint32_t position = (level * (size - 1) * (1u << kWeightBits) + 127) / 255;
+      uint32_t index = position >> kWeightBits;
+      // The top level sits on the last node; interpolate toward it from below
+      // so the upper corner stays inside the grid.
+      if (index == size - 1)
+      {
+        index--;
+      }
+      index_[level] = static_cast<uint8_t>(index);
+      fraction_[level] = static_cast<uint16_t>(position - (index << kWeightBits));
+    }
+  }
+
+  std::shared_ptr<const ColorLut> ColorLut::LoadCube(const std::string &path)
+  {
+    std::ifstream in(fs::u8path(path));
+    if (!in)
+    {
+      throw std::runtime_error("Could not open color LUT " + path);
+    }
+
+    uint32_t size = 0;
+    std::vector<float> nodes;
+    std::string line;
+    while (std::getline(in, line))
+    {
+      std::istringstream fields(line);
+      std::string keyword;
+      if (!(fields >> keyword) || keyword[0] == '#')
+      {
+        continue;
+      }
+      if (keyword == "TITLE")
+      {
+        continue;
+      }
+      if (keyword == "LUT_3D_SIZE")
+      {
+        if (!(fields >> size) || size < kMinSize || size > kMaxSize)
+        {
+          throw CubeError(path, "unsupported LUT_3D_SIZE");
+        }
+        nodes.reserve(static_cast<size_t>(size) * size * size * 3);
+        continue;
+      }
+      if (keyword == "DOMAIN_MIN" || keyword == "DOMAIN_MAX")
+      {
+        float expected = keyword == "DOMAIN_MIN" ? 0.0f : 1.0f;
+        float r, g, b;
+        if (!(fields >> r >> g >> b) || r != expected || g != expected || b != expected)
+        {
+          throw CubeError(path, "only the [0, 1] domain is supported");
+        }
+        continue;
+      }
+      if (std::isalpha(static_cast<unsigned char>(keyword[0])))
+      {
+        throw CubeError(path, "unsupported keyword " + keyword);
+      }
+
+      fields.clear();
+      fields.str(line);
+      float r, g, b;
+      if (size == 0 || !(fields >> r >> g >> b))
+      {
+        throw CubeError(path, "malformed table");
+      }
+      nodes.push_back(r);
+      nodes.push_back(g);
+      nodes.push_back(b);
+    }
+
+    if (size == 0 || nodes.size() != static_cast<size_t>(size) * size * size * 3)
+    {
+      throw CubeError(path, "table is incomplete");
+    }
+    return std::make_shared<const ColorLut>(size, nodes);
+  }
+
+  void ColorLut::ApplyBgra(uint8_t *pixels, size_t count) const
+  {
+    const size_t stride[3] = {4, 4 * size_, 4 * size_ * size_};
+    const int16_t *nodes = nodes_.data();
+    Tetrahedron t;
+#ifdef QUICK_SCANNER_PLUS_SSE2
+    const __m128i round = _mm_set1_epi32(1 << (kShift - 1));
+#endif
+    // Scanned documents are mostly runs of the same paper and ink colors.
+    uint32_t last_in = 0;
+    uint32_t last_out = 0;
+    bool have_last = false;
+    for (size_t i = 0; i < count; i++, pixels += 4)
+    {
+      uint32_t in;
+      std::memcpy(&in, pixels, 4);
+      uint32_t bgr_in = in & 0x00FFFFFF;
+      if (have_last && bgr_in == last_in)
+      {
+        uint32_t out = last_out | (in & 0xFF000000);
+        std::memcpy(pixels, &out, 4);
+        continue;
+      }
+
+      uint8_t b = pixels[0];
+      uint8_t g = pixels[1];
+      uint8_t r = pixels[2];
+      const int32_t fraction[3] = {fraction_[r], fraction_[g], fraction_[b]};
+      Locate(nodes + index_[r] * stride[0] + index_[g] * stride[1] + index_[b] * stride[2], stride, fraction, t);
+#ifdef QUICK_SCANNER_PLUS_SSE2
+      // Interleave vertex pairs so one multiply-add weighs both of them for
+      // all channels at once.
+      __m128i v01 = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(t.vertex[0])),
+                                       _mm_loadl_epi64(reinterpret_cast<const __m128i *>(t.vertex[1])));
+      __m128i v23 = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(t.vertex[2])),
+                                       _mm_loadl_epi64(reinterpret_cast<const __m128i *>(t.vertex[3])));
+      __m128i w01 = _mm_set1_epi32(t.weight[0] | (t.weight[1] << 16));
+      __m128i w23 = _mm_set1_epi32(t.weight[2] | (t.weight[3] << 16));
+      __m128i sum = _mm_add_epi32(_mm_madd_epi16(v01, w01), _mm_madd_epi16(v23, w23));
+      sum = _mm_srli_epi32(_mm_add_epi32(sum, round), kShift);
+      sum = _mm_packs_epi32(sum, sum);
+      // The node's fourth lane is zero, so the alpha byte comes out clear.
+      auto out = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+#else
+      uint32_t out = 0;
+      for (int c = 0; c < 3; c++)
+      {
+        int32_t sum = 1 << (kShift - 1);
+        for (int v = 0; v < 4; v++)
+        {
+          sum += t.vertex[v][c] * t.weight[v];
+        }
+        out |= static_cast<uint32_t>(std::min(sum >> kShift, 255)) << (8 * c);
+      }
+#endif
+      last_in = bgr_in;
+      last_out = out;
+      have_last = true;
+      out |= in & 0xFF000000;
+      std::memcpy(pixels, &out, 4);
+    }
+  }
+
+  void ColorLut::ApplyTile(Tile &tile) const
+  {
+    if (tile.format != PixelFormat::kBgra8)
+    {
+      return;
+    }
+    for (uint32_t row = 0; row < tile.height; row++)
+    {
+      ApplyBgra(tile.Row(row), tile.width);
+    }
+  }
+
+  std::shared_ptr<const ColorLut> ColorLutCache::Load(const std::string &device_id, const std::string &path)
+  {
+    auto modified = fs::last_write_time(fs::u8path(path));
+    std::shared_ptr<const ColorLut> lut;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto file = files_.find(path);
+      if (file != files_.end() && file->second.modified == modified)
+      {
+        lut = file->second.lut.lock();
+      }
+    }
+    if (!lut)
+    {
+      lut = ColorLut::LoadCube(path);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_[path] = File{modified, lut};
+    devices_[device_id] = lut;
+    return lut;
+  }
+
+  void ColorLutCache::Remove(const std::string &device_id)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    devices_.erase(device_id);
+    for (auto file = files_.begin(); file != files_.end();)
+    {
+      file = file->second.lut.expired() ? files_.erase(file) : std::next(file);
+    }
+  }
+
+  std::shared_ptr<const ColorLut> ColorLutCache::Find(const std::string &device_id) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto device = devices_.find(device_id);
+    return device == devices_.end() ? nullptr : device->second;
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,85 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_COLOR_LUT_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_COLOR_LUT_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tiled_image.h"
+
+namespace quick_scanner_plus
+{
+
+  // A calibrated 3D color lookup table that maps device RGB to normalized
+  // RGB, applied with tetrahedral interpolation.
+  //
+  // Nodes are kept as 16-bit fixed point with 4 fractional bits, laid out as
+  // B, G, R, 0 to match BGRA pixels, so the four vertices of a tetrahedron
+  // are blended with two SSE2 multiply-adds per pixel. The grid position of
+  // every input level is precomputed, leaving no division per pixel. Results
+  // stay within one level of the exact interpolation.
+  class ColorLut
+  {
+  public:
+    static constexpr uint32_t kMinSize = 2;
+    static constexpr uint32_t kMaxSize = 129;
+
+    // |nodes| holds size^3 RGB triples in [0, 1], red varying fastest, as in
+    // .cube files. Throws std::invalid_argument on a size mismatch.
+    ColorLut(uint32_t size, const std::vector<float> &nodes);
+
+    // Parses an Adobe/Resolve .cube file (UTF-8 |path|) with a LUT_3D_SIZE
+    // table over the default [0, 1] domain. Throws std::runtime_error if the
+    // file cannot be read or is not such a table.
+    static std::shared_ptr<const ColorLut> LoadCube(const std::string &path);
+
+    uint32_t size() const { return size_; }
+
+    // Maps |count| BGRA pixels in place; alpha is kept.
+    void ApplyBgra(uint8_t *pixels, size_t count) const;
+    // Maps every pixel of a BGRA tile. Gray tiles are left alone. Usable as
+    // a TiledImage stage.
+    void ApplyTile(Tile &tile) const;
+
+  private:
+    uint32_t size_;
+    // Per input level: the lower grid index and the offset from it in 1/4096.
+    std::array<uint8_t, 256> index_{};
+    std::array<uint16_t, 256> fraction_{};
+    // size^3 nodes of 4 int16 each.
+    std::vector<int16_t> nodes_;
+  };
+
+  // LUTs per device. A file loaded for several devices, or loaded again
+  // unchanged, is parsed once.
+  class ColorLutCache
+  {
+  public:
+    // Loads |path| for |device_id|, replacing its previous LUT. Throws like
+    // ColorLut::LoadCube.
+    std::shared_ptr<const ColorLut> Load(const std::string &device_id, const std::string &path);
+    void Remove(const std::string &device_id);
+    // Null when no LUT was loaded for |device_id|.
+    std::shared_ptr<const ColorLut> Find(const std::string &device_id) const;
+
+  private:
+    struct File
+    {
+      std::filesystem::file_time_type modified;
+      std::weak_ptr<const ColorLut> lut;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<const ColorLut>> devices_;
+    std::map<std::string, File> files_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_COLOR_LUT_H_
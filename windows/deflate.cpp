@@ -0,0 +1,843 @@
+#include "deflate.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <queue>
+#include <utility>
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    const size_t kWindowSize = 32 * 1024;
+    const size_t kBlockSize = 64 * 1024;
+    const size_t kOutputChunk = 64 * 1024;
+    const uint32_t kHashBits = 15;
+    const uint32_t kMinMatch = 3;
+    const uint32_t kMaxMatch = 258;
+    // Earlier positions with the same hash tried per position, newest first.
+    const uint32_t kMaxChain = 16;
+    // A match this long ends the search.
+    const size_t kNiceLength = 64;
+    // Positions inside matches up to this long are hashed as well.
+    const size_t kMaxInsertLength = 32;
+    const uint64_t kChainMask = kWindowSize - 1;
+    const uint32_t kAdlerBase = 65521;
+
+    const size_t kLiteralLengthCodes = 286;
+    const size_t kDistanceCodes = 30;
+    const size_t kCodeLengthCodes = 19;
+    const uint32_t kMaxCodeLength = 15;
+    const uint32_t kMaxCodeLengthCodeLength = 7;
+    const uint32_t kEndOfBlock = 256;
+    // Matches shorter than this are the ones that tend to cost more than
+    // their literals.
+    const size_t kShortMatch = 8;
+
+    const uint16_t kLengthBase[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const uint8_t kLengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                    2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const uint16_t kDistanceBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                      193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                      6145, 8193, 12289, 16385, 24577};
+    const uint8_t kDistanceExtra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                      6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    // Order in which code length code lengths are sent (RFC 1951 3.2.7).
+    const uint8_t kCodeLengthOrder[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    uint32_t Hash(const uint8_t *p)
+    {
+      uint32_t v = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                   (static_cast<uint32_t>(p[2]) << 16);
+      return (v * 2654435761u) >> (32 - kHashBits);
+    }
+
+    uint32_t ReverseBits(uint32_t code, uint32_t length)
+    {
+      uint32_t reversed = 0;
+      for (uint32_t i = 0; i < length; i++)
+      {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+      }
+      return reversed;
+    }
+
+    uint32_t TrailingZeroBits(uint64_t value)
+    {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanForward64(&index, value);
+      return index;
+#else
+      return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    // Length of the common prefix of |a| and |b|, up to |limit|. Compares
+    // eight bytes at a time; the long white runs of scans make this the
+    // hottest loop.
+    size_t MatchLength(const uint8_t *a, const uint8_t *b, size_t limit)
+    {
+      size_t length = 0;
+      while (limit - length >= 8)
+      {
+        uint64_t x;
+        uint64_t y;
+        std::memcpy(&x, a + length, 8);
+        std::memcpy(&y, b + length, 8);
+        if (x != y)
+        {
+          return length + TrailingZeroBits(x ^ y) / 8;
+        }
+        length += 8;
+      }
+      while (length < limit && a[length] == b[length])
+      {
+        length++;
+      }
+      return length;
+    }
+
+    // Index of the last entry in |bases| that is <= |value|.
+    template <size_t N>
+    uint32_t CodeIndex(const uint16_t (&bases)[N], uint32_t value)
+    {
+      auto it = std::upper_bound(bases, bases + N, value);
+      return static_cast<uint32_t>(it - bases - 1);
+    }
+
+    // Table lookups for the length and distance code of a match, which the
+    // block coder needs twice per token.
+    struct CodeTables
+    {
+      std::array<uint8_t, kMaxMatch + 1> length_index{};
+      // Distances up to 256 directly, larger ones by (distance - 1) >> 7.
+      std::array<uint8_t, 257> near_distance_index{};
+      std::array<uint8_t, 256> far_distance_index{};
+
+      CodeTables()
+      {
+        for (uint32_t length = kMinMatch; length <= kMaxMatch; length++)
+        {
+          length_index[length] = static_cast<uint8_t>(CodeIndex(kLengthBase, length));
+        }
+        for (uint32_t distance = 1; distance <= 256; distance++)
+        {
+          near_distance_index[distance] = static_cast<uint8_t>(CodeIndex(kDistanceBase, distance));
+        }
+        for (uint32_t i = 2; i < 256; i++)
+        {
+          far_distance_index[i] = static_cast<uint8_t>(CodeIndex(kDistanceBase, (i << 7) + 1));
+        }
+      }
+
+      uint32_t DistanceIndex(uint32_t distance) const
+      {
+        return distance <= 256 ? near_distance_index[distance] : far_distance_index[(distance - 1) >> 7];
+      }
+    };
+
+    const CodeTables &Tables()
+    {
+      static const CodeTables tables;
+      return tables;
+    }
+
+    uint32_t FixedLiteralLength(uint32_t symbol)
+    {
+      if (symbol < 144)
+      {
+        return 8;
+      }
+      if (symbol < 256)
+      {
+        return 9;
+      }
+      if (symbol < 280)
+      {
+        return 7;
+      }
+      return 8;
+    }
+
+    // Optimal code lengths of at most |max_length| bits for the used
+    // symbols, by package-merge. |symbols| is sorted by ascending frequency.
+    // The result is always a complete code, which inflaters require.
+    void LimitLengths(const std::vector<uint32_t> &freqs, const std::vector<uint16_t> &symbols,
+                      uint32_t max_length, std::vector<uint8_t> &lengths)
+    {
+      // An item is a leaf (|symbol| >= 0) or a package of items 2 * |first|
+      // and 2 * |first| + 1 of the list one level deeper.
+      struct Item
+      {
+        uint64_t weight;
+        int32_t symbol;
+        uint32_t first;
+      };
+      std::vector<std::vector<Item>> levels(max_length);
+      for (auto symbol : symbols)
+      {
+        levels[0].push_back({freqs[symbol], symbol, 0});
+      }
+      for (uint32_t level = 1; level < max_length; level++)
+      {
+        const auto &deeper = levels[level - 1];
+        auto &items = levels[level];
+        size_t leaf = 0;
+        size_t pair = 0;
+        while (leaf < symbols.size() || pair + 1 < deeper.size())
+        {
+          uint64_t package = pair + 1 < deeper.size() ? deeper[pair].weight + deeper[pair + 1].weight : 0;
+          if (leaf < symbols.size() && (pair + 1 >= deeper.size() || freqs[symbols[leaf]] <= package))
+          {
+            items.push_back({freqs[symbols[leaf]], symbols[leaf], 0});
+            leaf++;
+          }
+          else
+          {
+            items.push_back({package, -1, static_cast<uint32_t>(pair / 2)});
+            pair += 2;
+          }
+        }
+      }
+
+      // Each time a symbol appears among the 2n - 2 cheapest items of the
+      // top level, or inside a package picked there, its code gets a bit.
+      std::vector<std::pair<uint32_t, uint32_t>> stack;
+      for (uint32_t i = 0; i < 2 * symbols.size() - 2; i++)
+      {
+        stack.emplace_back(max_length - 1, i);
+      }
+      while (!stack.empty())
+      {
+        auto entry = stack.back();
+        stack.pop_back();
+        const Item &item = levels[entry.first][entry.second];
+        if (item.symbol >= 0)
+        {
+          lengths[static_cast<size_t>(item.symbol)]++;
+        }
+        else
+        {
+          stack.emplace_back(entry.first - 1, 2 * item.first);
+          stack.emplace_back(entry.first - 1, 2 * item.first + 1);
+        }
+      }
+    }
+
+    // Huffman code lengths of at most |max_length| bits for |freqs|. At least
+    // two symbols always get a code: inflaters reject a code length code with
+    // a single symbol, and a one-symbol literal code cannot be complete.
+    std::vector<uint8_t> BuildLengths(std::vector<uint32_t> freqs, uint32_t max_length)
+    {
+      size_t used = 0;
+      for (auto freq : freqs)
+      {
+        used += freq > 0 ? 1 : 0;
+      }
+      for (size_t i = 0; used < 2 && i < freqs.size(); i++)
+      {
+        if (freqs[i] == 0)
+        {
+          freqs[i] = 1;
+          used++;
+        }
+      }
+
+      // Plain Huffman tree over the used symbols.
+      std::vector<int> parent(freqs.size() * 2, -1);
+      using Node = std::pair<uint64_t, int>;
+      std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap;
+      for (size_t i = 0; i < freqs.size(); i++)
+      {
+        if (freqs[i] > 0)
+        {
+          heap.emplace(freqs[i], static_cast<int>(i));
+        }
+      }
+      int next = static_cast<int>(freqs.size());
+      while (heap.size() > 1)
+      {
+        auto a = heap.top();
+        heap.pop();
+        auto b = heap.top();
+        heap.pop();
+        parent[static_cast<size_t>(a.second)] = next;
+        parent[static_cast<size_t>(b.second)] = next;
+        heap.emplace(a.first + b.first, next++);
+      }
+
+      std::vector<uint8_t> lengths(freqs.size(), 0);
+      uint32_t longest = 0;
+      for (size_t i = 0; i < freqs.size(); i++)
+      {
+        if (freqs[i] == 0)
+        {
+          continue;
+        }
+        uint32_t depth = 0;
+        for (int node = parent[i]; node >= 0; node = parent[static_cast<size_t>(node)])
+        {
+          depth++;
+        }
+        longest = std::max(longest, depth);
+        lengths[i] = static_cast<uint8_t>(depth);
+      }
+      if (longest <= max_length)
+      {
+        return lengths;
+      }
+
+      // Too deep for the format, which happens on skewed blocks. Rare enough
+      // that the slower optimal construction costs nothing overall.
+      std::vector<uint16_t> symbols;
+      for (size_t i = 0; i < freqs.size(); i++)
+      {
+        if (freqs[i] > 0)
+        {
+          symbols.push_back(static_cast<uint16_t>(i));
+        }
+      }
+      std::stable_sort(symbols.begin(), symbols.end(),
+                       [&freqs](uint16_t a, uint16_t b) { return freqs[a] < freqs[b]; });
+      std::fill(lengths.begin(), lengths.end(), static_cast<uint8_t>(0));
+      LimitLengths(freqs, symbols, max_length, lengths);
+      return lengths;
+    }
+
+    // Canonical codes for |lengths|, bit-reversed for the LSB-first writer.
+    std::vector<uint32_t> CanonicalCodes(const std::vector<uint8_t> &lengths)
+    {
+      uint32_t count[kMaxCodeLength + 1] = {};
+      for (auto length : lengths)
+      {
+        count[length]++;
+      }
+      count[0] = 0;
+      uint32_t next_code[kMaxCodeLength + 2] = {};
+      uint32_t code = 0;
+      for (uint32_t bits = 1; bits <= kMaxCodeLength; bits++)
+      {
+        code = (code + count[bits - 1]) << 1;
+        next_code[bits] = code;
+      }
+      std::vector<uint32_t> codes(lengths.size(), 0);
+      for (size_t i = 0; i < lengths.size(); i++)
+      {
+        if (lengths[i] > 0)
+        {
+          codes[i] = ReverseBits(next_code[lengths[i]]++, lengths[i]);
+        }
+      }
+      return codes;
+    }
+
+    struct CodeLengthSymbol
+    {
+      uint8_t symbol;
+      uint8_t extra;
+    };
+
+    // Run-length codes the literal/length and distance code lengths with the
+    // repeat symbols 16, 17 and 18.
+    std::vector<CodeLengthSymbol> RunLengthCode(const std::vector<uint8_t> &lengths)
+    {
+      std::vector<CodeLengthSymbol> symbols;
+      size_t i = 0;
+      while (i < lengths.size())
+      {
+        uint8_t length = lengths[i];
+        size_t run = 1;
+        while (i + run < lengths.size() && lengths[i + run] == length)
+        {
+          run++;
+        }
+        i += run;
+
+        if (length == 0)
+        {
+          while (run >= 11)
+          {
+            size_t n = std::min<size_t>(run, 138);
+            symbols.push_back({18, static_cast<uint8_t>(n - 11)});
+            run -= n;
+          }
+          if (run >= 3)
+          {
+            symbols.push_back({17, static_cast<uint8_t>(run - 3)});
+            run = 0;
+          }
+        }
+        else
+        {
+          symbols.push_back({length, 0});
+          run--;
+          while (run >= 3)
+          {
+            size_t n = std::min<size_t>(run, 6);
+            symbols.push_back({16, static_cast<uint8_t>(n - 3)});
+            run -= n;
+          }
+        }
+        for (; run > 0; run--)
+        {
+          symbols.push_back({length, 0});
+        }
+      }
+      return symbols;
+    }
+
+    uint32_t CodeLengthExtraBits(uint8_t symbol)
+    {
+      switch (symbol)
+      {
+      case 16:
+        return 2;
+      case 17:
+        return 3;
+      case 18:
+        return 7;
+      default:
+        return 0;
+      }
+    }
+
+    // Bits taken by the symbols counted in |freqs| when coded with a
+    // Huffman code built for them, not counting the code itself.
+    uint64_t HuffmanBits(const std::vector<uint32_t> &freqs)
+    {
+      auto lengths = BuildLengths(freqs, kMaxCodeLength);
+      uint64_t bits = 0;
+      for (size_t i = 0; i < freqs.size(); i++)
+      {
+        bits += uint64_t{freqs[i]} * lengths[i];
+      }
+      return bits;
+    }
+
+  } // namespace
+
+  Deflater::Deflater(Sink sink, Framing framing)
+      : sink_(std::move(sink)), framing_(framing), head_(size_t{1} << kHashBits, 0), prev_(kWindowSize, 0)
+  {
+    if (framing_ == Framing::kZlib)
+    {
+      // CMF: deflate with a 32 KB window, FLG: fastest compression level.
+      output_.push_back(0x78);
+      output_.push_back(0x01);
+    }
+    window_.reserve(kWindowSize + kBlockSize);
+    tokens_.reserve(kBlockSize);
+  }
+
+  void Deflater::Write(const uint8_t *data, size_t size)
+  {
+    // Adler-32, with the modulo deferred as long as the sums cannot overflow.
+    const uint8_t *p = data;
+    size_t remaining = size;
+    while (remaining > 0)
+    {
+      size_t chunk = std::min<size_t>(remaining, 5552);
+      for (size_t i = 0; i < chunk; i++)
+      {
+        adler_a_ += p[i];
+        adler_b_ += adler_a_;
+      }
+      adler_a_ %= kAdlerBase;
+      adler_b_ %= kAdlerBase;
+      p += chunk;
+      remaining -= chunk;
+    }
+
+    while (size > 0)
+    {
+      size_t room = pending_start_ + kBlockSize - window_.size();
+      size_t chunk = std::min(size, room);
+      window_.insert(window_.end(), data, data + chunk);
+      data += chunk;
+      size -= chunk;
+      if (window_.size() - pending_start_ == kBlockSize)
+      {
+        CompressPending(false);
+      }
+    }
+  }
+
+  void Deflater::Flush()
+  {
+    if (window_.size() > pending_start_)
+    {
+      CompressPending(false);
+    }
+    // Empty stored block: header bits, then LEN 0 and NLEN 0xFFFF.
+    PutBits(0, 3);
+    AlignToByte();
+    output_.insert(output_.end(), {0x00, 0x00, 0xFF, 0xFF});
+    FlushOutput(true);
+  }
+
+  void Deflater::Finish()
+  {
+    if (finished_)
+    {
+      return;
+    }
+    CompressPending(true);
+    AlignToByte();
+    if (framing_ == Framing::kZlib)
+    {
+      output_.push_back(static_cast<uint8_t>(adler_b_ >> 8));
+      output_.push_back(static_cast<uint8_t>(adler_b_));
+      output_.push_back(static_cast<uint8_t>(adler_a_ >> 8));
+      output_.push_back(static_cast<uint8_t>(adler_a_));
+    }
+    FlushOutput(true);
+    finished_ = true;
+  }
+
+  uint64_t Deflater::Insert(const uint8_t *data, uint64_t absolute)
+  {
+    uint32_t h = Hash(data);
+    uint64_t previous = head_[h];
+    head_[h] = absolute + 1;
+    prev_[absolute & kChainMask] = previous;
+    return previous;
+  }
+
+  void Deflater::CompressPending(bool final_block)
+  {
+    const uint8_t *base = window_.data();
+    size_t end = window_.size();
+    size_t pos = pending_start_;
+    tokens_.clear();
+    while (pos < end)
+    {
+      size_t best_length = 0;
+      size_t best_distance = 0;
+      if (end - pos >= kMinMatch)
+      {
+        uint64_t absolute = window_base_ + pos;
+        uint64_t candidate = Insert(base + pos, absolute);
+        size_t limit = std::min<size_t>(kMaxMatch, end - pos);
+        for (uint32_t probe = 0; probe < kMaxChain && candidate != 0 && candidate - 1 >= window_base_ &&
+                                 absolute - (candidate - 1) <= kWindowSize;
+             probe++)
+        {
+          size_t match = static_cast<size_t>(candidate - 1 - window_base_);
+          size_t length = MatchLength(base + match, base + pos, limit);
+          if (length > best_length && length >= kMinMatch)
+          {
+            best_length = length;
+            best_distance = pos - match;
+            if (length >= kNiceLength || length == limit)
+            {
+              break;
+            }
+          }
+          candidate = prev_[(candidate - 1) & kChainMask];
+        }
+      }
+
+      if (best_length > 0)
+      {
+        tokens_.push_back({static_cast<uint16_t>(best_length), static_cast<uint16_t>(best_distance)});
+        // Hashing inside long matches costs more than it finds.
+        if (best_length <= kMaxInsertLength)
+        {
+          for (size_t i = 1; i < best_length && pos + i + kMinMatch <= end; i++)
+          {
+            Insert(base + pos + i, window_base_ + pos + i);
+          }
+        }
+        pos += best_length;
+      }
+      else
+      {
+        tokens_.push_back({base[pos], 0});
+        pos++;
+      }
+    }
+    // Filtered scanner noise is full of short matches that cost more than
+    // the literals they replace. The block is also priced with short
+    // matches, or all matches, sent as literals instead, and sent whichever
+    // way codes smallest.
+    size_t keep_from = size_t{kMinMatch};
+    uint64_t best_bits = UINT64_MAX;
+    for (size_t min_length : {size_t{kMinMatch}, kShortMatch, size_t{kMaxMatch} + 1})
+    {
+      uint64_t bits = TokenBits(tokens_, base + pending_start_, min_length);
+      if (bits < best_bits)
+      {
+        best_bits = bits;
+        keep_from = min_length;
+      }
+    }
+    if (keep_from != kMinMatch)
+    {
+      ExpandShortMatches(tokens_, base + pending_start_, keep_from);
+    }
+
+    EmitBlock(final_block);
+    FlushOutput(false);
+
+    // Keep one window of history for the next block.
+    if (window_.size() > kWindowSize)
+    {
+      size_t drop = window_.size() - kWindowSize;
+      window_.erase(window_.begin(), window_.begin() + static_cast<std::ptrdiff_t>(drop));
+      window_base_ += drop;
+    }
+    pending_start_ = window_.size();
+  }
+
+  uint64_t Deflater::TokenBits(const std::vector<Token> &tokens, const uint8_t *data, size_t min_length)
+  {
+    const auto &tables = Tables();
+    std::vector<uint32_t> literal_freqs(kLiteralLengthCodes, 0);
+    std::vector<uint32_t> distance_freqs(kDistanceCodes, 0);
+    uint64_t bits = 0;
+    for (const auto &token : tokens)
+    {
+      if (token.distance == 0)
+      {
+        literal_freqs[token.value]++;
+        data++;
+      }
+      else if (token.value < min_length)
+      {
+        for (size_t i = 0; i < token.value; i++)
+        {
+          literal_freqs[data[i]]++;
+        }
+        data += token.value;
+      }
+      else
+      {
+        uint32_t length_index = tables.length_index[token.value];
+        uint32_t distance_index = tables.DistanceIndex(token.distance);
+        literal_freqs[257 + length_index]++;
+        distance_freqs[distance_index]++;
+        bits += kLengthExtra[length_index] + kDistanceExtra[distance_index];
+        data += token.value;
+      }
+    }
+    literal_freqs[kEndOfBlock]++;
+    return bits + HuffmanBits(literal_freqs) + HuffmanBits(distance_freqs);
+  }
+
+  void Deflater::ExpandShortMatches(std::vector<Token> &tokens, const uint8_t *data, size_t min_length)
+  {
+    std::vector<Token> expanded;
+    expanded.reserve(tokens.size());
+    for (const auto &token : tokens)
+    {
+      size_t length = token.distance == 0 ? 1 : token.value;
+      if (token.distance != 0 && length >= min_length)
+      {
+        expanded.push_back(token);
+      }
+      else
+      {
+        for (size_t i = 0; i < length; i++)
+        {
+          expanded.push_back({data[i], 0});
+        }
+      }
+      data += length;
+    }
+    tokens.swap(expanded);
+  }
+
+  void Deflater::EmitBlock(bool final_block)
+  {
+    const auto &tables = Tables();
+    std::vector<uint32_t> literal_freqs(kLiteralLengthCodes, 0);
+    std::vector<uint32_t> distance_freqs(kDistanceCodes, 0);
+    uint64_t extra_bits = 0;
+    for (const auto &token : tokens_)
+    {
+      if (token.distance == 0)
+      {
+        literal_freqs[token.value]++;
+        continue;
+      }
+      uint32_t length_index = tables.length_index[token.value];
+      uint32_t distance_index = tables.DistanceIndex(token.distance);
+      literal_freqs[257 + length_index]++;
+      distance_freqs[distance_index]++;
+      extra_bits += kLengthExtra[length_index] + kDistanceExtra[distance_index];
+    }
+    literal_freqs[kEndOfBlock]++;
+
+    auto literal_lengths = BuildLengths(literal_freqs, kMaxCodeLength);
+    auto distance_lengths = BuildLengths(distance_freqs, kMaxCodeLength);
+    size_t literal_count = kLiteralLengthCodes;
+    while (literal_count > 257 && literal_lengths[literal_count - 1] == 0)
+    {
+      literal_count--;
+    }
+    size_t distance_count = kDistanceCodes;
+    while (distance_count > 1 && distance_lengths[distance_count - 1] == 0)
+    {
+      distance_count--;
+    }
+
+    std::vector<uint8_t> all_lengths(literal_lengths.begin(), literal_lengths.begin() + static_cast<std::ptrdiff_t>(literal_count));
+    all_lengths.insert(all_lengths.end(), distance_lengths.begin(),
+                       distance_lengths.begin() + static_cast<std::ptrdiff_t>(distance_count));
+    auto code_length_symbols = RunLengthCode(all_lengths);
+    std::vector<uint32_t> code_length_freqs(kCodeLengthCodes, 0);
+    for (const auto &symbol : code_length_symbols)
+    {
+      code_length_freqs[symbol.symbol]++;
+    }
+    auto code_length_lengths = BuildLengths(code_length_freqs, kMaxCodeLengthCodeLength);
+    size_t code_length_count = kCodeLengthCodes;
+    while (code_length_count > 4 && code_length_lengths[kCodeLengthOrder[code_length_count - 1]] == 0)
+    {
+      code_length_count--;
+    }
+
+    // Compare the exact size of both codings and keep the smaller one.
+    uint64_t dynamic_bits = 14 + 3 * code_length_count + extra_bits;
+    for (const auto &symbol : code_length_symbols)
+    {
+      dynamic_bits += code_length_lengths[symbol.symbol] + CodeLengthExtraBits(symbol.symbol);
+    }
+    uint64_t fixed_bits = extra_bits;
+    for (size_t i = 0; i < kLiteralLengthCodes; i++)
+    {
+      dynamic_bits += uint64_t{literal_freqs[i]} * literal_lengths[i];
+      fixed_bits += uint64_t{literal_freqs[i]} * FixedLiteralLength(static_cast<uint32_t>(i));
+    }
+    for (size_t i = 0; i < kDistanceCodes; i++)
+    {
+      dynamic_bits += uint64_t{distance_freqs[i]} * distance_lengths[i];
+      fixed_bits += uint64_t{distance_freqs[i]} * 5;
+    }
+
+    PutBits(final_block ? 1 : 0, 1);
+    if (dynamic_bits < fixed_bits)
+    {
+      PutBits(2, 2);
+      PutBits(static_cast<uint32_t>(literal_count - 257), 5);
+      PutBits(static_cast<uint32_t>(distance_count - 1), 5);
+      PutBits(static_cast<uint32_t>(code_length_count - 4), 4);
+      for (size_t i = 0; i < code_length_count; i++)
+      {
+        PutBits(code_length_lengths[kCodeLengthOrder[i]], 3);
+      }
+      auto code_length_codes = CanonicalCodes(code_length_lengths);
+      for (const auto &symbol : code_length_symbols)
+      {
+        PutBits(code_length_codes[symbol.symbol], code_length_lengths[symbol.symbol]);
+        PutBits(symbol.extra, CodeLengthExtraBits(symbol.symbol));
+      }
+    }
+    else
+    {
+      PutBits(1, 2);
+      literal_lengths.resize(288);
+      for (size_t i = 0; i < literal_lengths.size(); i++)
+      {
+        literal_lengths[i] = static_cast<uint8_t>(FixedLiteralLength(static_cast<uint32_t>(i)));
+      }
+      distance_lengths.assign(kDistanceCodes, 5);
+    }
+
+    auto literal_codes = CanonicalCodes(literal_lengths);
+    auto distance_codes = CanonicalCodes(distance_lengths);
+    for (const auto &token : tokens_)
+    {
+      if (token.distance == 0)
+      {
+        PutBits(literal_codes[token.value], literal_lengths[token.value]);
+        continue;
+      }
+      uint32_t length_index = tables.length_index[token.value];
+      uint32_t symbol = 257 + length_index;
+      PutBits(literal_codes[symbol], literal_lengths[symbol]);
+      PutBits(token.value - kLengthBase[length_index], kLengthExtra[length_index]);
+      uint32_t distance_index = tables.DistanceIndex(token.distance);
+      PutBits(distance_codes[distance_index], distance_lengths[distance_index]);
+      PutBits(token.distance - kDistanceBase[distance_index], kDistanceExtra[distance_index]);
+    }
+    PutBits(literal_codes[kEndOfBlock], literal_lengths[kEndOfBlock]);
+  }
+
+  void Deflater::PutBits(uint32_t value, uint32_t count)
+  {
+    bit_buffer_ |= static_cast<uint64_t>(value) << bit_count_;
+    bit_count_ += count;
+    if (bit_count_ >= 32)
+    {
+      uint8_t bytes[4] = {static_cast<uint8_t>(bit_buffer_), static_cast<uint8_t>(bit_buffer_ >> 8),
+                          static_cast<uint8_t>(bit_buffer_ >> 16), static_cast<uint8_t>(bit_buffer_ >> 24)};
+      output_.insert(output_.end(), bytes, bytes + 4);
+      bit_buffer_ >>= 32;
+      bit_count_ -= 32;
+    }
+  }
+
+  void Deflater::AlignToByte()
+  {
+    if (bit_count_ % 8 != 0)
+    {
+      PutBits(0, 8 - bit_count_ % 8);
+    }
+    while (bit_count_ > 0)
+    {
+      output_.push_back(static_cast<uint8_t>(bit_buffer_));
+      bit_buffer_ >>= 8;
+      bit_count_ -= 8;
+    }
+  }
+
+  void Deflater::FlushOutput(bool force)
+  {
+    if (output_.empty() || (!force && output_.size() < kOutputChunk))
+    {
+      return;
+    }
+    sink_(output_.data(), output_.size());
+    output_.clear();
+  }
+
+  uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t length2)
+  {
+    // As zlib's adler32_combine: b1 absorbs a1 once per byte of the second
+    // buffer.
+    uint32_t remainder = static_cast<uint32_t>(length2 % kAdlerBase);
+    uint32_t sum1 = adler1 & 0xFFFF;
+    uint32_t sum2 = static_cast<uint32_t>((uint64_t{remainder} * sum1) % kAdlerBase);
+    sum1 += (adler2 & 0xFFFF) + kAdlerBase - 1;
+    sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + kAdlerBase - remainder;
+    if (sum1 >= kAdlerBase)
+    {
+      sum1 -= kAdlerBase;
+    }
+    if (sum1 >= kAdlerBase)
+    {
+      sum1 -= kAdlerBase;
+    }
+    if (sum2 >= kAdlerBase * 2)
+    {
+      sum2 -= kAdlerBase * 2;
+    }
+    if (sum2 >= kAdlerBase)
+    {
+      sum2 -= kAdlerBase;
+    }
+    return sum1 | (sum2 << 16);
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,96 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_DEFLATE_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_DEFLATE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  // Streaming zlib (RFC 1950/1951) compressor. Input is buffered into blocks
+  // and matched greedily against a 32 KB window through short hash chains.
+  // Blocks where short matches cost more than their literals, as in filtered
+  // scanner noise, drop them. Each block is coded with Huffman tables built
+  // for it, or with the fixed tables when those come out smaller. Trades
+  // some ratio for speed and for not pulling a compression library into the
+  // plugin.
+  class Deflater
+  {
+  public:
+    using Sink = std::function<void(const uint8_t *data, size_t size)>;
+
+    enum class Framing
+    {
+      // A complete zlib stream: header, deflate data, Adler-32 trailer.
+      kZlib,
+      // Bare deflate blocks, for splicing into a stream framed elsewhere.
+      kRaw,
+    };
+
+    explicit Deflater(Sink sink, Framing framing = Framing::kZlib);
+
+    Deflater(const Deflater &) = delete;
+    Deflater &operator=(const Deflater &) = delete;
+
+    void Write(const uint8_t *data, size_t size);
+    // Compresses everything written so far and ends the output on a byte
+    // boundary with an empty stored block (a zlib sync flush). Data
+    // compressed by another Deflater can be appended to the output after it.
+    void Flush();
+    // Flushes the final block and, for zlib framing, the Adler-32 trailer.
+    void Finish();
+
+    // Adler-32 of everything written so far.
+    uint32_t adler32() const { return (adler_b_ << 16) | adler_a_; }
+
+  private:
+    // A literal when |distance| is 0, otherwise a back reference.
+    struct Token
+    {
+      uint16_t value;
+      uint16_t distance;
+    };
+
+    // Hashes the three bytes at |data| and returns the newest earlier
+    // position with the same hash plus one, or 0.
+    uint64_t Insert(const uint8_t *data, uint64_t absolute);
+    void CompressPending(bool final_block);
+    // Bits of |tokens| under Huffman codes built for them, not counting the
+    // codes, when matches shorter than |min_length| are sent as the literals
+    // they cover. |data| is the input the tokens start at.
+    static uint64_t TokenBits(const std::vector<Token> &tokens, const uint8_t *data, size_t min_length);
+    // Replaces matches shorter than |min_length| with their literals.
+    static void ExpandShortMatches(std::vector<Token> &tokens, const uint8_t *data, size_t min_length);
+    void EmitBlock(bool final_block);
+    void PutBits(uint32_t value, uint32_t count);
+    void AlignToByte();
+    void FlushOutput(bool force);
+
+    Sink sink_;
+    Framing framing_;
+    // History (up to one window) followed by input not yet compressed.
+    std::vector<uint8_t> window_;
+    size_t pending_start_ = 0;
+    // Absolute stream position of window_[0].
+    uint64_t window_base_ = 0;
+    std::vector<uint64_t> head_;
+    // Previous position with the same hash, by position modulo the window.
+    std::vector<uint64_t> prev_;
+    std::vector<Token> tokens_;
+    uint32_t adler_a_ = 1;
+    uint32_t adler_b_ = 0;
+    uint64_t bit_buffer_ = 0;
+    uint32_t bit_count_ = 0;
+    std::vector<uint8_t> output_;
+    bool finished_ = false;
+  };
+
+  // Adler-32 of two concatenated buffers from the checksums of each, where
+  // |length2| is the size of the second.
+  uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t length2);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_DEFLATE_H_
@@ -0,0 +1,198 @@
+#include "escl_client.h"
+
+// This must be included before many other Windows headers.
+#include <windows.h>
+
+#include <winrt/Windows.Foundation.Collections.h>
+#include <winrt/Windows.Storage.Streams.h>
+#include <winrt/Windows.Web.Http.Headers.h>
+
+#include <sstream>
+#include <utility>
+
+using namespace winrt;
+using namespace Windows::Devices::Enumeration;
+using namespace Windows::Foundation;
+using namespace Windows::Foundation::Collections;
+using namespace Windows::Storage;
+using namespace Windows::Storage::Streams;
+using namespace Windows::Web::Http;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    const wchar_t kHostNameProperty[] = L"System.Devices.Dnssd.HostName";
+    const wchar_t kPortProperty[] = L"System.Devices.Dnssd.PortNumber";
+    const wchar_t kTextProperty[] = L"System.Devices.Dnssd.TextAttributes";
+    const wchar_t kAddressProperty[] = L"System.Devices.IpAddress";
+
+    // Value of TXT record |key| ("key=value"), or an empty string.
+    std::string TextAttribute(DeviceInformation const &info, const std::string &key)
+    {
+      auto value = info.Properties().TryLookup(kTextProperty);
+      if (!value)
+      {
+        return std::string();
+      }
+      for (auto const &attribute : value.as<IReferenceArray<hstring>>().Value())
+      {
+        auto text = winrt::to_string(attribute);
+        if (text.size() > key.size() && text.compare(0, key.size(), key) == 0 && text[key.size()] == '=')
+        {
+          return text.substr(key.size() + 1);
+        }
+      }
+      return std::string();
+    }
+
+    std::string ContentType(HttpResponseMessage const &response)
+    {
+      auto header = response.Content().Headers().ContentType();
+      return header ? winrt::to_string(header.MediaType()) : std::string();
+    }
+
+    // EsclTransport over HttpClient. Pages are streamed into |folder|.
+    class HttpTransport : public EsclTransport
+    {
+    public:
+      HttpTransport(HttpClient http, StorageFolder folder) : http_(std::move(http)), folder_(std::move(folder)) {}
+
+      Response Get(const std::string &url) override
+      {
+        return Read(http_.GetAsync(Uri{winrt::to_hstring(url)}).get());
+      }
+
+      Response Post(const std::string &url, const std::string &content_type, const std::string &body) override
+      {
+        HttpStringContent content{winrt::to_hstring(body), UnicodeEncoding::Utf8, winrt::to_hstring(content_type)};
+        return Read(http_.PostAsync(Uri{winrt::to_hstring(url)}, content).get());
+      }
+
+      Response Delete(const std::string &url) override
+      {
+        return Read(http_.DeleteAsync(Uri{winrt::to_hstring(url)}).get());
+      }
+
+      Document GetDocument(const std::string &url) override
+      {
+        auto response = http_.GetAsync(Uri{winrt::to_hstring(url)}, HttpCompletionOption::ResponseHeadersRead).get();
+        Document document;
+        document.status = static_cast<int>(response.StatusCode());
+        document.content_type = ContentType(response);
+        document.save = [response, folder = folder_, extension = EsclFileExtension(document.content_type)]
+        {
+          auto file =
+              folder.CreateFileAsync(L"Scan" + winrt::to_hstring(extension), CreationCollisionOption::GenerateUniqueName)
+                  .get();
+          auto input = response.Content().ReadAsInputStreamAsync().get();
+          auto output = file.OpenAsync(FileAccessMode::ReadWrite).get();
+          RandomAccessStream::CopyAndCloseAsync(input, output).get();
+          return winrt::to_string(file.Path());
+        };
+        return document;
+      }
+
+    private:
+      static Response Read(HttpResponseMessage const &response)
+      {
+        Response result;
+        result.status = static_cast<int>(response.StatusCode());
+        result.content_type = ContentType(response);
+        if (response.Headers().HasKey(L"Location"))
+        {
+          result.location = winrt::to_string(response.Headers().Lookup(L"Location"));
+        }
+        result.body = winrt::to_string(response.Content().ReadAsStringAsync().get());
+        return result;
+      }
+
+      HttpClient http_;
+      StorageFolder folder_;
+    };
+
+  } // namespace
+
+  hstring EsclServiceSelector()
+  {
+    return L"System.Devices.AepService.ProtocolId:=\"{4526e8c1-8aac-4153-9b16-55e86ada0e54}\" AND "
+           L"System.Devices.Dnssd.Domain:=\"local\" AND System.Devices.Dnssd.ServiceName:=\"_uscan._tcp\"";
+  }
+
+  IIterable<hstring> EsclServiceProperties()
+  {
+    return single_threaded_vector<hstring>({kHostNameProperty, kPortProperty, kTextProperty, kAddressProperty});
+  }
+
+  std::string EsclDeviceIdFromService(DeviceInformation const &info)
+  {
+    std::string host;
+    auto addresses = info.Properties().TryLookup(kAddressProperty);
+    if (addresses)
+    {
+      auto values = addresses.as<IReferenceArray<hstring>>().Value();
+      if (values.size() > 0)
+      {
+        host = winrt::to_string(values[0]);
+        if (host.find(':') != std::string::npos)
+        {
+          host = "[" + host + "]";
+        }
+      }
+    }
+    if (host.empty())
+    {
+      auto host_name = info.Properties().TryLookup(kHostNameProperty);
+      host = host_name ? winrt::to_string(unbox_value<hstring>(host_name)) : std::string();
+    }
+    if (host.empty())
+    {
+      return std::string();
+    }
+
+    auto port = unbox_value_or<uint16_t>(info.Properties().TryLookup(kPortProperty), 80);
+    auto resource = TextAttribute(info, "rs");
+    if (resource.empty())
+    {
+      resource = "eSCL";
+    }
+
+    std::ostringstream url;
+    url << "http://" << host << ":" << port << "/" << resource;
+    return EsclDeviceId(url.str());
+  }
+
+  std::string EsclNameFromService(DeviceInformation const &info)
+  {
+    auto model = TextAttribute(info, "ty");
+    return model.empty() ? winrt::to_string(info.Name()) : model;
+  }
+
+  EsclClient::EsclClient(const std::string &device_id) : base_url_(EsclBaseUrl(device_id)) {}
+
+  IAsyncOperation<hstring> EsclClient::CapabilitiesAsync()
+  {
+    auto response = co_await http_.GetAsync(Uri{winrt::to_hstring(base_url_ + "/ScannerCapabilities")});
+    response.EnsureSuccessStatusCode();
+    co_return co_await response.Content().ReadAsStringAsync();
+  }
+
+  IAsyncAction EsclClient::ScanAsync(EsclScanSettings settings, StorageFolder folder, EsclSession::PageHandler on_page)
+  {
+    // The session blocks on every request.
+    co_await winrt::resume_background();
+    HttpTransport transport(http_, folder);
+    EsclSession session(transport, base_url_);
+    try
+    {
+      session.Scan(settings, on_page);
+    }
+    catch (EsclBusyError const &e)
+    {
+      throw winrt::hresult_error(HRESULT_FROM_WIN32(ERROR_TIMEOUT), winrt::to_hstring(e.what()));
+    }
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,52 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_ESCL_CLIENT_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_ESCL_CLIENT_H_
+
+#include <winrt/Windows.Devices.Enumeration.h>
+#include <winrt/Windows.Foundation.h>
+#include <winrt/Windows.Storage.h>
+#include <winrt/Windows.Web.Http.h>
+
+#include <functional>
+#include <string>
+
+#include "escl_session.h"
+
+namespace quick_scanner_plus
+{
+
+  // AQS selecting "_uscan._tcp" services advertised over mDNS.
+  winrt::hstring EsclServiceSelector();
+  // Properties EsclDeviceIdFromService needs; request them from the watcher.
+  winrt::Windows::Foundation::Collections::IIterable<winrt::hstring> EsclServiceProperties();
+  // Builds the device ID of a discovered "_uscan._tcp" service. Returns an
+  // empty string if the service record lacks an address.
+  std::string EsclDeviceIdFromService(winrt::Windows::Devices::Enumeration::DeviceInformation const &info);
+  // Display name of a discovered service, from its "ty" TXT record.
+  std::string EsclNameFromService(winrt::Windows::Devices::Enumeration::DeviceInformation const &info);
+
+  // Client for a single eSCL scanner, running EsclSession over WinRT's
+  // HttpClient. Uses one HttpClient for the whole job, so requests reuse its
+  // keep-alive connections.
+  class EsclClient
+  {
+  public:
+    explicit EsclClient(const std::string &device_id);
+
+    // Fetches the scanner's ScannerCapabilities XML document.
+    winrt::Windows::Foundation::IAsyncOperation<winrt::hstring> CapabilitiesAsync();
+
+    // Runs EsclSession::Scan on a background thread, streaming each page
+    // into a new file in |folder|. |on_page| runs on that thread and may
+    // block. A device that stays busy fails with ERROR_TIMEOUT.
+    winrt::Windows::Foundation::IAsyncAction ScanAsync(EsclScanSettings settings,
+                                                       winrt::Windows::Storage::StorageFolder folder,
+                                                       EsclSession::PageHandler on_page);
+
+  private:
+    std::string base_url_;
+    winrt::Windows::Web::Http::HttpClient http_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_ESCL_CLIENT_H_
@@ -0,0 +1,281 @@
+#include "escl_session.h"
+
+#include <future>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    const char kDeviceIdPrefix[] = "escl:";
+
+    const int kStatusOk = 200;
+    const int kStatusCreated = 201;
+    const int kStatusNotFound = 404;
+    const int kStatusServiceUnavailable = 503;
+
+    std::string EscapeXml(const std::string &text)
+    {
+      std::string escaped;
+      for (char c : text)
+      {
+        switch (c)
+        {
+        case '&':
+          escaped += "&amp;";
+          break;
+        case '<':
+          escaped += "&lt;";
+          break;
+        case '>':
+          escaped += "&gt;";
+          break;
+        default:
+          escaped += c;
+        }
+      }
+      return escaped;
+    }
+
+    // Drops "." and ".." segments from an absolute path (RFC 3986, 5.2.4).
+    std::string RemoveDotSegments(const std::string &path)
+    {
+      std::vector<std::string> segments;
+      size_t start = 1;
+      while (start <= path.size())
+      {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+        {
+          end = path.size();
+        }
+        auto segment = path.substr(start, end - start);
+        if (segment == "..")
+        {
+          if (!segments.empty())
+          {
+            segments.pop_back();
+          }
+        }
+        else if (segment != "." && !(segment.empty() && end < path.size()))
+        {
+          segments.push_back(segment);
+        }
+        start = end + 1;
+      }
+      std::string result;
+      for (const auto &segment : segments)
+      {
+        result += "/" + segment;
+      }
+      return result.empty() ? "/" : result;
+    }
+
+    std::runtime_error StatusError(const char *request, int status)
+    {
+      return std::runtime_error(std::string("eSCL scanner answered ") + request + " with HTTP " +
+                                std::to_string(status) + ".");
+    }
+
+  } // namespace
+
+  bool IsEsclDeviceId(const std::string &device_id)
+  {
+    return device_id.compare(0, sizeof(kDeviceIdPrefix) - 1, kDeviceIdPrefix) == 0;
+  }
+
+  std::string EsclDeviceId(const std::string &base_url)
+  {
+    return kDeviceIdPrefix + base_url;
+  }
+
+  std::string EsclBaseUrl(const std::string &device_id)
+  {
+    return device_id.substr(sizeof(kDeviceIdPrefix) - 1);
+  }
+
+  bool EsclSupportsFormat(const std::string &capabilities, ScanFormat format)
+  {
+    std::string mime = ScanFormatMimeType(format);
+    if (mime.empty())
+    {
+      return false;
+    }
+    // Formats are listed as <pwg:DocumentFormat> and <scan:DocumentFormatExt>
+    // elements; matching the bare element text covers both.
+    return capabilities.find(">" + mime + "<") != std::string::npos;
+  }
+
+  bool EsclSupportsDuplex(const std::string &capabilities)
+  {
+    return capabilities.find("AdfDuplexInputCaps>") != std::string::npos;
+  }
+
+  std::string EsclScanSettingsXml(const EsclScanSettings &settings)
+  {
+    std::ostringstream xml;
+    xml << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        << "<scan:ScanSettings xmlns:scan=\"http://schemas.hp.com/imaging/escl/2011/05/03\""
+        << " xmlns:pwg=\"http://www.pwg.org/schemas/2010/12/sm\">"
+        << "<pwg:Version>2.0</pwg:Version>"
+        << "<pwg:InputSource>" << EscapeXml(settings.input_source) << "</pwg:InputSource>"
+        << "<scan:ColorMode>" << EscapeXml(settings.color_mode) << "</scan:ColorMode>"
+        << "<scan:XResolution>" << settings.resolution << "</scan:XResolution>"
+        << "<scan:YResolution>" << settings.resolution << "</scan:YResolution>"
+        << "<pwg:DocumentFormat>" << EscapeXml(settings.document_format) << "</pwg:DocumentFormat>"
+        << "<scan:DocumentFormatExt>" << EscapeXml(settings.document_format) << "</scan:DocumentFormatExt>";
+    if (settings.duplex)
+    {
+      xml << "<scan:Duplex>true</scan:Duplex>";
+    }
+    xml << "</scan:ScanSettings>";
+    return xml.str();
+  }
+
+  std::string ResolveEsclLocation(const std::string &base_url, const std::string &location)
+  {
+    size_t scheme_end = base_url.find("://");
+    size_t path_start = scheme_end == std::string::npos ? std::string::npos : base_url.find('/', scheme_end + 3);
+    std::string origin = base_url.substr(0, path_start);
+    std::string base_path = path_start == std::string::npos ? "/" : base_url.substr(path_start);
+
+    std::string resolved;
+    if (location.compare(0, 7, "http://") == 0 || location.compare(0, 8, "https://") == 0)
+    {
+      resolved = location;
+    }
+    else if (!location.empty() && location[0] == '/')
+    {
+      resolved = origin + RemoveDotSegments(location);
+    }
+    else
+    {
+      // The service URL is taken as a directory, so "ScanJobs/1" lands
+      // below it rather than next to it.
+      if (base_path.back() != '/')
+      {
+        base_path += '/';
+      }
+      resolved = origin + RemoveDotSegments(base_path + location);
+    }
+    while (!resolved.empty() && resolved.back() == '/')
+    {
+      resolved.pop_back();
+    }
+    return resolved;
+  }
+
+  std::string EsclFileExtension(const std::string &content_type)
+  {
+    if (content_type == "image/png")
+    {
+      return ".png";
+    }
+    if (content_type == "image/tiff")
+    {
+      return ".tif";
+    }
+    if (content_type == "application/pdf")
+    {
+      return ".pdf";
+    }
+    return ".jpg";
+  }
+
+  EsclSession::EsclSession(EsclTransport &transport, std::string base_url)
+      : transport_(transport), base_url_(std::move(base_url)) {}
+
+  std::string EsclSession::Capabilities()
+  {
+    auto response = transport_.Get(base_url_ + "/ScannerCapabilities");
+    if (response.status != kStatusOk)
+    {
+      throw StatusError("ScannerCapabilities", response.status);
+    }
+    return response.body;
+  }
+
+  void EsclSession::Scan(const EsclScanSettings &settings, const PageHandler &on_page)
+  {
+    FetchPages(CreateJob(settings), settings, on_page);
+  }
+
+  std::string EsclSession::CreateJob(const EsclScanSettings &settings)
+  {
+    auto response = transport_.Post(base_url_ + "/ScanJobs", "text/xml", EsclScanSettingsXml(settings));
+    if (response.status != kStatusCreated)
+    {
+      throw StatusError("ScanJobs", response.status);
+    }
+    if (response.location.empty())
+    {
+      throw std::runtime_error("eSCL scanner created a scan job without a location.");
+    }
+    return ResolveEsclLocation(base_url_, response.location);
+  }
+
+  void EsclSession::FetchPages(const std::string &job, const EsclScanSettings &settings, const PageHandler &on_page)
+  {
+    auto next_document = job + "/NextDocument";
+    auto request = [this, next_document]
+    { return transport_.GetDocument(next_document); };
+    // Outside the try block, so a request still out when something fails is
+    // only waited for after the job is deleted, which ends it.
+    std::future<EsclTransport::Document> next;
+    try
+    {
+      auto busy_since = std::chrono::steady_clock::now();
+      next = std::async(std::launch::async, request);
+      while (true)
+      {
+        auto document = next.get();
+        if (document.status == kStatusNotFound)
+        {
+          // The job has no more pages.
+          return;
+        }
+        if (document.status == kStatusServiceUnavailable)
+        {
+          if (std::chrono::steady_clock::now() - busy_since >= settings.busy_timeout)
+          {
+            throw EsclBusyError("eSCL scanner stayed busy.");
+          }
+          std::this_thread::sleep_for(settings.busy_retry_delay);
+          next = std::async(std::launch::async, request);
+          continue;
+        }
+        if (document.status != kStatusOk)
+        {
+          throw StatusError("NextDocument", document.status);
+        }
+
+        next = std::async(std::launch::async, request);
+        on_page(document.save());
+        busy_since = std::chrono::steady_clock::now();
+      }
+    }
+    catch (...)
+    {
+      CancelJob(job);
+      throw;
+    }
+  }
+
+  void EsclSession::CancelJob(const std::string &job)
+  {
+    try
+    {
+      transport_.Delete(job);
+    }
+    catch (...)
+    {
+      // The device may be gone; the job expires there on its own.
+    }
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,129 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_ESCL_SESSION_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_ESCL_SESSION_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#include "scan_format.h"
+
+namespace quick_scanner_plus
+{
+
+  // Device IDs of eSCL (AirScan) scanners are "escl:" followed by the base
+  // URL of the scanner's eSCL service, e.g. "escl:http://10.0.0.7:80/eSCL".
+  bool IsEsclDeviceId(const std::string &device_id);
+  std::string EsclDeviceId(const std::string &base_url);
+  std::string EsclBaseUrl(const std::string &device_id);
+
+  // Whether an eSCL ScannerCapabilities document lists |format| among its
+  // document formats.
+  bool EsclSupportsFormat(const std::string &capabilities, ScanFormat format);
+  // Whether an eSCL ScannerCapabilities document describes a feeder that
+  // scans both sides of a sheet.
+  bool EsclSupportsDuplex(const std::string &capabilities);
+
+  struct EsclScanSettings
+  {
+    // "Platen" or "Feeder".
+    std::string input_source = "Platen";
+    // "RGB24", "Grayscale8" or "BlackAndWhite1".
+    std::string color_mode = "RGB24";
+    uint32_t resolution = 300;
+    std::string document_format = "image/jpeg";
+    // Scan both sides of each sheet; Feeder only. Sides arrive front first.
+    bool duplex = false;
+    // How long the device may keep answering 503 (busy) for one page before
+    // the scan fails, and how long to wait before asking again.
+    std::chrono::milliseconds busy_timeout{60000};
+    std::chrono::milliseconds busy_retry_delay{250};
+  };
+
+  // The ScanSettings document that creates a job with |settings|.
+  std::string EsclScanSettingsXml(const EsclScanSettings &settings);
+
+  // The job URL a ScanJobs response points to with |location|, which may be
+  // absolute, relative to the host or relative to |base_url|. Without a
+  // trailing slash, so "/NextDocument" can be appended.
+  std::string ResolveEsclLocation(const std::string &base_url, const std::string &location);
+
+  // File extension, with the dot, for a page of |content_type|.
+  std::string EsclFileExtension(const std::string &content_type);
+
+  // Thrown when the device stays busy for longer than busy_timeout.
+  class EsclBusyError : public std::runtime_error
+  {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+  // HTTP as eSCL uses it. Calls block until the response headers are in and
+  // throw when the device cannot be reached. GetDocument may be called from
+  // another thread while a page body is being saved.
+  class EsclTransport
+  {
+  public:
+    struct Response
+    {
+      int status = 0;
+      std::string content_type;
+      std::string location;
+      std::string body;
+    };
+
+    struct Document
+    {
+      int status = 0;
+      std::string content_type;
+      // With status 200, streams the body into a new file named after the
+      // content type and returns its path (UTF-8).
+      std::function<std::string()> save;
+    };
+
+    virtual ~EsclTransport() = default;
+
+    virtual Response Get(const std::string &url) = 0;
+    virtual Response Post(const std::string &url, const std::string &content_type, const std::string &body) = 0;
+    virtual Response Delete(const std::string &url) = 0;
+    virtual Document GetDocument(const std::string &url) = 0;
+  };
+
+  // Drives the scan jobs of one eSCL scanner over |transport|. Blocks; keep
+  // it off the platform thread.
+  class EsclSession
+  {
+  public:
+    // Receives the path of each page file (UTF-8).
+    using PageHandler = std::function<void(const std::string &path)>;
+
+    EsclSession(EsclTransport &transport, std::string base_url);
+
+    // Fetches the scanner's ScannerCapabilities XML document.
+    std::string Capabilities();
+
+    // Creates a scan job and fetches its pages until the device reports no
+    // more documents. The request for the next page goes out before a
+    // page's body is saved, so the device scans the next sheet while this
+    // one is written and passed to |on_page|. |on_page| may block; no
+    // request beyond that next one goes out until it returns.
+    //
+    // If fetching fails, the device stays busy past |settings.busy_timeout|
+    // or |on_page| throws, the job is deleted on the device before the error
+    // is rethrown, so the scanner is not left holding it.
+    void Scan(const EsclScanSettings &settings, const PageHandler &on_page);
+
+  private:
+    std::string CreateJob(const EsclScanSettings &settings);
+    void FetchPages(const std::string &job, const EsclScanSettings &settings, const PageHandler &on_page);
+    // Deletes |job| on the device, ignoring failures.
+    void CancelJob(const std::string &job);
+
+    EsclTransport &transport_;
+    std::string base_url_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_ESCL_SESSION_H_
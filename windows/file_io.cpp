@@ -0,0 +1,134 @@
+#include "file_io.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#else
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include <array>
+#include <filesystem>
+
+namespace quick_scanner_plus
+{
+
+  uint32_t Crc32(const uint8_t *data, size_t size, uint32_t crc)
+  {
+    static const std::array<uint32_t, 256> table = []
+    {
+      std::array<uint32_t, 256> t{};
+      for (uint32_t n = 0; n < 256; n++)
+      {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+        {
+          c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        t[n] = c;
+      }
+      return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+      crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+  }
+
+  void StoreLittleEndian(uint8_t *out, uint64_t value, int bytes)
+  {
+    for (int i = 0; i < bytes; i++)
+    {
+      out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+  }
+
+  void AppendLittleEndian(std::vector<uint8_t> &out, uint64_t value, int bytes)
+  {
+    for (int i = 0; i < bytes; i++)
+    {
+      out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  uint64_t LoadLittleEndian(const uint8_t *in, int bytes)
+  {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+      value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+  }
+
+#ifdef _WIN32
+  int OpenFd(const std::string &path)
+  {
+    int fd = -1;
+    _wsopen_s(&fd, std::filesystem::u8path(path).c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _SH_DENYWR,
+              _S_IREAD | _S_IWRITE);
+    return fd;
+  }
+  int CreateFd(const std::string &path)
+  {
+    int fd = -1;
+    _wsopen_s(&fd, std::filesystem::u8path(path).c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _SH_DENYWR,
+              _S_IREAD | _S_IWRITE);
+    return fd;
+  }
+  int ReadFd(int fd, uint8_t *data, size_t size) { return _read(fd, data, static_cast<unsigned int>(size)); }
+  int WriteFd(int fd, const uint8_t *data, size_t size) { return _write(fd, data, static_cast<unsigned int>(size)); }
+  int SyncFd(int fd) { return _commit(fd); }
+  int TruncateFd(int fd, long long size) { return _chsize_s(fd, size); }
+  long long SeekEnd(int fd) { return _lseeki64(fd, 0, SEEK_END); }
+  void CloseFd(int fd) { _close(fd); }
+  // _SH_DENYWR already keeps a second writer from opening the file.
+  bool LockFd(int) { return true; }
+#else
+  int OpenFd(const std::string &path) { return open(path.c_str(), O_RDWR | O_CREAT, 0644); }
+  int CreateFd(const std::string &path) { return open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644); }
+  int ReadFd(int fd, uint8_t *data, size_t size) { return static_cast<int>(read(fd, data, size)); }
+  int WriteFd(int fd, const uint8_t *data, size_t size) { return static_cast<int>(write(fd, data, size)); }
+  int SyncFd(int fd) { return fsync(fd); }
+  int TruncateFd(int fd, long long size) { return ftruncate(fd, static_cast<off_t>(size)); }
+  long long SeekEnd(int fd) { return lseek(fd, 0, SEEK_END); }
+  void CloseFd(int fd) { close(fd); }
+  bool LockFd(int fd) { return flock(fd, LOCK_EX | LOCK_NB) == 0; }
+#endif
+
+  std::vector<uint8_t> ReadAllFd(int fd)
+  {
+    std::vector<uint8_t> contents;
+    uint8_t buffer[64 * 1024];
+    int count;
+    while ((count = ReadFd(fd, buffer, sizeof(buffer))) > 0)
+    {
+      contents.insert(contents.end(), buffer, buffer + count);
+    }
+    return contents;
+  }
+
+  bool WriteAllFd(int fd, const uint8_t *data, size_t size)
+  {
+    while (size > 0)
+    {
+      // Stay well inside the int range of _write.
+      size_t chunk = size < (1u << 30) ? size : (1u << 30);
+      int written = WriteFd(fd, data, chunk);
+      if (written <= 0)
+      {
+        return false;
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+} // namespace quick_scanner_plus
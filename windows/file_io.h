@@ -0,0 +1,47 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_FILE_IO_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_FILE_IO_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  // Helpers shared by the plugin's binary file formats. Not part of any
+  // module's interface.
+
+  // CRC-32 as used by zlib and PNG. Passing the result of an earlier call as
+  // |crc| continues it over the next bytes.
+  uint32_t Crc32(const uint8_t *data, size_t size, uint32_t crc = 0);
+
+  // The low |bytes| bytes of |value|, least significant first.
+  void StoreLittleEndian(uint8_t *out, uint64_t value, int bytes);
+  void AppendLittleEndian(std::vector<uint8_t> &out, uint64_t value, int bytes);
+  uint64_t LoadLittleEndian(const uint8_t *in, int bytes);
+
+  // Thin wrappers over the POSIX and CRT file descriptor calls, returning
+  // what those return. OpenFd opens |path| (UTF-8) for reading and writing,
+  // creating it if needed; on Windows other writers are shut out.
+  int OpenFd(const std::string &path);
+  // Creates |path| (UTF-8) for writing; fails if it exists.
+  int CreateFd(const std::string &path);
+  int ReadFd(int fd, uint8_t *data, size_t size);
+  int WriteFd(int fd, const uint8_t *data, size_t size);
+  int SyncFd(int fd);
+  int TruncateFd(int fd, long long size);
+  long long SeekEnd(int fd);
+  void CloseFd(int fd);
+  // Takes an exclusive lock held until |fd| is closed, which also refuses a
+  // second descriptor in the same process. Returns false if it is taken.
+  bool LockFd(int fd);
+
+  // Reads from the current position to the end of the file.
+  std::vector<uint8_t> ReadAllFd(int fd);
+  // Writes all of |data|, retrying short writes. Returns false on failure.
+  bool WriteAllFd(int fd, const uint8_t *data, size_t size);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_FILE_IO_H_
@@ -0,0 +1,70 @@
+#include "known_devices.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // First line of the file; one "id<TAB>name" line per device follows.
+    const char kHeader[] = "quick_scanner_plus known devices 1";
+
+  } // namespace
+
+  std::vector<KnownDevice> LoadKnownDevices(const std::string &path)
+  {
+    std::vector<KnownDevice> devices;
+    std::ifstream in(fs::u8path(path));
+    std::string line;
+    if (!std::getline(in, line) || line != kHeader)
+    {
+      return devices;
+    }
+    while (std::getline(in, line))
+    {
+      auto tab = line.find('\t');
+      if (tab == std::string::npos || tab == 0)
+      {
+        continue;
+      }
+      devices.push_back(KnownDevice{line.substr(0, tab), line.substr(tab + 1)});
+    }
+    return devices;
+  }
+
+  bool SaveKnownDevices(const std::string &path, const std::vector<KnownDevice> &devices)
+  {
+    fs::path target = fs::u8path(path);
+    fs::path staging = fs::u8path(path + ".tmp");
+    std::error_code error;
+    fs::create_directories(target.parent_path(), error);
+    {
+      std::ofstream out(staging, std::ios::trunc);
+      out << kHeader << '\n';
+      for (const auto &device : devices)
+      {
+        // Keep every device on its own line.
+        auto name = device.name;
+        std::replace_if(name.begin(), name.end(), [](char c)
+                        { return c == '\t' || c == '\r' || c == '\n'; }, ' ');
+        out << device.id << '\t' << name << '\n';
+      }
+      out.flush();
+      if (!out)
+      {
+        fs::remove(staging, error);
+        return false;
+      }
+    }
+    fs::rename(staging, target, error);
+    return !error;
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,29 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_KNOWN_DEVICES_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_KNOWN_DEVICES_H_
+
+#include <string>
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  struct KnownDevice
+  {
+    std::string id;
+    std::string name;
+  };
+
+  // The scanners found by the last discovery, kept between runs so the next
+  // start can show them before discovery has found anything.
+
+  // Reads the list at |path| (UTF-8). Returns an empty list when there is
+  // none or it cannot be read.
+  std::vector<KnownDevice> LoadKnownDevices(const std::string &path);
+
+  // Replaces the list at |path|, creating its directory. The old list stays
+  // intact until the new one is complete. Returns false on failure.
+  bool SaveKnownDevices(const std::string &path, const std::vector<KnownDevice> &devices);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_KNOWN_DEVICES_H_
@@ -0,0 +1,262 @@
+#include "local_socket.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+#ifdef _WIN32
+    using NativeSocket = SOCKET;
+    const NativeSocket kInvalidNative = INVALID_SOCKET;
+
+    void StartWinsock()
+    {
+      static std::once_flag started;
+      std::call_once(started, []
+                     {
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data); });
+    }
+
+    bool AddressInUse() { return WSAGetLastError() == WSAEADDRINUSE; }
+    bool Interrupted() { return WSAGetLastError() == WSAEINTR; }
+    void CloseNative(NativeSocket socket) { closesocket(socket); }
+    int PollNative(pollfd *fd, int timeout_ms) { return WSAPoll(fd, 1, timeout_ms); }
+    const int kSendFlags = 0;
+    const int kShutdownBoth = SD_BOTH;
+#else
+    using NativeSocket = int;
+    const NativeSocket kInvalidNative = -1;
+
+    void StartWinsock() {}
+    bool AddressInUse() { return errno == EADDRINUSE; }
+    bool Interrupted() { return errno == EINTR; }
+    void CloseNative(NativeSocket socket) { close(socket); }
+    int PollNative(pollfd *fd, int timeout_ms) { return poll(fd, 1, timeout_ms); }
+#ifdef MSG_NOSIGNAL
+    // A peer that went away must not kill the process with SIGPIPE.
+    const int kSendFlags = MSG_NOSIGNAL;
+#else
+    const int kSendFlags = 0;
+#endif
+    const int kShutdownBoth = SHUT_RDWR;
+#endif
+
+    NativeSocket ToNative(intptr_t handle) { return static_cast<NativeSocket>(handle); }
+    intptr_t FromNative(NativeSocket socket)
+    {
+      return socket == kInvalidNative ? intptr_t{-1} : static_cast<intptr_t>(socket);
+    }
+
+    sockaddr_un Address(const std::string &path)
+    {
+      sockaddr_un address{};
+      address.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(address.sun_path))
+      {
+        throw std::runtime_error("Socket path is too long: " + path);
+      }
+      std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+      return address;
+    }
+
+    NativeSocket NewSocket()
+    {
+      StartWinsock();
+      NativeSocket socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      if (socket == kInvalidNative)
+      {
+        throw std::runtime_error("Could not create a local socket.");
+      }
+#ifndef _WIN32
+      // Processes started by the daemon or the app do not inherit it.
+      fcntl(socket, F_SETFD, FD_CLOEXEC);
+#endif
+#ifdef SO_NOSIGPIPE
+      int on = 1;
+      setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+      return socket;
+    }
+
+  } // namespace
+
+  LocalSocket::~LocalSocket()
+  {
+    Close();
+  }
+
+  LocalSocket::LocalSocket(LocalSocket &&other) noexcept
+      : handle_(std::exchange(other.handle_, kInvalid)), path_(std::move(other.path_))
+  {
+    other.path_.clear();
+  }
+
+  LocalSocket &LocalSocket::operator=(LocalSocket &&other) noexcept
+  {
+    if (this != &other)
+    {
+      Close();
+      handle_ = std::exchange(other.handle_, kInvalid);
+      path_ = std::move(other.path_);
+      other.path_.clear();
+    }
+    return *this;
+  }
+
+  LocalSocket LocalSocket::Listen(const std::string &path)
+  {
+    auto address = Address(path);
+    for (int attempt = 0;; attempt++)
+    {
+      NativeSocket socket = NewSocket();
+      if (bind(socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0 &&
+          listen(socket, SOMAXCONN) == 0)
+      {
+        LocalSocket listener(FromNative(socket));
+        listener.path_ = path;
+        return listener;
+      }
+      bool in_use = AddressInUse();
+      CloseNative(socket);
+      if (!in_use || attempt > 0)
+      {
+        throw std::runtime_error("Could not listen on " + path);
+      }
+      // Another listener may have bound the file and not be listening yet.
+      for (int probe = 0; probe < 3; probe++)
+      {
+        if (Connect(path).valid())
+        {
+          return LocalSocket();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+      // Nobody answers: the file is left over from a listener that died.
+      std::error_code ignored;
+      std::filesystem::remove(std::filesystem::u8path(path), ignored);
+    }
+  }
+
+  LocalSocket LocalSocket::Connect(const std::string &path)
+  {
+    auto address = Address(path);
+    NativeSocket socket = NewSocket();
+    if (connect(socket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+    {
+      CloseNative(socket);
+      return LocalSocket();
+    }
+    return LocalSocket(FromNative(socket));
+  }
+
+  LocalSocket LocalSocket::Accept(std::chrono::milliseconds timeout)
+  {
+    pollfd fd{};
+    fd.fd = ToNative(handle_);
+    fd.events = POLLIN;
+    if (PollNative(&fd, static_cast<int>(timeout.count())) <= 0 || !(fd.revents & POLLIN))
+    {
+      return LocalSocket();
+    }
+    NativeSocket socket = accept(ToNative(handle_), nullptr, nullptr);
+    if (socket == kInvalidNative)
+    {
+      return LocalSocket();
+    }
+#ifndef _WIN32
+    fcntl(socket, F_SETFD, FD_CLOEXEC);
+#endif
+    return LocalSocket(FromNative(socket));
+  }
+
+  void LocalSocket::Send(const uint8_t *data, size_t size)
+  {
+    size_t done = 0;
+    while (done < size)
+    {
+      auto chunk = static_cast<int>((std::min)(size - done, size_t{1} << 30));
+      auto sent = send(ToNative(handle_), reinterpret_cast<const char *>(data + done), chunk, kSendFlags);
+      if (sent <= 0)
+      {
+        if (sent < 0 && Interrupted())
+        {
+          continue;
+        }
+        throw std::runtime_error("Local connection closed.");
+      }
+      done += static_cast<size_t>(sent);
+    }
+  }
+
+  bool LocalSocket::Receive(uint8_t *data, size_t size)
+  {
+    size_t done = 0;
+    while (done < size)
+    {
+      auto chunk = static_cast<int>((std::min)(size - done, size_t{1} << 30));
+      auto received = recv(ToNative(handle_), reinterpret_cast<char *>(data + done), chunk, 0);
+      if (received == 0 && done == 0)
+      {
+        return false;
+      }
+      if (received <= 0)
+      {
+        if (received < 0 && Interrupted())
+        {
+          continue;
+        }
+        throw std::runtime_error("Local connection closed.");
+      }
+      done += static_cast<size_t>(received);
+    }
+    return true;
+  }
+
+  void LocalSocket::Shutdown()
+  {
+    if (valid())
+    {
+      shutdown(ToNative(handle_), kShutdownBoth);
+    }
+  }
+
+  void LocalSocket::Close()
+  {
+    if (!valid())
+    {
+      return;
+    }
+    CloseNative(ToNative(handle_));
+    handle_ = kInvalid;
+    if (!path_.empty())
+    {
+      std::error_code ignored;
+      std::filesystem::remove(std::filesystem::u8path(path_), ignored);
+      path_.clear();
+    }
+  }
+
+} // namespace quick_scanner_plus
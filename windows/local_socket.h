@@ -0,0 +1,64 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_LOCAL_SOCKET_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_LOCAL_SOCKET_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace quick_scanner_plus
+{
+
+  // A stream socket bound to a path on the local machine (AF_UNIX). Windows
+  // 10 1803 and later have AF_UNIX too, so the scan daemon and its clients
+  // use the same transport everywhere.
+  class LocalSocket
+  {
+  public:
+    LocalSocket() = default;
+    ~LocalSocket();
+
+    LocalSocket(LocalSocket &&other) noexcept;
+    LocalSocket &operator=(LocalSocket &&other) noexcept;
+    LocalSocket(const LocalSocket &) = delete;
+    LocalSocket &operator=(const LocalSocket &) = delete;
+
+    // Listens on |path| (UTF-8). A socket file left behind by a listener
+    // that is gone is replaced; returns an invalid socket if another one is
+    // still listening there. Throws std::runtime_error on other failures.
+    static LocalSocket Listen(const std::string &path);
+    // Returns an invalid socket if nothing listens on |path|.
+    static LocalSocket Connect(const std::string &path);
+
+    // Waits up to |timeout| for a connection; returns an invalid socket if
+    // none arrived.
+    LocalSocket Accept(std::chrono::milliseconds timeout);
+
+    // Throws std::runtime_error if the peer is gone.
+    void Send(const uint8_t *data, size_t size);
+    // Fills |data|. Returns false if the peer closed the connection before
+    // the first byte; throws std::runtime_error if it did so midway or the
+    // connection failed.
+    bool Receive(uint8_t *data, size_t size);
+
+    // Ends the connection in both directions, waking a Receive blocked on
+    // another thread. The socket stays open until destroyed.
+    void Shutdown();
+
+    bool valid() const { return handle_ != kInvalid; }
+
+  private:
+    static constexpr intptr_t kInvalid = -1;
+
+    explicit LocalSocket(intptr_t handle) : handle_(handle) {}
+    void Close();
+
+    // A file descriptor, or a SOCKET on Windows.
+    intptr_t handle_ = kInvalid;
+    // Set on a listener, whose socket file is removed when it closes.
+    std::string path_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_LOCAL_SOCKET_H_
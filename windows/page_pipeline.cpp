@@ -0,0 +1,303 @@
+#include "page_pipeline.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <vector>
+
+#include "png_writer.h"
+
+namespace fs = std::filesystem;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // Candidate encodings written during the pass. Whatever is not kept is
+    // removed, also when a stage throws.
+    struct Candidates
+    {
+      fs::path gray_path;
+      fs::path mono_path;
+      fs::path color_path;
+      std::unique_ptr<PngWriter> gray;
+      std::unique_ptr<PngWriter> mono;
+      std::unique_ptr<PngWriter> color;
+
+      ~Candidates()
+      {
+        gray.reset();
+        mono.reset();
+        color.reset();
+        std::error_code ignored;
+        fs::remove(gray_path, ignored);
+        fs::remove(mono_path, ignored);
+        fs::remove(color_path, ignored);
+      }
+    };
+
+    bool IsJpegPath(const std::string &path)
+    {
+      auto extension = fs::u8path(path).extension().u8string();
+      std::transform(extension.begin(), extension.end(), extension.begin(), [](char c)
+                     { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+      return extension == ".jpg" || extension == ".jpeg" || extension == ".jfif";
+    }
+
+    // Encodes the frame of |thumbnail| as an RGB PNG, staged through the
+    // file at |scratch|.
+    std::vector<uint8_t> EncodeThumbnail(const ScanPreview &thumbnail, const fs::path &scratch)
+    {
+      ScanPreview::Frame frame;
+      if (!thumbnail.CopyFrame(frame))
+      {
+        return std::vector<uint8_t>();
+      }
+
+      {
+        // Thumbnails are small; a second thread would not pay off.
+        PngWriterOptions options;
+        options.threads = 1;
+        PngWriter writer(scratch.u8string(), frame.width, frame.height, PngColorType::kRgb8, options);
+        std::vector<uint8_t> row(writer.row_bytes());
+        const uint8_t *rgba = frame.pixels.data();
+        for (uint32_t y = 0; y < frame.height; y++)
+        {
+          for (uint32_t x = 0; x < frame.width; x++, rgba += 4)
+          {
+            row[x * 3] = rgba[0];
+            row[x * 3 + 1] = rgba[1];
+            row[x * 3 + 2] = rgba[2];
+          }
+          writer.WriteRow(row.data());
+        }
+        writer.Finish();
+      }
+
+      std::vector<uint8_t> png;
+      {
+        std::ifstream in(scratch, std::ios::binary);
+        png.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+      }
+      std::error_code ignored;
+      fs::remove(scratch, ignored);
+      return png;
+    }
+
+  } // namespace
+
+  PageResult ProcessPage(std::unique_ptr<TiledImage> page, const std::string &path, const PageOptions &options)
+  {
+    PageResult result;
+    result.path = path;
+
+    std::optional<SeparatorDetector> detector;
+    if (options.detect_separators)
+    {
+      detector.emplace(options.separator);
+    }
+
+    std::optional<ColorAnalyzer> analyzer;
+    Candidates candidates;
+    std::vector<uint8_t> row;
+    std::vector<uint8_t> rgb_row;
+    std::vector<uint8_t> gray_row;
+    std::vector<uint8_t> mono_row;
+    // Mono pages have next to nothing in the midtone band, so its middle is
+    // a safe binarization threshold.
+    auto threshold = static_cast<uint8_t>((options.color.midtone_low + options.color.midtone_high) / 2);
+    if (options.auto_color || options.detect_blank)
+    {
+      analyzer.emplace(options.color);
+    }
+    if (options.auto_color)
+    {
+      candidates.gray_path = fs::u8path(path + ".gray.tmp");
+      candidates.mono_path = fs::u8path(path + ".mono.tmp");
+      candidates.gray = std::make_unique<PngWriter>(candidates.gray_path.u8string(), page->width(), page->height(),
+                                                    PngColorType::kGray8);
+      candidates.mono = std::make_unique<PngWriter>(candidates.mono_path.u8string(), page->width(), page->height(),
+                                                    PngColorType::kGray1);
+      row.resize(page->width() * BytesPerPixel(page->format()));
+      gray_row.resize(page->width());
+      mono_row.resize(candidates.mono->row_bytes());
+    }
+
+    // Gray pages carry no color to correct. JPEG pages are kept as they are
+    // unless their growth to PNG was asked for.
+    bool correct_color = options.color_lut && page->format() == PixelFormat::kBgra8 &&
+                         (options.correct_jpeg || !IsJpegPath(path));
+    if (correct_color)
+    {
+      auto lut = options.color_lut;
+      page->AddStage([lut](Tile &tile)
+                     { lut->ApplyTile(tile); });
+      candidates.color_path = fs::u8path(path + ".color.tmp");
+      candidates.color = std::make_unique<PngWriter>(candidates.color_path.u8string(), page->width(), page->height(),
+                                                     PngColorType::kRgb8);
+      row.resize(page->width() * BytesPerPixel(page->format()));
+      rgb_row.resize(candidates.color->row_bytes());
+    }
+
+    uint64_t preview_page = 0;
+    if (options.preview)
+    {
+      preview_page = options.preview->BeginPage(page->width(), page->height());
+    }
+    std::unique_ptr<ScanPreview> thumbnail;
+    uint64_t thumbnail_page = 0;
+    if (options.thumbnail_edge)
+    {
+      thumbnail = std::make_unique<ScanPreview>(options.thumbnail_edge);
+      thumbnail_page = thumbnail->BeginPage(page->width(), page->height());
+    }
+    uint64_t band_page = 0;
+    if (options.bands)
+    {
+      band_page = options.bands->BeginPage();
+    }
+
+    auto format = page->format();
+    page->ForEachTileRow([&](const TileRow &strip)
+                        {
+      if (options.preview)
+      {
+        options.preview->Observe(preview_page, strip);
+      }
+      if (thumbnail)
+      {
+        thumbnail->Observe(thumbnail_page, strip);
+      }
+      if (options.bands)
+      {
+        bool last = strip.y() + strip.height() == page->height();
+        options.bands->Push(MakeRowBand(band_page, page->width(), strip, last));
+      }
+      if (detector)
+      {
+        detector->Observe(strip);
+      }
+      if (analyzer)
+      {
+        analyzer->Observe(strip);
+      }
+      if (!options.auto_color && !correct_color)
+      {
+        return;
+      }
+
+      for (uint32_t r = 0; r < strip.height(); r++)
+      {
+        strip.CopyRow(r, row.data());
+        if (correct_color)
+        {
+          for (size_t x = 0; x < rgb_row.size() / 3; x++)
+          {
+            rgb_row[x * 3] = row[x * 4 + 2];
+            rgb_row[x * 3 + 1] = row[x * 4 + 1];
+            rgb_row[x * 3 + 2] = row[x * 4];
+          }
+          candidates.color->WriteRow(rgb_row.data());
+        }
+        if (!options.auto_color)
+        {
+          continue;
+        }
+
+        if (format == PixelFormat::kGray8)
+        {
+          gray_row.assign(row.begin(), row.end());
+        }
+        else
+        {
+          for (size_t x = 0; x < gray_row.size(); x++)
+          {
+            gray_row[x] = Luma(&row[x * 4]);
+          }
+        }
+
+        std::fill(mono_row.begin(), mono_row.end(), static_cast<uint8_t>(0));
+        for (size_t x = 0; x < gray_row.size(); x++)
+        {
+          if (gray_row[x] >= threshold)
+          {
+            mono_row[x / 8] |= static_cast<uint8_t>(0x80 >> (x % 8));
+          }
+        }
+
+        candidates.gray->WriteRow(gray_row.data());
+        candidates.mono->WriteRow(mono_row.data());
+      } });
+
+    page.reset();
+
+    if (thumbnail)
+    {
+      result.thumbnail = EncodeThumbnail(*thumbnail, fs::u8path(path + ".thumb.tmp"));
+    }
+
+    if (detector)
+    {
+      result.separator = detector->Finish();
+    }
+
+    if (options.detect_blank)
+    {
+      result.is_blank = analyzer->IsBlank();
+    }
+
+    fs::path source = fs::u8path(path);
+    // The driver's file, unless color correction replaced its content.
+    fs::path current = source;
+    if (correct_color)
+    {
+      candidates.color->Finish();
+      current = candidates.color_path;
+    }
+
+    fs::path chosen;
+    if (options.auto_color)
+    {
+      candidates.gray->Finish();
+      candidates.mono->Finish();
+      result.color_class = analyzer->Finish();
+
+      if (result.color_class == ColorClass::kMono)
+      {
+        chosen = candidates.mono_path;
+      }
+      else if (result.color_class == ColorClass::kGray)
+      {
+        chosen = candidates.gray_path;
+      }
+      if (!chosen.empty() && fs::file_size(chosen) >= fs::file_size(current))
+      {
+        chosen.clear();
+      }
+    }
+    if (chosen.empty() && current != source)
+    {
+      chosen = current;
+    }
+
+    // Separators and blank pages are dropped, no point in re-encoding them.
+    if (!result.separator.is_separator && !result.is_blank && !chosen.empty())
+    {
+      fs::path target = source;
+      target.replace_extension(".png");
+      fs::remove(source);
+      fs::rename(chosen, target);
+      result.path = target.u8string();
+    }
+
+    return result;
+  }
+
+} // namespace quick_scanner_plus
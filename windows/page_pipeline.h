@@ -0,0 +1,70 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PAGE_PIPELINE_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PAGE_PIPELINE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "band_stream.h"
+#include "batch_separator.h"
+#include "color_analysis.h"
+#include "color_lut.h"
+#include "scan_preview.h"
+#include "tiled_image.h"
+
+namespace quick_scanner_plus
+{
+
+  struct PageOptions
+  {
+    bool detect_separators = false;
+    SeparatorOptions separator;
+    // Re-encode pages without color as 1-bit or grayscale PNG when that is
+    // smaller than the file the driver wrote.
+    bool auto_color = false;
+    ColorAnalysisOptions color;
+    // Receives the page strip by strip as it is read. Optional.
+    std::shared_ptr<ScanPreview> preview;
+    // Receives the page's raw rows band by band as it is read. Optional.
+    std::shared_ptr<BandStream> bands;
+    // Longer side of a PNG thumbnail returned with the page; 0 for none.
+    uint32_t thumbnail_edge = 0;
+    // Check whether the page is blank, using the thresholds in |color|.
+    bool detect_blank = false;
+    // Normalizes the colors of BGRA pages before every other stage sees
+    // them. The page is then stored as PNG, or smaller with auto color.
+    std::shared_ptr<const ColorLut> color_lut;
+    // Also correct JPEG pages. Off by default: a corrected JPEG page is
+    // stored as lossless PNG, typically several times the size of the JPEG.
+    bool correct_jpeg = false;
+
+    // Whether any stage needs the page pixels.
+    bool NeedsDecoding() const
+    {
+      return detect_separators || auto_color || preview || bands || thumbnail_edge || detect_blank || color_lut;
+    }
+  };
+
+  struct PageResult
+  {
+    // The file holding the page after processing (UTF-8).
+    std::string path;
+    SeparatorResult separator;
+    ColorClass color_class = ColorClass::kColor;
+    // Only set with PageOptions::detect_blank.
+    bool is_blank = false;
+    // PNG bytes, when PageOptions::thumbnail_edge is set.
+    std::vector<uint8_t> thumbnail;
+  };
+
+  // Runs every enabled post-scan stage over |page| in a single strip-by-strip
+  // pass, so each page is decoded once. |path| is the file |page| was decoded
+  // from; it is replaced when color correction or auto color re-encode the
+  // page. |page| is released before that, so its source file is no longer
+  // held open.
+  PageResult ProcessPage(std::unique_ptr<TiledImage> page, const std::string &path, const PageOptions &options);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PAGE_PIPELINE_H_
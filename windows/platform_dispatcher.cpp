@@ -0,0 +1,160 @@
+#include "platform_dispatcher.h"
+
+namespace quick_scanner_plus
+{
+
+  constexpr std::chrono::milliseconds PlatformDispatcher::kDefaultFrame;
+
+  PlatformDispatcher::PlatformDispatcher(std::function<void()> wake, std::chrono::milliseconds frame)
+      : wake_(std::move(wake)), frame_(frame) {}
+
+  PlatformDispatcher::~PlatformDispatcher()
+  {
+    Node *node = head_.exchange(nullptr);
+    while (node)
+    {
+      Node *next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+
+  void PlatformDispatcher::Post(Task task)
+  {
+    posted_++;
+    if (!wake_)
+    {
+      task();
+      delivered_++;
+      return;
+    }
+    Push(new Node{std::move(task), std::string(), false, nullptr});
+    if (!wake_pending_.exchange(true))
+    {
+      wake_();
+    }
+  }
+
+  void PlatformDispatcher::PostCoalesced(std::string key, Task task)
+  {
+    posted_++;
+    if (!wake_)
+    {
+      task();
+      delivered_++;
+      return;
+    }
+    Push(new Node{std::move(task), std::move(key), true, nullptr});
+    // A Drain is already scheduled for the held frame.
+    if (!frame_pending_.load() && !wake_pending_.exchange(true))
+    {
+      wake_();
+    }
+  }
+
+  void PlatformDispatcher::Push(Node *node)
+  {
+    node->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(node->next, node))
+    {
+    }
+  }
+
+  std::chrono::milliseconds PlatformDispatcher::Drain()
+  {
+    auto start = std::chrono::steady_clock::now();
+    wake_pending_.store(false);
+
+    // The stack holds the newest task first.
+    Node *node = head_.exchange(nullptr);
+    Node *fifo = nullptr;
+    while (node)
+    {
+      Node *next = node->next;
+      node->next = fifo;
+      fifo = node;
+      node = next;
+    }
+
+    uint64_t delivered = 0;
+    while (fifo)
+    {
+      Node *next = fifo->next;
+      if (fifo->coalesced)
+      {
+        auto it = held_index_.find(fifo->key);
+        if (it != held_index_.end())
+        {
+          held_[it->second].second = std::move(fifo->task);
+          superseded_++;
+        }
+        else
+        {
+          held_index_.emplace(fifo->key, held_.size());
+          held_.emplace_back(std::move(fifo->key), std::move(fifo->task));
+        }
+      }
+      else
+      {
+        fifo->task();
+        delivered++;
+      }
+      delete fifo;
+      fifo = next;
+    }
+
+    std::chrono::milliseconds due{0};
+    if (!held_.empty())
+    {
+      auto since_frame = start - last_frame_;
+      if (since_frame >= frame_)
+      {
+        // Tasks may post again; those go to the next frame.
+        auto frame = std::move(held_);
+        held_.clear();
+        held_index_.clear();
+        last_frame_ = start;
+        for (auto &[key, task] : frame)
+        {
+          task();
+          delivered++;
+        }
+        frame_pending_.store(false);
+        // Coalesced posts seen before the store skipped their wake.
+        if (head_.load() && !wake_pending_.exchange(true))
+        {
+          wake_();
+        }
+      }
+      else
+      {
+        frame_pending_.store(true);
+        due = std::chrono::duration_cast<std::chrono::milliseconds>(frame_ - since_frame) + std::chrono::milliseconds(1);
+      }
+    }
+
+    auto busy = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    delivered_ += delivered;
+    drains_++;
+    busy_us_ += busy;
+    if (busy > max_drain_us_.load())
+    {
+      max_drain_us_.store(busy);
+    }
+    return due;
+  }
+
+  DispatcherStats PlatformDispatcher::stats() const
+  {
+    DispatcherStats stats;
+    stats.posted = posted_.load();
+    stats.delivered = delivered_.load();
+    stats.superseded = superseded_.load();
+    stats.drains = drains_.load();
+    stats.busy_us = busy_us_.load();
+    stats.max_drain_us = max_drain_us_.load();
+    return stats;
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,99 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PLATFORM_DISPATCHER_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PLATFORM_DISPATCHER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  struct DispatcherStats
+  {
+    uint64_t posted = 0;
+    // Tasks that ran on the platform thread.
+    uint64_t delivered = 0;
+    // Coalesced tasks replaced by a newer one before their frame.
+    uint64_t superseded = 0;
+    uint64_t drains = 0;
+    // Time spent running tasks on the platform thread.
+    uint64_t busy_us = 0;
+    uint64_t max_drain_us = 0;
+  };
+
+  // Moves work from scan threads onto the platform thread, where the engine
+  // expects every channel message to be sent. Any thread can post; queued
+  // tasks run in order the next time the platform thread calls Drain.
+  //
+  // Posting never takes a lock: tasks go onto an intrusive lock-free stack
+  // that Drain takes over whole. Coalesced tasks stand for the latest state
+  // of something that changes quickly, such as a preview frame or a device
+  // list. They are held back and run at most once per frame, and only the
+  // last one posted under each key runs.
+  class PlatformDispatcher
+  {
+  public:
+    using Task = std::function<void()>;
+
+    static constexpr std::chrono::milliseconds kDefaultFrame{16};
+
+    // |wake| is called on the posting thread when Drain needs to run on the
+    // platform thread, at most once per Drain. Without |wake| there is no
+    // platform thread to hand over to and tasks run where they are posted.
+    explicit PlatformDispatcher(std::function<void()> wake, std::chrono::milliseconds frame = kDefaultFrame);
+    ~PlatformDispatcher();
+
+    PlatformDispatcher(const PlatformDispatcher &) = delete;
+    PlatformDispatcher &operator=(const PlatformDispatcher &) = delete;
+
+    void Post(Task task);
+    // Coalesced tasks may run before or after plain tasks posted around them.
+    void PostCoalesced(std::string key, Task task);
+
+    // Runs queued tasks on the platform thread. Returns how long until held
+    // coalesced tasks are due, or zero when none are; the caller must call
+    // Drain again after that long.
+    std::chrono::milliseconds Drain();
+
+    DispatcherStats stats() const;
+
+  private:
+    struct Node
+    {
+      Task task;
+      std::string key;
+      bool coalesced;
+      Node *next;
+    };
+
+    void Push(Node *node);
+
+    std::function<void()> wake_;
+    std::chrono::milliseconds frame_;
+    std::atomic<Node *> head_{nullptr};
+    std::atomic<bool> wake_pending_{false};
+    // Set while held coalesced tasks wait for their frame; coalesced posts
+    // need no wake then.
+    std::atomic<bool> frame_pending_{false};
+
+    // Platform thread only.
+    std::vector<std::pair<std::string, Task>> held_;
+    std::map<std::string, size_t> held_index_;
+    std::chrono::steady_clock::time_point last_frame_{};
+
+    std::atomic<uint64_t> posted_{0};
+    std::atomic<uint64_t> delivered_{0};
+    std::atomic<uint64_t> superseded_{0};
+    std::atomic<uint64_t> drains_{0};
+    std::atomic<uint64_t> busy_us_{0};
+    std::atomic<uint64_t> max_drain_us_{0};
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PLATFORM_DISPATCHER_H_
@@ -0,0 +1,490 @@
+#include "png_writer.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define QUICK_SCANNER_PLUS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "file_io.h"
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    const size_t kImageDataChunk = 64 * 1024;
+
+    // PNG filter types (PNG specification, section 9.2).
+    const uint8_t kFilterNone = 0;
+    const uint8_t kFilterSub = 1;
+    const uint8_t kFilterUp = 2;
+    const uint8_t kFilterAverage = 3;
+    const uint8_t kFilterPaeth = 4;
+
+    void PutBigEndian(std::vector<uint8_t> &out, uint32_t value)
+    {
+      out.push_back(static_cast<uint8_t>(value >> 24));
+      out.push_back(static_cast<uint8_t>(value >> 16));
+      out.push_back(static_cast<uint8_t>(value >> 8));
+      out.push_back(static_cast<uint8_t>(value));
+    }
+
+    // Band workers running across all writers. Several pages are encoded
+    // at once, each into several candidates, so each writer starting one
+    // worker per core would oversubscribe the machine many times over.
+    std::atomic<unsigned> running_band_workers{0};
+
+    bool TryStartBandWorker()
+    {
+      unsigned limit = std::max(1u, std::thread::hardware_concurrency());
+      unsigned running = running_band_workers.load();
+      while (running < limit)
+      {
+        if (running_band_workers.compare_exchange_weak(running, running + 1))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void FinishBandWorker()
+    {
+      running_band_workers--;
+    }
+
+    uint8_t PaethPredictor(int a, int b, int c)
+    {
+      int pa = std::abs(b - c);
+      int pb = std::abs(a - c);
+      int pc = std::abs(a + b - 2 * c);
+      if (pa <= pb && pa <= pc)
+      {
+        return static_cast<uint8_t>(a);
+      }
+      return static_cast<uint8_t>(pb <= pc ? b : c);
+    }
+
+    // Sum of the residuals read as signed bytes, the usual estimate of how
+    // well a filtered row will compress.
+    uint64_t ResidualCost(const uint8_t *data, size_t size)
+    {
+      uint64_t cost = 0;
+      size_t i = 0;
+#ifdef QUICK_SCANNER_PLUS_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      __m128i sums = zero;
+      for (; i + 16 <= size; i += 16)
+      {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i magnitude = _mm_min_epu8(v, _mm_sub_epi8(zero, v));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(magnitude, zero));
+      }
+      cost = static_cast<uint64_t>(_mm_cvtsi128_si32(sums)) +
+             static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+#endif
+      for (; i < size; i++)
+      {
+        cost += data[i] < 128 ? data[i] : 256u - data[i];
+      }
+      return cost;
+    }
+
+    // Sub, Up, Average and Paeth residuals of |row| against |prior|, the raw
+    // row above. |distance| is the byte distance to the pixel on the left.
+    void FilterSub(const uint8_t *row, size_t size, size_t distance, uint8_t *out)
+    {
+      size_t i = 0;
+      for (; i < distance && i < size; i++)
+      {
+        out[i] = row[i];
+      }
+#ifdef QUICK_SCANNER_PLUS_SSE2
+      for (; i + 16 <= size; i += 16)
+      {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i - distance));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(x, a));
+      }
+#endif
+      for (; i < size; i++)
+      {
+        out[i] = static_cast<uint8_t>(row[i] - row[i - distance]);
+      }
+    }
+
+    void FilterUp(const uint8_t *row, const uint8_t *prior, size_t size, uint8_t *out)
+    {
+      size_t i = 0;
+#ifdef QUICK_SCANNER_PLUS_SSE2
+      for (; i + 16 <= size; i += 16)
+      {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(prior + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(x, b));
+      }
+#endif
+      for (; i < size; i++)
+      {
+        out[i] = static_cast<uint8_t>(row[i] - prior[i]);
+      }
+    }
+
+    void FilterAverage(const uint8_t *row, const uint8_t *prior, size_t size, size_t distance, uint8_t *out)
+    {
+      size_t i = 0;
+      for (; i < distance && i < size; i++)
+      {
+        out[i] = static_cast<uint8_t>(row[i] - (prior[i] >> 1));
+      }
+#ifdef QUICK_SCANNER_PLUS_SSE2
+      const __m128i one = _mm_set1_epi8(1);
+      for (; i + 16 <= size; i += 16)
+      {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i - distance));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(prior + i));
+        // _mm_avg_epu8 rounds up; PNG rounds down.
+        __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(x, average));
+      }
+#endif
+      for (; i < size; i++)
+      {
+        out[i] = static_cast<uint8_t>(row[i] - ((row[i - distance] + prior[i]) >> 1));
+      }
+    }
+
+    void FilterPaeth(const uint8_t *row, const uint8_t *prior, size_t size, size_t distance, uint8_t *out)
+    {
+      size_t i = 0;
+      for (; i < distance && i < size; i++)
+      {
+        // With no left neighbour the predictor is always the pixel above.
+        out[i] = static_cast<uint8_t>(row[i] - prior[i]);
+      }
+#ifdef QUICK_SCANNER_PLUS_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      for (; i + 8 <= size; i += 8)
+      {
+        auto load = [&](const uint8_t *p)
+        { return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), zero); };
+        __m128i x = load(row + i);
+        __m128i a = load(row + i - distance);
+        __m128i b = load(prior + i);
+        __m128i c = load(prior + i - distance);
+
+        __m128i b_minus_c = _mm_sub_epi16(b, c);
+        __m128i a_minus_c = _mm_sub_epi16(a, c);
+        __m128i pa = _mm_max_epi16(b_minus_c, _mm_sub_epi16(zero, b_minus_c));
+        __m128i pb = _mm_max_epi16(a_minus_c, _mm_sub_epi16(zero, a_minus_c));
+        __m128i sum = _mm_add_epi16(b_minus_c, a_minus_c);
+        __m128i pc = _mm_max_epi16(sum, _mm_sub_epi16(zero, sum));
+
+        __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+        __m128i not_b = _mm_cmpgt_epi16(pb, pc);
+        __m128i b_or_c = _mm_or_si128(_mm_and_si128(not_b, c), _mm_andnot_si128(not_b, b));
+        __m128i predictor = _mm_or_si128(_mm_and_si128(not_a, b_or_c), _mm_andnot_si128(not_a, a));
+
+        __m128i residual = _mm_sub_epi16(x, predictor);
+        residual = _mm_and_si128(residual, _mm_set1_epi16(0xFF));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(residual, zero));
+      }
+#endif
+      for (; i < size; i++)
+      {
+        out[i] = static_cast<uint8_t>(row[i] - PaethPredictor(row[i - distance], prior[i], prior[i - distance]));
+      }
+    }
+
+    // Writes the filter type byte and the residuals of the cheapest filter
+    // for |row| to |out| (size + 1 bytes). Bilevel rows compress best
+    // unfiltered, so they skip the search. |scratch| holds 4 * size bytes.
+    void FilterRow(const uint8_t *row, const uint8_t *prior, size_t size, size_t distance, bool adaptive,
+                   uint8_t *scratch, uint8_t *out)
+    {
+      const uint8_t *best = row;
+      uint8_t best_type = kFilterNone;
+      if (adaptive)
+      {
+        uint64_t best_cost = ResidualCost(row, size);
+        uint8_t *candidates[] = {scratch, scratch + size, scratch + 2 * size, scratch + 3 * size};
+        FilterSub(row, size, distance, candidates[0]);
+        FilterUp(row, prior, size, candidates[1]);
+        FilterAverage(row, prior, size, distance, candidates[2]);
+        FilterPaeth(row, prior, size, distance, candidates[3]);
+        for (uint8_t type = kFilterSub; type <= kFilterPaeth; type++)
+        {
+          const uint8_t *candidate = candidates[type - 1];
+          uint64_t cost = ResidualCost(candidate, size);
+          if (cost < best_cost)
+          {
+            best_cost = cost;
+            best = candidate;
+            best_type = type;
+          }
+        }
+      }
+      out[0] = best_type;
+      std::copy(best, best + size, out + 1);
+    }
+
+  } // namespace
+
+  PngWriter::PngWriter(const std::string &path, uint32_t width, uint32_t height, PngColorType color_type,
+                       PngWriterOptions options)
+      : file_(std::filesystem::u8path(path), std::ios::binary | std::ios::trunc),
+        height_(height),
+        color_type_(color_type)
+  {
+    if (!file_)
+    {
+      throw std::runtime_error("Could not create " + path);
+    }
+
+    uint8_t bit_depth = 8;
+    uint8_t png_color_type = 0;
+    filter_distance_ = 1;
+    switch (color_type_)
+    {
+    case PngColorType::kGray1:
+      bit_depth = 1;
+      row_bytes_ = (static_cast<size_t>(width) + 7) / 8;
+      break;
+    case PngColorType::kGray8:
+      row_bytes_ = width;
+      break;
+    case PngColorType::kRgb8:
+      png_color_type = 2;
+      row_bytes_ = static_cast<size_t>(width) * 3;
+      filter_distance_ = 3;
+      break;
+    }
+    previous_row_.assign(row_bytes_, 0);
+    filtered_row_.resize(row_bytes_ + 1);
+
+    static const uint8_t kSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file_.write(reinterpret_cast<const char *>(kSignature), sizeof(kSignature));
+
+    std::vector<uint8_t> header;
+    PutBigEndian(header, width);
+    PutBigEndian(header, height);
+    header.push_back(bit_depth);
+    header.push_back(png_color_type);
+    header.push_back(0); // Deflate.
+    header.push_back(0); // Adaptive filtering.
+    header.push_back(0); // No interlace.
+    WriteChunk("IHDR", header.data(), header.size());
+
+    threads_ = options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    band_rows_ = std::max<uint32_t>(options.band_rows, 1);
+    // A page that fits in one band gains nothing from splitting.
+    if (threads_ > 1 && height_ > band_rows_)
+    {
+      // Same header the serial Deflater writes.
+      image_data_.push_back(0x78);
+      image_data_.push_back(0x01);
+      band_ = BufferPool::Shared().Acquire(row_bytes_ * band_rows_);
+      return;
+    }
+
+    threads_ = 1;
+    scratch_.resize(row_bytes_ * 4);
+    deflater_ = std::make_unique<Deflater>([this](const uint8_t *data, size_t size)
+                                           {
+                                             image_data_.insert(image_data_.end(), data, data + size);
+                                             FlushImageData(false); });
+  }
+
+  PngWriter::~PngWriter()
+  {
+    // Workers only touch their own band, but must not outlive the writer.
+    // Bands that never got a worker are dropped unrun.
+    for (auto &band : in_flight_)
+    {
+      if (band.wait_for(std::chrono::seconds(0)) != std::future_status::deferred)
+      {
+        band.wait();
+      }
+    }
+  }
+
+  void PngWriter::WriteRow(const uint8_t *row)
+  {
+    bool adaptive = color_type_ != PngColorType::kGray1;
+    if (deflater_)
+    {
+      FilterRow(row, previous_row_.data(), row_bytes_, filter_distance_, adaptive, scratch_.data(),
+                filtered_row_.data());
+      std::copy(row, row + row_bytes_, previous_row_.begin());
+      deflater_->Write(filtered_row_.data(), filtered_row_.size());
+      rows_written_++;
+      return;
+    }
+
+    std::copy(row, row + row_bytes_, band_.data() + band_filled_ * row_bytes_);
+    band_filled_++;
+    rows_written_++;
+    if (band_filled_ == band_rows_ || rows_written_ == height_)
+    {
+      DispatchBand(rows_written_ == height_);
+    }
+  }
+
+  void PngWriter::Finish()
+  {
+    if (finished_)
+    {
+      return;
+    }
+    finished_ = true;
+    if (rows_written_ != height_)
+    {
+      throw std::runtime_error("PNG finished before all rows were written.");
+    }
+    if (deflater_)
+    {
+      deflater_->Finish();
+    }
+    else
+    {
+      while (!in_flight_.empty())
+      {
+        CollectBand();
+      }
+      for (int shift = 24; shift >= 0; shift -= 8)
+      {
+        image_data_.push_back(static_cast<uint8_t>(adler_ >> shift));
+      }
+    }
+    FlushImageData(true);
+    WriteChunk("IEND", nullptr, 0);
+    file_.close();
+    if (!file_)
+    {
+      throw std::runtime_error("Could not write PNG file.");
+    }
+  }
+
+  void PngWriter::DispatchBand(bool last)
+  {
+    if (in_flight_.size() >= threads_)
+    {
+      CollectBand();
+    }
+
+    // The band's first row is filtered against the last row of the one
+    // before, which is copied out before the buffer moves to the worker.
+    std::vector<uint8_t> prior = previous_row_;
+    std::copy(band_.data() + (band_filled_ - 1) * row_bytes_, band_.data() + band_filled_ * row_bytes_,
+              previous_row_.begin());
+    // Without a free worker the band is compressed on this thread when it
+    // is collected.
+    bool worker = TryStartBandWorker();
+    in_flight_.push_back(std::async(worker ? std::launch::async : std::launch::deferred,
+                                    [worker, rows = std::move(band_), row_count = band_filled_,
+                                     prior = std::move(prior), row_bytes = row_bytes_,
+                                     filter_distance = filter_distance_,
+                                     adaptive = color_type_ != PngColorType::kGray1, last]() mutable
+                                    {
+                                      struct Release
+                                      {
+                                        bool worker;
+                                        ~Release()
+                                        {
+                                          if (worker)
+                                          {
+                                            FinishBandWorker();
+                                          }
+                                        }
+                                      } release{worker};
+                                      return CompressBand(std::move(rows), row_count, std::move(prior), row_bytes,
+                                                          filter_distance, adaptive, last);
+                                    }));
+    band_filled_ = 0;
+    if (!last)
+    {
+      band_ = BufferPool::Shared().Acquire(row_bytes_ * band_rows_);
+    }
+  }
+
+  void PngWriter::CollectBand()
+  {
+    CompressedBand band = in_flight_.front().get();
+    in_flight_.pop_front();
+    adler_ = first_band_ ? band.adler : Adler32Combine(adler_, band.adler, band.size);
+    first_band_ = false;
+    image_data_.insert(image_data_.end(), band.data.begin(), band.data.end());
+    FlushImageData(false);
+  }
+
+  PngWriter::CompressedBand PngWriter::CompressBand(PooledBuffer rows, uint32_t row_count, std::vector<uint8_t> prior,
+                                                    size_t row_bytes, size_t filter_distance, bool adaptive,
+                                                    bool last)
+  {
+    CompressedBand band;
+    Deflater deflater([&band](const uint8_t *data, size_t size)
+                      { band.data.insert(band.data.end(), data, data + size); },
+                      Deflater::Framing::kRaw);
+    std::vector<uint8_t> scratch(row_bytes * 4);
+    std::vector<uint8_t> filtered(row_bytes + 1);
+    const uint8_t *above = prior.data();
+    for (uint32_t r = 0; r < row_count; r++)
+    {
+      const uint8_t *row = rows.data() + r * row_bytes;
+      FilterRow(row, above, row_bytes, filter_distance, adaptive, scratch.data(), filtered.data());
+      deflater.Write(filtered.data(), filtered.size());
+      above = row;
+    }
+    if (last)
+    {
+      deflater.Finish();
+    }
+    else
+    {
+      deflater.Flush();
+    }
+    band.adler = deflater.adler32();
+    band.size = static_cast<uint64_t>(row_count) * (row_bytes + 1);
+    return band;
+  }
+
+  void PngWriter::WriteChunk(const char *type, const uint8_t *data, size_t size)
+  {
+    std::vector<uint8_t> prefix;
+    PutBigEndian(prefix, static_cast<uint32_t>(size));
+    prefix.insert(prefix.end(), type, type + 4);
+
+    uint32_t crc = Crc32(data, size, Crc32(prefix.data() + 4, 4));
+    std::vector<uint8_t> suffix;
+    PutBigEndian(suffix, crc);
+
+    file_.write(reinterpret_cast<const char *>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+    if (size > 0)
+    {
+      file_.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(size));
+    }
+    file_.write(reinterpret_cast<const char *>(suffix.data()), static_cast<std::streamsize>(suffix.size()));
+  }
+
+  void PngWriter::FlushImageData(bool force)
+  {
+    if (image_data_.empty() || (!force && image_data_.size() < kImageDataChunk))
+    {
+      return;
+    }
+    WriteChunk("IDAT", image_data_.data(), image_data_.size());
+    image_data_.clear();
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,108 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PNG_WRITER_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PNG_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "deflate.h"
+
+namespace quick_scanner_plus
+{
+
+  enum class PngColorType
+  {
+    kGray1,
+    kGray8,
+    kRgb8,
+  };
+
+  struct PngWriterOptions
+  {
+    // Rows per band when bands are compressed in parallel.
+    uint32_t band_rows = 128;
+    // Bands in flight at once. 0 uses one per hardware thread; 1 writes a
+    // single deflate stream on the calling thread. Bands are compressed on
+    // workers drawn from a pool of one per hardware thread shared by all
+    // writers, or on the calling thread when none is free.
+    unsigned threads = 0;
+  };
+
+  // Writes a PNG one row at a time, so a page can be encoded straight from a
+  // strip-by-strip pass without ever holding the whole image.
+  //
+  // Each row gets the filter with the smallest sum of absolute residuals,
+  // picked with SSE2 where available. With more than one thread, rows are
+  // gathered into bands that are filtered and compressed concurrently. Every
+  // band becomes a run of deflate blocks ending on a sync flush, so the runs
+  // concatenate into one valid zlib stream whose Adler-32 is combined from
+  // the bands. Only the bands in flight are held in memory.
+  class PngWriter
+  {
+  public:
+    // |path| is UTF-8. Throws std::runtime_error if the file cannot be created.
+    PngWriter(const std::string &path, uint32_t width, uint32_t height, PngColorType color_type,
+              PngWriterOptions options = PngWriterOptions());
+    ~PngWriter();
+
+    PngWriter(const PngWriter &) = delete;
+    PngWriter &operator=(const PngWriter &) = delete;
+
+    // Packed size of one row: one bit per pixel for kGray1 (most significant
+    // bit first, 1 = white), one byte for kGray8, three (R, G, B) for kRgb8.
+    size_t row_bytes() const { return row_bytes_; }
+
+    void WriteRow(const uint8_t *row);
+    // Writes the trailer and closes the file. Throws std::runtime_error if
+    // not all rows were written or the file could not be written.
+    void Finish();
+
+  private:
+    struct CompressedBand
+    {
+      std::vector<uint8_t> data;
+      uint32_t adler = 1;
+      uint64_t size = 0;
+    };
+
+    void WriteChunk(const char *type, const uint8_t *data, size_t size);
+    void FlushImageData(bool force);
+    void DispatchBand(bool last);
+    static CompressedBand CompressBand(PooledBuffer rows, uint32_t row_count, std::vector<uint8_t> prior,
+                                       size_t row_bytes, size_t filter_distance, bool adaptive, bool last);
+    void CollectBand();
+
+    std::ofstream file_;
+    uint32_t height_;
+    PngColorType color_type_;
+    size_t row_bytes_;
+    size_t filter_distance_;
+    uint32_t rows_written_ = 0;
+    std::vector<uint8_t> previous_row_;
+    std::vector<uint8_t> filtered_row_;
+    std::vector<uint8_t> image_data_;
+    bool finished_ = false;
+
+    // Serial mode.
+    std::unique_ptr<Deflater> deflater_;
+    std::vector<uint8_t> scratch_;
+
+    // Parallel mode.
+    uint32_t band_rows_ = 0;
+    unsigned threads_ = 1;
+    PooledBuffer band_;
+    uint32_t band_filled_ = 0;
+    std::deque<std::future<CompressedBand>> in_flight_;
+    uint32_t adler_ = 1;
+    bool first_band_ = true;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_PNG_WRITER_H_
@@ -0,0 +1,53 @@
+// The scan daemon. The plugin starts one per user on demand; it owns the
+// scanners, so apps scanning at the same time queue for a device instead of
+// fighting over it, and exits once no app has needed it for a while.
+
+// This must be included before many other Windows headers.
+#include <windows.h>
+
+#include <winrt/Windows.Foundation.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include "scan_broker.h"
+#include "winrt_scan_backend.h"
+
+namespace
+{
+
+  // How long the daemon stays up after its last client left.
+  const std::chrono::milliseconds kIdleTimeout{60000};
+
+} // namespace
+
+int WINAPI wWinMain(HINSTANCE, HINSTANCE, PWSTR, int)
+{
+  // Broker threads use the MTA this keeps alive.
+  winrt::init_apartment(winrt::apartment_type::multi_threaded);
+
+  auto pages = std::filesystem::temp_directory_path() / "quick_scanner_plus-pages";
+  std::error_code ignored;
+  std::filesystem::create_directories(pages, ignored);
+
+  quick_scanner_plus::WinrtScanBackend backend(pages.u8string());
+  quick_scanner_plus::ScanBroker broker(backend);
+  try
+  {
+    backend.StartDiscovery(broker);
+  }
+  catch (winrt::hresult_error const &ex)
+  {
+    std::string message = "Device discovery failed: " + winrt::to_string(ex.message());
+    OutputDebugStringA(message.c_str()); // Log error
+    // Scans by ID still work; apps stop waiting for the device list.
+    broker.EnumerationCompleted();
+  }
+
+  // Returns at once if another daemon already serves this user.
+  broker.Serve(quick_scanner_plus::DefaultBrokerSocketPath(), kIdleTimeout);
+  backend.StopDiscovery();
+  return 0;
+}
@@ -4,39 +4,387 @@
 #include <windows.h>
 #include <winrt/Windows.Foundation.h>
 #include <winrt/Windows.Foundation.Collections.h>
-#include <winrt/Windows.Devices.Enumeration.h>
-#include <winrt/Windows.Devices.Scanners.h>
 #include <winrt/Windows.Storage.h>
 
 // For getPlatformVersion; remove unless needed for your plugin implementation.
 #include <VersionHelpers.h>
 
+#include <flutter/event_channel.h>
+#include <flutter/event_stream_handler_functions.h>
 #include <flutter/method_channel.h>
 #include <flutter/plugin_registrar_windows.h>
 #include <flutter/standard_method_codec.h>
+#include <flutter/texture_registrar.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <tuple>   // Include for using std::tuple
 #include <fstream> // For logging
 #include <future>  // For std::async
+#include <filesystem>
+#include <vector>
+
+#include "band_stream.h"
+#include "batch_journal.h"
+#include "batch_separator.h"
+#include "buffer_pool.h"
+#include "color_lut.h"
+#include "known_devices.h"
+#include "page_pipeline.h"
+#include "platform_dispatcher.h"
+#include "scan_broker_client.h"
+#include "scan_format.h"
+#include "scan_preview.h"
+#include "scan_store.h"
+#include "scanned_page.h"
+#include "session_trace.h"
+#include "sheet_assembler.h"
 using namespace winrt;
 using namespace Windows::Foundation;
 using namespace Windows::Foundation::Collections;
-using namespace Windows::Devices::Enumeration;
-using namespace Windows::Devices::Scanners;
 using namespace Windows::Storage;
 
 namespace
 {
 
+  using quick_scanner_plus::BandStream;
+  using quick_scanner_plus::BatchJournal;
+  using quick_scanner_plus::BatchSplitter;
+  using quick_scanner_plus::BrokerError;
+  using quick_scanner_plus::BrokerScanJob;
+  using quick_scanner_plus::BufferPool;
+  using quick_scanner_plus::PageOptions;
+  using quick_scanner_plus::PageResult;
+  using quick_scanner_plus::PlatformDispatcher;
+  using quick_scanner_plus::RecordedScan;
+  using quick_scanner_plus::ScanFormat;
+  using quick_scanner_plus::ScanPreview;
+  using quick_scanner_plus::ScanStore;
+  using quick_scanner_plus::SeparatorResult;
+  using quick_scanner_plus::SessionRecorder;
+  using quick_scanner_plus::ScanBrokerClient;
+  using quick_scanner_plus::SessionReplayer;
+  using quick_scanner_plus::Sheet;
+  using quick_scanner_plus::SheetAssembler;
+
+  // Pages per feeder run while a batch is journaled. A crash or jam loses at
+  // most the pages of the run in progress.
+  const uint32_t kJournaledPagesPerRun = 10;
+
+  // Pages of a batch decoded at the same time. Enough for both sides of two
+  // sheets, so one sheet is processed while the next one is collected.
+  const size_t kMaxPagesInFlight = 4;
+
+  // How long to wait for the scan daemon to come up after starting it, and
+  // how often to try it meanwhile.
+  const std::chrono::seconds kDaemonStartTimeout{10};
+  const std::chrono::milliseconds kDaemonRetryInterval{50};
+
+  // Prefix of the IDs under which scanners of a replayed session are listed.
+  const std::string kReplayDevicePrefix = "replay:";
+
+  bool IsReplayDeviceId(const std::string &device_id)
+  {
+    return device_id.compare(0, kReplayDevicePrefix.size(), kReplayDevicePrefix) == 0;
+  }
+
+  // Starts quick_scanner_plus_daemon.exe, which is installed next to the
+  // plugin's DLL.
+  bool StartDaemon()
+  {
+    HMODULE module = nullptr;
+    wchar_t module_path[MAX_PATH];
+    if (!GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                            reinterpret_cast<LPCWSTR>(&StartDaemon), &module) ||
+        !GetModuleFileNameW(module, module_path, MAX_PATH))
+    {
+      return false;
+    }
+    auto daemon = std::filesystem::path(module_path).parent_path() / L"quick_scanner_plus_daemon.exe";
+    std::wstring command_line = L"\"" + daemon.wstring() + L"\"";
+    STARTUPINFOW startup{};
+    startup.cb = sizeof(startup);
+    PROCESS_INFORMATION process{};
+    if (!CreateProcessW(daemon.c_str(), command_line.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr,
+                        &startup, &process))
+    {
+      return false;
+    }
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    return true;
+  }
+
+  // Connects to the scan daemon, starting it if it is not running. Blocks;
+  // throws BrokerError "DaemonUnavailable" if it does not come up.
+  std::unique_ptr<ScanBrokerClient> ConnectToDaemon()
+  {
+    auto path = quick_scanner_plus::DefaultBrokerSocketPath();
+    try
+    {
+      return std::make_unique<ScanBrokerClient>(path);
+    }
+    catch (BrokerError const &)
+    {
+      if (!StartDaemon())
+      {
+        throw BrokerError("DaemonUnavailable", "The scan daemon could not be started.");
+      }
+    }
+    // Several apps may start one at once; all but one exit again.
+    auto deadline = std::chrono::steady_clock::now() + kDaemonStartTimeout;
+    for (;;)
+    {
+      std::this_thread::sleep_for(kDaemonRetryInterval);
+      try
+      {
+        return std::make_unique<ScanBrokerClient>(path);
+      }
+      catch (BrokerError const &)
+      {
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+          throw;
+        }
+      }
+    }
+  }
+
+  // Scan events that record what the daemon reports in |recording| and
+  // keep the page format in |format|. Pages are left to the caller.
+  ScanBrokerClient::ScanEvents RecordingScanEvents(RecordedScan &recording, ScanFormat &format)
+  {
+    ScanBrokerClient::ScanEvents events;
+    events.capability = [&recording](const std::string &key, const std::string &value)
+    { recording.Capability(key, value); };
+    events.format = [&format](ScanFormat page_format)
+    { format = page_format; };
+    events.run_end = [] {};
+    return events;
+  }
+
+  // How long page buffers stay pooled after the last job used them.
+  const std::chrono::seconds kBufferPoolIdleTimeout{30};
+
+  // Hands pooled page buffers back to the system once no job has needed them
+  // for kBufferPoolIdleTimeout.
+  winrt::fire_and_forget TrimBufferPoolWhenIdle()
+  {
+    co_await winrt::resume_after(kBufferPoolIdleTimeout);
+    BufferPool::Shared().TrimIfIdle(kBufferPoolIdleTimeout);
+  }
+
+  // %LOCALAPPDATA%\quick_scanner_plus\known_devices.txt, or empty without a
+  // local app data folder.
+  std::string KnownDevicesPath()
+  {
+    wchar_t buffer[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH)
+    {
+      return std::string();
+    }
+    return (std::filesystem::path(std::wstring(buffer, length)) / L"quick_scanner_plus" / L"known_devices.txt")
+        .u8string();
+  }
+
+  winrt::fire_and_forget SaveKnownDevicesAsync(std::string path, std::vector<quick_scanner_plus::KnownDevice> devices)
+  {
+    co_await winrt::resume_background();
+    if (!quick_scanner_plus::SaveKnownDevices(path, devices))
+    {
+      OutputDebugStringA("Could not save the known scanners."); // Log error
+    }
+  }
+
+  int64_t MicrosecondsSince(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // Startup timings go to the debugger output only when the
+  // QUICK_SCANNER_PLUS_TRACE environment variable is set.
+  void Trace(const std::string &message)
+  {
+    static const bool enabled = GetEnvironmentVariableW(L"QUICK_SCANNER_PLUS_TRACE", nullptr, 0) > 0;
+    if (enabled)
+    {
+      OutputDebugStringA(("QuickScannerPlus: " + message + "\n").c_str());
+    }
+  }
+
+  // Returns the value stored under |key| in |args|, or |fallback| when it is
+  // missing or has a different type.
+  template <typename T>
+  T GetArgument(const flutter::EncodableMap &args, const char *key, T fallback)
+  {
+    auto it = args.find(flutter::EncodableValue(key));
+    if (it == args.end())
+    {
+      return fallback;
+    }
+    const T *value = std::get_if<T>(&it->second);
+    return value ? *value : fallback;
+  }
+
+  flutter::EncodableValue EncodeRowBand(const quick_scanner_plus::RowBand &band)
+  {
+    flutter::EncodableMap event;
+    event[flutter::EncodableValue("page")] = flutter::EncodableValue(static_cast<int64_t>(band.page));
+    event[flutter::EncodableValue("y")] = flutter::EncodableValue(static_cast<int32_t>(band.y));
+    event[flutter::EncodableValue("width")] = flutter::EncodableValue(static_cast<int32_t>(band.width));
+    event[flutter::EncodableValue("height")] = flutter::EncodableValue(static_cast<int32_t>(band.height));
+    event[flutter::EncodableValue("bytesPerPixel")] =
+        flutter::EncodableValue(static_cast<int32_t>(quick_scanner_plus::BytesPerPixel(band.format)));
+    event[flutter::EncodableValue("last")] = flutter::EncodableValue(band.last);
+    event[flutter::EncodableValue("pixels")] =
+        flutter::EncodableValue(std::vector<uint8_t>(band.pixels.data(), band.pixels.data() + band.stride * band.height));
+    return flutter::EncodableValue(event);
+  }
+
+  // A scan preview registered with the engine as a pixel buffer texture.
+  struct PreviewTexture
+  {
+    std::shared_ptr<ScanPreview> preview;
+    std::unique_ptr<flutter::TextureVariant> texture;
+    // The engine's copy of the frame, refreshed on every read.
+    ScanPreview::Frame frame;
+    FlutterDesktopPixelBuffer buffer{};
+  };
+
+  // Longer side of the thumbnails kept with stored pages.
+  const uint32_t kStoreThumbnailEdge = 256;
+
+  // Where the pages of a scan started with "storeJob" are kept.
+  struct StoreTarget
+  {
+    std::shared_ptr<ScanStore> store;
+    std::string job_id;
+
+    // Appends |page| to the store, if there is one, and returns its ID.
+    uint64_t Add(const std::string &device_id, const PageResult &page, ScanFormat format) const
+    {
+      if (!store)
+      {
+        return 0;
+      }
+      auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch());
+      return store->AddPageFile(job_id, device_id, format, now.count(), page.path, page.thumbnail);
+    }
+  };
+
+  flutter::EncodableValue EncodeStoredPage(const quick_scanner_plus::StoredPage &page)
+  {
+    flutter::EncodableMap info;
+    info[flutter::EncodableValue("id")] = flutter::EncodableValue(static_cast<int64_t>(page.id));
+    info[flutter::EncodableValue("jobId")] = flutter::EncodableValue(page.job_id);
+    info[flutter::EncodableValue("page")] = flutter::EncodableValue(static_cast<int32_t>(page.page));
+    info[flutter::EncodableValue("deviceId")] = flutter::EncodableValue(page.device_id);
+    info[flutter::EncodableValue("timeMs")] = flutter::EncodableValue(page.time_ms);
+    info[flutter::EncodableValue("format")] = flutter::EncodableValue(quick_scanner_plus::ScanFormatName(page.format));
+    info[flutter::EncodableValue("size")] = flutter::EncodableValue(static_cast<int64_t>(page.size));
+    info[flutter::EncodableValue("hasThumbnail")] = flutter::EncodableValue(page.thumbnail_size > 0);
+    return flutter::EncodableValue(info);
+  }
+
+  // Bands sent to Dart as one list per frame. At most kMaxPendingBytes of
+  // pixels wait for a frame, or a single band if it is larger; beyond that
+  // the band stream's consumer is held back, which in turn slows page
+  // processing down.
+  struct PendingBands
+  {
+    static constexpr size_t kMaxPendingBytes = 16 * 1024 * 1024;
+
+    std::mutex mutex;
+    std::condition_variable drained;
+    flutter::EncodableList bands;
+    size_t bytes = 0;
+    bool closed = false;
+    std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> sink;
+  };
+
+  // Timer that runs held coalesced dispatcher tasks when their frame is due.
+  const UINT_PTR kDispatchTimerId = 0x5153;
+
+  // Hands a method result that a scan completes on a worker thread to the
+  // platform thread, where the engine expects it.
+  class PlatformThreadResult : public flutter::MethodResult<flutter::EncodableValue>
+  {
+  public:
+    PlatformThreadResult(std::shared_ptr<PlatformDispatcher> dispatcher,
+                         std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result)
+        : dispatcher_(std::move(dispatcher)), result_(std::move(result)) {}
+
+  protected:
+    void SuccessInternal(const flutter::EncodableValue *result) override
+    {
+      Deliver([value = result ? std::optional<flutter::EncodableValue>(*result) : std::nullopt](
+                  flutter::MethodResult<flutter::EncodableValue> &target)
+              {
+                if (value)
+                {
+                  target.Success(*value);
+                }
+                else
+                {
+                  target.Success();
+                }
+              });
+    }
+
+    void ErrorInternal(const std::string &error_code, const std::string &error_message,
+                       const flutter::EncodableValue *error_details) override
+    {
+      Deliver([error_code, error_message,
+               details = error_details ? std::optional<flutter::EncodableValue>(*error_details) : std::nullopt](
+                  flutter::MethodResult<flutter::EncodableValue> &target)
+              {
+                if (details)
+                {
+                  target.Error(error_code, error_message, *details);
+                }
+                else
+                {
+                  target.Error(error_code, error_message);
+                }
+              });
+    }
+
+    void NotImplementedInternal() override
+    {
+      Deliver([](flutter::MethodResult<flutter::EncodableValue> &target)
+              { target.NotImplemented(); });
+    }
+
+  private:
+    void Deliver(std::function<void(flutter::MethodResult<flutter::EncodableValue> &)> send)
+    {
+      dispatcher_->Post([result = std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>>(std::move(result_)),
+                         send = std::move(send)]
+                        { send(*result); });
+    }
+
+    std::shared_ptr<PlatformDispatcher> dispatcher_;
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result_;
+  };
+
   class QuickScannerPlusPlugin : public flutter::Plugin
   {
   public:
     static void RegisterWithRegistrar(flutter::PluginRegistrarWindows *registrar);
 
-    QuickScannerPlusPlugin();
+    explicit QuickScannerPlusPlugin(flutter::PluginRegistrarWindows *registrar);
 
     virtual ~QuickScannerPlusPlugin();
 
@@ -46,18 +394,94 @@ namespace
         const flutter::MethodCall<flutter::EncodableValue> &method_call,
         std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
 
-    DeviceWatcher deviceWatcher{nullptr};
+    flutter::PluginRegistrarWindows *registrar_;
+
+    // Carries results and events from scan threads to the platform thread,
+    // woken through the top-level window's message loop.
+    std::shared_ptr<PlatformDispatcher> dispatcher_;
+    UINT dispatchMessage_ = 0;
+    int windowProcDelegateId_ = -1;
+    std::optional<LRESULT> HandleWindowProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam);
+    // Wraps |result| so it can be completed from any thread.
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> OnPlatformThread(
+        std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+    // Discovery starts with the first startWatch or getScanners. The scan
+    // daemon owns the device watchers; a worker thread follows its device
+    // list while watching is requested, starting the daemon if needed and
+    // reconnecting if it goes away. Until the daemon reports, getScanners
+    // returns the scanners found last time, marked stale.
+    bool discoveryStarted_ = false;
+    std::chrono::steady_clock::time_point discoveryStart_;
+    std::string knownDevicesPath_;
+    std::future<void> discovery_;
+    void StartDiscovery();
+    void WatchDevices();
+    std::mutex watcherMutex_;
+    std::condition_variable watchChanged_;
+    bool watchRequested_ = false;
+    bool closing_ = false;
+    // The connection WatchDevices follows, closed to stop watching.
+    std::shared_ptr<ScanBrokerClient> watchClient_;
+    // Drops stale scanners that discovery did not find again and saves the
+    // list for the next start.
+    void ForgetStaleScanners();
+
+    // Name, ID and whether the scanner is only known from the last run.
+    // Platform thread only.
+    std::vector<std::tuple<std::string, std::string, bool>> scanners_{};
+    // Update scanners_ on the platform thread; callable from any thread.
+    void AddScanner(const std::string &name, const std::string &device_id);
+    void RemoveScanner(const std::string &device_id);
 
-    winrt::event_token deviceWatcherAddedToken;
-    void DeviceWatcher_Added(DeviceWatcher sender, DeviceInformation info);
+    // Session being recorded and session being replayed, if any. Scans read
+    // them from worker threads.
+    std::mutex sessionMutex_;
+    std::shared_ptr<SessionRecorder> recorder_;
+    std::shared_ptr<SessionReplayer> replayer_;
+    std::shared_ptr<SessionRecorder> Recorder();
+    std::shared_ptr<SessionReplayer> Replayer();
+    // Lists the scanners of the replayed session as they appeared in it.
+    winrt::fire_and_forget ReplayEnumerationAsync(std::shared_ptr<SessionReplayer> replayer);
 
-    winrt::event_token deviceWatcherRemovedToken;
-    void DeviceWatcher_Removed(DeviceWatcher sender, DeviceInformationUpdate infoUpdate);
+    flutter::TextureRegistrar *textures_;
+    std::map<int64_t, std::shared_ptr<PreviewTexture>> previews_{}; // Texture ID -> preview
 
-    std::vector<std::tuple<std::string, std::string>> scanners_{}; // Change to store pairs of name and ID
+    // Bands of scans started with "streamBands" while Dart listens.
+    std::shared_ptr<BandStream> bandStream_;
+    std::shared_ptr<PendingBands> pendingBands_;
+    void StartBandStream(std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> sink);
+    void StopBandStream();
+
+    int64_t CreatePreviewTexture(uint32_t max_edge);
+    // Points |page_options| at the preview named by "previewTextureId" in
+    // |args|. Returns false if that texture does not exist.
+    bool ResolvePreview(const flutter::EncodableMap &args, PageOptions &page_options) const;
+
+    // Color correction per device, set by setColorLut.
+    quick_scanner_plus::ColorLutCache colorLuts_;
+    // Devices whose JPEG pages are corrected too. Platform thread only.
+    std::set<std::string> jpegColorLuts_;
+
+    // Scan store opened by openScanStore, if any.
+    std::mutex storeMutex_;
+    std::shared_ptr<ScanStore> store_;
+    // Points |store_target| at the open store when |args| names a
+    // "storeJob", and has pages decoded for thumbnails. Returns false if
+    // there is a job but no open store.
+    bool ResolveStore(const flutter::EncodableMap &args, PageOptions &page_options, StoreTarget &store_target);
 
     winrt::fire_and_forget ScanFileAsync(std::string device_id, std::string directory,
+                                         std::optional<ScanFormat> format, PageOptions page_options,
+                                         StoreTarget store_target, bool detailed,
+                                         std::chrono::milliseconds device_timeout,
                                          std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+
+    winrt::fire_and_forget ScanBatchAsync(std::string device_id, std::string directory, std::string job_id,
+                                          std::optional<ScanFormat> format, PageOptions page_options,
+                                          StoreTarget store_target, bool duplex, bool drop_blank_backs,
+                                          std::chrono::milliseconds device_timeout,
+                                          std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
   };
 
   // static
@@ -69,7 +493,7 @@ namespace
             registrar->messenger(), "quick_scanner_plus",
             &flutter::StandardMethodCodec::GetInstance());
 
-    auto plugin = std::make_unique<QuickScannerPlusPlugin>();
+    auto plugin = std::make_unique<QuickScannerPlusPlugin>(registrar);
 
     channel->SetMethodCallHandler(
         [plugin_pointer = plugin.get()](const auto &call, auto result)
@@ -77,21 +501,225 @@ namespace
           plugin_pointer->HandleMethodCall(call, std::move(result));
         });
 
+    auto bandChannel =
+        std::make_unique<flutter::EventChannel<flutter::EncodableValue>>(
+            registrar->messenger(), "quick_scanner_plus/bands",
+            &flutter::StandardMethodCodec::GetInstance());
+
+    bandChannel->SetStreamHandler(
+        std::make_unique<flutter::StreamHandlerFunctions<flutter::EncodableValue>>(
+            [plugin_pointer = plugin.get()](const flutter::EncodableValue *arguments,
+                                            std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> &&events)
+                -> std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>>
+            {
+              plugin_pointer->StartBandStream(std::move(events));
+              return nullptr;
+            },
+            [plugin_pointer = plugin.get()](const flutter::EncodableValue *arguments)
+                -> std::unique_ptr<flutter::StreamHandlerError<flutter::EncodableValue>>
+            {
+              plugin_pointer->StopBandStream();
+              return nullptr;
+            }));
+
     registrar->AddPlugin(std::move(plugin));
   }
 
-  QuickScannerPlusPlugin::QuickScannerPlusPlugin()
+  QuickScannerPlusPlugin::QuickScannerPlusPlugin(flutter::PluginRegistrarWindows *registrar)
+      : registrar_(registrar), textures_(registrar->texture_registrar())
   {
-    deviceWatcher = DeviceInformation::CreateWatcher(DeviceClass::ImageScanner);
-    deviceWatcherAddedToken = deviceWatcher.Added({this, &QuickScannerPlusPlugin::DeviceWatcher_Added});
-    deviceWatcherRemovedToken = deviceWatcher.Removed({this, &QuickScannerPlusPlugin::DeviceWatcher_Removed});
+    auto start = std::chrono::steady_clock::now();
+    HWND window = nullptr;
+    if (auto view = registrar->GetView())
+    {
+      window = GetAncestor(view->GetNativeWindow(), GA_ROOT);
+      dispatchMessage_ = RegisterWindowMessage(L"QuickScannerPlusDispatch");
+    }
+    if (window && dispatchMessage_)
+    {
+      dispatcher_ = std::make_shared<PlatformDispatcher>([window, message = dispatchMessage_]
+                                                         { PostMessage(window, message, 0, 0); });
+      windowProcDelegateId_ = registrar->RegisterTopLevelWindowProcDelegate(
+          [this](HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
+          { return HandleWindowProc(hwnd, message, wparam, lparam); });
+    }
+    else
+    {
+      // Headless: no message loop to hand over to.
+      dispatcher_ = std::make_shared<PlatformDispatcher>(nullptr);
+    }
+    Trace("plugin ready in " + std::to_string(MicrosecondsSince(start)) + " us");
   }
 
   QuickScannerPlusPlugin::~QuickScannerPlusPlugin()
   {
-    deviceWatcher.Added(deviceWatcherAddedToken);
-    deviceWatcher.Removed(deviceWatcherRemovedToken);
-    deviceWatcher = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(watcherMutex_);
+      closing_ = true;
+      if (watchClient_)
+      {
+        watchClient_->Close();
+      }
+      watchChanged_.notify_all();
+    }
+    if (discovery_.valid())
+    {
+      discovery_.wait();
+    }
+    StopBandStream();
+    for (auto &[id, entry] : previews_)
+    {
+      entry->preview->SetUpdateCallback(nullptr);
+      textures_->UnregisterTexture(id, [entry = entry] {});
+    }
+    if (windowProcDelegateId_ != -1)
+    {
+      registrar_->UnregisterTopLevelWindowProcDelegate(windowProcDelegateId_);
+    }
+  }
+
+  std::optional<LRESULT> QuickScannerPlusPlugin::HandleWindowProc(HWND hwnd, UINT message, WPARAM wparam,
+                                                                  LPARAM lparam)
+  {
+    if (message != dispatchMessage_ && !(message == WM_TIMER && wparam == kDispatchTimerId))
+    {
+      return std::nullopt;
+    }
+    KillTimer(hwnd, kDispatchTimerId);
+    auto due = dispatcher_->Drain();
+    if (due.count() > 0)
+    {
+      SetTimer(hwnd, kDispatchTimerId, static_cast<UINT>(due.count()), nullptr);
+    }
+    return 0;
+  }
+
+  std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> QuickScannerPlusPlugin::OnPlatformThread(
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result)
+  {
+    return std::make_unique<PlatformThreadResult>(dispatcher_, std::move(result));
+  }
+
+  void QuickScannerPlusPlugin::StartBandStream(std::unique_ptr<flutter::EventSink<flutter::EncodableValue>> sink)
+  {
+    StopBandStream();
+    auto pending = std::make_shared<PendingBands>();
+    pending->sink = std::move(sink);
+    pendingBands_ = pending;
+    bandStream_ = std::make_shared<BandStream>();
+    bandStream_->AddConsumer([pending, dispatcher = dispatcher_](const quick_scanner_plus::RowBand &band)
+                             {
+      auto event = EncodeRowBand(band);
+      size_t bytes = band.stride * band.height;
+      {
+        std::unique_lock<std::mutex> lock(pending->mutex);
+        pending->drained.wait(lock, [&]
+                              { return pending->closed || pending->bands.empty() ||
+                                       pending->bytes + bytes <= PendingBands::kMaxPendingBytes; });
+        if (pending->closed)
+        {
+          return;
+        }
+        pending->bands.push_back(std::move(event));
+        pending->bytes += bytes;
+      }
+      dispatcher->PostCoalesced("bands", [pending]
+                                {
+        flutter::EncodableList bands;
+        {
+          std::lock_guard<std::mutex> lock(pending->mutex);
+          if (pending->closed)
+          {
+            return;
+          }
+          bands.swap(pending->bands);
+          pending->bytes = 0;
+          pending->drained.notify_all();
+        }
+        if (!bands.empty())
+        {
+          pending->sink->Success(flutter::EncodableValue(std::move(bands)));
+        } }); });
+  }
+
+  void QuickScannerPlusPlugin::StopBandStream()
+  {
+    // Let go of a consumer waiting for a frame first; dropping the last
+    // reference to the stream joins it.
+    if (pendingBands_)
+    {
+      std::lock_guard<std::mutex> lock(pendingBands_->mutex);
+      pendingBands_->closed = true;
+      pendingBands_->drained.notify_all();
+    }
+    pendingBands_.reset();
+    if (bandStream_)
+    {
+      // Scans still holding the stream finish their pages without it.
+      bandStream_->Close();
+      bandStream_.reset();
+    }
+  }
+
+  int64_t QuickScannerPlusPlugin::CreatePreviewTexture(uint32_t max_edge)
+  {
+    auto entry = std::make_shared<PreviewTexture>();
+    entry->preview = std::make_shared<ScanPreview>(max_edge);
+    // The engine asks for the buffer on its raster thread and is done with
+    // it before asking again, so one copy per texture is enough. The copy is
+    // taken under a short lock; strips never wait on the engine.
+    entry->texture = std::make_unique<flutter::TextureVariant>(flutter::PixelBufferTexture(
+        [raw = entry.get()](size_t, size_t) -> const FlutterDesktopPixelBuffer *
+        {
+          if (!raw->preview->CopyFrame(raw->frame))
+          {
+            return nullptr;
+          }
+          raw->buffer.buffer = raw->frame.pixels.data();
+          raw->buffer.width = raw->frame.width;
+          raw->buffer.height = raw->frame.height;
+          return &raw->buffer;
+        }));
+
+    auto id = textures_->RegisterTexture(entry->texture.get());
+    // Strips repaint the frame far more often than the display refreshes.
+    entry->preview->SetUpdateCallback([dispatcher = dispatcher_, textures = textures_, id]
+                                      { dispatcher->PostCoalesced("texture:" + std::to_string(id), [textures, id]
+                                                                  { textures->MarkTextureFrameAvailable(id); }); });
+    previews_[id] = std::move(entry);
+    return id;
+  }
+
+  bool QuickScannerPlusPlugin::ResolvePreview(const flutter::EncodableMap &args, PageOptions &page_options) const
+  {
+    auto it = args.find(flutter::EncodableValue("previewTextureId"));
+    if (it == args.end() || it->second.IsNull())
+    {
+      return true;
+    }
+    auto preview = previews_.find(it->second.LongValue());
+    if (preview == previews_.end())
+    {
+      return false;
+    }
+    page_options.preview = preview->second->preview;
+    return true;
+  }
+
+  bool QuickScannerPlusPlugin::ResolveStore(const flutter::EncodableMap &args, PageOptions &page_options,
+                                            StoreTarget &store_target)
+  {
+    store_target.job_id = GetArgument<std::string>(args, "storeJob", "");
+    if (store_target.job_id.empty())
+    {
+      return true;
+    }
+    {
+      std::lock_guard<std::mutex> lock(storeMutex_);
+      store_target.store = store_;
+    }
+    page_options.thumbnail_edge = kStoreThumbnailEdge;
+    return store_target.store != nullptr;
   }
 
   void QuickScannerPlusPlugin::HandleMethodCall(
@@ -118,140 +746,705 @@ namespace
     }
     else if (method_call.method_name().compare("startWatch") == 0)
     {
-      deviceWatcher.Start();
+      {
+        std::lock_guard<std::mutex> lock(watcherMutex_);
+        watchRequested_ = true;
+        watchChanged_.notify_all();
+      }
+      StartDiscovery();
       result->Success(nullptr);
     }
     else if (method_call.method_name().compare("stopWatch") == 0)
     {
-      deviceWatcher.Stop();
+      std::lock_guard<std::mutex> lock(watcherMutex_);
+      watchRequested_ = false;
+      if (watchClient_)
+      {
+        watchClient_->Close();
+      }
       result->Success(nullptr);
     }
     else if (method_call.method_name().compare("getScanners") == 0)
     {
+      StartDiscovery();
       flutter::EncodableList list{};
       for (const auto &scanner : scanners_)
       {
         flutter::EncodableMap scannerInfo;
         scannerInfo[flutter::EncodableValue("id")] = flutter::EncodableValue(std::get<1>(scanner));   // ID
         scannerInfo[flutter::EncodableValue("name")] = flutter::EncodableValue(std::get<0>(scanner)); // Name
+        scannerInfo[flutter::EncodableValue("stale")] = flutter::EncodableValue(std::get<2>(scanner));
         list.push_back(flutter::EncodableValue(scannerInfo));
       }
       result->Success(list);
     }
-    else if (method_call.method_name().compare("scanFile") == 0)
+    else if (method_call.method_name().compare("startRecording") == 0)
+    {
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto path = std::get<std::string>(args[flutter::EncodableValue("path")]);
+      std::shared_ptr<SessionRecorder> recorder;
+      try
+      {
+        recorder = std::make_shared<SessionRecorder>(path);
+      }
+      catch (std::exception const &e)
+      {
+        result->Error("RecordingFailed", e.what());
+        return;
+      }
+      // The trace starts with the scanners already present.
+      for (const auto &scanner : scanners_)
+      {
+        if (std::get<2>(scanner))
+        {
+          continue;
+        }
+        recorder->DeviceAdded(std::get<1>(scanner), std::get<0>(scanner));
+      }
+      std::lock_guard<std::mutex> lock(sessionMutex_);
+      recorder_ = recorder;
+      result->Success(nullptr);
+    }
+    else if (method_call.method_name().compare("stopRecording") == 0)
+    {
+      std::lock_guard<std::mutex> lock(sessionMutex_);
+      recorder_.reset();
+      result->Success(nullptr);
+    }
+    else if (method_call.method_name().compare("replaySession") == 0)
+    {
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto path = std::get<std::string>(args[flutter::EncodableValue("path")]);
+      auto realtime = GetArgument<bool>(args, "realtime", true);
+      std::shared_ptr<SessionReplayer> replayer;
+      try
+      {
+        replayer = std::make_shared<SessionReplayer>(quick_scanner_plus::SessionTrace::Load(path), realtime);
+      }
+      catch (std::exception const &e)
+      {
+        result->Error("InvalidTrace", e.what());
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(sessionMutex_);
+        replayer_ = replayer;
+      }
+      // Scanners of an earlier replay go away with it.
+      scanners_.erase(std::remove_if(scanners_.begin(), scanners_.end(), [](const auto &scanner)
+                                     { return IsReplayDeviceId(std::get<1>(scanner)); }),
+                      scanners_.end());
+      ReplayEnumerationAsync(replayer);
+      result->Success(nullptr);
+    }
+    else if (method_call.method_name().compare("setColorLut") == 0)
+    {
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto device_id = std::get<std::string>(args[flutter::EncodableValue("deviceId")]);
+      auto path = GetArgument<std::string>(args, "path", "");
+      if (path.empty())
+      {
+        colorLuts_.Remove(device_id);
+        jpegColorLuts_.erase(device_id);
+        result->Success(nullptr);
+        return;
+      }
+      try
+      {
+        auto lut = colorLuts_.Load(device_id, path);
+        if (GetArgument<bool>(args, "correctJpeg", false))
+        {
+          jpegColorLuts_.insert(device_id);
+        }
+        else
+        {
+          jpegColorLuts_.erase(device_id);
+        }
+        result->Success(flutter::EncodableValue(static_cast<int32_t>(lut->size())));
+      }
+      catch (std::exception const &e)
+      {
+        result->Error("InvalidColorLut", e.what());
+      }
+    }
+    else if (method_call.method_name().compare("openScanStore") == 0)
+    {
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto path = std::get<std::string>(args[flutter::EncodableValue("path")]);
+      std::shared_ptr<ScanStore> store;
+      try
+      {
+        store = std::make_shared<ScanStore>(path);
+      }
+      catch (std::exception const &e)
+      {
+        result->Error("StoreUnavailable", e.what());
+        return;
+      }
+      std::lock_guard<std::mutex> lock(storeMutex_);
+      store_ = store;
+      result->Success(flutter::EncodableValue(static_cast<int64_t>(store->page_count())));
+    }
+    else if (method_call.method_name().compare("closeScanStore") == 0)
+    {
+      // Scans still writing to the store keep it open until they finish.
+      std::lock_guard<std::mutex> lock(storeMutex_);
+      store_.reset();
+      result->Success(nullptr);
+    }
+    else if (method_call.method_name().compare("queryScanStore") == 0 ||
+             method_call.method_name().compare("readStoredPage") == 0)
+    {
+      std::shared_ptr<ScanStore> store;
+      {
+        std::lock_guard<std::mutex> lock(storeMutex_);
+        store = store_;
+      }
+      if (!store)
+      {
+        result->Error("StoreUnavailable", "No scan store is open.");
+        return;
+      }
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      try
+      {
+        if (method_call.method_name().compare("queryScanStore") == 0)
+        {
+          quick_scanner_plus::ScanQuery query;
+          auto job_id = GetArgument<std::string>(args, "jobId", "");
+          auto device_id = GetArgument<std::string>(args, "deviceId", "");
+          if (!job_id.empty())
+          {
+            query.job_id = job_id;
+          }
+          if (!device_id.empty())
+          {
+            query.device_id = device_id;
+          }
+          auto from = args.find(flutter::EncodableValue("fromMs"));
+          if (from != args.end() && !from->second.IsNull())
+          {
+            query.from_ms = from->second.LongValue();
+          }
+          auto to = args.find(flutter::EncodableValue("toMs"));
+          if (to != args.end() && !to->second.IsNull())
+          {
+            query.to_ms = to->second.LongValue();
+          }
+          query.offset = static_cast<size_t>(GetArgument<int32_t>(args, "offset", 0));
+          auto limit = GetArgument<int32_t>(args, "limit", -1);
+          if (limit >= 0)
+          {
+            query.limit = static_cast<size_t>(limit);
+          }
+          flutter::EncodableList pages{};
+          for (const auto &page : store->Query(query))
+          {
+            pages.push_back(EncodeStoredPage(page));
+          }
+          result->Success(flutter::EncodableValue(pages));
+        }
+        else
+        {
+          auto id = static_cast<uint64_t>(args[flutter::EncodableValue("id")].LongValue());
+          auto bytes = GetArgument<bool>(args, "thumbnail", false) ? store->ReadThumbnail(id) : store->ReadPage(id);
+          result->Success(flutter::EncodableValue(std::vector<uint8_t>(bytes.data(), bytes.data() + bytes.size())));
+        }
+      }
+      catch (std::exception const &e)
+      {
+        result->Error("StoreError", e.what());
+      }
+    }
+    else if (method_call.method_name().compare("getBufferPoolStats") == 0)
+    {
+      auto stats = BufferPool::Shared().stats();
+      flutter::EncodableMap statsMap;
+      statsMap[flutter::EncodableValue("liveBytes")] = flutter::EncodableValue(static_cast<int64_t>(stats.live_bytes));
+      statsMap[flutter::EncodableValue("peakLiveBytes")] = flutter::EncodableValue(static_cast<int64_t>(stats.peak_live_bytes));
+      statsMap[flutter::EncodableValue("cachedBytes")] = flutter::EncodableValue(static_cast<int64_t>(stats.cached_bytes));
+      statsMap[flutter::EncodableValue("acquires")] = flutter::EncodableValue(static_cast<int64_t>(stats.acquires));
+      statsMap[flutter::EncodableValue("reuseRate")] = flutter::EncodableValue(stats.reuse_rate());
+      result->Success(flutter::EncodableValue(statsMap));
+    }
+    else if (method_call.method_name().compare("getDispatcherStats") == 0)
+    {
+      auto stats = dispatcher_->stats();
+      flutter::EncodableMap statsMap;
+      statsMap[flutter::EncodableValue("posted")] = flutter::EncodableValue(static_cast<int64_t>(stats.posted));
+      statsMap[flutter::EncodableValue("delivered")] = flutter::EncodableValue(static_cast<int64_t>(stats.delivered));
+      statsMap[flutter::EncodableValue("superseded")] = flutter::EncodableValue(static_cast<int64_t>(stats.superseded));
+      statsMap[flutter::EncodableValue("drains")] = flutter::EncodableValue(static_cast<int64_t>(stats.drains));
+      statsMap[flutter::EncodableValue("busyMicros")] = flutter::EncodableValue(static_cast<int64_t>(stats.busy_us));
+      statsMap[flutter::EncodableValue("maxDrainMicros")] = flutter::EncodableValue(static_cast<int64_t>(stats.max_drain_us));
+      result->Success(flutter::EncodableValue(statsMap));
+    }
+    else if (method_call.method_name().compare("createPreviewTexture") == 0)
+    {
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto max_edge = GetArgument<int32_t>(args, "maxEdge", static_cast<int32_t>(ScanPreview::kDefaultMaxEdge));
+      if (max_edge <= 0)
+      {
+        result->Error("InvalidArguments", "maxEdge must be positive.");
+        return;
+      }
+      result->Success(flutter::EncodableValue(CreatePreviewTexture(static_cast<uint32_t>(max_edge))));
+    }
+    else if (method_call.method_name().compare("disposePreviewTexture") == 0)
+    {
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto it = previews_.find(args[flutter::EncodableValue("textureId")].LongValue());
+      if (it != previews_.end())
+      {
+        // Scans still running keep the preview alive but stop repainting it.
+        it->second->preview->SetUpdateCallback(nullptr);
+        // The texture must outlive its unregistration, which completes on the
+        // raster thread.
+        textures_->UnregisterTexture(it->first, [entry = it->second] {});
+        previews_.erase(it);
+      }
+      result->Success(nullptr);
+    }
+    else if (method_call.method_name().compare("scanFile") == 0 || method_call.method_name().compare("scanPage") == 0)
     {
       auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
       auto device_id = std::get<std::string>(args[flutter::EncodableValue("deviceId")]);
       auto directory = std::get<std::string>(args[flutter::EncodableValue("directory")]);
-      ScanFileAsync(device_id, directory, std::move(result));
+      auto format_name = GetArgument<std::string>(args, "format", "");
+      auto format = quick_scanner_plus::ParseScanFormat(format_name);
+      if (!format_name.empty() && !format)
+      {
+        result->Error("InvalidArguments", "Unknown output format: " + format_name);
+        return;
+      }
+      PageOptions page_options;
+      page_options.auto_color = GetArgument<bool>(args, "autoColor", false);
+      page_options.color_lut = colorLuts_.Find(device_id);
+      page_options.correct_jpeg = jpegColorLuts_.count(device_id) != 0;
+      if (GetArgument<bool>(args, "streamBands", false))
+      {
+        page_options.bands = bandStream_;
+      }
+      if (!ResolvePreview(args, page_options))
+      {
+        result->Error("InvalidArguments", "Unknown preview texture.");
+        return;
+      }
+      StoreTarget store_target;
+      if (!ResolveStore(args, page_options, store_target))
+      {
+        result->Error("StoreUnavailable", "No scan store is open.");
+        return;
+      }
+      // scanPage reports the format and color class along with the path.
+      bool detailed = method_call.method_name().compare("scanPage") == 0;
+      // Without a timeout the scan waits its turn for as long as it takes.
+      std::chrono::milliseconds device_timeout{GetArgument<int32_t>(args, "deviceTimeoutMs", -1)};
+      ScanFileAsync(device_id, directory, format, page_options, store_target, detailed, device_timeout,
+                    OnPlatformThread(std::move(result)));
       // result->Success(nullptr);
     }
+    else if (method_call.method_name().compare("scanBatch") == 0)
+    {
+      auto args = std::get<flutter::EncodableMap>(*method_call.arguments());
+      auto device_id = std::get<std::string>(args[flutter::EncodableValue("deviceId")]);
+      auto directory = std::get<std::string>(args[flutter::EncodableValue("directory")]);
+      PageOptions page_options;
+      page_options.separator.detect_patch_codes = GetArgument<bool>(args, "splitOnPatchCodes", true);
+      page_options.separator.barcode = GetArgument<std::string>(args, "separatorBarcode", "");
+      page_options.detect_separators =
+          page_options.separator.detect_patch_codes || !page_options.separator.barcode.empty();
+      page_options.auto_color = GetArgument<bool>(args, "autoColor", false);
+      page_options.color_lut = colorLuts_.Find(device_id);
+      page_options.correct_jpeg = jpegColorLuts_.count(device_id) != 0;
+      auto job_id = GetArgument<std::string>(args, "jobId", "");
+      if (!job_id.empty() && !quick_scanner_plus::IsValidJobId(job_id))
+      {
+        result->Error("InvalidArguments", "Job IDs may only use letters, digits, '-', '_' and '.'.");
+        return;
+      }
+      if (GetArgument<bool>(args, "streamBands", false))
+      {
+        page_options.bands = bandStream_;
+      }
+      if (!ResolvePreview(args, page_options))
+      {
+        result->Error("InvalidArguments", "Unknown preview texture.");
+        return;
+      }
+      auto format_name = GetArgument<std::string>(args, "format", "");
+      auto format = quick_scanner_plus::ParseScanFormat(format_name);
+      if (!format_name.empty() && !format)
+      {
+        result->Error("InvalidArguments", "Unknown output format: " + format_name);
+        return;
+      }
+      StoreTarget store_target;
+      if (!ResolveStore(args, page_options, store_target))
+      {
+        result->Error("StoreUnavailable", "No scan store is open.");
+        return;
+      }
+      bool duplex = GetArgument<bool>(args, "duplex", false);
+      bool drop_blank_backs = duplex && GetArgument<bool>(args, "dropBlankBacks", false);
+      std::chrono::milliseconds device_timeout{GetArgument<int32_t>(args, "deviceTimeoutMs", -1)};
+      ScanBatchAsync(device_id, directory, job_id, format, page_options, store_target, duplex, drop_blank_backs,
+                     device_timeout,
+                     OnPlatformThread(std::move(result)));
+    }
     else
     {
       result->NotImplemented();
     }
   }
 
-  void QuickScannerPlusPlugin::DeviceWatcher_Added(DeviceWatcher sender, DeviceInformation info)
+  void QuickScannerPlusPlugin::StartDiscovery()
   {
-    std::cout << "DeviceWatcher_Added " << winrt::to_string(info.Name()) << std::endl;
+    if (discoveryStarted_)
+    {
+      return;
+    }
+    discoveryStarted_ = true;
+    discoveryStart_ = std::chrono::steady_clock::now();
 
-    auto device_id = winrt::to_string(info.Id());
-    auto scanner_name = winrt::to_string(info.Name()); // Get the scanner name
-    auto it = std::find_if(scanners_.begin(), scanners_.end(), [&](const auto &scanner)
-                           { return std::get<1>(scanner) == device_id; });
+    knownDevicesPath_ = KnownDevicesPath();
+    if (!knownDevicesPath_.empty())
+    {
+      for (const auto &device : quick_scanner_plus::LoadKnownDevices(knownDevicesPath_))
+      {
+        scanners_.emplace_back(device.name, device.id, true);
+      }
+    }
+    Trace(std::to_string(scanners_.size()) + " known scanners loaded in " +
+          std::to_string(MicrosecondsSince(discoveryStart_)) + " us");
 
-    if (it == scanners_.end())
     {
-      scanners_.emplace_back(scanner_name, device_id); // Store name and ID
+      std::lock_guard<std::mutex> lock(watcherMutex_);
+      watchRequested_ = true;
     }
+    discovery_ = std::async(std::launch::async, [this]
+                            { WatchDevices(); });
   }
 
-  void QuickScannerPlusPlugin::DeviceWatcher_Removed(DeviceWatcher sender, DeviceInformationUpdate infoUpdate)
+  void QuickScannerPlusPlugin::WatchDevices()
   {
-    std::cout << "DeviceWatcher_Removed " << winrt::to_string(infoUpdate.Id()) << std::endl;
+    std::unique_lock<std::mutex> lock(watcherMutex_);
+    while (!closing_)
+    {
+      if (!watchRequested_)
+      {
+        watchChanged_.wait(lock);
+        continue;
+      }
+      lock.unlock();
+      auto start = std::chrono::steady_clock::now();
+      std::shared_ptr<ScanBrokerClient> client;
+      try
+      {
+        client = ConnectToDaemon();
+        Trace("scan daemon connected in " + std::to_string(MicrosecondsSince(start)) + " us");
+      }
+      catch (BrokerError const &e)
+      {
+        std::string message = "Device discovery failed: " + std::string(e.what());
+        OutputDebugStringA(message.c_str()); // Log error
+      }
+      lock.lock();
+      if (!client)
+      {
+        watchChanged_.wait_for(lock, kDaemonStartTimeout, [this]
+                               { return closing_; });
+        continue;
+      }
+      if (closing_ || !watchRequested_)
+      {
+        continue;
+      }
+      watchClient_ = client;
+      lock.unlock();
 
-    auto device_id = winrt::to_string(infoUpdate.Id());
-    auto it = std::find_if(scanners_.begin(), scanners_.end(), [&](const auto &scanner)
-                           { return std::get<1>(scanner) == device_id; });
+      ScanBrokerClient::DeviceEvents events;
+      events.added = [this](const std::string &id, const std::string &name)
+      { AddScanner(name, id); };
+      events.removed = [this](const std::string &id)
+      { RemoveScanner(id); };
+      // Coalesced like the scanner changes, so it runs after those posted
+      // before it.
+      events.enumerated = [this]
+      { dispatcher_->PostCoalesced("devices:enumerated", [this]
+                                   { ForgetStaleScanners(); }); };
+      try
+      {
+        client->WatchDevices(events);
+      }
+      catch (BrokerError const &e)
+      {
+        std::string message = "Device discovery lost the scan daemon: " + std::string(e.what());
+        OutputDebugStringA(message.c_str()); // Log error
+      }
 
-    if (it != scanners_.end())
-    {
-      scanners_.erase(it);
+      lock.lock();
+      watchClient_ = nullptr;
     }
   }
-  winrt::fire_and_forget QuickScannerPlusPlugin::ScanFileAsync(
-      std::string device_id,
-      std::string directory,
-      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result)
+
+  void QuickScannerPlusPlugin::ForgetStaleScanners()
   {
-    try
+    scanners_.erase(std::remove_if(scanners_.begin(), scanners_.end(), [](const auto &scanner)
+                                   { return std::get<2>(scanner); }),
+                    scanners_.end());
+    Trace(std::to_string(scanners_.size()) + " scanners discovered in " +
+          std::to_string(MicrosecondsSince(discoveryStart_) / 1000) + " ms");
+
+    if (knownDevicesPath_.empty())
     {
-      // Initialize the scanner
-      auto scanner = co_await ImageScanner::FromIdAsync(winrt::to_hstring(device_id));
-      if (!scanner)
+      return;
+    }
+    std::vector<quick_scanner_plus::KnownDevice> devices;
+    for (const auto &scanner : scanners_)
+    {
+      if (!IsReplayDeviceId(std::get<1>(scanner)))
       {
-        result->Error("ScannerInitializationFailed", "Scanner could not be initialized.");
-        co_return;
+        devices.push_back(quick_scanner_plus::KnownDevice{std::get<1>(scanner), std::get<0>(scanner)});
       }
+    }
+    SaveKnownDevicesAsync(knownDevicesPath_, std::move(devices));
+  }
 
-      // Determine the scan source
-      ImageScannerScanSource scanSource = ImageScannerScanSource::Flatbed;
-      if (scanner.IsScanSourceSupported(ImageScannerScanSource::Flatbed))
+  void QuickScannerPlusPlugin::AddScanner(const std::string &name, const std::string &device_id)
+  {
+    // Only the latest change per device within a frame is applied.
+    dispatcher_->PostCoalesced("device:" + device_id, [this, name, device_id]
+                               {
+      auto it = std::find_if(scanners_.begin(), scanners_.end(), [&](const auto &scanner)
+                             { return std::get<1>(scanner) == device_id; });
+      if (it != scanners_.end())
       {
-        scanSource = ImageScannerScanSource::Flatbed;
+        // Found again; a stale entry is current now.
+        std::get<2>(*it) = false;
+        return;
       }
-      else if (scanner.IsScanSourceSupported(ImageScannerScanSource::Feeder))
+      scanners_.emplace_back(name, device_id, false);
+      if (auto recorder = Recorder())
       {
-        scanSource = ImageScannerScanSource::Feeder;
-      }
-      else if (scanner.IsScanSourceSupported(ImageScannerScanSource::AutoConfigured))
+        recorder->DeviceAdded(device_id, name);
+      } });
+  }
+
+  void QuickScannerPlusPlugin::RemoveScanner(const std::string &device_id)
+  {
+    dispatcher_->PostCoalesced("device:" + device_id, [this, device_id]
+                               {
+      auto it = std::find_if(scanners_.begin(), scanners_.end(), [&](const auto &scanner)
+                             { return std::get<1>(scanner) == device_id; });
+      if (it == scanners_.end())
       {
-        scanSource = ImageScannerScanSource::AutoConfigured;
+        return;
       }
-      else
+      scanners_.erase(it);
+      if (auto recorder = Recorder())
       {
-        result->Error("ScanSourceNotSupported", "No supported scan source available on this scanner.");
-        co_return;
-      }
+        recorder->DeviceRemoved(device_id);
+      } });
+  }
+
+  std::shared_ptr<SessionRecorder> QuickScannerPlusPlugin::Recorder()
+  {
+    std::lock_guard<std::mutex> lock(sessionMutex_);
+    return recorder_;
+  }
+
+  std::shared_ptr<SessionReplayer> QuickScannerPlusPlugin::Replayer()
+  {
+    std::lock_guard<std::mutex> lock(sessionMutex_);
+    return replayer_;
+  }
+
+  winrt::fire_and_forget QuickScannerPlusPlugin::ReplayEnumerationAsync(std::shared_ptr<SessionReplayer> replayer)
+  {
+    co_await winrt::resume_background();
+    try
+    {
+      replayer->ReplayEnumeration(
+          [&](const std::string &id, const std::string &name)
+          {
+            if (Replayer() == replayer)
+            {
+              AddScanner(name, kReplayDevicePrefix + id);
+            }
+          },
+          [&](const std::string &id)
+          {
+            if (Replayer() == replayer)
+            {
+              RemoveScanner(kReplayDevicePrefix + id);
+            }
+          });
+    }
+    catch (std::exception const &e)
+    {
+      std::string message = "Session replay failed: " + std::string(e.what());
+      OutputDebugStringA(message.c_str()); // Log error
+    }
+  }
+
+  winrt::fire_and_forget QuickScannerPlusPlugin::ScanFileAsync(
+      std::string device_id,
+      std::string directory,
+      std::optional<ScanFormat> format,
+      PageOptions page_options,
+      StoreTarget store_target,
+      bool detailed,
+      std::chrono::milliseconds device_timeout,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result)
+  {
+    try
+    {
+      RecordedScan recording(Recorder(), device_id);
 
-      // Configure scanner settings
-      if (scanSource == ImageScannerScanSource::Flatbed)
+      StorageFile scannedFile{nullptr};
+      ScanFormat scanFormat = ScanFormat::kJpeg;
+      if (IsReplayDeviceId(device_id))
       {
-        auto flatbedConfig = scanner.FlatbedConfiguration();
-        if (flatbedConfig.IsColorModeSupported(ImageScannerColorMode::Color))
-        {
-          flatbedConfig.ColorMode(ImageScannerColorMode::Color);
-        }
-        else if (flatbedConfig.IsColorModeSupported(ImageScannerColorMode::Grayscale))
+        auto replayer = Replayer();
+        if (!replayer)
         {
-          flatbedConfig.ColorMode(ImageScannerColorMode::Grayscale);
+          result->Error("ScannerInitializationFailed", "No session is being replayed.");
+          co_return;
         }
-        else
+        // Replay writes pages with the recorded pauses, keep it off the
+        // platform thread.
+        co_await winrt::resume_background();
+        std::string pagePath;
+        auto replayed = replayer->ReplayScan(device_id.substr(kReplayDevicePrefix.size()), directory,
+                                             [&](const std::string &path)
+                                             {
+                                               if (pagePath.empty())
+                                               {
+                                                 pagePath = path;
+                                               }
+                                             });
+        if (pagePath.empty())
         {
-          result->Error("UnsupportedScanModes", "Flatbed does not support required color modes.");
+          result->Error("ScanFailed", "No files were scanned.");
           co_return;
         }
+        scanFormat = replayed.format;
+        scannedFile = co_await StorageFile::GetFileFromPathAsync(winrt::to_hstring(pagePath));
       }
-      else if (scanSource == ImageScannerScanSource::Feeder)
+      else
       {
-        auto feederConfig = scanner.FeederConfiguration();
-        if (feederConfig.IsColorModeSupported(ImageScannerColorMode::Color))
+        auto storageFolder = co_await StorageFolder::GetFolderFromPathAsync(winrt::to_hstring(directory));
+        if (!storageFolder)
         {
-          feederConfig.ColorMode(ImageScannerColorMode::Color);
+          result->Error("InvalidDirectory", "Specified directory does not exist or is inaccessible.");
+          co_return;
         }
-        else if (feederConfig.IsColorModeSupported(ImageScannerColorMode::Grayscale))
+
+        // The daemon runs the scan after those other apps started on the
+        // same device earlier; waiting for it blocks.
+        co_await winrt::resume_background();
+        BrokerScanJob job;
+        job.device_id = device_id;
+        job.format = format;
+        job.decodable = page_options.NeedsDecoding();
+        job.device_timeout = device_timeout;
+        std::string pagePath;
+        auto events = RecordingScanEvents(recording, scanFormat);
+        events.page = [&](const uint8_t *data, size_t size, const std::string &extension)
         {
-          feederConfig.ColorMode(ImageScannerColorMode::Grayscale);
-        }
-        else
+          auto path = quick_scanner_plus::SaveScanPage(directory, extension, data, size);
+          if (pagePath.empty())
+          {
+            pagePath = path;
+          }
+        };
+        ConnectToDaemon()->Scan(job, events);
+        if (pagePath.empty())
         {
-          result->Error("UnsupportedScanModes", "Feeder does not support required color modes.");
+          result->Error("ScanFailed", "No files were scanned.");
           co_return;
         }
+        scannedFile = co_await StorageFile::GetFileFromPathAsync(winrt::to_hstring(pagePath));
       }
 
-      // Validate directory
+      PageResult page;
+      page.path = winrt::to_string(scannedFile.Path());
+      recording.Page(page.path);
+      if (page_options.NeedsDecoding())
+      {
+        // Page decoding blocks, keep it off the platform thread.
+        co_await winrt::resume_background();
+        page = quick_scanner_plus::ProcessPage(quick_scanner_plus::OpenScannedPage(scannedFile), page.path, page_options);
+        TrimBufferPoolWhenIdle();
+      }
+
+      // Auto color re-encodes pages it can store smaller as PNG.
+      ScanFormat pageFormat = page.path != winrt::to_string(scannedFile.Path()) ? ScanFormat::kPng : scanFormat;
+      auto storeId = store_target.Add(device_id, page, pageFormat);
+
+      recording.Succeeded();
+      if (!detailed)
+      {
+        result->Success(flutter::EncodableValue(page.path));
+        co_return;
+      }
+      flutter::EncodableMap pageInfo;
+      pageInfo[flutter::EncodableValue("path")] = flutter::EncodableValue(page.path);
+      pageInfo[flutter::EncodableValue("format")] = flutter::EncodableValue(quick_scanner_plus::ScanFormatName(pageFormat));
+      if (store_target.store)
+      {
+        pageInfo[flutter::EncodableValue("storeId")] = flutter::EncodableValue(static_cast<int64_t>(storeId));
+      }
+      if (page_options.auto_color)
+      {
+        pageInfo[flutter::EncodableValue("colorClass")] =
+            flutter::EncodableValue(quick_scanner_plus::ColorClassName(page.color_class));
+      }
+      result->Success(flutter::EncodableValue(pageInfo));
+    }
+    catch (winrt::hresult_error const &ex)
+    {
+      std::string message = "WinRT error occurred: " + winrt::to_string(ex.message());
+      OutputDebugStringA(message.c_str()); // Log error
+      result->Error(std::to_string(ex.code()), winrt::to_string(ex.message()));
+    }
+    catch (BrokerError const &e)
+    {
+      result->Error(e.code(), e.what());
+    }
+    catch (std::exception const &e)
+    {
+      std::string message = "Standard exception occurred: " + std::string(e.what());
+      OutputDebugStringA(message.c_str()); // Log error
+      result->Error("UnexpectedError", e.what());
+    }
+    catch (...)
+    {
+      std::string message = "An unknown error occurred.";
+      OutputDebugStringA(message.c_str()); // Log error
+      result->Error("UnknownError", "An unknown error occurred.");
+    }
+  }
+
+  winrt::fire_and_forget QuickScannerPlusPlugin::ScanBatchAsync(
+      std::string device_id,
+      std::string directory,
+      std::string job_id,
+      std::optional<ScanFormat> format,
+      PageOptions page_options,
+      StoreTarget store_target,
+      bool duplex,
+      bool drop_blank_backs,
+      std::chrono::milliseconds device_timeout,
+      std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result)
+  {
+    try
+    {
+      RecordedScan recording(Recorder(), device_id);
+      recording.Capability("source", "feeder");
+      recording.Capability("duplex", duplex ? "true" : "false");
+
       auto storageFolder = co_await StorageFolder::GetFolderFromPathAsync(winrt::to_hstring(directory));
       if (!storageFolder)
       {
@@ -259,34 +1452,149 @@ namespace
         co_return;
       }
 
-      // Perform the scan
-      auto scanResult = co_await scanner.ScanFilesToFolderAsync(scanSource, storageFolder);
+      // Page decoding and journal writes block, keep them off the platform thread.
+      co_await winrt::resume_background();
 
-      // Wait until files are accessible (confirm the scanning process is fully complete)
-      int maxRetries = 5;
-      int retries = 0;
-      while (!scanResult.ScannedFiles().Size() && retries < maxRetries)
+      BatchSplitter splitter;
+      std::unique_ptr<BatchJournal> journal;
+      int64_t resumed_pages = 0;
+      if (!job_id.empty())
       {
-        co_await winrt::resume_after(std::chrono::seconds(1)); // Wait for 1 second
-        retries++;
+        auto journal_path = std::filesystem::u8path(directory) / std::filesystem::u8path(job_id + ".qsjournal");
+        journal = std::make_unique<BatchJournal>(journal_path.u8string());
+        for (const auto &entry : journal->recovered())
+        {
+          if (entry.is_separator)
+          {
+            SeparatorResult separator;
+            separator.is_separator = true;
+            splitter.AddPage(entry.path, separator);
+          }
+          else if (std::filesystem::exists(std::filesystem::u8path(entry.path)))
+          {
+            splitter.AddPage(entry.path, SeparatorResult());
+            resumed_pages++;
+          }
+        }
       }
 
-      if (!scanResult.ScannedFiles().Size())
+      ScanFormat scanFormat = ScanFormat::kJpeg;
+      int64_t blank_pages = 0;
+      // Commits the sides of one sheet, front first. A sheet with a separator
+      // on either side is a separator sheet and none of its sides are kept.
+      auto commitSheet = [&](Sheet const &sheet)
       {
-        result->Error("ScanFailed", "No files were scanned after waiting.");
-        co_return;
+        if (auto separator = sheet.separator())
+        {
+          splitter.AddPage(separator->result.path, separator->result.separator);
+          for (auto const &side : sheet.sides)
+          {
+            std::filesystem::remove(std::filesystem::u8path(side.result.path));
+          }
+          if (journal)
+          {
+            journal->AppendSeparator();
+          }
+          return;
+        }
+
+        for (auto const &side : sheet.sides)
+        {
+          if (!side.keep)
+          {
+            std::filesystem::remove(std::filesystem::u8path(side.result.path));
+            blank_pages++;
+            continue;
+          }
+          splitter.AddPage(side.result.path, side.result.separator);
+          if (journal)
+          {
+            journal->AppendPage(side.result.path);
+          }
+          bool reencoded = side.result.path != side.source;
+          store_target.Add(device_id, side.result, reencoded ? ScanFormat::kPng : scanFormat);
+        }
+      };
+
+      // Pages are processed on worker threads while the next ones are being
+      // fetched, and committed in feeder order as they finish. With duplex
+      // the device delivers the front and then the back of each sheet; both
+      // sides are processed at the same time and committed together.
+      SheetAssembler sheets(duplex, drop_blank_backs, kMaxPagesInFlight, page_options, commitSheet);
+      auto enqueuePage = [&](StorageFile const &file)
+      {
+        auto path = winrt::to_string(file.Path());
+        recording.Page(path);
+        // Every source goes through here, so this bounds the decoding
+        // threads and held pages however fast the device delivers.
+        sheets.Add(path, [file, path](PageOptions const &options)
+                   { return quick_scanner_plus::ProcessPage(quick_scanner_plus::OpenScannedPage(file), path, options); });
+      };
+
+      if (IsReplayDeviceId(device_id))
+      {
+        auto replayer = Replayer();
+        if (!replayer)
+        {
+          result->Error("ScannerInitializationFailed", "No session is being replayed.");
+          co_return;
+        }
+        auto replayed = replayer->ReplayScan(device_id.substr(kReplayDevicePrefix.size()), directory,
+                                             [&](const std::string &path)
+                                             { enqueuePage(StorageFile::GetFileFromPathAsync(winrt::to_hstring(path)).get()); });
+        scanFormat = replayed.format;
+        sheets.Finish();
+      }
+      else
+      {
+        // The daemon runs the batch after those other apps started on the
+        // same device earlier, and holds the feeder back while enqueuePage
+        // waits for pages in flight.
+        BrokerScanJob job;
+        job.device_id = device_id;
+        job.format = format;
+        job.decodable = page_options.NeedsDecoding();
+        job.batch = true;
+        job.duplex = duplex;
+        job.pages_per_run = journal ? kJournaledPagesPerRun : 0;
+        job.device_timeout = device_timeout;
+        auto events = RecordingScanEvents(recording, scanFormat);
+        events.page = [&](const uint8_t *data, size_t size, const std::string &extension)
+        {
+          auto path = quick_scanner_plus::SaveScanPage(directory, extension, data, size);
+          enqueuePage(StorageFile::GetFileFromPathAsync(winrt::to_hstring(path)).get());
+        };
+        // Journal each run before the next one is fed. A sheet split across
+        // runs waits for its back.
+        events.run_end = [&]
+        { sheets.Commit(sheets.sides() - 1); };
+        ConnectToDaemon()->Scan(job, events);
       }
 
-      // Confirm file presence and return the first scanned file path
-      auto scannedFile = scanResult.ScannedFiles().First().Current();
-      if (!scannedFile)
+      sheets.Finish();
+      if (journal)
       {
-        result->Error("ScanFailed", "Scanned file could not be retrieved.");
-        co_return;
+        journal->Complete();
       }
+      recording.Succeeded();
+      TrimBufferPoolWhenIdle();
 
-      auto path = scannedFile.Path();
-      result->Success(flutter::EncodableValue(winrt::to_string(path)));
+      flutter::EncodableList documents{};
+      for (const auto &document : splitter.documents())
+      {
+        flutter::EncodableList pages{};
+        for (const auto &page : document)
+        {
+          pages.push_back(flutter::EncodableValue(page));
+        }
+        documents.push_back(flutter::EncodableValue(pages));
+      }
+      flutter::EncodableMap batch;
+      batch[flutter::EncodableValue("documents")] = flutter::EncodableValue(documents);
+      batch[flutter::EncodableValue("resumedPages")] = flutter::EncodableValue(resumed_pages);
+      batch[flutter::EncodableValue("blankPages")] = flutter::EncodableValue(blank_pages);
+      batch[flutter::EncodableValue("format")] = flutter::EncodableValue(quick_scanner_plus::ScanFormatName(scanFormat));
+      result->Success(flutter::EncodableValue(batch));
     }
     catch (winrt::hresult_error const &ex)
     {
@@ -294,6 +1602,10 @@ namespace
       OutputDebugStringA(message.c_str()); // Log error
       result->Error(std::to_string(ex.code()), winrt::to_string(ex.message()));
     }
+    catch (BrokerError const &e)
+    {
+      result->Error(e.code(), e.what());
+    }
     catch (std::exception const &e)
     {
       std::string message = "Standard exception occurred: " + std::string(e.what());
@@ -0,0 +1,452 @@
+#include "scan_broker.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <thread>
+
+#include "shared_memory.h"
+
+namespace fs = std::filesystem;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // How often Serve looks at Stop and the idle timeout between clients.
+    const std::chrono::milliseconds kAcceptInterval{100};
+
+    BrokerWriter ErrorFields(const std::string &code, const std::string &message)
+    {
+      return BrokerWriter().String(code).String(message);
+    }
+
+  } // namespace
+
+  struct ScanBroker::Connection
+  {
+    LocalSocket socket;
+    // Reads the client's messages; runs Handle.
+    std::thread reader;
+    // Runs the client's current scan, if any.
+    std::thread job;
+    // Device changes and the job's messages come from different threads.
+    std::mutex send_mutex;
+
+    // Guarded by the broker's mutex_.
+    bool closed = false;
+    bool scanning = false;
+    bool finished = false;
+    uint64_t next_page = 0;
+    // Pages handed over and not yet released, by number.
+    std::map<uint64_t, SharedMemory> pages;
+
+    // Throws std::runtime_error if the client is gone.
+    void Send(BrokerMessage type, const BrokerWriter &fields = BrokerWriter())
+    {
+      std::lock_guard<std::mutex> lock(send_mutex);
+      SendBrokerMessage(socket, type, fields);
+    }
+
+    // For the job: a client that is gone cancels the scan.
+    void SendOrCancel(BrokerMessage type, const BrokerWriter &fields = BrokerWriter())
+    {
+      try
+      {
+        Send(type, fields);
+      }
+      catch (const std::runtime_error &)
+      {
+        throw BrokerError("Cancelled", "The app that started the scan went away.");
+      }
+    }
+
+    void TrySend(BrokerMessage type, const BrokerWriter &fields = BrokerWriter())
+    {
+      try
+      {
+        Send(type, fields);
+      }
+      catch (const std::runtime_error &)
+      {
+        // Its reader sees the connection close and cleans up.
+      }
+    }
+  };
+
+  ScanBroker::ScanBroker(ScanBackend &backend) : backend_(backend) {}
+
+  ScanBroker::~ScanBroker()
+  {
+    Stop();
+  }
+
+  void ScanBroker::AddDevice(const std::string &id, const std::string &name)
+  {
+    std::lock_guard<std::mutex> events(events_mutex_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto present = std::find_if(devices_.begin(), devices_.end(), [&](const auto &device)
+                                  { return device.first == id; });
+      if (present != devices_.end())
+      {
+        return;
+      }
+      devices_.emplace_back(id, name);
+    }
+    Broadcast(BrokerMessage::kDeviceAdded, BrokerWriter().String(id).String(name));
+  }
+
+  void ScanBroker::RemoveDevice(const std::string &id)
+  {
+    std::lock_guard<std::mutex> events(events_mutex_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto present = std::find_if(devices_.begin(), devices_.end(), [&](const auto &device)
+                                  { return device.first == id; });
+      if (present == devices_.end())
+      {
+        return;
+      }
+      devices_.erase(present);
+    }
+    Broadcast(BrokerMessage::kDeviceRemoved, BrokerWriter().String(id));
+  }
+
+  void ScanBroker::EnumerationCompleted()
+  {
+    std::lock_guard<std::mutex> events(events_mutex_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (enumerated_)
+      {
+        return;
+      }
+      enumerated_ = true;
+    }
+    Broadcast(BrokerMessage::kEnumerationCompleted, BrokerWriter());
+  }
+
+  void ScanBroker::Broadcast(BrokerMessage type, const BrokerWriter &fields)
+  {
+    std::vector<std::shared_ptr<Connection>> watchers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      watchers = watchers_;
+    }
+    for (const auto &watcher : watchers)
+    {
+      watcher->TrySend(type, fields);
+    }
+  }
+
+  bool ScanBroker::Serve(const std::string &socket_path, std::chrono::milliseconds idle_timeout)
+  {
+    auto listener = LocalSocket::Listen(socket_path);
+    if (!listener.valid())
+    {
+      return false;
+    }
+
+    auto idle_since = std::chrono::steady_clock::now();
+    while (!stopping_)
+    {
+      auto socket = listener.Accept(kAcceptInterval);
+      std::vector<std::shared_ptr<Connection>> finished;
+      bool idle = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = connections_.begin(); it != connections_.end();)
+        {
+          if ((*it)->finished)
+          {
+            finished.push_back(*it);
+            it = connections_.erase(it);
+          }
+          else
+          {
+            ++it;
+          }
+        }
+        if (socket.valid())
+        {
+          auto connection = std::make_shared<Connection>();
+          connection->socket = std::move(socket);
+          connection->reader = std::thread([this, connection]
+                                           { Handle(connection); });
+          connections_.push_back(connection);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (!connections_.empty())
+        {
+          idle_since = now;
+        }
+        idle = idle_timeout.count() >= 0 && now - idle_since >= idle_timeout;
+      }
+      for (const auto &connection : finished)
+      {
+        connection->reader.join();
+      }
+      if (idle)
+      {
+        break;
+      }
+    }
+
+    // Cut every client off; jobs notice at their next page and end.
+    std::list<std::shared_ptr<Connection>> remaining;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      remaining.swap(connections_);
+      for (const auto &connection : remaining)
+      {
+        connection->socket.Shutdown();
+      }
+    }
+    for (const auto &connection : remaining)
+    {
+      connection->reader.join();
+    }
+    return true;
+  }
+
+  void ScanBroker::Stop()
+  {
+    stopping_ = true;
+  }
+
+  void ScanBroker::Handle(const std::shared_ptr<Connection> &connection)
+  {
+    try
+    {
+      BrokerMessage type;
+      std::vector<uint8_t> fields;
+      if (ReceiveBrokerMessage(connection->socket, type, fields) && type == BrokerMessage::kHello)
+      {
+        BrokerReader hello(fields);
+        uint32_t version = hello.U32();
+        connection->Send(BrokerMessage::kWelcome, BrokerWriter().U32(kBrokerProtocolVersion));
+        // A client of another version sees ours and hangs up.
+        while (version == kBrokerProtocolVersion && ReceiveBrokerMessage(connection->socket, type, fields))
+        {
+          BrokerReader reader(fields);
+          if (type == BrokerMessage::kWatchDevices)
+          {
+            Watch(connection);
+          }
+          else if (type == BrokerMessage::kScan)
+          {
+            auto job = reader.Job();
+            {
+              std::lock_guard<std::mutex> lock(mutex_);
+              if (connection->scanning)
+              {
+                throw std::runtime_error("Client started a second scan on one connection.");
+              }
+              connection->scanning = true;
+            }
+            if (connection->job.joinable())
+            {
+              connection->job.join();
+            }
+            connection->job = std::thread([this, connection, job]
+                                          { RunJob(connection, job); });
+          }
+          else if (type == BrokerMessage::kPageDone)
+          {
+            auto page = reader.U64();
+            std::lock_guard<std::mutex> lock(mutex_);
+            connection->pages.erase(page);
+            changed_.notify_all();
+          }
+          else
+          {
+            throw std::runtime_error("Client sent an unexpected message.");
+          }
+        }
+      }
+    }
+    catch (const std::exception &)
+    {
+      // A client that breaks the protocol is dropped like one that left.
+    }
+
+    connection->socket.Shutdown();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      connection->closed = true;
+      watchers_.erase(std::remove(watchers_.begin(), watchers_.end(), connection), watchers_.end());
+      changed_.notify_all();
+    }
+    if (connection->job.joinable())
+    {
+      connection->job.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    connection->pages.clear();
+    connection->finished = true;
+  }
+
+  void ScanBroker::Watch(const std::shared_ptr<Connection> &connection)
+  {
+    std::lock_guard<std::mutex> events(events_mutex_);
+    std::vector<std::pair<std::string, std::string>> devices;
+    bool enumerated;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (std::find(watchers_.begin(), watchers_.end(), connection) != watchers_.end())
+      {
+        return;
+      }
+      devices = devices_;
+      enumerated = enumerated_;
+      watchers_.push_back(connection);
+    }
+    for (const auto &device : devices)
+    {
+      connection->Send(BrokerMessage::kDeviceAdded, BrokerWriter().String(device.first).String(device.second));
+    }
+    if (enumerated)
+    {
+      connection->Send(BrokerMessage::kEnumerationCompleted);
+    }
+  }
+
+  void ScanBroker::RunJob(const std::shared_ptr<Connection> &connection, const BrokerScanJob &job)
+  {
+    BrokerMessage result = BrokerMessage::kScanDone;
+    BrokerWriter fields;
+    if (!AcquireDevice(*connection, job.device_id, job.device_timeout))
+    {
+      result = BrokerMessage::kError;
+      fields = ErrorFields("DeviceBusy", "Scanner is in use by another application.");
+    }
+    else
+    {
+      try
+      {
+        ScanBackend::Events events;
+        events.capability = [&](const std::string &key, const std::string &value)
+        { connection->SendOrCancel(BrokerMessage::kCapability, BrokerWriter().String(key).String(value)); };
+        events.format = [&](ScanFormat format)
+        { connection->SendOrCancel(BrokerMessage::kFormat, BrokerWriter().U8(static_cast<uint8_t>(format))); };
+        events.page = [&](const std::string &path)
+        { SendPage(*connection, path); };
+        events.run_end = [&]
+        { connection->SendOrCancel(BrokerMessage::kRunEnd); };
+        backend_.Scan(job, events);
+      }
+      catch (const BrokerError &error)
+      {
+        result = BrokerMessage::kError;
+        fields = ErrorFields(error.code(), error.what());
+      }
+      catch (const std::exception &error)
+      {
+        result = BrokerMessage::kError;
+        fields = ErrorFields("UnexpectedError", error.what());
+      }
+      catch (...)
+      {
+        result = BrokerMessage::kError;
+        fields = ErrorFields("UnknownError", "An unknown error occurred.");
+      }
+      ReleaseDevice(job.device_id);
+    }
+    {
+      // The client may start its next scan as soon as it hears the result.
+      std::lock_guard<std::mutex> lock(mutex_);
+      connection->scanning = false;
+    }
+    connection->TrySend(result, fields);
+  }
+
+  bool ScanBroker::AcquireDevice(Connection &connection, const std::string &device_id,
+                                 std::chrono::milliseconds timeout)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto &queue = queues_[device_id];
+    uint64_t ticket = next_ticket_++;
+    queue.waiting.push_back(ticket);
+    auto ready = [&]
+    { return connection.closed || (!queue.busy && queue.waiting.front() == ticket); };
+    if (timeout.count() < 0)
+    {
+      changed_.wait(lock, ready);
+    }
+    else
+    {
+      changed_.wait_for(lock, timeout, ready);
+    }
+
+    if (!connection.closed && !queue.busy && queue.waiting.front() == ticket)
+    {
+      queue.waiting.pop_front();
+      queue.busy = true;
+      return true;
+    }
+    queue.waiting.erase(std::find(queue.waiting.begin(), queue.waiting.end(), ticket));
+    if (!queue.busy && queue.waiting.empty())
+    {
+      queues_.erase(device_id);
+    }
+    // The job behind this one may be first now.
+    changed_.notify_all();
+    return false;
+  }
+
+  void ScanBroker::ReleaseDevice(const std::string &device_id)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto queue = queues_.find(device_id);
+    queue->second.busy = false;
+    if (queue->second.waiting.empty())
+    {
+      queues_.erase(queue);
+    }
+    changed_.notify_all();
+  }
+
+  void ScanBroker::SendPage(Connection &connection, const std::string &path)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock, [&]
+                    { return connection.closed || connection.pages.size() < kMaxPagesInFlight; });
+      if (connection.closed)
+      {
+        throw BrokerError("Cancelled", "The app that started the scan went away.");
+      }
+    }
+
+    auto file = fs::u8path(path);
+    auto size = static_cast<size_t>(fs::file_size(file));
+    auto memory = SharedMemory::Create(size);
+    {
+      std::ifstream in(file, std::ios::binary);
+      if (!in.read(reinterpret_cast<char *>(memory.data()), static_cast<std::streamsize>(size)))
+      {
+        throw std::runtime_error("Could not read scanned page " + path);
+      }
+    }
+    std::error_code ignored;
+    fs::remove(file, ignored);
+
+    auto name = memory.name();
+    uint64_t page;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      page = connection.next_page++;
+      connection.pages.emplace(page, std::move(memory));
+    }
+    connection.SendOrCancel(BrokerMessage::kPage, BrokerWriter()
+                                                      .U64(page)
+                                                      .String(name)
+                                                      .U64(size)
+                                                      .String(file.extension().u8string()));
+  }
+
+} // namespace quick_scanner_plus
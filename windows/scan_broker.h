@@ -0,0 +1,123 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "scan_broker_protocol.h"
+
+namespace quick_scanner_plus
+{
+
+  // Drives the devices for the scan daemon: WinRT scanners and eSCL
+  // network scanners in the daemon itself, simulated ones in tests.
+  class ScanBackend
+  {
+  public:
+    struct Events
+    {
+      // What the device reported while the job was set up, for traces.
+      std::function<void(const std::string &key, const std::string &value)> capability;
+      // The format the pages arrive in; called before the first page.
+      std::function<void(ScanFormat format)> format;
+      // A page file (UTF-8 path) the device wrote. It is handed to the
+      // client and removed. Blocks while the client is behind, and throws
+      // if the client went away, which should end the scan.
+      std::function<void(const std::string &path)> page;
+      // The feeder finished a run; the pages so far can be committed.
+      std::function<void()> run_end;
+    };
+
+    virtual ~ScanBackend() = default;
+
+    // Runs |job|, which has the device to itself. Throws BrokerError with
+    // the code for the client, or any other exception for an unexpected
+    // failure.
+    virtual void Scan(const BrokerScanJob &job, const Events &events) = 0;
+  };
+
+  // The scan daemon: owns the device list and the devices' job queues and
+  // serves both to clients over a local socket. Jobs for one device run one
+  // at a time in the order clients asked for them; jobs for different
+  // devices run side by side. A client that goes away gives up its place
+  // in the queue, or ends its job.
+  class ScanBroker
+  {
+  public:
+    // Pages of one job handed to the client that it has not yet released.
+    static constexpr size_t kMaxPagesInFlight = 4;
+
+    explicit ScanBroker(ScanBackend &backend);
+    ~ScanBroker();
+
+    ScanBroker(const ScanBroker &) = delete;
+    ScanBroker &operator=(const ScanBroker &) = delete;
+
+    // Device changes, from the backend's discovery. Callable from any
+    // thread.
+    void AddDevice(const std::string &id, const std::string &name);
+    void RemoveDevice(const std::string &id);
+    // The devices present when discovery started are all reported.
+    void EnumerationCompleted();
+
+    // Listens on |socket_path| and serves clients until Stop is called or
+    // none has been connected for |idle_timeout| (never if negative).
+    // Returns false at once if another daemon already listens there.
+    bool Serve(const std::string &socket_path, std::chrono::milliseconds idle_timeout);
+    // Makes Serve return once the jobs in progress have ended.
+    void Stop();
+
+  private:
+    struct Connection;
+
+    void Handle(const std::shared_ptr<Connection> &connection);
+    void Watch(const std::shared_ptr<Connection> &connection);
+    void RunJob(const std::shared_ptr<Connection> &connection, const BrokerScanJob &job);
+    // Waits until |connection| may use |device_id|. Returns false if it
+    // went away or |timeout| passed first.
+    bool AcquireDevice(Connection &connection, const std::string &device_id, std::chrono::milliseconds timeout);
+    void ReleaseDevice(const std::string &device_id);
+    // Moves the page file at |path| into shared memory and tells the client.
+    void SendPage(Connection &connection, const std::string &path);
+    // Sends to every watching client.
+    void Broadcast(BrokerMessage type, const BrokerWriter &fields);
+
+    ScanBackend &backend_;
+    std::atomic<bool> stopping_{false};
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    // Present devices, in the order they appeared.
+    std::vector<std::pair<std::string, std::string>> devices_;
+    bool enumerated_ = false;
+    std::vector<std::shared_ptr<Connection>> watchers_;
+    // Per device, the jobs waiting for it in the order they asked and
+    // whether one is running.
+    struct DeviceQueue
+    {
+      std::deque<uint64_t> waiting;
+      bool busy = false;
+    };
+    std::map<std::string, DeviceQueue> queues_;
+    uint64_t next_ticket_ = 0;
+    std::list<std::shared_ptr<Connection>> connections_;
+
+    // Keeps device changes in order on every watcher, and a new watcher's
+    // initial list ahead of the changes after it.
+    std::mutex events_mutex_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_H_
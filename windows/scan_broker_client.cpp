@@ -0,0 +1,214 @@
+#include "scan_broker_client.h"
+
+#include <filesystem>
+#include <system_error>
+
+#include "file_io.h"
+#include "shared_memory.h"
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    BrokerError DaemonGone()
+    {
+      return BrokerError("DaemonUnavailable", "The scan daemon went away.");
+    }
+
+  } // namespace
+
+  ScanBrokerClient::ScanBrokerClient(const std::string &socket_path)
+      : socket_(LocalSocket::Connect(socket_path))
+  {
+    if (!socket_.valid())
+    {
+      throw BrokerError("DaemonUnavailable", "The scan daemon is not running.");
+    }
+    BrokerMessage type;
+    std::vector<uint8_t> fields;
+    try
+    {
+      SendBrokerMessage(socket_, BrokerMessage::kHello, BrokerWriter().U32(kBrokerProtocolVersion));
+      if (ReceiveBrokerMessage(socket_, type, fields) && type == BrokerMessage::kWelcome &&
+          BrokerReader(fields).U32() == kBrokerProtocolVersion)
+      {
+        return;
+      }
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+    throw BrokerError("DaemonUnavailable", "The scan daemon does not speak this plugin's protocol.");
+  }
+
+  void ScanBrokerClient::WatchDevices(const DeviceEvents &events)
+  {
+    BrokerMessage type;
+    std::vector<uint8_t> fields;
+    try
+    {
+      SendBrokerMessage(socket_, BrokerMessage::kWatchDevices);
+      while (ReceiveBrokerMessage(socket_, type, fields))
+      {
+        BrokerReader reader(fields);
+        if (type == BrokerMessage::kDeviceAdded)
+        {
+          auto id = reader.String();
+          auto name = reader.String();
+          events.added(id, name);
+        }
+        else if (type == BrokerMessage::kDeviceRemoved)
+        {
+          events.removed(reader.String());
+        }
+        else if (type == BrokerMessage::kEnumerationCompleted)
+        {
+          events.enumerated();
+        }
+      }
+    }
+    catch (const BrokerError &)
+    {
+      throw;
+    }
+    catch (const std::runtime_error &)
+    {
+      // Close shuts the socket down under a blocked read.
+      if (!closed_)
+      {
+        throw DaemonGone();
+      }
+    }
+    if (!closed_)
+    {
+      throw DaemonGone();
+    }
+  }
+
+  void ScanBrokerClient::Scan(const BrokerScanJob &job, const ScanEvents &events)
+  {
+    BrokerMessage type;
+    std::vector<uint8_t> fields;
+    auto receive = [&]
+    {
+      try
+      {
+        return ReceiveBrokerMessage(socket_, type, fields);
+      }
+      catch (const std::runtime_error &)
+      {
+        return false;
+      }
+    };
+
+    try
+    {
+      SendBrokerMessage(socket_, BrokerMessage::kScan, BrokerWriter().Job(job));
+    }
+    catch (const std::runtime_error &)
+    {
+      throw DaemonGone();
+    }
+    while (receive())
+    {
+      BrokerReader reader(fields);
+      switch (type)
+      {
+      case BrokerMessage::kCapability:
+      {
+        auto key = reader.String();
+        auto value = reader.String();
+        events.capability(key, value);
+        break;
+      }
+      case BrokerMessage::kFormat:
+      {
+        auto format = reader.U8();
+        if (format > static_cast<uint8_t>(ScanFormat::kXps))
+        {
+          throw std::runtime_error("Scan daemon named an unknown format.");
+        }
+        events.format(static_cast<ScanFormat>(format));
+        break;
+      }
+      case BrokerMessage::kPage:
+      {
+        auto page = reader.U64();
+        auto name = reader.String();
+        auto size = static_cast<size_t>(reader.U64());
+        auto extension = reader.String();
+        {
+          auto memory = SharedMemory::Open(name, size);
+          events.page(memory.data(), size, extension);
+        }
+        try
+        {
+          SendBrokerMessage(socket_, BrokerMessage::kPageDone, BrokerWriter().U64(page));
+        }
+        catch (const std::runtime_error &)
+        {
+          throw DaemonGone();
+        }
+        break;
+      }
+      case BrokerMessage::kRunEnd:
+        events.run_end();
+        break;
+      case BrokerMessage::kScanDone:
+        return;
+      case BrokerMessage::kError:
+      {
+        auto code = reader.String();
+        auto message = reader.String();
+        throw BrokerError(code, message);
+      }
+      default:
+        throw std::runtime_error("Scan daemon sent an unexpected message.");
+      }
+    }
+    if (closed_)
+    {
+      throw BrokerError("Cancelled", "The scan was cancelled.");
+    }
+    throw DaemonGone();
+  }
+
+  void ScanBrokerClient::Close()
+  {
+    closed_ = true;
+    socket_.Shutdown();
+  }
+
+  std::string SaveScanPage(const std::string &directory, const std::string &extension, const uint8_t *data,
+                           size_t size)
+  {
+    auto folder = std::filesystem::u8path(directory);
+    for (int copy = 1;; copy++)
+    {
+      auto name = copy == 1 ? "Scan" + extension : "Scan (" + std::to_string(copy) + ")" + extension;
+      auto path = (folder / std::filesystem::u8path(name)).u8string();
+      int fd = CreateFd(path);
+      if (fd < 0)
+      {
+        std::error_code error;
+        if (std::filesystem::exists(std::filesystem::u8path(path), error))
+        {
+          continue;
+        }
+        throw std::runtime_error("Could not create " + path);
+      }
+      bool written = WriteAllFd(fd, data, size);
+      CloseFd(fd);
+      if (!written)
+      {
+        std::error_code ignored;
+        std::filesystem::remove(std::filesystem::u8path(path), ignored);
+        throw std::runtime_error("Could not write " + path);
+      }
+      return path;
+    }
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,73 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_CLIENT_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_CLIENT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "scan_broker_protocol.h"
+
+namespace quick_scanner_plus
+{
+
+  // One connection to the scan daemon, for watching its devices or for
+  // running scans one after another.
+  class ScanBrokerClient
+  {
+  public:
+    struct DeviceEvents
+    {
+      std::function<void(const std::string &id, const std::string &name)> added;
+      std::function<void(const std::string &id)> removed;
+      // Every device present when the daemon started has been reported.
+      std::function<void()> enumerated;
+    };
+
+    struct ScanEvents
+    {
+      std::function<void(const std::string &key, const std::string &value)> capability;
+      std::function<void(ScanFormat format)> format;
+      // A page's file contents, valid during the call, and its extension
+      // with the dot.
+      std::function<void(const uint8_t *data, size_t size, const std::string &extension)> page;
+      std::function<void()> run_end;
+    };
+
+    // Connects to the daemon listening on |socket_path|. Throws BrokerError
+    // "DaemonUnavailable" if there is none or it speaks another version.
+    explicit ScanBrokerClient(const std::string &socket_path);
+
+    ScanBrokerClient(const ScanBrokerClient &) = delete;
+    ScanBrokerClient &operator=(const ScanBrokerClient &) = delete;
+
+    // Reports the daemon's devices, then their changes as they happen, until
+    // Close is called. Blocks. Throws BrokerError "DaemonUnavailable" if the
+    // daemon goes away.
+    void WatchDevices(const DeviceEvents &events);
+
+    // Runs |job| on the daemon, after the jobs other clients started on the
+    // same device earlier. Blocks until the scan is done. Throws BrokerError
+    // with the daemon's code if it fails; an exception from |events| ends
+    // the connection, which cancels the scan.
+    void Scan(const BrokerScanJob &job, const ScanEvents &events);
+
+    // Ends a WatchDevices or Scan running on another thread.
+    void Close();
+
+  private:
+    LocalSocket socket_;
+    std::atomic<bool> closed_{false};
+  };
+
+  // Writes a page the daemon handed over to a new file in |directory|,
+  // named "Scan" and |extension| like the files WinRT scans produce, with a
+  // number added while that name is taken. Returns its path (UTF-8).
+  // Throws std::runtime_error if it cannot be written.
+  std::string SaveScanPage(const std::string &directory, const std::string &extension, const uint8_t *data,
+                           size_t size);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_CLIENT_H_
@@ -0,0 +1,159 @@
+#include "scan_broker_protocol.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <filesystem>
+
+#include "file_io.h"
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // Messages carry names and IDs; page data goes through shared memory.
+    const uint32_t kMaxFrameSize = 1 << 20;
+
+    const uint8_t kDecodable = 1;
+    const uint8_t kBatch = 2;
+    const uint8_t kDuplex = 4;
+
+  } // namespace
+
+  BrokerWriter &BrokerWriter::U8(uint8_t value)
+  {
+    bytes_.push_back(value);
+    return *this;
+  }
+
+  BrokerWriter &BrokerWriter::U32(uint32_t value)
+  {
+    AppendLittleEndian(bytes_, value, 4);
+    return *this;
+  }
+
+  BrokerWriter &BrokerWriter::U64(uint64_t value)
+  {
+    AppendLittleEndian(bytes_, value, 8);
+    return *this;
+  }
+
+  BrokerWriter &BrokerWriter::String(const std::string &value)
+  {
+    U32(static_cast<uint32_t>(value.size()));
+    bytes_.insert(bytes_.end(), value.begin(), value.end());
+    return *this;
+  }
+
+  BrokerWriter &BrokerWriter::Job(const BrokerScanJob &job)
+  {
+    String(job.device_id);
+    // 0 for the device's default, else the format plus one.
+    U8(job.format ? static_cast<uint8_t>(static_cast<int>(*job.format) + 1) : 0);
+    U8(static_cast<uint8_t>((job.decodable ? kDecodable : 0) | (job.batch ? kBatch : 0) |
+                            (job.duplex ? kDuplex : 0)));
+    U32(job.pages_per_run);
+    return U64(static_cast<uint64_t>(static_cast<int64_t>(job.device_timeout.count())));
+  }
+
+  const uint8_t *BrokerReader::Take(size_t size)
+  {
+    if (bytes_.size() - position_ < size)
+    {
+      throw std::runtime_error("Scan daemon message is cut short.");
+    }
+    const uint8_t *data = bytes_.data() + position_;
+    position_ += size;
+    return data;
+  }
+
+  uint8_t BrokerReader::U8()
+  {
+    return *Take(1);
+  }
+
+  uint32_t BrokerReader::U32()
+  {
+    return static_cast<uint32_t>(LoadLittleEndian(Take(4), 4));
+  }
+
+  uint64_t BrokerReader::U64()
+  {
+    return LoadLittleEndian(Take(8), 8);
+  }
+
+  std::string BrokerReader::String()
+  {
+    uint32_t size = U32();
+    const uint8_t *data = Take(size);
+    return std::string(reinterpret_cast<const char *>(data), size);
+  }
+
+  BrokerScanJob BrokerReader::Job()
+  {
+    BrokerScanJob job;
+    job.device_id = String();
+    uint8_t format = U8();
+    if (format > static_cast<int>(ScanFormat::kXps) + 1)
+    {
+      throw std::runtime_error("Scan daemon message names an unknown format.");
+    }
+    if (format > 0)
+    {
+      job.format = static_cast<ScanFormat>(format - 1);
+    }
+    uint8_t flags = U8();
+    job.decodable = (flags & kDecodable) != 0;
+    job.batch = (flags & kBatch) != 0;
+    job.duplex = (flags & kDuplex) != 0;
+    job.pages_per_run = U32();
+    job.device_timeout = std::chrono::milliseconds(static_cast<int64_t>(U64()));
+    return job;
+  }
+
+  void SendBrokerMessage(LocalSocket &socket, BrokerMessage type, const BrokerWriter &fields)
+  {
+    std::vector<uint8_t> frame;
+    frame.reserve(5 + fields.bytes().size());
+    AppendLittleEndian(frame, 1 + fields.bytes().size(), 4);
+    frame.push_back(static_cast<uint8_t>(type));
+    frame.insert(frame.end(), fields.bytes().begin(), fields.bytes().end());
+    socket.Send(frame.data(), frame.size());
+  }
+
+  bool ReceiveBrokerMessage(LocalSocket &socket, BrokerMessage &type, std::vector<uint8_t> &fields)
+  {
+    uint8_t header[5];
+    if (!socket.Receive(header, sizeof(header)))
+    {
+      return false;
+    }
+    auto size = static_cast<uint32_t>(LoadLittleEndian(header, 4));
+    if (size == 0 || size > kMaxFrameSize)
+    {
+      throw std::runtime_error("Scan daemon message has a bad length.");
+    }
+    type = static_cast<BrokerMessage>(header[4]);
+    fields.resize(size - 1);
+    if (!fields.empty() && !socket.Receive(fields.data(), fields.size()))
+    {
+      throw std::runtime_error("Local connection closed.");
+    }
+    return true;
+  }
+
+  std::string DefaultBrokerSocketPath()
+  {
+#ifdef _WIN32
+    // The temp directory is per user on Windows.
+    std::string name = "quick_scanner_plus.sock";
+#else
+    std::string name = "quick_scanner_plus-" + std::to_string(getuid()) + ".sock";
+#endif
+    return (std::filesystem::temp_directory_path() / name).u8string();
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,126 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_PROTOCOL_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_PROTOCOL_H_
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "local_socket.h"
+#include "scan_format.h"
+
+namespace quick_scanner_plus
+{
+
+  // The scan daemon owns every scanner on the machine for the current user;
+  // apps reach them through it over a local socket. Each message is a frame
+  // of a little-endian 32-bit length, a one-byte type and the fields of the
+  // type: integers little-endian, strings as a 32-bit length and UTF-8.
+  const uint32_t kBrokerProtocolVersion = 1;
+
+  enum class BrokerMessage : uint8_t
+  {
+    // Client to daemon. A connection starts with kHello, then either
+    // watches devices or runs scans one at a time.
+    kHello = 1,       // u32 protocol version
+    kWatchDevices = 2,
+    kScan = 3,        // BrokerScanJob
+    kPageDone = 4,    // u64 page: the client is done with its memory
+
+    // Daemon to client.
+    kWelcome = 64,               // u32 protocol version
+    kDeviceAdded = 65,           // string id, string name
+    kDeviceRemoved = 66,         // string id
+    kEnumerationCompleted = 67,  // the devices present at start are reported
+    kCapability = 68,            // string key, string value: for session traces
+    kFormat = 69,                // u8 ScanFormat the pages arrive in
+    kPage = 70,                  // u64 page, string memory name, u64 size, string extension
+    kRunEnd = 71,                // the feeder finished a run
+    kScanDone = 72,
+    kError = 73,                 // string code, string message
+  };
+
+  // One scan, as a client asks the daemon for it.
+  struct BrokerScanJob
+  {
+    std::string device_id;
+    // The wanted page format, or the device's default.
+    std::optional<ScanFormat> format;
+    // Only formats the page pipeline can decode qualify.
+    bool decodable = false;
+    // Scan the whole feeder rather than one page from the preferred source.
+    bool batch = false;
+    // With |batch|, scan both sides of each sheet.
+    bool duplex = false;
+    // With |batch|, pages per feeder run; 0 scans until the feeder is empty.
+    uint32_t pages_per_run = 0;
+    // How long the job may wait for a device other clients are using;
+    // negative waits as long as it takes.
+    std::chrono::milliseconds device_timeout{-1};
+  };
+
+  // A failure the daemon reports to the client, with the error code the
+  // plugin hands on to Dart, e.g. "DeviceBusy" or "UnsupportedFormat".
+  class BrokerError : public std::runtime_error
+  {
+  public:
+    BrokerError(std::string code, const std::string &message)
+        : std::runtime_error(message), code_(std::move(code)) {}
+
+    const std::string &code() const { return code_; }
+
+  private:
+    std::string code_;
+  };
+
+  // Builds the fields of a message.
+  class BrokerWriter
+  {
+  public:
+    BrokerWriter &U8(uint8_t value);
+    BrokerWriter &U32(uint32_t value);
+    BrokerWriter &U64(uint64_t value);
+    BrokerWriter &String(const std::string &value);
+    BrokerWriter &Job(const BrokerScanJob &job);
+
+    const std::vector<uint8_t> &bytes() const { return bytes_; }
+
+  private:
+    std::vector<uint8_t> bytes_;
+  };
+
+  // Reads the fields of a message back. Throws std::runtime_error if the
+  // message ends early.
+  class BrokerReader
+  {
+  public:
+    explicit BrokerReader(const std::vector<uint8_t> &bytes) : bytes_(bytes) {}
+
+    uint8_t U8();
+    uint32_t U32();
+    uint64_t U64();
+    std::string String();
+    BrokerScanJob Job();
+
+  private:
+    const uint8_t *Take(size_t size);
+
+    const std::vector<uint8_t> &bytes_;
+    size_t position_ = 0;
+  };
+
+  // Writes one frame. Throws std::runtime_error if the peer is gone.
+  void SendBrokerMessage(LocalSocket &socket, BrokerMessage type, const BrokerWriter &fields = BrokerWriter());
+  // Reads one frame into |type| and |fields|. Returns false if the peer
+  // closed the connection; throws std::runtime_error on a broken frame.
+  bool ReceiveBrokerMessage(LocalSocket &socket, BrokerMessage &type, std::vector<uint8_t> &fields);
+
+  // Where the daemon of the current user listens.
+  std::string DefaultBrokerSocketPath();
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_BROKER_PROTOCOL_H_
@@ -0,0 +1,119 @@
+#include "scan_format.h"
+
+#include <vector>
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // Fallback order per requested format: lossless requests stay lossless as
+    // long as possible, lossy ones prefer the smaller encodings.
+    std::vector<ScanFormat> Preferences(ScanFormat requested)
+    {
+      switch (requested)
+      {
+      case ScanFormat::kJpeg:
+        return {ScanFormat::kJpeg, ScanFormat::kPdf, ScanFormat::kPng, ScanFormat::kTiff, ScanFormat::kDib};
+      case ScanFormat::kPng:
+        return {ScanFormat::kPng, ScanFormat::kTiff, ScanFormat::kDib, ScanFormat::kJpeg, ScanFormat::kPdf};
+      case ScanFormat::kTiff:
+        return {ScanFormat::kTiff, ScanFormat::kPng, ScanFormat::kDib, ScanFormat::kJpeg, ScanFormat::kPdf};
+      case ScanFormat::kPdf:
+        return {ScanFormat::kPdf, ScanFormat::kJpeg, ScanFormat::kPng, ScanFormat::kTiff, ScanFormat::kDib};
+      case ScanFormat::kDib:
+        return {ScanFormat::kDib, ScanFormat::kPng, ScanFormat::kTiff, ScanFormat::kJpeg, ScanFormat::kPdf};
+      case ScanFormat::kXps:
+        return {ScanFormat::kXps, ScanFormat::kPdf, ScanFormat::kTiff, ScanFormat::kPng, ScanFormat::kJpeg};
+      }
+      return {requested};
+    }
+
+  } // namespace
+
+  const char *ScanFormatName(ScanFormat format)
+  {
+    switch (format)
+    {
+    case ScanFormat::kJpeg:
+      return "jpeg";
+    case ScanFormat::kPng:
+      return "png";
+    case ScanFormat::kTiff:
+      return "tiff";
+    case ScanFormat::kPdf:
+      return "pdf";
+    case ScanFormat::kDib:
+      return "dib";
+    case ScanFormat::kXps:
+      return "xps";
+    }
+    return "";
+  }
+
+  std::optional<ScanFormat> ParseScanFormat(const std::string &name)
+  {
+    for (auto format : {ScanFormat::kJpeg, ScanFormat::kPng, ScanFormat::kTiff, ScanFormat::kPdf,
+                        ScanFormat::kDib, ScanFormat::kXps})
+    {
+      if (name == ScanFormatName(format))
+      {
+        return format;
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::string SupportedScanFormatNames(const std::function<bool(ScanFormat)> &is_supported)
+  {
+    std::string names;
+    for (auto format : {ScanFormat::kJpeg, ScanFormat::kPng, ScanFormat::kTiff, ScanFormat::kPdf,
+                        ScanFormat::kDib, ScanFormat::kXps})
+    {
+      if (is_supported(format))
+      {
+        names += (names.empty() ? "" : ",") + std::string(ScanFormatName(format));
+      }
+    }
+    return names;
+  }
+
+  const char *ScanFormatMimeType(ScanFormat format)
+  {
+    switch (format)
+    {
+    case ScanFormat::kJpeg:
+      return "image/jpeg";
+    case ScanFormat::kPng:
+      return "image/png";
+    case ScanFormat::kTiff:
+      return "image/tiff";
+    case ScanFormat::kPdf:
+      return "application/pdf";
+    case ScanFormat::kDib:
+    case ScanFormat::kXps:
+      return "";
+    }
+    return "";
+  }
+
+  bool IsDecodableScanFormat(ScanFormat format)
+  {
+    return format != ScanFormat::kPdf && format != ScanFormat::kXps;
+  }
+
+  std::optional<ScanFormat> NegotiateScanFormat(ScanFormat requested, bool decodable,
+                                                const std::function<bool(ScanFormat)> &is_supported)
+  {
+    for (auto format : Preferences(requested))
+    {
+      if ((!decodable || IsDecodableScanFormat(format)) && is_supported(format))
+      {
+        return format;
+      }
+    }
+    return std::nullopt;
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,42 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_FORMAT_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_FORMAT_H_
+
+#include <functional>
+#include <optional>
+#include <string>
+
+namespace quick_scanner_plus
+{
+
+  // File formats a scanner can produce natively.
+  enum class ScanFormat
+  {
+    kJpeg,
+    kPng,
+    kTiff,
+    kPdf,
+    kDib,
+    kXps,
+  };
+
+  // "jpeg", "png", "tiff", "pdf", "dib" or "xps".
+  const char *ScanFormatName(ScanFormat format);
+  std::optional<ScanFormat> ParseScanFormat(const std::string &name);
+  // Names of the formats |is_supported| accepts, separated by commas.
+  std::string SupportedScanFormatNames(const std::function<bool(ScanFormat)> &is_supported);
+
+  // MIME type used by eSCL, or an empty string for formats eSCL lacks.
+  const char *ScanFormatMimeType(ScanFormat format);
+
+  // Whether pages in |format| can be decoded for post-scan processing.
+  bool IsDecodableScanFormat(ScanFormat format);
+
+  // Returns the format closest to |requested| that |is_supported| accepts,
+  // so pages arrive in the wanted format instead of being transcoded. When
+  // |decodable| is set only formats the page pipeline can read qualify.
+  std::optional<ScanFormat> NegotiateScanFormat(ScanFormat requested, bool decodable,
+                                                const std::function<bool(ScanFormat)> &is_supported);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_FORMAT_H_
@@ -0,0 +1,111 @@
+#include "scan_preview.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace quick_scanner_plus
+{
+
+  ScanPreview::ScanPreview(uint32_t max_edge) : max_edge_(std::max<uint32_t>(max_edge, 1)) {}
+
+  void ScanPreview::SetUpdateCallback(UpdateCallback callback)
+  {
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    callback_ = std::move(callback);
+  }
+
+  uint64_t ScanPreview::BeginPage(uint32_t width, uint32_t height)
+  {
+    uint64_t page;
+    {
+      std::lock_guard<std::mutex> lock(frame_mutex_);
+      // An integer factor keeps sampling a plain stride over the page rows.
+      scale_ = (std::max(width, height) + max_edge_ - 1) / max_edge_;
+      scale_ = std::max<uint32_t>(scale_, 1);
+      frame_width_ = (width + scale_ - 1) / scale_;
+      frame_height_ = (height + scale_ - 1) / scale_;
+      // Unscanned parts of the page show as white paper.
+      frame_.assign(static_cast<size_t>(frame_width_) * frame_height_ * 4, 0xFF);
+      page = ++page_;
+      version_++;
+    }
+
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (callback_)
+    {
+      callback_();
+    }
+    return page;
+  }
+
+  void ScanPreview::Observe(uint64_t page, const TileRow &row)
+  {
+    {
+      std::lock_guard<std::mutex> lock(frame_mutex_);
+      if (page != page_)
+      {
+        return;
+      }
+
+      version_++;
+      // First page row in this strip that lands on a frame row.
+      uint32_t first = (row.y() + scale_ - 1) / scale_ * scale_ - row.y();
+      for (uint32_t r = first; r < row.height(); r += scale_)
+      {
+        uint32_t fy = (row.y() + r) / scale_;
+        if (fy >= frame_height_)
+        {
+          break;
+        }
+        uint8_t *dst_row = frame_.data() + static_cast<size_t>(fy) * frame_width_ * 4;
+        for (const auto &tile : row.tiles())
+        {
+          auto bpp = BytesPerPixel(tile->format);
+          const uint8_t *src_row = tile->Row(r);
+          uint32_t x = (tile->x + scale_ - 1) / scale_ * scale_;
+          for (; x < tile->x + tile->width; x += scale_)
+          {
+            const uint8_t *src = src_row + (x - tile->x) * bpp;
+            uint8_t *dst = dst_row + static_cast<size_t>(x / scale_) * 4;
+            if (tile->format == PixelFormat::kGray8)
+            {
+              dst[0] = dst[1] = dst[2] = src[0];
+            }
+            else
+            {
+              // BGRA to the RGBA Flutter pixel buffers expect.
+              dst[0] = src[2];
+              dst[1] = src[1];
+              dst[2] = src[0];
+            }
+            dst[3] = 0xFF;
+          }
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(callback_mutex_);
+    if (callback_)
+    {
+      callback_();
+    }
+  }
+
+  bool ScanPreview::CopyFrame(Frame &frame) const
+  {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (frame_.empty())
+    {
+      return false;
+    }
+    if (frame.version != version_)
+    {
+      frame.pixels.assign(frame_.begin(), frame_.end());
+      frame.width = frame_width_;
+      frame.height = frame_height_;
+      frame.version = version_;
+    }
+    return true;
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,71 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_PREVIEW_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_PREVIEW_H_
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "tiled_image.h"
+
+namespace quick_scanner_plus
+{
+
+  // A live, downsampled RGBA copy of the page being processed, filled strip
+  // by strip from the page pass so it can be shown while the page is still
+  // being read. Only one frame is ever held; each page overwrites the last.
+  // Readers take copies, so a slow reader never holds up the page pass.
+  class ScanPreview
+  {
+  public:
+    static constexpr uint32_t kDefaultMaxEdge = 1024;
+
+    // Called after every strip that changed the frame. May run on any thread.
+    using UpdateCallback = std::function<void()>;
+
+    // |max_edge| bounds the longer side of the frame in pixels.
+    explicit ScanPreview(uint32_t max_edge = kDefaultMaxEdge);
+
+    ScanPreview(const ScanPreview &) = delete;
+    ScanPreview &operator=(const ScanPreview &) = delete;
+
+    void SetUpdateCallback(UpdateCallback callback);
+
+    // Starts showing a |width| x |height| page and clears the frame. Returns
+    // a token for Observe; strips of a page that has since been replaced by
+    // a newer one are ignored.
+    uint64_t BeginPage(uint32_t width, uint32_t height);
+    void Observe(uint64_t page, const TileRow &row);
+
+    struct Frame
+    {
+      // RGBA, empty before the first page.
+      std::vector<uint8_t> pixels;
+      uint32_t width = 0;
+      uint32_t height = 0;
+      // Changes whenever the frame does.
+      uint64_t version = 0;
+    };
+    // Copies the current frame into |frame| under a short lock, or leaves it
+    // as it is when it already holds this version. Reusing |frame| reuses
+    // its buffer. Returns false before the first page.
+    bool CopyFrame(Frame &frame) const;
+
+  private:
+    uint32_t max_edge_;
+    UpdateCallback callback_;
+    std::mutex callback_mutex_;
+
+    mutable std::mutex frame_mutex_;
+    std::vector<uint8_t> frame_;
+    uint64_t version_ = 0;
+    uint32_t frame_width_ = 0;
+    uint32_t frame_height_ = 0;
+    // Page pixels per frame pixel along each axis.
+    uint32_t scale_ = 1;
+    uint64_t page_ = 0;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_PREVIEW_H_
@@ -0,0 +1,566 @@
+#include "scan_store.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "file_io.h"
+
+namespace fs = std::filesystem;
+
+namespace quick_scanner_plus
+{
+
+  // A whole file mapped read-only.
+  class MappedFile
+  {
+  public:
+    // |path| is UTF-8. Throws std::runtime_error if it cannot be mapped.
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *data() const { return data_; }
+    uint64_t size() const { return size_; }
+
+  private:
+    void Close();
+
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+    const uint8_t *data_ = nullptr;
+    uint64_t size_ = 0;
+  };
+
+#ifdef _WIN32
+  MappedFile::MappedFile(const std::string &path)
+  {
+    // The store keeps appending to the file through its own handle.
+    file_ = CreateFileW(fs::u8path(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size))
+    {
+      Close();
+      throw std::runtime_error("Could not open pack file " + path);
+    }
+    size_ = static_cast<uint64_t>(size.QuadPart);
+    if (size_ == 0)
+    {
+      return;
+    }
+    mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_)
+    {
+      data_ = static_cast<const uint8_t *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!data_)
+    {
+      Close();
+      throw std::runtime_error("Could not map pack file " + path);
+    }
+  }
+
+  void MappedFile::Close()
+  {
+    if (data_)
+    {
+      UnmapViewOfFile(data_);
+      data_ = nullptr;
+    }
+    if (mapping_)
+    {
+      CloseHandle(mapping_);
+      mapping_ = nullptr;
+    }
+    if (file_ != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(file_);
+      file_ = INVALID_HANDLE_VALUE;
+    }
+  }
+#else
+  MappedFile::MappedFile(const std::string &path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      throw std::runtime_error("Could not open pack file " + path);
+    }
+    size_ = static_cast<uint64_t>(info.st_size);
+    if (size_ > 0)
+    {
+      void *data = mmap(nullptr, static_cast<size_t>(size_), PROT_READ, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED)
+      {
+        data_ = static_cast<const uint8_t *>(data);
+      }
+    }
+    // The mapping stays valid without the descriptor.
+    close(fd);
+    if (size_ > 0 && !data_)
+    {
+      throw std::runtime_error("Could not map pack file " + path);
+    }
+  }
+
+  void MappedFile::Close()
+  {
+    if (data_)
+    {
+      munmap(const_cast<uint8_t *>(data_), static_cast<size_t>(size_));
+      data_ = nullptr;
+    }
+  }
+#endif
+
+  MappedFile::~MappedFile()
+  {
+    Close();
+  }
+
+  namespace
+  {
+
+    const char kIndexMagic[4] = {'Q', 'S', 'P', 'I'};
+    const char kStringsMagic[4] = {'Q', 'S', 'P', 'S'};
+    const uint8_t kVersion = 1;
+    const size_t kHeaderSize = sizeof(kIndexMagic) + 1;
+
+    // Index record: time (8), pack offset (8), job, device, page, pack,
+    // size, thumbnail size (4 each), format (1), reserved (3), checksum of
+    // the preceding bytes (4).
+    const size_t kRecordSize = 48;
+    const size_t kChecksumOffset = 44;
+
+    // Longer names can only come from a corrupted length field.
+    const uint32_t kMaxName = 64 * 1024;
+
+    uint32_t Checksum(const uint8_t *data, size_t size)
+    {
+      // FNV-1a; catches records that were only partly written.
+      uint32_t hash = 2166136261u;
+      for (size_t i = 0; i < size; i++)
+      {
+        hash = (hash ^ data[i]) * 16777619u;
+      }
+      return hash;
+    }
+
+    void Sync(int fd, const std::string &path)
+    {
+      if (SyncFd(fd) != 0)
+      {
+        throw std::runtime_error("Could not flush " + path);
+      }
+    }
+
+    void WriteAll(int fd, const uint8_t *data, size_t size, const std::string &path)
+    {
+      if (!WriteAllFd(fd, data, size))
+      {
+        throw std::runtime_error("Could not write " + path);
+      }
+    }
+
+    // Cuts |fd| back to |valid_end| and starts a new file with |magic| when
+    // it was empty.
+    void Repair(int fd, const std::vector<uint8_t> &contents, size_t valid_end, const char *magic,
+                const std::string &path)
+    {
+      if (valid_end == 0)
+      {
+        uint8_t header[kHeaderSize];
+        std::memcpy(header, magic, sizeof(kIndexMagic));
+        header[sizeof(kIndexMagic)] = kVersion;
+        if (TruncateFd(fd, 0) != 0 || SeekEnd(fd) < 0)
+        {
+          throw std::runtime_error("Could not reset " + path);
+        }
+        WriteAll(fd, header, sizeof(header), path);
+      }
+      else if (valid_end != contents.size() && TruncateFd(fd, static_cast<long long>(valid_end)) != 0)
+      {
+        throw std::runtime_error("Could not truncate " + path);
+      }
+      SeekEnd(fd);
+    }
+
+    bool HasHeader(const std::vector<uint8_t> &contents, const char *magic)
+    {
+      return contents.size() >= kHeaderSize && std::memcmp(contents.data(), magic, sizeof(kIndexMagic)) == 0 &&
+             contents[sizeof(kIndexMagic)] == kVersion;
+    }
+
+  } // namespace
+
+  ScanStore::ScanStore(const std::string &root) : root_(root)
+  {
+    std::error_code error;
+    fs::create_directories(fs::u8path(root_), error);
+    auto index_path = (fs::u8path(root_) / "index.qsidx").u8string();
+    auto strings_path = (fs::u8path(root_) / "strings.qsstr").u8string();
+    index_fd_ = OpenFd(index_path);
+    if (index_fd_ >= 0 && !LockFd(index_fd_))
+    {
+      CloseFiles();
+      throw std::runtime_error("Scan store " + root_ + " is already open.");
+    }
+    strings_fd_ = OpenFd(strings_path);
+    if (index_fd_ < 0 || strings_fd_ < 0)
+    {
+      CloseFiles();
+      throw std::runtime_error("Could not open scan store " + root_);
+    }
+    try
+    {
+      Load();
+    }
+    catch (...)
+    {
+      CloseFiles();
+      throw;
+    }
+  }
+
+  ScanStore::~ScanStore()
+  {
+    CloseFiles();
+  }
+
+  void ScanStore::CloseFiles()
+  {
+    for (int *fd : {&index_fd_, &strings_fd_, &pack_fd_})
+    {
+      if (*fd >= 0)
+      {
+        CloseFd(*fd);
+        *fd = -1;
+      }
+    }
+  }
+
+  void ScanStore::Load()
+  {
+    auto strings_path = (fs::u8path(root_) / "strings.qsstr").u8string();
+    auto strings = ReadAllFd(strings_fd_);
+    size_t valid_end = 0;
+    if (HasHeader(strings, kStringsMagic))
+    {
+      size_t pos = kHeaderSize;
+      valid_end = pos;
+      while (strings.size() - pos >= 4)
+      {
+        auto length = static_cast<uint32_t>(LoadLittleEndian(&strings[pos], 4));
+        if (length > kMaxName || strings.size() - pos - 4 < length)
+        {
+          break;
+        }
+        std::string name(reinterpret_cast<const char *>(&strings[pos + 4]), length);
+        name_ids_.emplace(name, static_cast<uint32_t>(names_.size()));
+        names_.push_back(std::move(name));
+        pos += 4 + length;
+        valid_end = pos;
+      }
+    }
+    Repair(strings_fd_, strings, valid_end, kStringsMagic, strings_path);
+
+    auto index_path = (fs::u8path(root_) / "index.qsidx").u8string();
+    auto index = ReadAllFd(index_fd_);
+    valid_end = 0;
+    if (HasHeader(index, kIndexMagic))
+    {
+      valid_end = kHeaderSize;
+      records_.reserve((index.size() - kHeaderSize) / kRecordSize);
+      for (size_t pos = kHeaderSize; index.size() - pos >= kRecordSize; pos += kRecordSize)
+      {
+        const uint8_t *p = &index[pos];
+        if (Checksum(p, kChecksumOffset) != LoadLittleEndian(p + kChecksumOffset, 4))
+        {
+          break;
+        }
+        Record record;
+        record.time_ms = static_cast<int64_t>(LoadLittleEndian(p, 8));
+        record.offset = LoadLittleEndian(p + 8, 8);
+        record.job = static_cast<uint32_t>(LoadLittleEndian(p + 16, 4));
+        record.device = static_cast<uint32_t>(LoadLittleEndian(p + 20, 4));
+        record.page = static_cast<uint32_t>(LoadLittleEndian(p + 24, 4));
+        record.pack = static_cast<uint32_t>(LoadLittleEndian(p + 28, 4));
+        record.size = LoadLittleEndian(p + 32, 4);
+        record.thumbnail_size = static_cast<uint32_t>(LoadLittleEndian(p + 36, 4));
+        record.format = p[40];
+        if (record.job >= names_.size() || record.device >= names_.size())
+        {
+          break;
+        }
+        records_.push_back(record);
+        auto &pages = job_pages_[record.job];
+        if (record.page > pages)
+        {
+          pages = record.page;
+        }
+        valid_end = pos + kRecordSize;
+      }
+    }
+    Repair(index_fd_, index, valid_end, kIndexMagic, index_path);
+
+    // Data written after the last record belongs to a page that was never
+    // indexed; it stays in the pack unreferenced.
+    pack_ = records_.empty() ? 0 : records_.back().pack;
+    pack_fd_ = OpenFd(PackPath(pack_));
+    long long end = pack_fd_ < 0 ? -1 : SeekEnd(pack_fd_);
+    if (end < 0)
+    {
+      throw std::runtime_error("Could not open " + PackPath(pack_));
+    }
+    pack_size_ = static_cast<uint64_t>(end);
+  }
+
+  uint32_t ScanStore::Intern(const std::string &name)
+  {
+    auto it = name_ids_.find(name);
+    if (it != name_ids_.end())
+    {
+      return it->second;
+    }
+    if (name.size() > kMaxName)
+    {
+      throw std::runtime_error("Name too long for the scan store.");
+    }
+    std::vector<uint8_t> entry(4 + name.size());
+    StoreLittleEndian(entry.data(), name.size(), 4);
+    std::memcpy(entry.data() + 4, name.data(), name.size());
+    WriteAll(strings_fd_, entry.data(), entry.size(), root_);
+    auto id = static_cast<uint32_t>(names_.size());
+    name_ids_.emplace(name, id);
+    names_.push_back(name);
+    return id;
+  }
+
+  uint64_t ScanStore::AddPage(const std::string &job_id, const std::string &device_id, ScanFormat format,
+                              int64_t time_ms, const uint8_t *data, size_t size, const uint8_t *thumbnail,
+                              size_t thumbnail_size)
+  {
+    if (size > UINT32_MAX || thumbnail_size > UINT32_MAX)
+    {
+      throw std::runtime_error("Page too large for the scan store.");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pack_size_ > 0 && pack_size_ + size + thumbnail_size > kMaxPackBytes)
+    {
+      int fd = OpenFd(PackPath(pack_ + 1));
+      if (fd < 0)
+      {
+        throw std::runtime_error("Could not create " + PackPath(pack_ + 1));
+      }
+      CloseFd(pack_fd_);
+      pack_fd_ = fd;
+      pack_++;
+      pack_size_ = static_cast<uint64_t>(SeekEnd(pack_fd_));
+    }
+
+    Record record;
+    record.time_ms = time_ms;
+    record.pack = pack_;
+    record.offset = pack_size_;
+    record.size = size;
+    record.thumbnail_size = static_cast<uint32_t>(thumbnail_size);
+    record.format = static_cast<uint8_t>(format);
+    try
+    {
+      WriteAll(pack_fd_, data, size, PackPath(pack_));
+      WriteAll(pack_fd_, thumbnail, thumbnail_size, PackPath(pack_));
+    }
+    catch (...)
+    {
+      // Whatever made it to the pack is unreferenced; carry on after it.
+      pack_size_ = static_cast<uint64_t>(SeekEnd(pack_fd_));
+      throw;
+    }
+    pack_size_ += size + thumbnail_size;
+    auto names = names_.size();
+    record.job = Intern(job_id);
+    record.device = Intern(device_id);
+    record.page = job_pages_[record.job] + 1;
+
+    // Everything the record points to reaches the disk before the record
+    // does, so a power loss cannot leave a record for missing data.
+    Sync(pack_fd_, PackPath(pack_));
+    if (names_.size() != names)
+    {
+      Sync(strings_fd_, root_);
+    }
+
+    uint8_t encoded[kRecordSize] = {};
+    StoreLittleEndian(encoded, static_cast<uint64_t>(record.time_ms), 8);
+    StoreLittleEndian(encoded + 8, record.offset, 8);
+    StoreLittleEndian(encoded + 16, record.job, 4);
+    StoreLittleEndian(encoded + 20, record.device, 4);
+    StoreLittleEndian(encoded + 24, record.page, 4);
+    StoreLittleEndian(encoded + 28, record.pack, 4);
+    StoreLittleEndian(encoded + 32, record.size, 4);
+    StoreLittleEndian(encoded + 36, record.thumbnail_size, 4);
+    encoded[40] = record.format;
+    StoreLittleEndian(encoded + kChecksumOffset, Checksum(encoded, kChecksumOffset), 4);
+    WriteAll(index_fd_, encoded, sizeof(encoded), root_);
+    Sync(index_fd_, root_);
+
+    records_.push_back(record);
+    job_pages_[record.job] = record.page;
+    return records_.size();
+  }
+
+  uint64_t ScanStore::AddPageFile(const std::string &job_id, const std::string &device_id, ScanFormat format,
+                                  int64_t time_ms, const std::string &path, const std::vector<uint8_t> &thumbnail)
+  {
+    std::ifstream in(fs::u8path(path), std::ios::binary);
+    if (!in)
+    {
+      throw std::runtime_error("Could not read " + path);
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return AddPage(job_id, device_id, format, time_ms, data.data(), data.size(), thumbnail.data(), thumbnail.size());
+  }
+
+  std::vector<StoredPage> ScanStore::Query(const ScanQuery &query) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<StoredPage> pages;
+    uint32_t job = 0;
+    uint32_t device = 0;
+    for (auto [filter, id] : {std::make_pair(&query.job_id, &job), std::make_pair(&query.device_id, &device)})
+    {
+      if (*filter)
+      {
+        auto it = name_ids_.find(**filter);
+        if (it == name_ids_.end())
+        {
+          return pages;
+        }
+        *id = it->second;
+      }
+    }
+
+    size_t skipped = 0;
+    for (size_t i = 0; i < records_.size() && pages.size() < query.limit; i++)
+    {
+      const auto &record = records_[i];
+      if ((query.job_id && record.job != job) || (query.device_id && record.device != device) ||
+          record.time_ms < query.from_ms || record.time_ms > query.to_ms)
+      {
+        continue;
+      }
+      if (skipped < query.offset)
+      {
+        skipped++;
+        continue;
+      }
+      pages.push_back(Describe(i + 1));
+    }
+    return pages;
+  }
+
+  std::optional<StoredPage> ScanStore::Find(uint64_t id) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id == 0 || id > records_.size())
+    {
+      return std::nullopt;
+    }
+    return Describe(id);
+  }
+
+  size_t ScanStore::page_count() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_.size();
+  }
+
+  StoredBytes ScanStore::ReadPage(uint64_t id) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto &record = Get(id);
+    return Read(record.pack, record.offset, record.size);
+  }
+
+  StoredBytes ScanStore::ReadThumbnail(uint64_t id) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto &record = Get(id);
+    return Read(record.pack, record.offset + record.size, record.thumbnail_size);
+  }
+
+  const ScanStore::Record &ScanStore::Get(uint64_t id) const
+  {
+    if (id == 0 || id > records_.size())
+    {
+      throw std::runtime_error("Unknown stored page " + std::to_string(id));
+    }
+    return records_[id - 1];
+  }
+
+  StoredPage ScanStore::Describe(uint64_t id) const
+  {
+    const auto &record = records_[id - 1];
+    StoredPage page;
+    page.id = id;
+    page.job_id = names_[record.job];
+    page.page = record.page;
+    page.device_id = names_[record.device];
+    page.time_ms = record.time_ms;
+    page.format = static_cast<ScanFormat>(record.format);
+    page.size = record.size;
+    page.thumbnail_size = record.thumbnail_size;
+    return page;
+  }
+
+  StoredBytes ScanStore::Read(uint32_t pack, uint64_t offset, uint64_t size) const
+  {
+    if (size == 0)
+    {
+      return StoredBytes();
+    }
+    auto &mapping = mapped_[pack];
+    // The current pack grows; map it again once it outgrows the mapping.
+    if (!mapping || mapping->size() < offset + size)
+    {
+      mapping = std::make_shared<const MappedFile>(PackPath(pack));
+      if (mapping->size() < offset + size)
+      {
+        throw std::runtime_error("Pack file " + PackPath(pack) + " is truncated.");
+      }
+    }
+    return StoredBytes(mapping, mapping->data() + offset, static_cast<size_t>(size));
+  }
+
+  std::string ScanStore::PackPath(uint32_t pack) const
+  {
+    char name[32];
+    std::snprintf(name, sizeof(name), "pack-%05u.qspack", pack);
+    return (fs::u8path(root_) / name).u8string();
+  }
+
+} // namespace quick_scanner_plus
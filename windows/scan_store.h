@@ -0,0 +1,154 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_STORE_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "scan_format.h"
+
+namespace quick_scanner_plus
+{
+
+  class MappedFile;
+
+  struct StoredPage
+  {
+    uint64_t id = 0;
+    std::string job_id;
+    // 1-based position within the job.
+    uint32_t page = 0;
+    std::string device_id;
+    // Unix time in milliseconds.
+    int64_t time_ms = 0;
+    ScanFormat format = ScanFormat::kJpeg;
+    uint64_t size = 0;
+    uint32_t thumbnail_size = 0;
+  };
+
+  // Filters of ScanStore::Query. Unset fields match every page.
+  struct ScanQuery
+  {
+    std::optional<std::string> job_id;
+    std::optional<std::string> device_id;
+    int64_t from_ms = (std::numeric_limits<int64_t>::min)();
+    int64_t to_ms = (std::numeric_limits<int64_t>::max)();
+    // Matches skipped, then matches returned, in the order pages were added.
+    size_t offset = 0;
+    size_t limit = (std::numeric_limits<size_t>::max)();
+  };
+
+  // Bytes of a stored page or thumbnail, read straight from a memory-mapped
+  // pack file. Stays valid while this object is alive.
+  class StoredBytes
+  {
+  public:
+    StoredBytes() = default;
+    StoredBytes(std::shared_ptr<const MappedFile> file, const uint8_t *data, size_t size)
+        : file_(std::move(file)), data_(data), size_(size) {}
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    std::shared_ptr<const MappedFile> file_;
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+  };
+
+  // Keeps scanned pages in a directory of append-only pack files, with a
+  // compact index of job, page, device, time and size held in memory, so
+  // listing and searching never walk the file system.
+  //
+  // Page data, including an optional thumbnail, is appended to the current
+  // pack; the pack rolls over once it passes kMaxPackBytes. Each page then
+  // gets a fixed-size index record. Names are interned in a string table,
+  // so queries compare integers. The data a record points to is flushed to
+  // disk before the record is written, the record is flushed before AddPage
+  // returns, and a torn record at the end is cut off on open, so a crash or
+  // power loss loses at most the page being added. Reads map the pack files
+  // instead of copying them.
+  //
+  // Thread-safe. Only one ScanStore may have a directory open at a time, in
+  // this process or another; opening a second one throws.
+  class ScanStore
+  {
+  public:
+    static constexpr uint64_t kMaxPackBytes = 1024ull * 1024 * 1024;
+
+    // Opens or creates the store in |root| (UTF-8). Throws
+    // std::runtime_error if it cannot be opened or is already open.
+    explicit ScanStore(const std::string &root);
+    ~ScanStore();
+
+    ScanStore(const ScanStore &) = delete;
+    ScanStore &operator=(const ScanStore &) = delete;
+
+    // Appends a page to |job_id| after the pages already stored for it and
+    // returns its ID.
+    uint64_t AddPage(const std::string &job_id, const std::string &device_id, ScanFormat format, int64_t time_ms,
+                     const uint8_t *data, size_t size, const uint8_t *thumbnail = nullptr,
+                     size_t thumbnail_size = 0);
+    // Same, reading the page from the file at |path| (UTF-8).
+    uint64_t AddPageFile(const std::string &job_id, const std::string &device_id, ScanFormat format,
+                         int64_t time_ms, const std::string &path,
+                         const std::vector<uint8_t> &thumbnail = std::vector<uint8_t>());
+
+    std::vector<StoredPage> Query(const ScanQuery &query) const;
+    std::optional<StoredPage> Find(uint64_t id) const;
+    size_t page_count() const;
+
+    // Throw std::runtime_error if |id| is unknown. A page stored without a
+    // thumbnail has an empty one.
+    StoredBytes ReadPage(uint64_t id) const;
+    StoredBytes ReadThumbnail(uint64_t id) const;
+
+  private:
+    // An index record. A page's ID is its record's position, counted from 1.
+    struct Record
+    {
+      int64_t time_ms;
+      uint32_t job;
+      uint32_t device;
+      uint32_t page;
+      uint32_t pack;
+      uint64_t offset;
+      uint64_t size;
+      uint32_t thumbnail_size;
+      uint8_t format;
+    };
+
+    void Load();
+    void CloseFiles();
+    uint32_t Intern(const std::string &name);
+    const Record &Get(uint64_t id) const;
+    StoredPage Describe(uint64_t id) const;
+    StoredBytes Read(uint32_t pack, uint64_t offset, uint64_t size) const;
+    std::string PackPath(uint32_t pack) const;
+
+    std::string root_;
+    mutable std::mutex mutex_;
+    int index_fd_ = -1;
+    int strings_fd_ = -1;
+    int pack_fd_ = -1;
+    uint32_t pack_ = 0;
+    uint64_t pack_size_ = 0;
+
+    std::vector<Record> records_;
+    std::vector<std::string> names_;
+    std::map<std::string, uint32_t> name_ids_;
+    // Pages stored per job, by interned job name.
+    std::map<uint32_t, uint32_t> job_pages_;
+    mutable std::map<uint32_t, std::shared_ptr<const MappedFile>> mapped_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCAN_STORE_H_
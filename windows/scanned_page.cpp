@@ -0,0 +1,80 @@
+#include "scanned_page.h"
+
+#include <winrt/Windows.Foundation.h>
+#include <winrt/Windows.Graphics.Imaging.h>
+#include <winrt/Windows.Storage.Streams.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace winrt;
+using namespace Windows::Graphics::Imaging;
+using namespace Windows::Storage;
+using namespace Windows::Storage::Streams;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // The full-width rows last decoded. Tiles of a strip are requested left
+    // to right, so one decode serves the whole strip instead of one per
+    // tile; codecs such as JPEG decode from the top for every request.
+    struct DecodedStrip
+    {
+      uint32_t y = 0;
+      uint32_t height = 0;
+      com_array<uint8_t> pixels;
+    };
+
+  } // namespace
+
+  std::unique_ptr<TiledImage> OpenScannedPage(StorageFile const &file)
+  {
+    IRandomAccessStream stream = file.OpenAsync(FileAccessMode::Read).get();
+    BitmapDecoder decoder = BitmapDecoder::CreateAsync(stream).get();
+
+    // Gray scans stay one byte per pixel, a quarter of the BGRA size.
+    auto source_format = decoder.BitmapPixelFormat();
+    bool gray = source_format == BitmapPixelFormat::Gray8 || source_format == BitmapPixelFormat::Gray16;
+    auto format = gray ? PixelFormat::kGray8 : PixelFormat::kBgra8;
+    uint32_t width = decoder.PixelWidth();
+    size_t bpp = BytesPerPixel(format);
+
+    // Loader calls are serialized, so the strip needs no lock.
+    auto strip = std::make_shared<DecodedStrip>();
+    auto loader = [stream, decoder, strip, gray, width, bpp](Tile &tile)
+    {
+      if (strip->pixels.empty() || strip->y != tile.y || strip->height != tile.height)
+      {
+        strip->pixels = com_array<uint8_t>();
+        BitmapTransform transform;
+        transform.Bounds(BitmapBounds{0, tile.y, width, tile.height});
+        auto provider = decoder.GetPixelDataAsync(
+                                   gray ? BitmapPixelFormat::Gray8 : BitmapPixelFormat::Bgra8,
+                                   BitmapAlphaMode::Ignore, transform, ExifOrientationMode::IgnoreExifOrientation,
+                                   ColorManagementMode::DoNotColorManage)
+                            .get();
+        strip->pixels = provider.DetachPixelData();
+        strip->y = tile.y;
+        strip->height = tile.height;
+      }
+
+      size_t strip_stride = width * bpp;
+      size_t copy = std::min(tile.stride, strip_stride - tile.x * bpp);
+      for (uint32_t r = 0; r < tile.height && (r + 1) * strip_stride <= strip->pixels.size(); r++)
+      {
+        std::memcpy(tile.Row(r), strip->pixels.data() + r * strip_stride + tile.x * bpp, copy);
+      }
+      // The rightmost tile is the last one of its strip.
+      if (tile.x + tile.width == width)
+      {
+        strip->pixels = com_array<uint8_t>();
+      }
+    };
+
+    return std::make_unique<TiledImage>(width, decoder.PixelHeight(), format, loader);
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,20 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCANNED_PAGE_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCANNED_PAGE_H_
+
+#include <winrt/Windows.Storage.h>
+
+#include <memory>
+
+#include "tiled_image.h"
+
+namespace quick_scanner_plus
+{
+
+  // Opens a file written by the scanner driver as a tiled image. Tiles are
+  // decoded from the file on demand, so the page is never decoded in full.
+  // Blocks on WinRT async calls; must not be called from the platform thread.
+  std::unique_ptr<TiledImage> OpenScannedPage(winrt::Windows::Storage::StorageFile const &file);
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SCANNED_PAGE_H_
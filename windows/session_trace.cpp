@@ -0,0 +1,360 @@
+#include "session_trace.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "file_io.h"
+
+namespace fs = std::filesystem;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    const char kMagic[4] = {'Q', 'S', 'P', 'T'};
+    const uint8_t kVersion = 1;
+
+    // Larger strings can only come from a corrupted length field.
+    const uint32_t kMaxString = 1024 * 1024;
+
+    void PutString(std::vector<uint8_t> &out, const std::string &text)
+    {
+      AppendLittleEndian(out, text.size(), 4);
+      out.insert(out.end(), text.begin(), text.end());
+    }
+
+    bool ReadLittleEndian(std::ifstream &in, uint64_t &value, int bytes)
+    {
+      uint8_t buffer[8];
+      if (!in.read(reinterpret_cast<char *>(buffer), bytes))
+      {
+        return false;
+      }
+      value = LoadLittleEndian(buffer, bytes);
+      return true;
+    }
+
+    bool GetString(std::ifstream &in, std::string &text)
+    {
+      uint64_t size;
+      if (!ReadLittleEndian(in, size, 4) || size > kMaxString)
+      {
+        return false;
+      }
+      text.resize(static_cast<size_t>(size));
+      return size == 0 || static_cast<bool>(in.read(&text[0], static_cast<std::streamsize>(size)));
+    }
+
+    // |name| in |directory|, numbered like Windows does when it is taken.
+    fs::path UniquePath(const fs::path &directory, const fs::path &name)
+    {
+      fs::path candidate = directory / name;
+      for (int n = 2; fs::exists(candidate); n++)
+      {
+        candidate = directory / fs::u8path(name.stem().u8string() + " (" + std::to_string(n) + ")" +
+                                           name.extension().u8string());
+      }
+      return candidate;
+    }
+
+  } // namespace
+
+  SessionRecorder::SessionRecorder(const std::string &path)
+      : file_(fs::u8path(path), std::ios::binary | std::ios::trunc), start_(std::chrono::steady_clock::now())
+  {
+    if (!file_)
+    {
+      throw std::runtime_error("Could not create session trace " + path);
+    }
+    file_.write(kMagic, sizeof(kMagic));
+    file_.put(static_cast<char>(kVersion));
+    file_.flush();
+  }
+
+  void SessionRecorder::DeviceAdded(const std::string &device_id, const std::string &name)
+  {
+    Write(TraceEventType::kDeviceAdded, device_id, std::string(), name, {});
+  }
+
+  void SessionRecorder::DeviceRemoved(const std::string &device_id)
+  {
+    Write(TraceEventType::kDeviceRemoved, device_id, std::string(), std::string(), {});
+  }
+
+  void SessionRecorder::ScanStart(const std::string &device_id)
+  {
+    Write(TraceEventType::kScanStart, device_id, std::string(), std::string(), {});
+  }
+
+  void SessionRecorder::Capability(const std::string &device_id, const std::string &key, const std::string &value)
+  {
+    Write(TraceEventType::kCapability, device_id, key, value, {});
+  }
+
+  void SessionRecorder::Page(const std::string &device_id, const std::string &path)
+  {
+    fs::path file = fs::u8path(path);
+    std::ifstream in(file, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    Write(TraceEventType::kPage, device_id, file.filename().u8string(), std::string(), data);
+  }
+
+  void SessionRecorder::ScanEnd(const std::string &device_id, const std::string &status)
+  {
+    Write(TraceEventType::kScanEnd, device_id, std::string(), status, {});
+  }
+
+  void SessionRecorder::Write(TraceEventType type, const std::string &device_id, const std::string &key,
+                              const std::string &value, const std::vector<uint8_t> &data)
+  {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_);
+    std::vector<uint8_t> record;
+    record.push_back(static_cast<uint8_t>(type));
+    AppendLittleEndian(record, static_cast<uint64_t>(elapsed.count()), 8);
+    PutString(record, device_id);
+    PutString(record, key);
+    PutString(record, value);
+    AppendLittleEndian(record, data.size(), 4);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_.write(reinterpret_cast<const char *>(record.data()), static_cast<std::streamsize>(record.size()));
+    file_.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    file_.flush();
+  }
+
+  RecordedScan::RecordedScan(std::shared_ptr<SessionRecorder> recorder, std::string device_id)
+      : recorder_(std::move(recorder)), device_id_(std::move(device_id))
+  {
+    if (recorder_)
+    {
+      recorder_->ScanStart(device_id_);
+    }
+  }
+
+  RecordedScan::~RecordedScan()
+  {
+    if (recorder_)
+    {
+      recorder_->ScanEnd(device_id_, succeeded_ ? "ok" : "failed");
+    }
+  }
+
+  void RecordedScan::Capability(const std::string &key, const std::string &value)
+  {
+    if (recorder_)
+    {
+      recorder_->Capability(device_id_, key, value);
+    }
+  }
+
+  void RecordedScan::Formats(const std::function<bool(ScanFormat)> &is_supported, ScanFormat chosen)
+  {
+    if (!recorder_)
+    {
+      return;
+    }
+    Capability("formats", SupportedScanFormatNames(is_supported));
+    Capability("format", ScanFormatName(chosen));
+  }
+
+  void RecordedScan::Page(const std::string &path)
+  {
+    if (recorder_)
+    {
+      recorder_->Page(device_id_, path);
+    }
+  }
+
+  void RecordedScan::Succeeded()
+  {
+    succeeded_ = true;
+  }
+
+  std::shared_ptr<const SessionTrace> SessionTrace::Load(const std::string &path)
+  {
+    std::ifstream in(fs::u8path(path), std::ios::binary);
+    char magic[sizeof(kMagic)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), kMagic) ||
+        in.get() != kVersion)
+    {
+      throw std::runtime_error(path + " is not a session trace.");
+    }
+    const uint64_t file_size = fs::file_size(fs::u8path(path));
+
+    auto trace = std::make_shared<SessionTrace>();
+    trace->path_ = path;
+    while (true)
+    {
+      int type = in.get();
+      if (type == std::char_traits<char>::eof())
+      {
+        break;
+      }
+      Event event;
+      event.type = static_cast<TraceEventType>(type);
+      uint64_t data_size;
+      if (!ReadLittleEndian(in, event.time_us, 8) || !GetString(in, event.device_id) || !GetString(in, event.key) ||
+          !GetString(in, event.value) || !ReadLittleEndian(in, data_size, 4))
+      {
+        break;
+      }
+      event.data_offset = static_cast<uint64_t>(in.tellg());
+      event.data_size = static_cast<uint32_t>(data_size);
+      if (event.data_offset + event.data_size > file_size)
+      {
+        break;
+      }
+      in.seekg(static_cast<std::streamoff>(data_size), std::ios::cur);
+      trace->events_.push_back(std::move(event));
+    }
+    return trace;
+  }
+
+  std::vector<uint8_t> SessionTrace::ReadData(const Event &event) const
+  {
+    std::ifstream in(fs::u8path(path_), std::ios::binary);
+    std::vector<uint8_t> data(event.data_size);
+    in.seekg(static_cast<std::streamoff>(event.data_offset));
+    if (!in.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size())))
+    {
+      throw std::runtime_error("Session trace " + path_ + " is truncated.");
+    }
+    return data;
+  }
+
+  SessionReplayer::SessionReplayer(std::shared_ptr<const SessionTrace> trace, bool realtime)
+      : trace_(std::move(trace)), realtime_(realtime)
+  {
+    // Scans of different devices may overlap in the trace; split them per
+    // device so each replays on its own.
+    std::map<std::string, RecordedScanIndex> open;
+    const auto &events = trace_->events();
+    for (size_t i = 0; i < events.size(); i++)
+    {
+      const auto &event = events[i];
+      switch (event.type)
+      {
+      case TraceEventType::kScanStart:
+        open[event.device_id] = RecordedScanIndex{{i}};
+        break;
+      case TraceEventType::kCapability:
+      case TraceEventType::kPage:
+      case TraceEventType::kScanEnd:
+      {
+        auto it = open.find(event.device_id);
+        if (it == open.end())
+        {
+          break;
+        }
+        it->second.events.push_back(i);
+        if (event.type == TraceEventType::kScanEnd)
+        {
+          scans_[event.device_id].push_back(std::move(it->second));
+          open.erase(it);
+        }
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+
+  void SessionReplayer::ReplayEnumeration(
+      const std::function<void(const std::string &id, const std::string &name)> &on_added,
+      const std::function<void(const std::string &id)> &on_removed) const
+  {
+    uint64_t now = 0;
+    for (const auto &event : trace_->events())
+    {
+      if (event.type != TraceEventType::kDeviceAdded && event.type != TraceEventType::kDeviceRemoved)
+      {
+        continue;
+      }
+      Wait(now, event.time_us);
+      now = event.time_us;
+      if (event.type == TraceEventType::kDeviceAdded)
+      {
+        on_added(event.device_id, event.value);
+      }
+      else
+      {
+        on_removed(event.device_id);
+      }
+    }
+  }
+
+  SessionReplayer::Scan SessionReplayer::ReplayScan(const std::string &device_id, const std::string &directory,
+                                                    const std::function<void(const std::string &path)> &on_page)
+  {
+    const RecordedScanIndex *recorded = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto scans = scans_.find(device_id);
+      size_t &next = next_scan_[device_id];
+      if (scans == scans_.end() || next >= scans->second.size())
+      {
+        throw std::runtime_error("No recorded scans left for " + device_id + ".");
+      }
+      recorded = &scans->second[next++];
+    }
+
+    const auto &events = trace_->events();
+    Scan scan;
+    uint64_t now = events[recorded->events.front()].time_us;
+    std::string status = "failed";
+    for (size_t index : recorded->events)
+    {
+      const auto &event = events[index];
+      if (event.type == TraceEventType::kCapability && event.key == "format")
+      {
+        if (auto format = ParseScanFormat(event.value))
+        {
+          scan.format = *format;
+        }
+      }
+      else if (event.type == TraceEventType::kPage)
+      {
+        Wait(now, event.time_us);
+        now = event.time_us;
+        auto data = trace_->ReadData(event);
+        auto path = UniquePath(fs::u8path(directory), fs::u8path(event.key));
+        {
+          std::ofstream out(path, std::ios::binary | std::ios::trunc);
+          out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+          if (!out)
+          {
+            throw std::runtime_error("Could not write replayed page " + path.u8string());
+          }
+        }
+        on_page(path.u8string());
+      }
+      else if (event.type == TraceEventType::kScanEnd)
+      {
+        Wait(now, event.time_us);
+        status = event.value;
+      }
+    }
+
+    if (status != "ok")
+    {
+      throw std::runtime_error("Recorded scan ended with: " + status);
+    }
+    return scan;
+  }
+
+  void SessionReplayer::Wait(uint64_t from_us, uint64_t to_us) const
+  {
+    if (realtime_ && to_us > from_us)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(to_us - from_us));
+    }
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,159 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SESSION_TRACE_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SESSION_TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "scan_format.h"
+
+namespace quick_scanner_plus
+{
+
+  enum class TraceEventType : uint8_t
+  {
+    kDeviceAdded = 1,
+    kDeviceRemoved = 2,
+    kScanStart = 3,
+    kCapability = 4,
+    kPage = 5,
+    kScanEnd = 6,
+  };
+
+  // Writes everything a session exchanges with its devices to a trace file:
+  // enumeration events, capability answers, the page files exactly as the
+  // device delivered them, and when each of these happened. Records are
+  // flushed as they are written, so a crashed session still leaves a
+  // readable trace. Safe to call from any thread.
+  class SessionRecorder
+  {
+  public:
+    // |path| is UTF-8. Throws std::runtime_error if the file cannot be created.
+    explicit SessionRecorder(const std::string &path);
+
+    SessionRecorder(const SessionRecorder &) = delete;
+    SessionRecorder &operator=(const SessionRecorder &) = delete;
+
+    void DeviceAdded(const std::string &device_id, const std::string &name);
+    void DeviceRemoved(const std::string &device_id);
+    void ScanStart(const std::string &device_id);
+    void Capability(const std::string &device_id, const std::string &key, const std::string &value);
+    // Copies the page file at |path| (UTF-8) into the trace.
+    void Page(const std::string &device_id, const std::string &path);
+    // |status| is "ok" or the error that ended the scan.
+    void ScanEnd(const std::string &device_id, const std::string &status);
+
+  private:
+    void Write(TraceEventType type, const std::string &device_id, const std::string &key, const std::string &value,
+               const std::vector<uint8_t> &data);
+
+    std::mutex mutex_;
+    std::ofstream file_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  // Records one scan of a session: ScanStart on construction, ScanEnd on
+  // destruction with "failed" unless Succeeded was called first. Does
+  // nothing without a recorder, so scan code can use it unconditionally.
+  class RecordedScan
+  {
+  public:
+    RecordedScan(std::shared_ptr<SessionRecorder> recorder, std::string device_id);
+    ~RecordedScan();
+
+    RecordedScan(const RecordedScan &) = delete;
+    RecordedScan &operator=(const RecordedScan &) = delete;
+
+    void Capability(const std::string &key, const std::string &value);
+    // Records which formats the device accepts and the one that was picked.
+    void Formats(const std::function<bool(ScanFormat)> &is_supported, ScanFormat chosen);
+    void Page(const std::string &path);
+    void Succeeded();
+
+  private:
+    std::shared_ptr<SessionRecorder> recorder_;
+    std::string device_id_;
+    bool succeeded_ = false;
+  };
+
+  // A trace file opened for replay. Only the event index is loaded; page
+  // data is read from the file when a page is replayed.
+  class SessionTrace
+  {
+  public:
+    struct Event
+    {
+      TraceEventType type;
+      uint64_t time_us = 0;
+      std::string device_id;
+      std::string key;
+      std::string value;
+      uint64_t data_offset = 0;
+      uint32_t data_size = 0;
+    };
+
+    // Throws std::runtime_error if |path| (UTF-8) is not a trace file. A
+    // record cut off by a crash ends the trace.
+    static std::shared_ptr<const SessionTrace> Load(const std::string &path);
+
+    const std::vector<Event> &events() const { return events_; }
+    std::vector<uint8_t> ReadData(const Event &event) const;
+
+  private:
+    std::string path_;
+    std::vector<Event> events_;
+  };
+
+  // Plays a recorded session back: enumeration events to the same handlers
+  // live devices feed, and each scan's pages into the scan folder with the
+  // recorded pauses between them, so the plugin's own scan pipeline runs
+  // exactly as it did in the session. Runs without any scanner attached.
+  class SessionReplayer
+  {
+  public:
+    // When |realtime| is false, recorded pauses are skipped.
+    SessionReplayer(std::shared_ptr<const SessionTrace> trace, bool realtime);
+
+    // Calls |on_added| and |on_removed| for the recorded enumeration events,
+    // in order and with their recorded timing. Blocks until done.
+    void ReplayEnumeration(const std::function<void(const std::string &id, const std::string &name)> &on_added,
+                           const std::function<void(const std::string &id)> &on_removed) const;
+
+    struct Scan
+    {
+      // Format the device was configured for, from the recording.
+      ScanFormat format = ScanFormat::kJpeg;
+    };
+
+    // Replays the next recorded scan of |device_id|: writes its pages into
+    // |directory| (UTF-8), calling |on_page| with each new file's path as it
+    // "arrives". Throws std::runtime_error if no recorded scans are left,
+    // or after the pages when the recorded scan failed.
+    Scan ReplayScan(const std::string &device_id, const std::string &directory,
+                    const std::function<void(const std::string &path)> &on_page);
+
+  private:
+    // Event indices of one recorded scan, from ScanStart to ScanEnd.
+    struct RecordedScanIndex
+    {
+      std::vector<size_t> events;
+    };
+
+    void Wait(uint64_t from_us, uint64_t to_us) const;
+
+    std::shared_ptr<const SessionTrace> trace_;
+    bool realtime_;
+    std::mutex mutex_;
+    std::map<std::string, std::vector<RecordedScanIndex>> scans_;
+    std::map<std::string, size_t> next_scan_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SESSION_TRACE_H_
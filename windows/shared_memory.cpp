@@ -0,0 +1,202 @@
+#include "shared_memory.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // Unique per process and call; the process ID keeps daemons started
+    // one after another from reusing a name a client still has open.
+    std::string NewName()
+    {
+      static std::atomic<uint64_t> next{0};
+#ifdef _WIN32
+      auto process = static_cast<uint64_t>(GetCurrentProcessId());
+#else
+      auto process = static_cast<uint64_t>(getpid());
+#endif
+      return "quick_scanner_plus-" + std::to_string(process) + "-" + std::to_string(next++);
+    }
+
+    // Empty pages still get a mapping.
+    size_t MappedSize(size_t size)
+    {
+      return size > 0 ? size : 1;
+    }
+
+#ifdef _WIN32
+    std::wstring ObjectName(const std::string &name)
+    {
+      return L"Local\\" + std::wstring(name.begin(), name.end());
+    }
+#else
+    std::string ObjectName(const std::string &name)
+    {
+      return "/" + name;
+    }
+#endif
+
+  } // namespace
+
+#ifdef _WIN32
+  SharedMemory SharedMemory::Create(size_t size)
+  {
+    SharedMemory memory;
+    memory.name_ = NewName();
+    memory.size_ = size;
+    memory.owner_ = true;
+    auto mapped = static_cast<uint64_t>(MappedSize(size));
+    memory.handle_ = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                        static_cast<DWORD>(mapped >> 32), static_cast<DWORD>(mapped),
+                                        ObjectName(memory.name_).c_str());
+    if (memory.handle_ && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+      memory.data_ = static_cast<uint8_t *>(MapViewOfFile(memory.handle_, FILE_MAP_WRITE, 0, 0, 0));
+    }
+    if (!memory.data_)
+    {
+      throw std::runtime_error("Could not create shared memory " + memory.name_);
+    }
+    return memory;
+  }
+
+  SharedMemory SharedMemory::Open(const std::string &name, size_t size)
+  {
+    SharedMemory memory;
+    memory.name_ = name;
+    memory.size_ = size;
+    memory.handle_ = OpenFileMappingW(FILE_MAP_READ, FALSE, ObjectName(name).c_str());
+    if (memory.handle_)
+    {
+      // Fails if the block is smaller than |size|.
+      memory.data_ = static_cast<uint8_t *>(MapViewOfFile(memory.handle_, FILE_MAP_READ, 0, 0, MappedSize(size)));
+    }
+    if (!memory.data_)
+    {
+      throw std::runtime_error("Could not open shared memory " + name);
+    }
+    return memory;
+  }
+
+  void SharedMemory::Close()
+  {
+    // The block itself goes away with the last handle to it.
+    if (data_)
+    {
+      UnmapViewOfFile(data_);
+      data_ = nullptr;
+    }
+    if (handle_)
+    {
+      CloseHandle(handle_);
+      handle_ = nullptr;
+    }
+  }
+#else
+  SharedMemory SharedMemory::Create(size_t size)
+  {
+    SharedMemory memory;
+    memory.name_ = NewName();
+    memory.size_ = size;
+    int fd = shm_open(ObjectName(memory.name_).c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Could not create shared memory " + memory.name_);
+    }
+    memory.owner_ = true;
+    if (ftruncate(fd, static_cast<off_t>(MappedSize(size))) == 0)
+    {
+      void *data = mmap(nullptr, MappedSize(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED)
+      {
+        memory.data_ = static_cast<uint8_t *>(data);
+      }
+    }
+    close(fd);
+    if (!memory.data_)
+    {
+      throw std::runtime_error("Could not map shared memory " + memory.name_);
+    }
+    return memory;
+  }
+
+  SharedMemory SharedMemory::Open(const std::string &name, size_t size)
+  {
+    SharedMemory memory;
+    memory.name_ = name;
+    memory.size_ = size;
+    int fd = shm_open(ObjectName(name).c_str(), O_RDONLY, 0);
+    struct stat info;
+    if (fd >= 0 && fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= MappedSize(size))
+    {
+      void *data = mmap(nullptr, MappedSize(size), PROT_READ, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED)
+      {
+        memory.data_ = static_cast<uint8_t *>(data);
+      }
+    }
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    if (!memory.data_)
+    {
+      throw std::runtime_error("Could not open shared memory " + name);
+    }
+    return memory;
+  }
+
+  void SharedMemory::Close()
+  {
+    if (data_)
+    {
+      munmap(data_, MappedSize(size_));
+      data_ = nullptr;
+    }
+    if (owner_)
+    {
+      shm_unlink(ObjectName(name_).c_str());
+      owner_ = false;
+    }
+  }
+#endif
+
+  SharedMemory::~SharedMemory()
+  {
+    Close();
+  }
+
+  SharedMemory::SharedMemory(SharedMemory &&other) noexcept
+      : name_(std::move(other.name_)), data_(std::exchange(other.data_, nullptr)),
+        size_(std::exchange(other.size_, 0)), owner_(std::exchange(other.owner_, false)),
+        handle_(std::exchange(other.handle_, nullptr)) {}
+
+  SharedMemory &SharedMemory::operator=(SharedMemory &&other) noexcept
+  {
+    if (this != &other)
+    {
+      Close();
+      name_ = std::move(other.name_);
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+      owner_ = std::exchange(other.owner_, false);
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+} // namespace quick_scanner_plus
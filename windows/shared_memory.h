@@ -0,0 +1,51 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SHARED_MEMORY_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SHARED_MEMORY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace quick_scanner_plus
+{
+
+  // A named block of memory other processes of the same user can map. The
+  // scan daemon hands pages to its clients this way, so page data never
+  // goes through the socket.
+  class SharedMemory
+  {
+  public:
+    // Creates a block of |size| bytes under a new name. The name goes away
+    // when the creator destroys it; processes that mapped it keep their
+    // mapping. Throws std::runtime_error on failure.
+    static SharedMemory Create(size_t size);
+    // Maps the block |name| made by another process, read-only. Throws
+    // std::runtime_error if it is gone or smaller than |size|.
+    static SharedMemory Open(const std::string &name, size_t size);
+
+    SharedMemory() = default;
+    ~SharedMemory();
+
+    SharedMemory(SharedMemory &&other) noexcept;
+    SharedMemory &operator=(SharedMemory &&other) noexcept;
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+
+    const std::string &name() const { return name_; }
+    uint8_t *data() { return data_; }
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    void Close();
+
+    std::string name_;
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool owner_ = false;
+    // The file mapping handle on Windows.
+    void *handle_ = nullptr;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SHARED_MEMORY_H_
@@ -0,0 +1,84 @@
+#include "sheet_assembler.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace quick_scanner_plus
+{
+
+  const SheetSide *Sheet::separator() const
+  {
+    auto side = std::find_if(sides.begin(), sides.end(), [](const SheetSide &side)
+                             { return side.result.separator.is_separator; });
+    return side == sides.end() ? nullptr : &*side;
+  }
+
+  SheetAssembler::SheetAssembler(bool duplex, bool drop_blank_backs, size_t max_pages_in_flight,
+                                 PageOptions options, SheetHandler on_sheet)
+      : sides_(duplex ? 2 : 1),
+        drop_blank_backs_(duplex && drop_blank_backs),
+        max_in_flight_((std::max)(max_pages_in_flight / sides_, size_t{1}) * sides_),
+        options_(std::move(options)),
+        on_sheet_(std::move(on_sheet)) {}
+
+  void SheetAssembler::Add(const std::string &source, PageTask task)
+  {
+    CommitSheets(max_in_flight_ - 1, false);
+    auto options = options_;
+    options.detect_blank = options.detect_blank || (drop_blank_backs_ && added_ % sides_ == 1);
+    added_++;
+    in_flight_.emplace_back(source, std::async(std::launch::async, [task = std::move(task), options]
+                                               { return task(options); }));
+  }
+
+  void SheetAssembler::Commit(size_t max_pages_in_flight)
+  {
+    CommitSheets(max_pages_in_flight, false);
+  }
+
+  void SheetAssembler::Finish()
+  {
+    CommitSheets(0, true);
+  }
+
+  void SheetAssembler::CommitSheets(size_t max_pages_in_flight, bool partial_sheet)
+  {
+    while (!in_flight_.empty())
+    {
+      size_t count = (std::min)(sides_, in_flight_.size());
+      if (count < sides_ && !partial_sheet)
+      {
+        break;
+      }
+      bool ready = true;
+      for (size_t i = 0; ready && i < count; i++)
+      {
+        ready = in_flight_[i].second.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+      }
+      if (!ready && in_flight_.size() <= max_pages_in_flight)
+      {
+        break;
+      }
+
+      Sheet sheet;
+      for (size_t i = 0; i < count; i++)
+      {
+        auto &page = in_flight_.front();
+        SheetSide side;
+        side.source = std::move(page.first);
+        // Popped before get(), so a page that failed is not waited on again.
+        auto result = std::move(page.second);
+        in_flight_.pop_front();
+        side.result = result.get();
+        sheet.sides.push_back(std::move(side));
+      }
+      bool separator = sheet.separator() != nullptr;
+      for (auto &side : sheet.sides)
+      {
+        side.keep = !separator && !side.result.is_blank;
+      }
+      on_sheet_(sheet);
+    }
+  }
+
+} // namespace quick_scanner_plus
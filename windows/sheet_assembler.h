@@ -0,0 +1,91 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SHEET_ASSEMBLER_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SHEET_ASSEMBLER_H_
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "page_pipeline.h"
+
+namespace quick_scanner_plus
+{
+
+  struct SheetSide
+  {
+    // The file the device delivered (UTF-8). |result.path| differs when the
+    // page was re-encoded.
+    std::string source;
+    PageResult result;
+    // False for a blank side and for both sides of a separator sheet.
+    bool keep = true;
+  };
+
+  struct Sheet
+  {
+    // Front first. The last sheet of a duplex scan lacks its back when the
+    // device delivered an odd number of pages.
+    std::vector<SheetSide> sides;
+
+    // The side carrying a separator, which makes the whole sheet a
+    // separator sheet, or null.
+    const SheetSide *separator() const;
+  };
+
+  // Groups the pages a feeder delivers into sheets, front then back with
+  // duplex, and processes them on worker threads while the next pages are
+  // fetched. Both sides of a sheet are processed at the same time. Finished
+  // sheets go to |on_sheet| in feeder order, on the thread that calls Add,
+  // Commit or Finish. Errors from processing or from |on_sheet| are thrown
+  // from there too.
+  class SheetAssembler
+  {
+  public:
+    // Processes one page with the options for its side.
+    using PageTask = std::function<PageResult(const PageOptions &options)>;
+    using SheetHandler = std::function<void(const Sheet &sheet)>;
+
+    // At most |max_pages_in_flight| pages, rounded down to whole sheets but
+    // never less than one sheet, are processed or held at once. With
+    // |drop_blank_backs|, backs are also checked for blank content. Sides
+    // found blank are not kept.
+    SheetAssembler(bool duplex, bool drop_blank_backs, size_t max_pages_in_flight, PageOptions options,
+                   SheetHandler on_sheet);
+
+    SheetAssembler(const SheetAssembler &) = delete;
+    SheetAssembler &operator=(const SheetAssembler &) = delete;
+
+    // Starts processing the next page the device delivered. Hands over
+    // finished sheets first and waits while the limit is reached.
+    void Add(const std::string &source, PageTask task);
+
+    // Hands over finished sheets, then waits for sheets until at most
+    // |max_pages_in_flight| pages are left in flight.
+    void Commit(size_t max_pages_in_flight);
+
+    // Waits for every page and hands over the remaining sheets, including a
+    // last sheet whose back never came.
+    void Finish();
+
+    size_t sides() const { return sides_; }
+    size_t max_pages_in_flight() const { return max_in_flight_; }
+    size_t pages_in_flight() const { return in_flight_.size(); }
+
+  private:
+    void CommitSheets(size_t max_pages_in_flight, bool partial_sheet);
+
+    size_t sides_;
+    bool drop_blank_backs_;
+    size_t max_in_flight_;
+    PageOptions options_;
+    SheetHandler on_sheet_;
+    size_t added_ = 0;
+    std::deque<std::pair<std::string, std::future<PageResult>>> in_flight_;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SHEET_ASSEMBLER_H_
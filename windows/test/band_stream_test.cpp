@@ -0,0 +1,201 @@
+// Streams pages from a simulated device through TiledImage strips and
+// BandStream to consumers. Checks band order and contents, that a slow
+// consumer holds the producer to the queue bound, and that the first band
+// arrives long before the page is read while consumers overlap the device.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "band_stream.h"
+#include "test_support.h"
+#include "tiled_image.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  // An A4 page at 200 dpi in grayscale.
+  const uint32_t kWidth = 1654;
+  const uint32_t kHeight = 2339;
+  const uint32_t kBandRows = 128;
+
+  uint8_t PixelValue(uint64_t page, uint32_t x, uint32_t y)
+  {
+    return static_cast<uint8_t>(page * 17 + (x / 9) + y);
+  }
+
+  // A device that produces |row_time| worth of rows at a time, the way a
+  // sheet-fed scanner hands over its lines as the sheet moves.
+  TiledImage::TileLoader SimulatedDevice(uint64_t page, std::chrono::microseconds row_time)
+  {
+    return [page, row_time](Tile &tile)
+    {
+      if (tile.x == 0)
+      {
+        std::this_thread::sleep_for(row_time * tile.height);
+      }
+      for (uint32_t r = 0; r < tile.height; r++)
+      {
+        for (uint32_t c = 0; c < tile.width; c++)
+        {
+          tile.Row(r)[c] = PixelValue(page, tile.x + c, tile.y + r);
+        }
+      }
+    };
+  }
+
+  void StreamPage(BandStream &stream, uint64_t page, std::chrono::microseconds row_time)
+  {
+    TiledImage image(kWidth, kHeight, PixelFormat::kGray8, SimulatedDevice(page, row_time), kBandRows);
+    auto band_page = stream.BeginPage();
+    image.ForEachTileRow([&](const TileRow &strip)
+                         {
+      bool last = strip.y() + strip.height() == kHeight;
+      stream.Push(MakeRowBand(band_page, kWidth, strip, last)); });
+  }
+
+  struct Received
+  {
+    uint64_t page;
+    uint32_t y;
+    uint32_t height;
+    bool last;
+  };
+
+  void CheckBandsInOrder()
+  {
+    const uint64_t kPages = 3;
+    std::vector<Received> first;
+    std::vector<Received> second;
+    bool contents_match = true;
+    {
+      BandStream stream;
+      stream.AddConsumer([&](const RowBand &band)
+                         {
+        first.push_back({band.page, band.y, band.height, band.last});
+        for (uint32_t r = 0; r < band.height; r++)
+        {
+          for (uint32_t x = 0; x < band.width; x += 97)
+          {
+            contents_match = contents_match && band.pixels.data()[r * band.stride + x] ==
+                                                   PixelValue(band.page, x, band.y + r);
+          }
+        } });
+      stream.AddConsumer([&](const RowBand &band)
+                         { second.push_back({band.page, band.y, band.height, band.last}); });
+      for (uint64_t page = 0; page < kPages; page++)
+      {
+        StreamPage(stream, page, std::chrono::microseconds(0));
+      }
+      // Destroying the stream delivers what is still queued.
+    }
+    CHECK(contents_match);
+
+    size_t bands_per_page = (kHeight + kBandRows - 1) / kBandRows;
+    CHECK_EQ(first.size(), kPages * bands_per_page);
+    CHECK_EQ(second.size(), first.size());
+    for (size_t i = 0; i < first.size(); i++)
+    {
+      CHECK_EQ(first[i].page, i / bands_per_page);
+      CHECK_EQ(first[i].y, (i % bands_per_page) * kBandRows);
+      CHECK_EQ(first[i].last, i % bands_per_page == bands_per_page - 1);
+      CHECK_EQ(first[i].y + first[i].height, first[i].last ? kHeight : first[i].y + kBandRows);
+      CHECK_EQ(second[i].page, first[i].page);
+      CHECK_EQ(second[i].y, first[i].y);
+    }
+  }
+
+  // A consumer slower than the device: the producer must wait rather than
+  // queue more than the stream's capacity.
+  void CheckSlowConsumerBoundsQueue()
+  {
+    const size_t kCapacity = 2;
+    const int kBands = 40;
+    std::atomic<int> pushed{0};
+    int delivered = 0;
+    int most_ahead = 0;
+    BandStreamStats stats;
+    {
+      BandStream stream(kCapacity);
+      stream.AddConsumer([&](const RowBand &)
+                         {
+        most_ahead = (std::max)(most_ahead, pushed.load() - delivered);
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        delivered++; });
+      auto page = stream.BeginPage();
+      for (int i = 0; i < kBands; i++)
+      {
+        RowBand band;
+        band.page = page;
+        band.y = static_cast<uint32_t>(i) * kBandRows;
+        band.width = kWidth;
+        band.height = kBandRows;
+        band.format = PixelFormat::kGray8;
+        band.stride = kWidth;
+        band.pixels = BufferPool::Shared().Acquire(band.stride * band.height);
+        band.last = i == kBands - 1;
+        stream.Push(std::move(band));
+        pushed++;
+      }
+      stream.Close();
+      // Pushes after Close are dropped.
+      stream.Push(RowBand());
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      stats = stream.stats();
+    }
+    CHECK_EQ(delivered, kBands);
+    CHECK_EQ(stats.bands, static_cast<uint64_t>(kBands));
+    CHECK_EQ(stats.bytes, uint64_t{kBands} * kWidth * kBandRows);
+    CHECK(stats.peak_queued <= kCapacity);
+    CHECK(stats.producer_waits > 0);
+    // One band with the consumer, |kCapacity| queued.
+    CHECK(most_ahead <= static_cast<int>(kCapacity) + 1);
+  }
+
+  // Bands reach consumers while the device is still reading the page, and
+  // consumer work overlaps device time instead of following it.
+  void CheckStreamingOverlapsDevice()
+  {
+    const auto kRowTime = std::chrono::microseconds(100);
+    const auto kConsumerTime = std::chrono::milliseconds(8);
+    size_t bands = 0;
+    double first_band = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+      BandStream stream;
+      stream.AddConsumer([&](const RowBand &)
+                         {
+        if (bands++ == 0)
+        {
+          first_band = test::SecondsSince(start);
+        }
+        std::this_thread::sleep_for(kConsumerTime); });
+      StreamPage(stream, 0, kRowTime);
+    }
+    double total = test::SecondsSince(start);
+
+    double device = std::chrono::duration<double>(kRowTime * kHeight).count();
+    double consumers = std::chrono::duration<double>(kConsumerTime * bands).count();
+    std::printf("first band after %.0f ms of a %.0f ms page; done in %.0f ms, %.0f ms back to back\n",
+                first_band * 1000, device * 1000, total * 1000, (device + consumers) * 1000);
+    CHECK(first_band < device / 4);
+    CHECK(total < (device + consumers) * 0.85);
+  }
+
+} // namespace
+
+int main()
+{
+  CheckBandsInOrder();
+  CheckSlowConsumerBoundsQueue();
+  CheckStreamingOverlapsDevice();
+  std::printf("band_stream_test passed\n");
+  return 0;
+}
@@ -0,0 +1,174 @@
+// Kills a journaling batch at random points and checks that every restart
+// resumes after the last committed page, plus torn-record and job ID
+// handling.
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__unix__)
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "batch_journal.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const size_t kBatchEntries = 2000;
+
+  bool IsSeparatorEntry(size_t index)
+  {
+    return index % 50 == 49;
+  }
+
+  std::string PagePath(const test::TempDir &dir, size_t index)
+  {
+    return dir.Child("page-" + std::to_string(index) + ".jpg");
+  }
+
+  // The recovered entries must be exactly the first ones of the batch, in
+  // order, with every page file on disk.
+  void CheckPrefix(const test::TempDir &dir, const std::vector<JournalEntry> &entries)
+  {
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+      CHECK_EQ(entries[i].is_separator, IsSeparatorEntry(i));
+      if (!entries[i].is_separator)
+      {
+        CHECK_EQ(entries[i].path, PagePath(dir, i));
+        CHECK(std::filesystem::exists(std::filesystem::u8path(entries[i].path)));
+      }
+    }
+  }
+
+  // What scanBatch does with a journal: resume after the recovered entries,
+  // write each page before journaling it, complete at the end.
+  int RunBatch(const test::TempDir &dir, const std::string &journal_path)
+  {
+    BatchJournal journal(journal_path);
+    auto resumed = journal.recovered();
+    CheckPrefix(dir, resumed);
+    for (size_t i = resumed.size(); i < kBatchEntries; i++)
+    {
+      if (IsSeparatorEntry(i))
+      {
+        journal.AppendSeparator();
+        continue;
+      }
+      std::ofstream page(std::filesystem::u8path(PagePath(dir, i)), std::ios::binary);
+      page << "page " << i;
+      page.close();
+      journal.AppendPage(PagePath(dir, i));
+    }
+    journal.Complete();
+    return 0;
+  }
+
+#if defined(__unix__)
+  void CheckKilledMidBatch()
+  {
+    test::TempDir dir("batch_journal_test");
+    auto journal_path = dir.Child("job.qsjournal");
+    std::mt19937 random(29);
+    int kills = 0;
+    size_t last_recovered = 0;
+    for (int run = 0;; run++)
+    {
+      pid_t child = fork();
+      CHECK(child >= 0);
+      if (child == 0)
+      {
+        _exit(RunBatch(dir, journal_path));
+      }
+      // Later runs are given more time so the batch eventually finishes.
+      usleep(static_cast<useconds_t>(500 + random() % 4000 + run * 500));
+      kill(child, SIGKILL);
+      int status = 0;
+      CHECK_EQ(waitpid(child, &status, 0), child);
+      if (WIFEXITED(status))
+      {
+        CHECK_EQ(WEXITSTATUS(status), 0);
+        break;
+      }
+      CHECK(WIFSIGNALED(status));
+      kills++;
+
+      BatchJournal journal(journal_path);
+      CheckPrefix(dir, journal.recovered());
+      CHECK(journal.recovered().size() >= last_recovered);
+      last_recovered = journal.recovered().size();
+    }
+    std::printf("batch finished after %d kills\n", kills);
+    CHECK(kills > 0);
+
+    // A completed journal starts the next run of the job from scratch.
+    BatchJournal journal(journal_path);
+    CHECK(journal.recovered().empty());
+  }
+#endif
+
+  void CheckTornRecordCutOff()
+  {
+    test::TempDir dir("batch_journal_test");
+    auto journal_path = dir.Child("job.qsjournal");
+    {
+      BatchJournal journal(journal_path);
+      journal.AppendPage("a");
+      journal.AppendSeparator();
+      journal.AppendPage("b");
+    }
+    auto size = std::filesystem::file_size(std::filesystem::u8path(journal_path));
+    // Half a record, as a write cut short by power loss leaves it.
+    std::filesystem::resize_file(std::filesystem::u8path(journal_path), size - 3);
+    {
+      BatchJournal journal(journal_path);
+      CHECK_EQ(journal.recovered().size(), 2u);
+      CHECK_EQ(journal.recovered()[0].path, "a");
+      CHECK(journal.recovered()[1].is_separator);
+      journal.AppendPage("c");
+    }
+    BatchJournal journal(journal_path);
+    CHECK_EQ(journal.recovered().size(), 3u);
+    CHECK_EQ(journal.recovered()[2].path, "c");
+  }
+
+  void CheckJobIds()
+  {
+    CHECK(IsValidJobId("batch-2024_05.01"));
+    CHECK(IsValidJobId(std::string(64, 'a')));
+    CHECK(!IsValidJobId(""));
+    CHECK(!IsValidJobId(std::string(65, 'a')));
+    CHECK(!IsValidJobId(".."));
+    CHECK(!IsValidJobId(".hidden"));
+    CHECK(!IsValidJobId("../outside"));
+    CHECK(!IsValidJobId("a/b"));
+    CHECK(!IsValidJobId("a\\b"));
+    CHECK(!IsValidJobId("C:job"));
+    CHECK(!IsValidJobId("job name"));
+    CHECK(!IsValidJobId("con"));
+    CHECK(!IsValidJobId("NUL.txt"));
+    CHECK(!IsValidJobId("Lpt3"));
+    CHECK(IsValidJobId("COM10"));
+    CHECK(IsValidJobId("console"));
+  }
+
+} // namespace
+
+int main()
+{
+  CheckJobIds();
+  CheckTornRecordCutOff();
+#if defined(__unix__)
+  CheckKilledMidBatch();
+#endif
+  std::printf("batch_journal_test passed\n");
+  return 0;
+}
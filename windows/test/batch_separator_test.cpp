@@ -0,0 +1,262 @@
+// Draws patch codes and Code 39 barcodes into scanlines and checks that
+// every patch type and payload decodes, including pages fed upside down,
+// that damaged or unknown symbols are rejected, and that BatchSplitter cuts
+// jobs at separator sheets.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "batch_separator.h"
+#include "test_support.h"
+#include "tiled_image.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const uint8_t kLight = 230;
+  const uint8_t kDark = 25;
+
+  void Append(std::vector<uint8_t> &luma, uint8_t value, size_t count)
+  {
+    luma.insert(luma.end(), count, value);
+  }
+
+  // Four bars, first bar in the most significant bit, 1 = wide.
+  std::vector<uint8_t> PatchLine(uint32_t bars, size_t narrow, size_t wide, size_t quiet = 60)
+  {
+    std::vector<uint8_t> luma;
+    Append(luma, kLight, quiet);
+    for (int i = 3; i >= 0; i--)
+    {
+      Append(luma, kDark, (bars >> i) & 1 ? wide : narrow);
+      if (i > 0)
+      {
+        Append(luma, kLight, 6);
+      }
+    }
+    Append(luma, kLight, quiet);
+    return luma;
+  }
+
+  // Nine elements starting with a bar, first element in the most significant
+  // bit, 1 = wide, then the narrow gap between characters.
+  void AppendCode39Pattern(std::vector<uint8_t> &luma, uint32_t pattern)
+  {
+    for (int i = 8; i >= 0; i--)
+    {
+      Append(luma, i % 2 == 0 ? kDark : kLight, (pattern >> i) & 1 ? 8 : 3);
+    }
+    Append(luma, kLight, 3);
+  }
+
+  const char kAlphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-. $/+%";
+  const uint32_t kPatterns[] = {
+      0x034, 0x121, 0x061, 0x160, 0x031, 0x130, 0x070, 0x025, 0x124, 0x064,
+      0x109, 0x049, 0x148, 0x019, 0x118, 0x058, 0x00D, 0x10C, 0x04C, 0x01C,
+      0x103, 0x043, 0x142, 0x013, 0x112, 0x052, 0x007, 0x106, 0x046, 0x016,
+      0x181, 0x0C1, 0x1C0, 0x091, 0x190, 0x0D0, 0x085, 0x184, 0x0C4, 0x0A8,
+      0x0A2, 0x08A, 0x02A};
+  const uint32_t kAsterisk = 0x094;
+
+  // |payload| between start and stop characters. A character outside the
+  // alphabet is written as |raw| instead.
+  std::vector<uint8_t> Code39Line(const std::string &payload, uint32_t raw = 0)
+  {
+    std::vector<uint8_t> luma;
+    Append(luma, kLight, 40);
+    AppendCode39Pattern(luma, kAsterisk);
+    for (char c : payload)
+    {
+      auto found = std::strchr(kAlphabet, c);
+      AppendCode39Pattern(luma, found && c ? kPatterns[found - kAlphabet] : raw);
+    }
+    AppendCode39Pattern(luma, kAsterisk);
+    Append(luma, kLight, 40);
+    return luma;
+  }
+
+  ScanlineRuns Runs(const std::vector<uint8_t> &luma)
+  {
+    ScanlineRuns runs;
+    CHECK(ToRuns(luma, runs));
+    return runs;
+  }
+
+  void CheckToRuns()
+  {
+    ScanlineRuns runs;
+    CHECK(!ToRuns(std::vector<uint8_t>(), runs));
+    // Paper texture without any marks.
+    CHECK(!ToRuns({200, 210, 230, 220, 200}, runs));
+
+    CHECK(ToRuns({250, 250, 10, 10, 10, 250, 20, 240, 240, 240}, runs));
+    CHECK(!runs.first_dark);
+    CHECK((runs.lengths == std::vector<uint32_t>{2, 3, 1, 1, 3}));
+
+    CHECK(ToRuns({10, 250, 250, 30}, runs));
+    CHECK(runs.first_dark);
+    CHECK((runs.lengths == std::vector<uint32_t>{1, 2, 1}));
+  }
+
+  void CheckPatchCodes()
+  {
+    const std::pair<uint32_t, PatchCode> kCodes[] = {
+        {0b1001, PatchCode::kPatch1}, {0b1010, PatchCode::kPatch2}, {0b1100, PatchCode::kPatch3},
+        {0b0101, PatchCode::kPatch4}, {0b0011, PatchCode::kPatch6}, {0b1011, PatchCode::kPatchT},
+    };
+    for (const auto &code : kCodes)
+    {
+      CHECK(DecodePatchCode(Runs(PatchLine(code.first, 4, 10))) == code.second);
+      // Upside down.
+      auto luma = PatchLine(code.first, 4, 10);
+      std::reverse(luma.begin(), luma.end());
+      auto reversed = DecodePatchCode(Runs(luma));
+      uint32_t mirrored = ((code.first & 1) << 3) | ((code.first & 2) << 1) | ((code.first & 4) >> 1) |
+                          ((code.first & 8) >> 3);
+      CHECK(reversed == DecodePatchCode(Runs(PatchLine(mirrored, 4, 10))));
+    }
+    CHECK_EQ(std::string(PatchCodeName(PatchCode::kPatchT)), "patchT");
+
+    // Four equal bars, a wide bar barely wider than a narrow one, bars too far
+    // apart in width, and no quiet zone around the bars.
+    CHECK(DecodePatchCode(Runs(PatchLine(0b1010, 6, 6))) == PatchCode::kNone);
+    CHECK(DecodePatchCode(Runs(PatchLine(0b1010, 6, 9))) == PatchCode::kNone);
+    CHECK(DecodePatchCode(Runs(PatchLine(0b1010, 4, 24))) == PatchCode::kNone);
+    CHECK(DecodePatchCode(Runs(PatchLine(0b1010, 4, 10, 12))) == PatchCode::kNone);
+    // 0b0110 is not a patch code.
+    CHECK(DecodePatchCode(Runs(PatchLine(0b0110, 4, 10))) == PatchCode::kNone);
+  }
+
+  void CheckCode39()
+  {
+    CHECK_EQ(DecodeCode39(Runs(Code39Line("SEP"))), "SEP");
+    CHECK_EQ(DecodeCode39(Runs(Code39Line("0123456789"))), "0123456789");
+    CHECK_EQ(DecodeCode39(Runs(Code39Line("JOB-7. $/+%"))), "JOB-7. $/+%");
+
+    // Fed upside down, the symbol reads right to left.
+    auto luma = Code39Line("BATCH-42");
+    std::reverse(luma.begin(), luma.end());
+    CHECK_EQ(DecodeCode39(Runs(luma)), "BATCH-42");
+
+    // Scanned at a different resolution.
+    std::vector<uint8_t> scaled;
+    for (auto value : Code39Line("SEP"))
+    {
+      Append(scaled, value, 3);
+    }
+    CHECK_EQ(DecodeCode39(Runs(scaled)), "SEP");
+
+    // A character with four wide elements, a three-wide pattern outside the
+    // alphabet, and a symbol without its stop character.
+    CHECK_EQ(DecodeCode39(Runs(Code39Line(std::string("SE") + '\0', 0x1E0))), "");
+    CHECK_EQ(DecodeCode39(Runs(Code39Line(std::string("SE") + '\0', 0x0E0))), "");
+    auto unterminated = Code39Line("SEP");
+    unterminated.resize(unterminated.size() - 40 - 3 - 3 * 8 - 6 * 3);
+    Append(unterminated, kLight, 40);
+    CHECK_EQ(DecodeCode39(Runs(unterminated)), "");
+    // Start and stop with nothing between them.
+    CHECK_EQ(DecodeCode39(Runs(Code39Line(""))), "");
+  }
+
+  // A page whose rows all carry |line| in the middle of white paper.
+  std::unique_ptr<TiledImage> SeparatorPage(const std::vector<uint8_t> &line, PixelFormat format)
+  {
+    const uint32_t width = static_cast<uint32_t>(line.size()) + 200;
+    auto bpp = BytesPerPixel(format);
+    return std::make_unique<TiledImage>(width, 300, format, [line, bpp](Tile &tile)
+                                        {
+      for (uint32_t r = 0; r < tile.height; r++)
+      {
+        for (uint32_t c = 0; c < tile.width; c++)
+        {
+          uint32_t x = tile.x + c;
+          uint8_t value = x >= 100 && x - 100 < line.size() ? line[x - 100] : kLight;
+          std::memset(tile.Row(r) + c * bpp, value, bpp);
+        }
+      } });
+  }
+
+  SeparatorResult Detect(const std::vector<uint8_t> &line, PixelFormat format, const SeparatorOptions &options)
+  {
+    SeparatorDetector detector(options);
+    SeparatorPage(line, format)->ForEachTileRow([&](const TileRow &row)
+                                                { detector.Observe(row); });
+    return detector.Finish();
+  }
+
+  void CheckDetector()
+  {
+    SeparatorOptions patches;
+    auto result = Detect(PatchLine(0b1010, 4, 10), PixelFormat::kGray8, patches);
+    CHECK(result.is_separator);
+    CHECK(result.patch_code == PatchCode::kPatch2);
+
+    SeparatorOptions barcode;
+    barcode.detect_patch_codes = false;
+    barcode.barcode = "SEP";
+    result = Detect(Code39Line("SEP"), PixelFormat::kBgra8, barcode);
+    CHECK(result.is_separator);
+    CHECK_EQ(result.barcode, "SEP");
+    CHECK(result.patch_code == PatchCode::kNone);
+
+    // Other barcodes are content, not separators.
+    CHECK(!Detect(Code39Line("INVOICE"), PixelFormat::kBgra8, barcode).is_separator);
+
+    SeparatorOptions off;
+    off.detect_patch_codes = false;
+    CHECK(!Detect(PatchLine(0b1010, 4, 10), PixelFormat::kGray8, off).is_separator);
+
+    // Fewer agreeing scanlines than required.
+    SeparatorOptions strict;
+    strict.row_step = 100;
+    strict.min_votes = 4;
+    CHECK(!Detect(PatchLine(0b1010, 4, 10), PixelFormat::kGray8, strict).is_separator);
+  }
+
+  void CheckSplitter()
+  {
+    SeparatorResult page;
+    SeparatorResult separator;
+    separator.is_separator = true;
+    separator.patch_code = PatchCode::kPatchT;
+
+    // A leading separator, two documents, back-to-back separators, a third
+    // document and a trailing separator.
+    BatchSplitter splitter;
+    CHECK(!splitter.AddPage("sep-0", separator));
+    CHECK(splitter.AddPage("a1", page));
+    CHECK(splitter.AddPage("a2", page));
+    CHECK(!splitter.AddPage("sep-1", separator));
+    CHECK(splitter.AddPage("b1", page));
+    CHECK(!splitter.AddPage("sep-2", separator));
+    CHECK(!splitter.AddPage("sep-3", separator));
+    CHECK(splitter.AddPage("c1", page));
+    CHECK(splitter.AddPage("c2", page));
+    CHECK(splitter.AddPage("c3", page));
+    CHECK(!splitter.AddPage("sep-4", separator));
+    CHECK((splitter.documents() ==
+           std::vector<std::vector<std::string>>{{"a1", "a2"}, {"b1"}, {"c1", "c2", "c3"}}));
+
+    BatchSplitter plain;
+    plain.AddPage("only", page);
+    CHECK((plain.documents() == std::vector<std::vector<std::string>>{{"only"}}));
+    CHECK(BatchSplitter().documents().empty());
+  }
+
+} // namespace
+
+int main()
+{
+  CheckToRuns();
+  CheckPatchCodes();
+  CheckCode39();
+  CheckDetector();
+  CheckSplitter();
+  std::printf("batch_separator_test passed\n");
+  return 0;
+}
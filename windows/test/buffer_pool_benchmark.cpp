@@ -0,0 +1,123 @@
+// Runs a simulated batch through the buffer lifetimes of a real one, once
+// with buffers from BufferPool and once with a fresh allocation per buffer,
+// and reports time, page faults and pool statistics.
+//
+//   buffer_pool_benchmark [pages]
+//
+// Each page is an A4 sheet at 300 dpi in RGB: raw device pixels, a
+// processed copy and the encoder output, with up to four pages in flight
+// as in scanBatch. Defaults to 500 pages.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+
+#if defined(__unix__)
+#include <sys/resource.h>
+#endif
+
+#include "buffer_pool.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const size_t kPagesInFlight = 4;
+  const size_t kWidth = 2480;
+  const size_t kHeight = 3508;
+
+  struct PlainBuffer
+  {
+    explicit PlainBuffer(size_t size) : bytes(new uint8_t[size]), length(size) {}
+    uint8_t *data() { return bytes.get(); }
+    size_t size() const { return length; }
+
+    std::unique_ptr<uint8_t[]> bytes;
+    size_t length;
+  };
+
+  template <typename Buffer>
+  struct Page
+  {
+    Buffer raw;
+    Buffer processed;
+    Buffer encoded;
+  };
+
+  long MinorFaults()
+  {
+#if defined(__unix__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+#else
+    return 0;
+#endif
+  }
+
+  // Pages differ a little in length, as sheets fed by hand do, and compress
+  // to different sizes.
+  template <typename Buffer, typename Allocate>
+  void RunBatch(const char *name, size_t pages, Allocate allocate)
+  {
+    std::mt19937 random(30);
+    std::deque<Page<Buffer>> in_flight;
+    uint64_t checksum = 0;
+    long faults = MinorFaults();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < pages; n++)
+    {
+      size_t rows = kHeight - random() % 64;
+      size_t raw_size = kWidth * 3 * rows;
+      Page<Buffer> page{allocate(raw_size), allocate(raw_size), allocate(raw_size / 8 + random() % 65536)};
+
+      // The device fills the raw pixels, processing writes every byte of
+      // its copy and the encoder writes its output.
+      std::memset(page.raw.data(), static_cast<int>(n), page.raw.size());
+      for (size_t i = 0; i < page.raw.size(); i += 64)
+      {
+        page.processed.data()[i] = static_cast<uint8_t>(255 - page.raw.data()[i]);
+      }
+      std::memset(page.processed.data(), static_cast<int>(n + 1), page.processed.size() / 2);
+      std::memset(page.encoded.data(), 0, page.encoded.size());
+      checksum += page.processed.data()[(page.processed.size() - 1) / 64 * 64];
+
+      in_flight.push_back(std::move(page));
+      if (in_flight.size() > kPagesInFlight)
+      {
+        in_flight.pop_front();
+      }
+    }
+    in_flight.clear();
+    double seconds = test::SecondsSince(start);
+    faults = MinorFaults() - faults;
+    std::printf("%s: %zu pages in %.2f s (%.2f ms/page), %ld minor page faults (%.0f/page)  [%llu]\n", name, pages,
+                seconds, seconds * 1000 / static_cast<double>(pages), faults,
+                static_cast<double>(faults) / static_cast<double>(pages), static_cast<unsigned long long>(checksum));
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  size_t pages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 500;
+
+  RunBatch<PlainBuffer>("new[] per buffer", pages, [](size_t size)
+                        { return PlainBuffer(size); });
+
+  BufferPool pool;
+  RunBatch<PooledBuffer>("BufferPool      ", pages, [&pool](size_t size)
+                         { return pool.Acquire(size); });
+  auto stats = pool.stats();
+  std::printf("  pool: %llu acquires, %.1f%% reused, peak live %.0f MB, %.0f MB cached after the batch\n",
+              static_cast<unsigned long long>(stats.acquires), stats.reuse_rate() * 100,
+              static_cast<double>(stats.peak_live_bytes) / 1e6, static_cast<double>(stats.cached_bytes) / 1e6);
+  std::printf("  trim released %.0f MB\n", static_cast<double>(pool.Trim()) / 1e6);
+  return 0;
+}
@@ -0,0 +1,116 @@
+// Checks BufferPool's size classes, reuse, statistics, cache limit and
+// trimming, and that buffers can be returned from other threads.
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  void CheckReuse()
+  {
+    BufferPool pool;
+    CHECK(pool.Acquire(0).empty());
+
+    const uint8_t *first = nullptr;
+    {
+      auto buffer = pool.Acquire(5000);
+      CHECK_EQ(buffer.size(), 5000u);
+      CHECK_EQ(buffer.capacity(), 8192u);
+      first = buffer.data();
+      CHECK_EQ(pool.stats().live_bytes, 8192u);
+    }
+    CHECK_EQ(pool.stats().live_bytes, 0u);
+    CHECK_EQ(pool.stats().cached_bytes, 8192u);
+
+    // Any size in the same class gets the cached buffer back.
+    auto again = pool.Acquire(8000);
+    CHECK_EQ(again.data(), first);
+    auto larger = pool.Acquire(9000);
+    CHECK(larger.data() != first);
+    CHECK_EQ(larger.capacity(), 16384u);
+
+    auto stats = pool.stats();
+    CHECK_EQ(stats.acquires, 3u);
+    CHECK_EQ(stats.reuses, 1u);
+    CHECK_EQ(stats.peak_live_bytes, 8192u + 16384u);
+  }
+
+  void CheckMoves()
+  {
+    BufferPool pool;
+    auto buffer = pool.Acquire(100);
+    PooledBuffer moved(std::move(buffer));
+    CHECK(buffer.empty());
+    CHECK_EQ(pool.stats().live_bytes, BufferPool::kMinClassSize);
+    // The new buffer is acquired before the old one goes back.
+    moved = pool.Acquire(100);
+    CHECK_EQ(pool.stats().live_bytes, BufferPool::kMinClassSize);
+    CHECK_EQ(pool.stats().cached_bytes, BufferPool::kMinClassSize);
+    moved = PooledBuffer();
+    CHECK_EQ(pool.stats().live_bytes, 0u);
+    CHECK_EQ(pool.stats().cached_bytes, 2 * BufferPool::kMinClassSize);
+  }
+
+  void CheckCacheLimitAndTrim()
+  {
+    BufferPool pool(64 * 1024);
+    {
+      std::vector<PooledBuffer> buffers;
+      for (int i = 0; i < 3; i++)
+      {
+        buffers.push_back(pool.Acquire(32 * 1024));
+      }
+    }
+    // Only two fit under the limit; the third is freed.
+    CHECK_EQ(pool.stats().cached_bytes, 64u * 1024);
+
+    CHECK_EQ(pool.TrimIfIdle(std::chrono::hours(1)), 0u);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK_EQ(pool.TrimIfIdle(std::chrono::milliseconds(10)), 64u * 1024);
+    CHECK_EQ(pool.stats().cached_bytes, 0u);
+    CHECK_EQ(pool.Trim(), 0u);
+  }
+
+  void CheckConcurrentUse()
+  {
+    BufferPool pool;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+      threads.emplace_back([&pool, t]
+                           {
+        for (int i = 0; i < 2000; i++)
+        {
+          auto buffer = pool.Acquire(static_cast<size_t>(1000 * (t + 1) + i % 7));
+          buffer.data()[buffer.size() - 1] = static_cast<uint8_t>(i);
+        } });
+    }
+    for (auto &thread : threads)
+    {
+      thread.join();
+    }
+    auto stats = pool.stats();
+    CHECK_EQ(stats.acquires, 8000u);
+    CHECK_EQ(stats.live_bytes, 0u);
+    CHECK(stats.reuse_rate() > 0.9);
+  }
+
+} // namespace
+
+int main()
+{
+  CheckReuse();
+  CheckMoves();
+  CheckCacheLimitAndTrim();
+  CheckConcurrentUse();
+  std::printf("buffer_pool_test passed\n");
+  return 0;
+}
@@ -0,0 +1,210 @@
+// Runs the SSE2 and scalar histogram kernels over the same random and
+// synthetic pixels and checks that they agree bit for bit, then classifies
+// mono, gray, color and blank pages in both pixel formats.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "color_analysis.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  using Histogram = std::array<uint64_t, 256>;
+
+  // Every length from 0 to 67 pixels at every alignment, so each kernel's
+  // four-pixel steps and its tail both run.
+  void CheckKernelsAgree(const std::vector<uint8_t> &pixels)
+  {
+    for (size_t offset = 0; offset < 4; offset++)
+    {
+      for (size_t count = 0; count < 68 && offset + count <= pixels.size() / 4; count++)
+      {
+        Histogram chroma{}, luma{}, scalar_chroma{}, scalar_luma{};
+        AccumulateBgra(pixels.data() + offset * 4, count, chroma, luma);
+        AccumulateBgraScalar(pixels.data() + offset * 4, count, scalar_chroma, scalar_luma);
+        CHECK(chroma == scalar_chroma);
+        CHECK(luma == scalar_luma);
+      }
+    }
+
+    Histogram chroma{}, luma{}, scalar_chroma{}, scalar_luma{};
+    AccumulateBgra(pixels.data(), pixels.size() / 4, chroma, luma);
+    AccumulateBgraScalar(pixels.data(), pixels.size() / 4, scalar_chroma, scalar_luma);
+    CHECK(chroma == scalar_chroma);
+    CHECK(luma == scalar_luma);
+
+    // And both match the definition pixel by pixel.
+    Histogram expected_chroma{}, expected_luma{};
+    for (size_t i = 0; i + 4 <= pixels.size(); i += 4)
+    {
+      const uint8_t *p = &pixels[i];
+      expected_chroma[static_cast<size_t>((std::max)({p[0], p[1], p[2]}) - (std::min)({p[0], p[1], p[2]}))]++;
+      expected_luma[static_cast<size_t>((p[0] * 29 + p[1] * 150 + p[2] * 77) >> 8)]++;
+    }
+    CHECK(chroma == expected_chroma);
+    CHECK(luma == expected_luma);
+  }
+
+  void CheckRandomPixels()
+  {
+    std::mt19937 random(28);
+    std::vector<uint8_t> pixels(4 * 100000);
+    for (auto &value : pixels)
+    {
+      value = static_cast<uint8_t>(random());
+    }
+    CheckKernelsAgree(pixels);
+  }
+
+  // The corners of the color cube, every gray level, saturated ramps and
+  // spreads of exactly 0 and 255, where a signed byte subtraction or a carry
+  // between lanes would show.
+  void CheckSyntheticPixels()
+  {
+    std::vector<uint8_t> pixels;
+    for (int corner = 0; corner < 8; corner++)
+    {
+      for (uint8_t alpha : {uint8_t{0}, uint8_t{255}})
+      {
+        pixels.insert(pixels.end(), {static_cast<uint8_t>(corner & 1 ? 255 : 0),
+                                     static_cast<uint8_t>(corner & 2 ? 255 : 0),
+                                     static_cast<uint8_t>(corner & 4 ? 255 : 0), alpha});
+      }
+    }
+    for (int v = 0; v < 256; v++)
+    {
+      auto b = static_cast<uint8_t>(v);
+      auto inverse = static_cast<uint8_t>(255 - v);
+      pixels.insert(pixels.end(), {b, b, b, 255});
+      pixels.insert(pixels.end(), {b, inverse, 0, inverse});
+      pixels.insert(pixels.end(), {255, b, inverse, b});
+      pixels.insert(pixels.end(), {inverse, 128, b, 0});
+    }
+    CheckKernelsAgree(pixels);
+  }
+
+  // A 600 x 400 page; |pixel| returns the BGRA value at (x, y).
+  ColorAnalyzer Analyze(PixelFormat format,
+                        const std::function<void(uint32_t x, uint32_t y, uint8_t *bgra)> &pixel)
+  {
+    auto bpp = BytesPerPixel(format);
+    TiledImage page(600, 400, format, [&](Tile &tile)
+                    {
+      for (uint32_t r = 0; r < tile.height; r++)
+      {
+        for (uint32_t c = 0; c < tile.width; c++)
+        {
+          uint8_t bgra[4];
+          pixel(tile.x + c, tile.y + r, bgra);
+          if (bpp == 1)
+          {
+            tile.Row(r)[c] = Luma(bgra);
+          }
+          else
+          {
+            std::memcpy(tile.Row(r) + c * 4, bgra, 4);
+          }
+        }
+      } },
+                    128);
+    ColorAnalyzer analyzer;
+    page.ForEachTileRow([&](const TileRow &row)
+                        { analyzer.Observe(row); });
+    uint64_t total = 0;
+    for (auto count : analyzer.luma_histogram())
+    {
+      total += count;
+    }
+    CHECK_EQ(total, 600u * 400u);
+    return analyzer;
+  }
+
+  void SetGray(uint8_t *bgra, uint8_t value)
+  {
+    bgra[0] = bgra[1] = bgra[2] = value;
+    bgra[3] = 255;
+  }
+
+  void Paper(uint32_t x, uint32_t y, uint8_t *bgra)
+  {
+    SetGray(bgra, static_cast<uint8_t>(240 + (x * 7 + y * 3) % 9));
+  }
+
+  void Text(uint32_t x, uint32_t y, uint8_t *bgra)
+  {
+    Paper(x, y, bgra);
+    if ((y / 20) % 2 == 0 && (x / 6) % 3 != 0)
+    {
+      SetGray(bgra, static_cast<uint8_t>(15 + (x + y) % 20));
+    }
+  }
+
+  void CheckClassification()
+  {
+    for (auto format : {PixelFormat::kGray8, PixelFormat::kBgra8})
+    {
+      auto blank = Analyze(format, Paper);
+      CHECK(blank.IsBlank());
+      CHECK(blank.Finish() == ColorClass::kMono);
+
+      auto mono = Analyze(format, Text);
+      CHECK(!mono.IsBlank());
+      CHECK(mono.Finish() == ColorClass::kMono);
+
+      // A grayscale photo in the middle of the text.
+      auto gray = Analyze(format, [](uint32_t x, uint32_t y, uint8_t *bgra)
+                          {
+        Text(x, y, bgra);
+        if (x >= 100 && x < 400 && y >= 100 && y < 300)
+        {
+          SetGray(bgra, static_cast<uint8_t>(x / 2 + y / 4));
+        } });
+      CHECK(!gray.IsBlank());
+      CHECK(gray.Finish() == ColorClass::kGray);
+
+      // A red stamp: color in BGRA, lost to luminance in gray.
+      auto stamp = Analyze(format, [](uint32_t x, uint32_t y, uint8_t *bgra)
+                           {
+        Text(x, y, bgra);
+        if (x >= 420 && x < 570 && y >= 260 && y < 380)
+        {
+          bgra[0] = 40;
+          bgra[1] = 30;
+          bgra[2] = 220;
+        } });
+      CHECK(stamp.Finish() == (format == PixelFormat::kBgra8 ? ColorClass::kColor : ColorClass::kGray));
+    }
+
+    // A handful of colored pixels below max_color_fraction stays mono.
+    auto specks = Analyze(PixelFormat::kBgra8, [](uint32_t x, uint32_t y, uint8_t *bgra)
+                          {
+      Text(x, y, bgra);
+      if (x % 97 == 0 && y % 89 == 0)
+      {
+        bgra[0] = 250;
+        bgra[1] = 20;
+        bgra[2] = 20;
+      } });
+    CHECK(specks.Finish() == ColorClass::kMono);
+    CHECK_EQ(std::string(ColorClassName(specks.Finish())), "mono");
+  }
+
+} // namespace
+
+int main()
+{
+  CheckRandomPixels();
+  CheckSyntheticPixels();
+  CheckClassification();
+  std::printf("color_analysis_test passed\n");
+  return 0;
+}
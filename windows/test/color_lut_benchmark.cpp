@@ -0,0 +1,165 @@
+// Applies a 33-point color LUT to an A4 page at 300 dpi, once a scanned
+// document (paper, text and a photo) and once random noise, and reports
+// throughput next to a plain floating-point tetrahedral interpolation.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "color_lut.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const int kSize = 33;
+  const size_t kWidth = 2480;
+  const size_t kHeight = 3508;
+  const int kRuns = 5;
+
+  std::vector<float> DeviceNodes()
+  {
+    std::vector<float> nodes;
+    for (int b = 0; b < kSize; b++)
+    {
+      for (int g = 0; g < kSize; g++)
+      {
+        for (int r = 0; r < kSize; r++)
+        {
+          double rf = std::pow(r / double{kSize - 1}, 1.1);
+          double gf = std::pow(g / double{kSize - 1}, 0.95);
+          double bf = std::pow(b / double{kSize - 1}, 1.05);
+          for (double value : {1.05 * rf - 0.04 * gf - 0.01 * bf, -0.03 * rf + 1.02 * gf + 0.01 * bf,
+                               0.02 * rf - 0.05 * gf + 1.03 * bf})
+          {
+            nodes.push_back(static_cast<float>(std::min(std::max(value, 0.0), 1.0)));
+          }
+        }
+      }
+    }
+    return nodes;
+  }
+
+  // What a first version would do: float grid positions and a sort per pixel.
+  void PlainTetrahedral(const std::vector<float> &nodes, uint8_t *pixels, size_t count)
+  {
+    for (size_t i = 0; i < count; i++, pixels += 4)
+    {
+      float position[3] = {pixels[2] * (kSize - 1) / 255.0f, pixels[1] * (kSize - 1) / 255.0f,
+                           pixels[0] * (kSize - 1) / 255.0f};
+      int index[3];
+      float fraction[3];
+      for (int c = 0; c < 3; c++)
+      {
+        index[c] = std::min(static_cast<int>(position[c]), kSize - 2);
+        fraction[c] = position[c] - static_cast<float>(index[c]);
+      }
+      int order[3] = {0, 1, 2};
+      std::sort(order, order + 3, [&](int a, int b)
+                { return fraction[a] > fraction[b]; });
+      float weight[4] = {1 - fraction[order[0]], fraction[order[0]] - fraction[order[1]],
+                         fraction[order[1]] - fraction[order[2]], fraction[order[2]]};
+      float out[3] = {0, 0, 0};
+      for (int v = 0; v < 4; v++)
+      {
+        if (v > 0)
+        {
+          index[order[v - 1]]++;
+        }
+        size_t node = (static_cast<size_t>(index[2]) * kSize + static_cast<size_t>(index[1])) * kSize +
+                      static_cast<size_t>(index[0]);
+        for (int c = 0; c < 3; c++)
+        {
+          out[c] += weight[v] * nodes[node * 3 + static_cast<size_t>(c)];
+        }
+      }
+      for (int c = 0; c < 3; c++)
+      {
+        pixels[2 - c] = static_cast<uint8_t>(std::lround(out[c] * 255));
+      }
+    }
+  }
+
+  // Paper with sensor noise, lines of text and a photo block.
+  std::vector<uint8_t> DocumentPage()
+  {
+    std::vector<uint8_t> page(kWidth * kHeight * 4, 255);
+    for (size_t y = 0; y < kHeight; y++)
+    {
+      for (size_t x = 0; x < kWidth; x++)
+      {
+        uint8_t *p = &page[(y * kWidth + x) * 4];
+        auto hash = static_cast<uint32_t>(x * 2654435761u ^ y * 40503u);
+        if (y > 2000 && y < 2800 && x > 300 && x < 2100)
+        {
+          p[0] = static_cast<uint8_t>(x / 8 + (hash & 15));
+          p[1] = static_cast<uint8_t>(y / 12 + (hash >> 8 & 15));
+          p[2] = static_cast<uint8_t>((x + y) / 20);
+        }
+        else if ((y / 14) % 3 == 0 && (hash >> 5) % 5 < 2)
+        {
+          p[0] = p[1] = p[2] = static_cast<uint8_t>(30 + (hash & 7));
+        }
+        else
+        {
+          p[0] = 236;
+          p[1] = 238;
+          p[2] = static_cast<uint8_t>(240 + ((hash >> 11) % 7 == 0));
+        }
+      }
+    }
+    return page;
+  }
+
+  std::vector<uint8_t> NoisePage()
+  {
+    std::vector<uint8_t> page(kWidth * kHeight * 4);
+    std::mt19937 random(41);
+    for (auto &value : page)
+    {
+      value = static_cast<uint8_t>(random());
+    }
+    return page;
+  }
+
+  template <typename Apply>
+  double MillisecondsPerPage(const std::vector<uint8_t> &source, Apply apply)
+  {
+    std::vector<uint8_t> page(source.size());
+    double seconds = 0;
+    for (int run = 0; run < kRuns; run++)
+    {
+      std::memcpy(page.data(), source.data(), page.size());
+      auto start = std::chrono::steady_clock::now();
+      apply(page.data(), kWidth * kHeight);
+      seconds += test::SecondsSince(start);
+    }
+    return seconds * 1000 / kRuns;
+  }
+
+} // namespace
+
+int main()
+{
+  auto nodes = DeviceNodes();
+  ColorLut lut(kSize, nodes);
+  const double megapixels = static_cast<double>(kWidth * kHeight) / 1e6;
+
+  std::printf("A4 page at 300 dpi (%.1f Mpx), %d-point LUT:\n", megapixels, kSize);
+  for (auto &page : {std::make_pair("document", DocumentPage()), std::make_pair("noise", NoisePage())})
+  {
+    double lut_ms = MillisecondsPerPage(page.second, [&](uint8_t *pixels, size_t count)
+                                        { lut.ApplyBgra(pixels, count); });
+    double plain_ms = MillisecondsPerPage(page.second, [&](uint8_t *pixels, size_t count)
+                                          { PlainTetrahedral(nodes, pixels, count); });
+    std::printf("  %-9s ColorLut %7.1f ms (%5.0f Mpx/s)   plain float %7.1f ms (%5.0f Mpx/s)\n", page.first, lut_ms,
+                megapixels * 1000 / lut_ms, plain_ms, megapixels * 1000 / plain_ms);
+  }
+  return 0;
+}
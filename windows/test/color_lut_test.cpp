@@ -0,0 +1,312 @@
+// Maps all 16.7 million colors through a 33-point LUT and checks them
+// against exact tetrahedral interpolation, plus alpha, gray tiles, .cube
+// parsing, the per-device cache and which pages ProcessPage corrects.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "color_lut.h"
+#include "page_pipeline.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const int kSize = 33;
+
+  // A device-like transform: per-channel gamma, cross-talk between channels
+  // and a slight hue twist.
+  void DeviceTransform(double r, double g, double b, double out[3])
+  {
+    r = std::pow(r, 1.1);
+    g = std::pow(g, 0.95);
+    b = std::pow(b, 1.05);
+    out[0] = 1.05 * r - 0.04 * g - 0.01 * b + 0.01 * std::sin(6 * g);
+    out[1] = -0.03 * r + 1.02 * g + 0.01 * b;
+    out[2] = 0.02 * r - 0.05 * g + 1.03 * b - 0.01 * r * g;
+    for (int c = 0; c < 3; c++)
+    {
+      out[c] = std::min(std::max(out[c], 0.0), 1.0);
+    }
+  }
+
+  std::vector<float> DeviceNodes()
+  {
+    std::vector<float> nodes;
+    for (int b = 0; b < kSize; b++)
+    {
+      for (int g = 0; g < kSize; g++)
+      {
+        for (int r = 0; r < kSize; r++)
+        {
+          double out[3];
+          DeviceTransform(r / double{kSize - 1}, g / double{kSize - 1}, b / double{kSize - 1}, out);
+          for (double value : out)
+          {
+            nodes.push_back(static_cast<float>(value));
+          }
+        }
+      }
+    }
+    return nodes;
+  }
+
+  // Tetrahedral interpolation in double precision, the exact result.
+  void Reference(const std::vector<float> &nodes, int r, int g, int b, double out[3])
+  {
+    double position[3] = {r * (kSize - 1) / 255.0, g * (kSize - 1) / 255.0, b * (kSize - 1) / 255.0};
+    int index[3];
+    double fraction[3];
+    for (int c = 0; c < 3; c++)
+    {
+      index[c] = std::min(static_cast<int>(position[c]), kSize - 2);
+      fraction[c] = position[c] - index[c];
+    }
+    int order[3] = {0, 1, 2};
+    std::sort(order, order + 3, [&](int a, int b2)
+              { return fraction[a] > fraction[b2]; });
+    double weight[4] = {1 - fraction[order[0]], fraction[order[0]] - fraction[order[1]],
+                        fraction[order[1]] - fraction[order[2]], fraction[order[2]]};
+    out[0] = out[1] = out[2] = 0;
+    for (int v = 0; v < 4; v++)
+    {
+      if (v > 0)
+      {
+        index[order[v - 1]]++;
+      }
+      size_t node = (static_cast<size_t>(index[2]) * kSize + static_cast<size_t>(index[1])) * kSize +
+                    static_cast<size_t>(index[0]);
+      for (int c = 0; c < 3; c++)
+      {
+        out[c] += weight[v] * nodes[node * 3 + static_cast<size_t>(c)];
+      }
+    }
+  }
+
+  void CheckEveryColor()
+  {
+    auto nodes = DeviceNodes();
+    ColorLut lut(kSize, nodes);
+
+    std::vector<uint8_t> pixels(size_t{256} * 256 * 256 * 4);
+    size_t i = 0;
+    for (int b = 0; b < 256; b++)
+    {
+      for (int g = 0; g < 256; g++)
+      {
+        for (int r = 0; r < 256; r++)
+        {
+          pixels[i++] = static_cast<uint8_t>(b);
+          pixels[i++] = static_cast<uint8_t>(g);
+          pixels[i++] = static_cast<uint8_t>(r);
+          pixels[i++] = static_cast<uint8_t>(r ^ g);
+        }
+      }
+    }
+    lut.ApplyBgra(pixels.data(), pixels.size() / 4);
+
+    long max_error = 0;
+    size_t off_by_one = 0;
+    i = 0;
+    for (int b = 0; b < 256; b++)
+    {
+      for (int g = 0; g < 256; g++)
+      {
+        for (int r = 0; r < 256; r++, i += 4)
+        {
+          double exact[3];
+          Reference(nodes, r, g, b, exact);
+          for (int c = 0; c < 3; c++)
+          {
+            long error = std::labs(pixels[i + 2 - static_cast<size_t>(c)] - std::lround(exact[c] * 255));
+            max_error = std::max(max_error, error);
+            off_by_one += error != 0;
+          }
+          CHECK_EQ(pixels[i + 3], static_cast<uint8_t>(r ^ g));
+        }
+      }
+    }
+    std::printf("max error %ld level, %.3f%% of channels off by one\n", max_error,
+                100.0 * static_cast<double>(off_by_one) / (3.0 * 256 * 256 * 256));
+    CHECK(max_error <= 1);
+  }
+
+  void CheckIdentity()
+  {
+    std::vector<float> nodes;
+    for (int b = 0; b < 17; b++)
+    {
+      for (int g = 0; g < 17; g++)
+      {
+        for (int r = 0; r < 17; r++)
+        {
+          nodes.insert(nodes.end(), {r / 16.0f, g / 16.0f, b / 16.0f});
+        }
+      }
+    }
+    ColorLut lut(17, nodes);
+    std::vector<uint8_t> pixels;
+    for (int v = 0; v < 256; v++)
+    {
+      pixels.insert(pixels.end(), {static_cast<uint8_t>(v), static_cast<uint8_t>(255 - v),
+                                   static_cast<uint8_t>(v / 2), 255});
+    }
+    auto expected = pixels;
+    lut.ApplyBgra(pixels.data(), pixels.size() / 4);
+    CHECK(pixels == expected);
+  }
+
+  void CheckTiles()
+  {
+    ColorLut lut(kSize, DeviceNodes());
+    Tile gray;
+    gray.width = 4;
+    gray.height = 2;
+    gray.format = PixelFormat::kGray8;
+    gray.stride = 4;
+    gray.pixels = BufferPool::Shared().Acquire(8);
+    std::fill(gray.pixels.data(), gray.pixels.data() + 8, static_cast<uint8_t>(100));
+    lut.ApplyTile(gray);
+    CHECK(std::all_of(gray.pixels.data(), gray.pixels.data() + 8, [](uint8_t v)
+                      { return v == 100; }));
+
+    Tile color;
+    color.width = 3;
+    color.height = 2;
+    color.format = PixelFormat::kBgra8;
+    color.stride = 16;
+    color.pixels = BufferPool::Shared().Acquire(32);
+    std::fill(color.pixels.data(), color.pixels.data() + 32, static_cast<uint8_t>(200));
+    std::vector<uint8_t> pixel = {200, 200, 200, 200};
+    lut.ApplyBgra(pixel.data(), 1);
+    lut.ApplyTile(color);
+    for (uint32_t row = 0; row < 2; row++)
+    {
+      CHECK(std::equal(pixel.begin(), pixel.end(), color.Row(row)));
+      // Padding past the row is not touched.
+      CHECK_EQ(color.Row(row)[12], 200);
+    }
+  }
+
+  bool Rejected(const std::string &path, const std::string &contents)
+  {
+    std::ofstream(std::filesystem::u8path(path)) << contents;
+    try
+    {
+      ColorLut::LoadCube(path);
+    }
+    catch (const std::runtime_error &)
+    {
+      return true;
+    }
+    return false;
+  }
+
+  void CheckCubeFiles()
+  {
+    test::TempDir dir("color_lut_test");
+    auto path = dir.Child("device.cube");
+    {
+      std::ofstream cube(std::filesystem::u8path(path));
+      cube << "# calibrated\nTITLE \"device\"\nLUT_3D_SIZE 2\nDOMAIN_MIN 0 0 0\nDOMAIN_MAX 1.0 1.0 1.0\n\n";
+      for (int i = 0; i < 8; i++)
+      {
+        // Inverts the colors.
+        cube << 1 - (i & 1) << " " << 1 - ((i >> 1) & 1) << " " << 1 - ((i >> 2) & 1) << "\n";
+      }
+    }
+    auto lut = ColorLut::LoadCube(path);
+    CHECK_EQ(lut->size(), 2u);
+    std::vector<uint8_t> pixel = {10, 20, 30, 40};
+    lut->ApplyBgra(pixel.data(), 1);
+    CHECK((pixel == std::vector<uint8_t>{245, 235, 225, 40}));
+
+    ColorLutCache cache;
+    auto first = cache.Load("scanner-a", path);
+    CHECK_EQ(cache.Load("scanner-b", path), first);
+    CHECK_EQ(cache.Find("scanner-a"), first);
+    cache.Remove("scanner-a");
+    CHECK(!cache.Find("scanner-a"));
+    CHECK_EQ(cache.Find("scanner-b"), first);
+
+    auto bad = dir.Child("bad.cube");
+    CHECK(Rejected(bad, "LUT_1D_SIZE 4\n"));
+    CHECK(Rejected(bad, "LUT_3D_SIZE 2\n0 0 0\n"));
+    CHECK(Rejected(bad, "LUT_3D_SIZE 2\nDOMAIN_MAX 2 2 2\n"));
+    CHECK(Rejected(bad, "LUT_3D_SIZE 1\n"));
+    CHECK(Rejected(bad, std::string()));
+    bool missing = false;
+    try
+    {
+      ColorLut::LoadCube(dir.Child("nowhere") + "/missing.cube");
+    }
+    catch (const std::runtime_error &)
+    {
+      missing = true;
+    }
+    CHECK(missing);
+  }
+
+  // Runs a flat color page through ProcessPage as if decoded from a file
+  // named |name| and returns the name of the file it ends up in.
+  std::string CorrectPage(const test::TempDir &dir, const std::string &name, bool correct_jpeg)
+  {
+    auto path = dir.Child(name);
+    std::ofstream(std::filesystem::u8path(path)) << "driver output";
+    auto page = std::make_unique<TiledImage>(64, 48, PixelFormat::kBgra8, [](Tile &tile)
+                                             {
+      for (uint32_t r = 0; r < tile.height; r++)
+      {
+        std::fill(tile.Row(r), tile.Row(r) + tile.width * 4, static_cast<uint8_t>(90));
+      } });
+    PageOptions options;
+    options.color_lut = std::make_shared<ColorLut>(kSize, DeviceNodes());
+    options.correct_jpeg = correct_jpeg;
+    auto result = ProcessPage(std::move(page), path, options);
+    if (result.path == path)
+    {
+      std::ifstream in(std::filesystem::u8path(path));
+      std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+      CHECK_EQ(contents, std::string("driver output"));
+    }
+    else
+    {
+      CHECK(!std::filesystem::exists(std::filesystem::u8path(path)));
+    }
+    return std::filesystem::u8path(result.path).filename().u8string();
+  }
+
+  void CheckCorrectedFormats()
+  {
+    test::TempDir dir("color_lut_pages");
+    // Lossless sources become PNG.
+    CHECK_EQ(CorrectPage(dir, "a.tif", false), std::string("a.png"));
+    CHECK_EQ(CorrectPage(dir, "b.bmp", false), std::string("b.png"));
+    // JPEG pages keep their file unless asked for.
+    CHECK_EQ(CorrectPage(dir, "c.jpg", false), std::string("c.jpg"));
+    CHECK_EQ(CorrectPage(dir, "d.JPEG", false), std::string("d.JPEG"));
+    CHECK_EQ(CorrectPage(dir, "e.jpg", true), std::string("e.png"));
+  }
+
+} // namespace
+
+int main()
+{
+  CheckEveryColor();
+  CheckIdentity();
+  CheckTiles();
+  CheckCubeFiles();
+  CheckCorrectedFormats();
+  std::printf("color_lut_test passed\n");
+  return 0;
+}
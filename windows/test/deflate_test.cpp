@@ -0,0 +1,194 @@
+// Round-trips varied inputs through Deflater and zlib's inflate.
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "deflate.h"
+#include "test_support.h"
+
+using quick_scanner_plus::Adler32Combine;
+using quick_scanner_plus::Deflater;
+
+namespace
+{
+
+  std::vector<uint8_t> Inflate(const std::vector<uint8_t> &compressed, int window_bits, size_t expected_size)
+  {
+    z_stream stream{};
+    CHECK_EQ(inflateInit2(&stream, window_bits), Z_OK);
+    std::vector<uint8_t> output(expected_size + 1);
+    stream.next_in = const_cast<Bytef *>(compressed.data());
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    stream.next_out = output.data();
+    stream.avail_out = static_cast<uInt>(output.size());
+    int status = inflate(&stream, Z_FINISH);
+    if (status != Z_STREAM_END)
+    {
+      std::fprintf(stderr, "inflate: %d %s\n", status, stream.msg ? stream.msg : "");
+    }
+    CHECK_EQ(status, Z_STREAM_END);
+    CHECK_EQ(stream.avail_in, 0u);
+    output.resize(stream.total_out);
+    inflateEnd(&stream);
+    return output;
+  }
+
+  // Compresses |input| in pieces of |chunk| bytes, as PngWriter feeds rows.
+  std::vector<uint8_t> Compress(const std::vector<uint8_t> &input, size_t chunk)
+  {
+    std::vector<uint8_t> output;
+    Deflater deflater([&output](const uint8_t *data, size_t size)
+                      { output.insert(output.end(), data, data + size); });
+    for (size_t offset = 0; offset < input.size(); offset += chunk)
+    {
+      deflater.Write(input.data() + offset, std::min(chunk, input.size() - offset));
+    }
+    CHECK_EQ(deflater.adler32(), adler32(1, input.data(), static_cast<uInt>(input.size())));
+    deflater.Finish();
+    return output;
+  }
+
+  void CheckRoundTrip(const char *name, const std::vector<uint8_t> &input)
+  {
+    for (size_t chunk : {size_t{1} << 20, size_t{4099}, size_t{1}})
+    {
+      if (chunk == 1 && input.size() > (1 << 16))
+      {
+        continue;
+      }
+      auto compressed = Compress(input, chunk);
+      CHECK(Inflate(compressed, 15, input.size()) == input);
+      if (chunk == (size_t{1} << 20))
+      {
+        std::printf("%-16s %9zu -> %9zu bytes\n", name, input.size(), compressed.size());
+      }
+    }
+  }
+
+  // Two raw runs, each ending on a sync flush, spliced into one zlib stream
+  // the way PngWriter joins its bands.
+  void CheckSplicedRuns(const std::vector<uint8_t> &first, const std::vector<uint8_t> &second)
+  {
+    std::vector<uint8_t> stream = {0x78, 0x01};
+    uint32_t adler[2];
+    const std::vector<uint8_t> *parts[2] = {&first, &second};
+    for (int i = 0; i < 2; i++)
+    {
+      Deflater deflater([&stream](const uint8_t *data, size_t size)
+                        { stream.insert(stream.end(), data, data + size); },
+                        Deflater::Framing::kRaw);
+      deflater.Write(parts[i]->data(), parts[i]->size());
+      adler[i] = deflater.adler32();
+      if (i == 0)
+      {
+        deflater.Flush();
+      }
+      else
+      {
+        deflater.Finish();
+      }
+    }
+    uint32_t combined = Adler32Combine(adler[0], adler[1], second.size());
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+      stream.push_back(static_cast<uint8_t>(combined >> shift));
+    }
+
+    std::vector<uint8_t> expected = first;
+    expected.insert(expected.end(), second.begin(), second.end());
+    CHECK(Inflate(stream, 15, expected.size()) == expected);
+  }
+
+} // namespace
+
+int main()
+{
+  std::mt19937 random(97);
+  const size_t kSize = 1 << 20;
+
+  CheckRoundTrip("empty", {});
+  CheckRoundTrip("one byte", {42});
+
+  std::vector<uint8_t> text;
+  std::string line = "The quick brown fox jumps over the lazy dog. ";
+  while (text.size() < kSize)
+  {
+    text.insert(text.end(), line.begin(), line.end());
+    line[random() % line.size()] = static_cast<char>('a' + random() % 26);
+  }
+  CheckRoundTrip("text", text);
+
+  std::vector<uint8_t> noise(kSize);
+  for (auto &byte : noise)
+  {
+    byte = static_cast<uint8_t>(random());
+  }
+  CheckRoundTrip("noise", noise);
+
+  CheckRoundTrip("zeros", std::vector<uint8_t>(kSize, 0));
+
+  // Mostly zeros with a random byte every 97: long matches and a literal
+  // alphabet with many rare symbols, which once produced an incomplete code
+  // length code.
+  for (int seed = 0; seed < 8; seed++)
+  {
+    std::mt19937 sparse_random(static_cast<uint32_t>(seed));
+    std::vector<uint8_t> sparse(kSize / 4 + static_cast<size_t>(seed) * 1237, 0);
+    for (size_t i = 0; i < sparse.size(); i += 97)
+    {
+      sparse[i] = static_cast<uint8_t>(sparse_random());
+    }
+    CheckRoundTrip("sparse", sparse);
+  }
+
+  // Geometric byte distributions, from mild to extreme skew. Fibonacci-like
+  // frequencies push plain Huffman codes past 15 bits.
+  for (double p : {0.05, 0.3, 0.6, 0.9})
+  {
+    std::geometric_distribution<int> geometric(p);
+    std::vector<uint8_t> skewed(kSize);
+    for (auto &byte : skewed)
+    {
+      byte = static_cast<uint8_t>(std::min(geometric(random), 255));
+    }
+    CheckRoundTrip("skewed", skewed);
+  }
+  std::vector<uint8_t> fibonacci;
+  {
+    uint64_t a = 1;
+    uint64_t b = 1;
+    for (int symbol = 0; symbol < 25; symbol++)
+    {
+      fibonacci.insert(fibonacci.end(), static_cast<size_t>(a), static_cast<uint8_t>(symbol * 7));
+      uint64_t next = a + b;
+      a = b;
+      b = next;
+    }
+    std::shuffle(fibonacci.begin(), fibonacci.end(), random);
+  }
+  CheckRoundTrip("fibonacci", fibonacci);
+
+  // A scanned page: paper noise with runs of dark text.
+  std::vector<uint8_t> page(2550 * 400);
+  for (size_t i = 0; i < page.size(); i++)
+  {
+    size_t x = i % 2550;
+    size_t y = i / 2550;
+    bool ink = (y / 40) % 2 == 0 && y % 40 < 28 && (x * 7 + y * 3) % 11 < 4;
+    page[i] = static_cast<uint8_t>(ink ? 20 + random() % 20 : 245 + random() % 8);
+  }
+  CheckRoundTrip("page", page);
+
+  CheckSplicedRuns(text, page);
+  CheckSplicedRuns({}, noise);
+  CheckSplicedRuns(std::vector<uint8_t>(100000, 0), {1, 2, 3});
+
+  std::printf("deflate_test passed\n");
+  return 0;
+}
@@ -0,0 +1,431 @@
+// Runs EsclSession against a stub eSCL scanner and checks capability
+// parsing, the ScanSettings document, job location resolution, that pages
+// arrive in order until the device has no more, that a busy device is
+// retried and then given up on, that every failure after the job exists
+// deletes it on the device, and that the request for the next page goes out
+// while the current one is still being saved and handed on.
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "escl_session.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const char kBaseUrl[] = "http://10.0.0.7:80/eSCL";
+  const char kJobUrl[] = "http://10.0.0.7:80/eSCL/ScanJobs/17";
+
+  // Answers eSCL requests as a scanner would. NextDocument requests take
+  // the scripted answers in order and get 404 once they run out.
+  class StubScanner : public EsclTransport
+  {
+  public:
+    struct Answer
+    {
+      int status = 200;
+      // How long the device takes before it answers.
+      std::chrono::milliseconds delay{0};
+      std::string body;
+    };
+
+    explicit StubScanner(const test::TempDir &dir) : dir_(dir) {}
+
+    int create_status = 201;
+    std::string location = "/eSCL/ScanJobs/17";
+    std::string capabilities;
+    // How long writing a page file takes.
+    std::chrono::milliseconds save_delay{0};
+
+    void Script(Answer answer)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      answers_.push_back(std::move(answer));
+    }
+
+    void ScriptPages(size_t count, std::chrono::milliseconds delay = std::chrono::milliseconds(0))
+    {
+      for (size_t i = 0; i < count; i++)
+      {
+        Script({200, delay, "page " + std::to_string(i + 1)});
+      }
+    }
+
+    std::vector<std::string> log() const
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return log_;
+    }
+
+    size_t Count(const std::string &entry) const
+    {
+      size_t count = 0;
+      for (const auto &line : log())
+      {
+        count += line == entry;
+      }
+      return count;
+    }
+
+    Response Get(const std::string &url) override
+    {
+      Log("GET " + url);
+      Response response;
+      response.status = 200;
+      response.content_type = "text/xml";
+      response.body = capabilities;
+      return response;
+    }
+
+    Response Post(const std::string &url, const std::string &, const std::string &) override
+    {
+      Log("POST " + url);
+      Response response;
+      response.status = create_status;
+      response.location = location;
+      return response;
+    }
+
+    Response Delete(const std::string &url) override
+    {
+      Log("DELETE " + url);
+      Response response;
+      response.status = 200;
+      return response;
+    }
+
+    Document GetDocument(const std::string &url) override
+    {
+      Log("GET " + url);
+      Answer answer;
+      answer.status = 404;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!answers_.empty())
+        {
+          answer = answers_.front();
+          answers_.pop_front();
+        }
+      }
+      std::this_thread::sleep_for(answer.delay);
+
+      Document document;
+      document.status = answer.status;
+      document.content_type = "image/jpeg";
+      if (answer.status == 200)
+      {
+        document.save = [this, answer]
+        {
+          Log("save " + answer.body);
+          std::this_thread::sleep_for(save_delay);
+          std::string path;
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            path = dir_.Child("Scan" + std::to_string(++saved_) + ".jpg");
+          }
+          std::ofstream(path, std::ios::binary) << answer.body;
+          Log("saved " + answer.body);
+          return path;
+        };
+      }
+      return document;
+    }
+
+  private:
+    void Log(const std::string &entry)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      log_.push_back(entry);
+    }
+
+    const test::TempDir &dir_;
+    mutable std::mutex mutex_;
+    std::deque<Answer> answers_;
+    std::vector<std::string> log_;
+    size_t saved_ = 0;
+  };
+
+  std::string ReadFile(const std::string &path)
+  {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  // Settings that keep retries quick.
+  EsclScanSettings QuickSettings()
+  {
+    EsclScanSettings settings;
+    settings.busy_timeout = std::chrono::milliseconds(200);
+    settings.busy_retry_delay = std::chrono::milliseconds(5);
+    return settings;
+  }
+
+  void CheckCapabilities()
+  {
+    const std::string capabilities =
+        "<scan:ScannerCapabilities><scan:Platen><scan:SettingProfiles><scan:SettingProfile>"
+        "<scan:DocumentFormats><pwg:DocumentFormat>image/jpeg</pwg:DocumentFormat>"
+        "<scan:DocumentFormatExt>application/pdf</scan:DocumentFormatExt></scan:DocumentFormats>"
+        "</scan:SettingProfile></scan:SettingProfiles></scan:Platen>"
+        "<scan:Adf><scan:AdfSimplexInputCaps/></scan:Adf></scan:ScannerCapabilities>";
+    CHECK(EsclSupportsFormat(capabilities, ScanFormat::kJpeg));
+    CHECK(EsclSupportsFormat(capabilities, ScanFormat::kPdf));
+    CHECK(!EsclSupportsFormat(capabilities, ScanFormat::kPng));
+    CHECK(!EsclSupportsDuplex(capabilities));
+    CHECK(EsclSupportsDuplex("<scan:Adf><scan:AdfDuplexInputCaps></scan:AdfDuplexInputCaps></scan:Adf>"));
+
+    test::TempDir dir("escl_session_test");
+    StubScanner scanner(dir);
+    scanner.capabilities = capabilities;
+    EsclSession session(scanner, kBaseUrl);
+    CHECK_EQ(session.Capabilities(), capabilities);
+    CHECK_EQ(scanner.Count("GET http://10.0.0.7:80/eSCL/ScannerCapabilities"), 1u);
+
+    CHECK(IsEsclDeviceId(EsclDeviceId(kBaseUrl)));
+    CHECK(!IsEsclDeviceId("\\\\?\\SWD#ScanDevice"));
+    CHECK_EQ(EsclBaseUrl(EsclDeviceId(kBaseUrl)), kBaseUrl);
+  }
+
+  void CheckSettingsXml()
+  {
+    EsclScanSettings settings;
+    settings.input_source = "Feeder";
+    settings.color_mode = "Grayscale8";
+    settings.resolution = 600;
+    settings.document_format = "image/<odd>&";
+    auto xml = EsclScanSettingsXml(settings);
+    CHECK(xml.find("<pwg:InputSource>Feeder</pwg:InputSource>") != std::string::npos);
+    CHECK(xml.find("<scan:ColorMode>Grayscale8</scan:ColorMode>") != std::string::npos);
+    CHECK(xml.find("<scan:XResolution>600</scan:XResolution>") != std::string::npos);
+    CHECK(xml.find("<scan:YResolution>600</scan:YResolution>") != std::string::npos);
+    CHECK(xml.find("<pwg:DocumentFormat>image/&lt;odd&gt;&amp;</pwg:DocumentFormat>") != std::string::npos);
+    CHECK(xml.find("Duplex") == std::string::npos);
+
+    settings.duplex = true;
+    CHECK(EsclScanSettingsXml(settings).find("<scan:Duplex>true</scan:Duplex>") != std::string::npos);
+  }
+
+  void CheckLocations()
+  {
+    CHECK_EQ(ResolveEsclLocation(kBaseUrl, "http://10.0.0.8/eSCL/ScanJobs/3"), "http://10.0.0.8/eSCL/ScanJobs/3");
+    CHECK_EQ(ResolveEsclLocation(kBaseUrl, "/eSCL/ScanJobs/17/"), kJobUrl);
+    CHECK_EQ(ResolveEsclLocation(kBaseUrl, "ScanJobs/17"), kJobUrl);
+    CHECK_EQ(ResolveEsclLocation(std::string(kBaseUrl) + "/", "ScanJobs/17"), kJobUrl);
+    CHECK_EQ(ResolveEsclLocation(kBaseUrl, "./ScanJobs/17"), kJobUrl);
+    CHECK_EQ(ResolveEsclLocation(kBaseUrl, "../eSCL/ScanJobs/17"), kJobUrl);
+    CHECK_EQ(ResolveEsclLocation(kBaseUrl, "/eSCL/./ScanJobs/../ScanJobs/17"), kJobUrl);
+    CHECK_EQ(ResolveEsclLocation("http://[fe80::1%25eth0]:8080/eSCL", "/eSCL/ScanJobs/2"),
+             "http://[fe80::1%25eth0]:8080/eSCL/ScanJobs/2");
+    CHECK_EQ(ResolveEsclLocation("http://10.0.0.7", "ScanJobs/4"), "http://10.0.0.7/ScanJobs/4");
+
+    CHECK_EQ(EsclFileExtension("image/png"), ".png");
+    CHECK_EQ(EsclFileExtension("application/pdf"), ".pdf");
+    CHECK_EQ(EsclFileExtension("image/jpeg"), ".jpg");
+  }
+
+  void CheckPages()
+  {
+    test::TempDir dir("escl_session_test");
+    StubScanner scanner(dir);
+    scanner.ScriptPages(3);
+    EsclSession session(scanner, kBaseUrl);
+
+    std::vector<std::string> pages;
+    session.Scan(QuickSettings(), [&](const std::string &path)
+                 { pages.push_back(ReadFile(path)); });
+    CHECK_EQ(pages.size(), 3u);
+    CHECK_EQ(pages[0], "page 1");
+    CHECK_EQ(pages[2], "page 3");
+    CHECK_EQ(scanner.log().front(), "POST http://10.0.0.7:80/eSCL/ScanJobs");
+    // Three pages and the 404 that ends the job.
+    CHECK_EQ(scanner.Count(std::string("GET ") + kJobUrl + "/NextDocument"), 4u);
+    CHECK_EQ(scanner.Count(std::string("DELETE ") + kJobUrl), 0u);
+  }
+
+  void CheckBusy()
+  {
+    test::TempDir dir("escl_session_test");
+    {
+      // Busy twice, then the page.
+      StubScanner scanner(dir);
+      scanner.Script({503});
+      scanner.Script({503});
+      scanner.ScriptPages(1);
+      EsclSession session(scanner, kBaseUrl);
+      size_t pages = 0;
+      session.Scan(QuickSettings(), [&](const std::string &)
+                   { pages++; });
+      CHECK_EQ(pages, 1u);
+      CHECK_EQ(scanner.Count(std::string("GET ") + kJobUrl + "/NextDocument"), 4u);
+    }
+    {
+      // Busy for longer than busy_timeout.
+      StubScanner scanner(dir);
+      for (int i = 0; i < 1000; i++)
+      {
+        scanner.Script({503, std::chrono::milliseconds(1)});
+      }
+      EsclSession session(scanner, kBaseUrl);
+      auto start = std::chrono::steady_clock::now();
+      bool busy = false;
+      try
+      {
+        session.Scan(QuickSettings(), [](const std::string &) {});
+      }
+      catch (const EsclBusyError &)
+      {
+        busy = true;
+      }
+      CHECK(busy);
+      CHECK(test::SecondsSince(start) >= 0.2);
+      CHECK(test::SecondsSince(start) < 5);
+      CHECK_EQ(scanner.log().back(), std::string("DELETE ") + kJobUrl);
+    }
+  }
+
+  void CheckFailures()
+  {
+    test::TempDir dir("escl_session_test");
+    {
+      // The handler fails on the second page.
+      StubScanner scanner(dir);
+      scanner.ScriptPages(3);
+      EsclSession session(scanner, kBaseUrl);
+      size_t pages = 0;
+      bool thrown = false;
+      try
+      {
+        session.Scan(QuickSettings(), [&](const std::string &)
+                     {
+          if (++pages == 2)
+          {
+            throw std::runtime_error("disk full");
+          } });
+      }
+      catch (const std::runtime_error &error)
+      {
+        thrown = std::string(error.what()) == "disk full";
+      }
+      CHECK(thrown);
+      CHECK_EQ(scanner.Count(std::string("DELETE ") + kJobUrl), 1u);
+    }
+    {
+      // The device refuses the job, so there is nothing to delete.
+      StubScanner scanner(dir);
+      scanner.create_status = 409;
+      EsclSession session(scanner, kBaseUrl);
+      bool thrown = false;
+      try
+      {
+        session.Scan(QuickSettings(), [](const std::string &) {});
+      }
+      catch (const std::runtime_error &)
+      {
+        thrown = true;
+      }
+      CHECK(thrown);
+      CHECK_EQ(scanner.log().size(), 1u);
+    }
+    {
+      // The device fails while scanning.
+      StubScanner scanner(dir);
+      scanner.ScriptPages(1);
+      scanner.Script({500});
+      EsclSession session(scanner, kBaseUrl);
+      size_t pages = 0;
+      bool thrown = false;
+      try
+      {
+        session.Scan(QuickSettings(), [&](const std::string &)
+                     { pages++; });
+      }
+      catch (const std::runtime_error &)
+      {
+        thrown = true;
+      }
+      CHECK(thrown);
+      CHECK_EQ(pages, 1u);
+      CHECK_EQ(scanner.log().back(), std::string("DELETE ") + kJobUrl);
+    }
+  }
+
+  void CheckPipelining()
+  {
+    const size_t kPages = 6;
+    const auto kScanTime = std::chrono::milliseconds(60);
+    const auto kSaveTime = std::chrono::milliseconds(20);
+    const auto kHandlerTime = std::chrono::milliseconds(60);
+
+    test::TempDir dir("escl_session_test");
+    StubScanner scanner(dir);
+    scanner.save_delay = kSaveTime;
+    scanner.ScriptPages(kPages, kScanTime);
+    EsclSession session(scanner, kBaseUrl);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t pages = 0;
+    // Blocks as scanBatch's enqueuePage does when its queue is full.
+    session.Scan(QuickSettings(), [&](const std::string &)
+                 {
+      pages++;
+      std::this_thread::sleep_for(kHandlerTime); });
+    double seconds = test::SecondsSince(start);
+    CHECK_EQ(pages, kPages);
+
+    // The request for page 2 goes out before page 1 is saved.
+    auto log = scanner.log();
+    auto position = [&](const std::string &entry)
+    {
+      for (size_t i = 0; i < log.size(); i++)
+      {
+        if (log[i] == entry)
+        {
+          return i;
+        }
+      }
+      return log.size();
+    };
+    size_t second_request = 0;
+    for (size_t i = 0, requests = 0; i < log.size(); i++)
+    {
+      if (log[i] == std::string("GET ") + kJobUrl + "/NextDocument" && ++requests == 2)
+      {
+        second_request = i;
+        break;
+      }
+    }
+    CHECK(second_request > 0);
+    CHECK(second_request < position("saved page 1"));
+
+    // One after the other, each page would take scan, save and handler
+    // time; overlapped, the handler runs while the device scans.
+    auto serial = std::chrono::duration<double>(kScanTime + kSaveTime + kHandlerTime).count() * kPages;
+    CHECK(seconds < serial * 0.8);
+    std::printf("  %zu pages in %.2f s, %.2f s one after the other\n", kPages, seconds, serial);
+  }
+
+} // namespace
+
+int main()
+{
+  CheckCapabilities();
+  CheckSettingsXml();
+  CheckLocations();
+  CheckPages();
+  CheckBusy();
+  CheckFailures();
+  CheckPipelining();
+  std::printf("escl_session_test passed\n");
+  return 0;
+}
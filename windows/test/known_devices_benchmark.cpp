@@ -0,0 +1,77 @@
+// Times what the first getScanners call adds to startup: reading the list
+// of known devices. Also times the save that follows discovery, which runs
+// off the platform thread.
+//
+//   known_devices_benchmark [devices]
+//
+// Defaults to lists of 4, 32 and 512 devices with ids and names as long as
+// WinRT's.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "known_devices.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const int kRuns = 200;
+
+  std::vector<KnownDevice> Devices(size_t count)
+  {
+    std::vector<KnownDevice> devices;
+    for (size_t i = 0; i < count; i++)
+    {
+      devices.push_back({"\\\\?\\SWD#WIA#{6bdd1fc6-810f-11d0-bec7-08002be2092f}\\" + std::to_string(1000 + i),
+                         "Office Scanner " + std::to_string(i) + " (Network Flatbed Series)"});
+    }
+    return devices;
+  }
+
+  // Median of |kRuns| runs in microseconds.
+  template <typename Run>
+  double MedianMicroseconds(Run run)
+  {
+    std::vector<double> times;
+    for (int i = 0; i < kRuns; i++)
+    {
+      auto start = std::chrono::steady_clock::now();
+      run();
+      times.push_back(test::SecondsSince(start) * 1e6);
+    }
+    std::nth_element(times.begin(), times.begin() + kRuns / 2, times.end());
+    return times[kRuns / 2];
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  std::vector<size_t> counts = {4, 32, 512};
+  if (argc > 1)
+  {
+    counts = {static_cast<size_t>(std::strtoull(argv[1], nullptr, 10))};
+  }
+
+  test::TempDir dir("known_devices_benchmark");
+  auto path = dir.Child("quick_scanner_plus") + "/known_devices.txt";
+  for (auto count : counts)
+  {
+    auto devices = Devices(count);
+    SaveKnownDevices(path, devices);
+    size_t loaded = 0;
+    double load = MedianMicroseconds([&]
+                                     { loaded = LoadKnownDevices(path).size(); });
+    double save = MedianMicroseconds([&]
+                                     { SaveKnownDevices(path, devices); });
+    std::printf("%5zu devices: load %8.1f us (%zu loaded), save %8.1f us\n", count, load, loaded, save);
+  }
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Saves and loads the known-device list: a round trip with awkward names,
+// missing, empty and garbled files, and the write to a staging file that is
+// renamed over the old list only once it is complete.
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "known_devices.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  bool SameDevices(const std::vector<KnownDevice> &a, const std::vector<KnownDevice> &b)
+  {
+    if (a.size() != b.size())
+    {
+      return false;
+    }
+    for (size_t i = 0; i < a.size(); i++)
+    {
+      if (a[i].id != b[i].id || a[i].name != b[i].name)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void WriteText(const std::string &path, const std::string &text)
+  {
+    std::ofstream(std::filesystem::u8path(path), std::ios::binary) << text;
+  }
+
+  std::string ReadText(const std::string &path)
+  {
+    std::ifstream in(std::filesystem::u8path(path), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  }
+
+  void CheckRoundTrip()
+  {
+    test::TempDir dir("known_devices_test");
+    // The directory is created on the first save.
+    auto path = dir.Child("quick_scanner_plus") + "/known_devices.txt";
+    std::vector<KnownDevice> devices = {
+        {"\\\\?\\SWD#WIA#{6bdd1fc6-810f-11d0-bec7-08002be2092f}\\0001", "Flatbed A"},
+        {"escl:http://192.168.1.20:80/eSCL", "Büro Scanner \xE2\x84\xA2"},
+        {"wia:2", ""},
+    };
+    CHECK(SaveKnownDevices(path, devices));
+    CHECK(SameDevices(LoadKnownDevices(path), devices));
+    CHECK(!std::filesystem::exists(std::filesystem::u8path(path + ".tmp")));
+
+    // Tabs and line breaks in names would split an entry; they become spaces.
+    CHECK(SaveKnownDevices(path, {{"wia:1", "Line\tone\r\ntwo"}}));
+    CHECK(SameDevices(LoadKnownDevices(path), {{"wia:1", "Line one  two"}}));
+
+    CHECK(SaveKnownDevices(path, {}));
+    CHECK(LoadKnownDevices(path).empty());
+  }
+
+  void CheckUnreadableLists()
+  {
+    test::TempDir dir("known_devices_test");
+    auto path = dir.Child("known_devices.txt");
+    CHECK(LoadKnownDevices(path).empty());
+
+    WriteText(path, "");
+    CHECK(LoadKnownDevices(path).empty());
+
+    // No header, a different version, and a header with trailing junk.
+    WriteText(path, "wia:1\tFlatbed\n");
+    CHECK(LoadKnownDevices(path).empty());
+    WriteText(path, "quick_scanner_plus known devices 2\nwia:1\tFlatbed\n");
+    CHECK(LoadKnownDevices(path).empty());
+    WriteText(path, "quick_scanner_plus known devices 1 \nwia:1\tFlatbed\n");
+    CHECK(LoadKnownDevices(path).empty());
+    WriteText(path, std::string("\x89PNG\r\n\x1a\n\0\0\0", 11));
+    CHECK(LoadKnownDevices(path).empty());
+
+    // Lines without an id are skipped, the rest is kept.
+    WriteText(path, "quick_scanner_plus known devices 1\nwia:1\tFlatbed\nno tab\n\tno id\n\nwia:2\tFeeder\n");
+    CHECK(SameDevices(LoadKnownDevices(path), {{"wia:1", "Flatbed"}, {"wia:2", "Feeder"}}));
+  }
+
+  void CheckStagedWrite()
+  {
+    test::TempDir dir("known_devices_test");
+    auto path = dir.Child("known_devices.txt");
+    std::vector<KnownDevice> old_list = {{"wia:1", "Flatbed"}, {"wia:2", "Feeder"}};
+    CHECK(SaveKnownDevices(path, old_list));
+    auto old_text = ReadText(path);
+
+    // A run that crashed while saving left half a staging file behind. It
+    // is never read, and the next save replaces it.
+    WriteText(path + ".tmp", "quick_scanner_plus known devices 1\nwia:3\tHal");
+    CHECK(SameDevices(LoadKnownDevices(path), old_list));
+    CHECK(SaveKnownDevices(path, {{"wia:3", "Handheld"}}));
+    CHECK(SameDevices(LoadKnownDevices(path), {{"wia:3", "Handheld"}}));
+    CHECK(!std::filesystem::exists(std::filesystem::u8path(path + ".tmp")));
+
+    // When the staging file cannot be written, the save fails and the list
+    // on disk is left as it was.
+    CHECK(SaveKnownDevices(path, old_list));
+    std::filesystem::create_directory(std::filesystem::u8path(path + ".tmp"));
+    CHECK(!SaveKnownDevices(path, {{"wia:4", "Never saved"}}));
+    CHECK_EQ(ReadText(path), old_text);
+    CHECK(SameDevices(LoadKnownDevices(path), old_list));
+  }
+
+} // namespace
+
+int main()
+{
+  CheckRoundTrip();
+  CheckUnreadableLists();
+  CheckStagedWrite();
+  std::printf("known_devices_test passed\n");
+  return 0;
+}
@@ -0,0 +1,92 @@
+// Loads PlatformDispatcher the way a busy batch does: scan threads posting
+// results and band events, mixed with progress and preview updates that
+// are coalesced per frame. Reports the message rate and how much time the
+// platform thread spends delivering.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "platform_dispatcher.h"
+#include "simulated_platform_thread.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const int kThreads = 8;
+
+  // |rate| is events per second per thread, or zero for as fast as
+  // possible. Three in four events are coalesced progress updates, one key
+  // per thread.
+  void Run(const char *name, int rate, std::chrono::milliseconds duration)
+  {
+    std::atomic<uint64_t> plain_runs{0};
+    std::atomic<uint64_t> coalesced_runs{0};
+    DispatcherStats stats;
+    double seconds = 0;
+    {
+      test::SimulatedPlatformThread platform;
+      auto start = std::chrono::steady_clock::now();
+      std::vector<std::thread> threads;
+      for (int t = 0; t < kThreads; t++)
+      {
+        threads.emplace_back([&, t]
+                             {
+          std::string key = "progress:" + std::to_string(t);
+          auto next = std::chrono::steady_clock::now();
+          for (uint64_t i = 0; std::chrono::steady_clock::now() - start < duration; i++)
+          {
+            if (i % 4 == 0)
+            {
+              platform.dispatcher().Post([&plain_runs]
+                                         { plain_runs++; });
+            }
+            else
+            {
+              platform.dispatcher().PostCoalesced(key, [&coalesced_runs]
+                                                  { coalesced_runs++; });
+            }
+            if (rate > 0)
+            {
+              next += std::chrono::microseconds(1000000 / rate);
+              std::this_thread::sleep_until(next);
+            }
+          } });
+      }
+      for (auto &thread : threads)
+      {
+        thread.join();
+      }
+      seconds = test::SecondsSince(start);
+      stats = platform.dispatcher().stats();
+    }
+
+    std::printf("%s: %d threads for %.2f s\n", name, kThreads, seconds);
+    std::printf("  posted     %9llu (%.0f/s)\n", static_cast<unsigned long long>(stats.posted),
+                static_cast<double>(stats.posted) / seconds);
+    std::printf("  delivered  %9llu (%llu plain, %llu coalesced, %.0f/s per progress key)\n",
+                static_cast<unsigned long long>(plain_runs + coalesced_runs),
+                static_cast<unsigned long long>(plain_runs.load()),
+                static_cast<unsigned long long>(coalesced_runs.load()),
+                static_cast<double>(coalesced_runs) / kThreads / seconds);
+    std::printf("  superseded %9llu\n", static_cast<unsigned long long>(stats.superseded));
+    std::printf("  platform thread: %llu drains, %.1f ms busy (%.2f%%), longest drain %llu us\n",
+                static_cast<unsigned long long>(stats.drains), static_cast<double>(stats.busy_us) / 1000,
+                static_cast<double>(stats.busy_us) / 1e4 / seconds,
+                static_cast<unsigned long long>(stats.max_drain_us));
+  }
+
+} // namespace
+
+int main()
+{
+  Run("Paced, 1625 events/s per thread", 1625, std::chrono::milliseconds(1200));
+  Run("Flood", 0, std::chrono::milliseconds(1000));
+  return 0;
+}
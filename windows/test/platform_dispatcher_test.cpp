@@ -0,0 +1,130 @@
+// Checks that PlatformDispatcher runs tasks on the platform thread in
+// posting order and coalesces keyed tasks to the latest one per frame.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "platform_dispatcher.h"
+#include "simulated_platform_thread.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  void CheckInlineWithoutWake()
+  {
+    PlatformDispatcher dispatcher(nullptr);
+    int runs = 0;
+    dispatcher.Post([&runs]
+                    { runs++; });
+    dispatcher.PostCoalesced("key", [&runs]
+                             { runs++; });
+    CHECK_EQ(runs, 2);
+    CHECK_EQ(dispatcher.stats().delivered, 2u);
+  }
+
+  void CheckWakesOncePerDrain()
+  {
+    int wakes = 0;
+    PlatformDispatcher dispatcher([&wakes]
+                                  { wakes++; });
+    std::vector<int> order;
+    for (int i = 0; i < 5; i++)
+    {
+      dispatcher.Post([&order, i]
+                      { order.push_back(i); });
+    }
+    CHECK_EQ(wakes, 1);
+    CHECK(order.empty());
+    CHECK_EQ(dispatcher.Drain().count(), 0);
+    CHECK((order == std::vector<int>{0, 1, 2, 3, 4}));
+    dispatcher.Post([] {});
+    CHECK_EQ(wakes, 2);
+  }
+
+  void CheckCoalescedHeldToFrame()
+  {
+    PlatformDispatcher dispatcher([] {}, std::chrono::milliseconds(50));
+    int last = -1;
+    int runs = 0;
+    // The first frame is due at once.
+    dispatcher.PostCoalesced("progress", [&]
+                             { last = 0, runs++; });
+    CHECK_EQ(dispatcher.Drain().count(), 0);
+    CHECK_EQ(last, 0);
+
+    for (int i = 1; i <= 10; i++)
+    {
+      dispatcher.PostCoalesced("progress", [&, i]
+                               { last = i, runs++; });
+    }
+    auto due = dispatcher.Drain();
+    CHECK(due.count() > 0 && due.count() <= 51);
+    CHECK_EQ(runs, 1);
+    std::this_thread::sleep_for(due);
+    CHECK_EQ(dispatcher.Drain().count(), 0);
+    CHECK_EQ(last, 10);
+    CHECK_EQ(runs, 2);
+    CHECK_EQ(dispatcher.stats().superseded, 9u);
+  }
+
+  // Producers post numbered tasks concurrently. Each producer's tasks must
+  // run in its own order, all on the platform thread, and the last coalesced
+  // value per key must win.
+  void CheckConcurrentProducers()
+  {
+    const int kProducers = 4;
+    const int kPerProducer = 20000;
+    std::vector<int> next(kProducers, 0);
+    std::map<int, int> last_progress;
+    std::atomic<bool> off_thread{false};
+    {
+      test::SimulatedPlatformThread platform(std::chrono::milliseconds(2));
+      auto platform_id = platform.id();
+      std::vector<std::thread> producers;
+      for (int p = 0; p < kProducers; p++)
+      {
+        producers.emplace_back([&, p]
+                               {
+          for (int i = 0; i < kPerProducer; i++)
+          {
+            platform.dispatcher().Post([&, p, i]
+                                       {
+              off_thread = off_thread || std::this_thread::get_id() != platform_id;
+              CHECK_EQ(next[static_cast<size_t>(p)], i);
+              next[static_cast<size_t>(p)]++; });
+            platform.dispatcher().PostCoalesced("progress:" + std::to_string(p), [&, p, i]
+                                                { last_progress[p] = i; });
+          } });
+      }
+      for (auto &producer : producers)
+      {
+        producer.join();
+      }
+    }
+    CHECK(!off_thread);
+    for (int p = 0; p < kProducers; p++)
+    {
+      CHECK_EQ(next[static_cast<size_t>(p)], kPerProducer);
+      CHECK_EQ(last_progress[p], kPerProducer - 1);
+    }
+  }
+
+} // namespace
+
+int main()
+{
+  CheckInlineWithoutWake();
+  CheckWakesOncePerDrain();
+  CheckCoalescedHeldToFrame();
+  CheckConcurrentProducers();
+  std::printf("platform_dispatcher_test passed\n");
+  return 0;
+}
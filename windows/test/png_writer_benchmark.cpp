@@ -0,0 +1,119 @@
+// Encodes a synthetic 300 dpi letter page with PngWriter and with libpng at
+// its default settings, and reports throughput and ratio for both. Every
+// PngWriter output is decoded with libpng and compared to the source.
+
+#include <png.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include "png_writer.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const uint32_t kWidth = 2550;
+  const uint32_t kHeight = 3300;
+
+  // Paper noise, lines of text and, in color, a photo-like block.
+  std::vector<uint8_t> SyntheticPage(size_t channels)
+  {
+    std::mt19937 random(7);
+    std::vector<uint8_t> page(size_t{kWidth} * kHeight * channels);
+    for (uint32_t y = 0; y < kHeight; y++)
+    {
+      for (uint32_t x = 0; x < kWidth; x++)
+      {
+        bool ink = (y / 40) % 2 == 0 && y % 40 < 28 && (x / 14) % 3 != 0 && x > 150 && x < 2400 &&
+                   (x * 7 + y * 3) % 11 < 4;
+        uint32_t value = ink ? 20 + random() % 20 : 245 + random() % 8;
+        for (size_t c = 0; c < channels; c++)
+        {
+          bool photo = channels == 3 && y > 2000 && y < 2600 && x > 300 && x < 1500;
+          page[(size_t{y} * kWidth + x) * channels + c] =
+              static_cast<uint8_t>(photo ? (x * c * 3 + y) % 256 : value);
+        }
+      }
+    }
+    return page;
+  }
+
+  size_t FileSize(const std::string &path)
+  {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return static_cast<size_t>(file.tellg());
+  }
+
+  std::vector<uint8_t> Decode(const std::string &path, size_t channels)
+  {
+    png_image image{};
+    image.version = PNG_IMAGE_VERSION;
+    CHECK(png_image_begin_read_from_file(&image, path.c_str()));
+    image.format = channels == 1 ? PNG_FORMAT_GRAY : PNG_FORMAT_RGB;
+    std::vector<uint8_t> pixels(PNG_IMAGE_SIZE(image));
+    CHECK(png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr));
+    return pixels;
+  }
+
+  void Report(const char *name, const std::vector<uint8_t> &page, double seconds, size_t size)
+  {
+    std::printf("%-24s %6.1f MB/s  ratio %.2f\n", name, static_cast<double>(page.size()) / 1e6 / seconds,
+                static_cast<double>(page.size()) / static_cast<double>(size));
+  }
+
+} // namespace
+
+int main()
+{
+  test::TempDir dir("png_writer_benchmark");
+  for (size_t channels : {size_t{1}, size_t{3}})
+  {
+    auto page = SyntheticPage(channels);
+    size_t row_bytes = size_t{kWidth} * channels;
+    std::printf("%s page, %ux%u:\n", channels == 1 ? "Gray" : "RGB", kWidth, kHeight);
+
+    for (unsigned threads : {1u, 0u})
+    {
+      std::string path = dir.Child("ours.png");
+      auto start = std::chrono::steady_clock::now();
+      PngWriterOptions options;
+      options.threads = threads;
+      PngWriter writer(path, kWidth, kHeight, channels == 1 ? PngColorType::kGray8 : PngColorType::kRgb8,
+                       options);
+      for (uint32_t y = 0; y < kHeight; y++)
+      {
+        writer.WriteRow(page.data() + y * row_bytes);
+      }
+      writer.Finish();
+      double seconds = test::SecondsSince(start);
+      CHECK(Decode(path, channels) == page);
+      Report(threads == 1 ? "  PngWriter, 1 thread" : "  PngWriter, all threads", page, seconds, FileSize(path));
+    }
+
+    std::string path = dir.Child("libpng.png");
+    auto start = std::chrono::steady_clock::now();
+    FILE *file = std::fopen(path.c_str(), "wb");
+    CHECK(file != nullptr);
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+    png_init_io(png, file);
+    png_set_IHDR(png, info, kWidth, kHeight, 8, channels == 1 ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (uint32_t y = 0; y < kHeight; y++)
+    {
+      png_write_row(png, page.data() + y * row_bytes);
+    }
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+    std::fclose(file);
+    Report("  libpng defaults", page, test::SecondsSince(start), FileSize(path));
+  }
+  return 0;
+}
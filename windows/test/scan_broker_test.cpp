@@ -0,0 +1,670 @@
+// Runs the scan daemon against a simulated scanner: the protocol, pages
+// handed over through shared memory, device events, and several client
+// processes sharing one device, which must get it one at a time in the
+// order they asked, without a killed client holding up the rest.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "scan_broker.h"
+#include "scan_broker_client.h"
+#include "shared_memory.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+  const char kDevice[] = "simulated:scanner";
+  const char kOtherDevice[] = "simulated:other";
+  const char kJammedDevice[] = "simulated:jammed";
+  const uint32_t kBatchPages = 6;
+  // Larger than a socket buffer, so a page through the socket would show.
+  const size_t kPageSize = 300 * 1024 + 5;
+
+  uint8_t PageByte(uint32_t page, size_t i)
+  {
+    return static_cast<uint8_t>((page * 131 + i * 7 + i / 4096) & 0xFF);
+  }
+
+  bool IsPage(uint32_t page, const uint8_t *data, size_t size)
+  {
+    if (size != kPageSize)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+      if (data[i] != PageByte(page, i))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Writes kBatchPages pages from the feeder or one from the flatbed, and
+  // notes whether two jobs ever drove one device at once.
+  class SimulatedScanner : public ScanBackend
+  {
+  public:
+    explicit SimulatedScanner(std::string dir) : dir_(std::move(dir)) {}
+
+    void Scan(const BrokerScanJob &job, const Events &events) override
+    {
+      if (job.device_id == kJammedDevice)
+      {
+        throw BrokerError("ScanFailed", "Paper jam.");
+      }
+      InUse in_use(*this, job.device_id);
+      events.capability("source", job.batch ? "feeder" : "flatbed");
+      events.format(job.format.value_or(ScanFormat::kPng));
+      uint32_t pages = job.batch ? kBatchPages : 1;
+      for (uint32_t page = 0; page < pages; page++)
+      {
+        std::this_thread::sleep_for(2ms);
+        auto path = dir_ + "/page-" + std::to_string(next_file_++) + ".png";
+        {
+          std::vector<uint8_t> bytes(kPageSize);
+          for (size_t i = 0; i < bytes.size(); i++)
+          {
+            bytes[i] = PageByte(page, i);
+          }
+          std::ofstream out(path, std::ios::binary);
+          out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        }
+        events.page(path);
+        if (job.pages_per_run != 0 && (page + 1) % job.pages_per_run == 0)
+        {
+          events.run_end();
+        }
+      }
+    }
+
+    bool overlapped() const { return overlapped_; }
+
+  private:
+    struct InUse
+    {
+      InUse(SimulatedScanner &scanner, std::string device) : scanner(scanner), device(std::move(device))
+      {
+        std::lock_guard<std::mutex> lock(scanner.mutex_);
+        if (!scanner.in_use_.insert(this->device).second)
+        {
+          scanner.overlapped_ = true;
+        }
+      }
+      ~InUse()
+      {
+        std::lock_guard<std::mutex> lock(scanner.mutex_);
+        scanner.in_use_.erase(device);
+      }
+
+      SimulatedScanner &scanner;
+      std::string device;
+    };
+
+    std::string dir_;
+    std::atomic<uint64_t> next_file_{0};
+    std::mutex mutex_;
+    std::set<std::string> in_use_;
+    std::atomic<bool> overlapped_{false};
+  };
+
+  BrokerScanJob BatchJob(const std::string &device)
+  {
+    BrokerScanJob job;
+    job.device_id = device;
+    job.batch = true;
+    job.pages_per_run = 2;
+    return job;
+  }
+
+  BrokerScanJob FlatbedJob(const std::string &device)
+  {
+    BrokerScanJob job;
+    job.device_id = device;
+    return job;
+  }
+
+  // Scans |job| and checks every page arrives intact and in order. Returns
+  // the number of pages.
+  uint32_t ScanAndCheck(ScanBrokerClient &client, const BrokerScanJob &job,
+                        const std::function<void(uint32_t page)> &on_page = nullptr)
+  {
+    uint32_t pages = 0;
+    ScanBrokerClient::ScanEvents events;
+    events.capability = [](const std::string &, const std::string &) {};
+    events.format = [](ScanFormat) {};
+    events.page = [&](const uint8_t *data, size_t size, const std::string &extension)
+    {
+      CHECK_EQ(extension, ".png");
+      CHECK(IsPage(pages, data, size));
+      if (on_page)
+      {
+        on_page(pages);
+      }
+      pages++;
+    };
+    events.run_end = [] {};
+    client.Scan(job, events);
+    return pages;
+  }
+
+  std::string ErrorCode(ScanBrokerClient &client, const BrokerScanJob &job)
+  {
+    try
+    {
+      ScanAndCheck(client, job);
+    }
+    catch (const BrokerError &error)
+    {
+      return error.code();
+    }
+    return "";
+  }
+
+  ScanBrokerClient ConnectWhenUp(const std::string &path)
+  {
+    for (int attempt = 0;; attempt++)
+    {
+      if (LocalSocket::Connect(path).valid() || attempt == 500)
+      {
+        return ScanBrokerClient(path);
+      }
+      std::this_thread::sleep_for(10ms);
+    }
+  }
+
+  void CheckProtocol()
+  {
+    BrokerScanJob job;
+    job.device_id = "escl:Büro";
+    job.format = ScanFormat::kTiff;
+    job.decodable = true;
+    job.batch = true;
+    job.duplex = true;
+    job.pages_per_run = 10;
+    job.device_timeout = 2500ms;
+    BrokerWriter writer;
+    writer.Job(job).U64(uint64_t{1} << 40);
+
+    BrokerReader reader(writer.bytes());
+    auto read = reader.Job();
+    CHECK_EQ(read.device_id, job.device_id);
+    CHECK(read.format == job.format);
+    CHECK(read.decodable && read.batch && read.duplex);
+    CHECK_EQ(read.pages_per_run, 10u);
+    CHECK(read.device_timeout == 2500ms);
+    CHECK_EQ(reader.U64(), uint64_t{1} << 40);
+
+    BrokerScanJob defaults;
+    BrokerWriter default_writer;
+    default_writer.Job(defaults);
+    BrokerReader default_reader(default_writer.bytes());
+    auto read_defaults = default_reader.Job();
+    CHECK(!read_defaults.format);
+    CHECK(!read_defaults.batch && !read_defaults.duplex && !read_defaults.decodable);
+    CHECK(read_defaults.device_timeout == -1ms);
+
+    // A message cut short throws instead of reading past its end.
+    std::vector<uint8_t> cut(writer.bytes().begin(), writer.bytes().end() - 3);
+    BrokerReader cut_reader(cut);
+    cut_reader.Job();
+    bool threw = false;
+    try
+    {
+      cut_reader.U64();
+    }
+    catch (const std::runtime_error &)
+    {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  void CheckSharedMemory()
+  {
+    std::string name;
+    {
+      auto created = SharedMemory::Create(kPageSize);
+      for (size_t i = 0; i < kPageSize; i++)
+      {
+        created.data()[i] = PageByte(3, i);
+      }
+      name = created.name();
+      auto opened = SharedMemory::Open(name, kPageSize);
+      CHECK(IsPage(3, opened.data(), opened.size()));
+
+      bool too_small = false;
+      try
+      {
+        SharedMemory::Open(name, kPageSize + 1);
+      }
+      catch (const std::runtime_error &)
+      {
+        too_small = true;
+      }
+      CHECK(too_small);
+    }
+    // The name goes with its creator.
+    bool gone = false;
+    try
+    {
+      SharedMemory::Open(name, kPageSize);
+    }
+    catch (const std::runtime_error &)
+    {
+      gone = true;
+    }
+    CHECK(gone);
+  }
+
+  void CheckSaveScanPage()
+  {
+    test::TempDir dir("scan_broker_test");
+    const uint8_t data[] = {1, 2, 3};
+    auto first = SaveScanPage(dir.path().u8string(), ".jpg", data, sizeof(data));
+    auto second = SaveScanPage(dir.path().u8string(), ".jpg", data, sizeof(data));
+    CHECK_EQ(first, dir.Child("Scan.jpg"));
+    CHECK_EQ(second, dir.Child("Scan (2).jpg"));
+    CHECK_EQ(std::filesystem::file_size(second), sizeof(data));
+
+    bool threw = false;
+    try
+    {
+      SaveScanPage(dir.Child("missing"), ".jpg", data, sizeof(data));
+    }
+    catch (const std::runtime_error &)
+    {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  void CheckDeviceEvents(ScanBroker &broker, const std::string &path)
+  {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::string> seen;
+    auto watcher = ConnectWhenUp(path);
+    std::thread watch([&]
+                      {
+      ScanBrokerClient::DeviceEvents events;
+      auto note = [&](const std::string &event)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        seen.push_back(event);
+        changed.notify_all();
+      };
+      events.added = [&](const std::string &id, const std::string &name)
+      { note("added " + id + " " + name); };
+      events.removed = [&](const std::string &id)
+      { note("removed " + id); };
+      events.enumerated = [&]
+      { note("enumerated"); };
+      watcher.WatchDevices(events); });
+
+    auto wait_for = [&](size_t count)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      CHECK(changed.wait_for(lock, 5s, [&]
+                             { return seen.size() >= count; }));
+    };
+    // Changes after the initial list follow it.
+    wait_for(1);
+    broker.AddDevice(kOtherDevice, "Other");
+    broker.AddDevice(kOtherDevice, "Other");
+    broker.EnumerationCompleted();
+    broker.RemoveDevice(kOtherDevice);
+    wait_for(4);
+    watcher.Close();
+    watch.join();
+    CHECK(seen == (std::vector<std::string>{"added simulated:scanner Simulated", "added simulated:other Other",
+                                             "enumerated", "removed simulated:other"}));
+  }
+
+  void CheckWithinProcess()
+  {
+    test::TempDir dir("scan_broker_test");
+    auto path = dir.Child("daemon.sock");
+    SimulatedScanner scanner(dir.path().u8string());
+    ScanBroker broker(scanner);
+    broker.AddDevice(kDevice, "Simulated");
+    bool served = false;
+    std::thread serve([&]
+                      { served = broker.Serve(path, -1ms); });
+
+    CheckDeviceEvents(broker, path);
+
+    // A second daemon finds the first and leaves.
+    ScanBroker second(scanner);
+    CHECK(!second.Serve(path, 0ms));
+
+    // Pages, capabilities and feeder runs reach the client.
+    auto client = ConnectWhenUp(path);
+    auto job = BatchJob(kDevice);
+    job.format = ScanFormat::kJpeg;
+    std::vector<std::string> traced;
+    uint32_t pages = 0;
+    int runs = 0;
+    test::TempDir out("scan_broker_test");
+    ScanBrokerClient::ScanEvents events;
+    events.capability = [&](const std::string &key, const std::string &value)
+    { traced.push_back(key + "=" + value); };
+    events.format = [&](ScanFormat format)
+    { traced.push_back(ScanFormatName(format)); };
+    events.page = [&](const uint8_t *data, size_t size, const std::string &extension)
+    {
+      CHECK(IsPage(pages++, data, size));
+      SaveScanPage(out.path().u8string(), extension, data, size);
+    };
+    events.run_end = [&]
+    { runs++; };
+    client.Scan(job, events);
+    CHECK_EQ(pages, kBatchPages);
+    CHECK_EQ(runs, static_cast<int>(kBatchPages / 2));
+    CHECK(traced == (std::vector<std::string>{"source=feeder", "jpeg"}));
+    CHECK(std::filesystem::exists(out.Child("Scan (6).png")));
+
+    // One connection runs scans one after another.
+    CHECK_EQ(ScanAndCheck(client, FlatbedJob(kDevice)), 1u);
+    CHECK_EQ(ErrorCode(client, FlatbedJob(kJammedDevice)), "ScanFailed");
+
+    // A scan that cannot get the device in time gives up; the one holding
+    // it is unaffected.
+    std::promise<void> holding;
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::thread holder([&]
+                       {
+      auto holder_client = ConnectWhenUp(path);
+      ScanAndCheck(holder_client, BatchJob(kDevice), [&](uint32_t page)
+                   {
+        if (page == 0)
+        {
+          holding.set_value();
+          released.wait();
+        } }); });
+    holding.get_future().wait();
+    auto impatient = BatchJob(kDevice);
+    impatient.device_timeout = 50ms;
+    CHECK_EQ(ErrorCode(client, impatient), "DeviceBusy");
+    // Another device is free meanwhile.
+    CHECK_EQ(ScanAndCheck(client, FlatbedJob(kOtherDevice)), 1u);
+    release.set_value();
+    holder.join();
+    CHECK_EQ(ScanAndCheck(client, impatient), kBatchPages);
+
+    broker.Stop();
+    serve.join();
+    CHECK(served);
+    CHECK(!std::filesystem::exists(path));
+    CHECK(!scanner.overlapped());
+
+    // With no clients the daemon exits on its own.
+    auto start = std::chrono::steady_clock::now();
+    ScanBroker idle(scanner);
+    CHECK(idle.Serve(path, 200ms));
+    CHECK(test::SecondsSince(start) < 5);
+  }
+
+#if defined(__unix__)
+  void Log(const std::string &path, const std::string &line)
+  {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    CHECK(fd >= 0);
+    std::string text = line + "\n";
+    CHECK_EQ(write(fd, text.data(), text.size()), static_cast<ssize_t>(text.size()));
+    close(fd);
+  }
+
+  std::vector<std::string> ReadLog(const std::string &path)
+  {
+    std::ifstream file(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line);)
+    {
+      lines.push_back(line);
+    }
+    return lines;
+  }
+
+  void Wait(pid_t child)
+  {
+    int status = 0;
+    CHECK_EQ(waitpid(child, &status, 0), child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  // The daemon runs in its own process and exits once its clients are gone,
+  // failing if two jobs ever drove one device at once.
+  pid_t StartDaemon(const test::TempDir &dir)
+  {
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0)
+    {
+      SimulatedScanner scanner(dir.path().u8string());
+      ScanBroker broker(scanner);
+      broker.AddDevice(kDevice, "Simulated");
+      broker.EnumerationCompleted();
+      bool served = broker.Serve(dir.Child("daemon.sock"), 300ms);
+      _exit(served && !scanner.overlapped() ? 0 : 1);
+    }
+    ConnectWhenUp(dir.Child("daemon.sock"));
+    return child;
+  }
+
+  void WaitDaemon(pid_t daemon)
+  {
+    Wait(daemon);
+#if defined(__linux__)
+    // Pages of clients that were killed were freed too.
+    auto prefix = "quick_scanner_plus-" + std::to_string(daemon) + "-";
+    for (const auto &entry : std::filesystem::directory_iterator("/dev/shm"))
+    {
+      CHECK(entry.path().filename().string().compare(0, prefix.size(), prefix) != 0);
+    }
+#endif
+  }
+
+  void CheckSharedDevice()
+  {
+    const int kClients = 4;
+    const int kScans = 5;
+    test::TempDir dir("scan_broker_test");
+    auto daemon = StartDaemon(dir);
+    std::vector<pid_t> clients;
+    for (int c = 0; c < kClients; c++)
+    {
+      pid_t child = fork();
+      CHECK(child >= 0);
+      if (child == 0)
+      {
+        ScanBrokerClient client(dir.Child("daemon.sock"));
+        for (int i = 0; i < kScans; i++)
+        {
+          CHECK_EQ(ScanAndCheck(client, BatchJob(kDevice)), kBatchPages);
+        }
+        _exit(0);
+      }
+      clients.push_back(child);
+    }
+    for (auto child : clients)
+    {
+      Wait(child);
+    }
+    WaitDaemon(daemon);
+  }
+
+  // Starts a client whose scan joins the device's queue, then logs when it
+  // is done.
+  pid_t StartQueuedClient(const test::TempDir &dir, const std::string &name)
+  {
+    int ready[2];
+    CHECK_EQ(pipe(ready), 0);
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0)
+    {
+      close(ready[0]);
+      ScanBrokerClient client(dir.Child("daemon.sock"));
+      CHECK_EQ(write(ready[1], "q", 1), 1);
+      CHECK_EQ(ScanAndCheck(client, FlatbedJob(kDevice)), 1u);
+      Log(dir.Child("order.log"), name);
+      _exit(0);
+    }
+    close(ready[1]);
+    char byte = 0;
+    CHECK_EQ(read(ready[0], &byte, 1), 1);
+    close(ready[0]);
+    // Time for the request to reach the daemon's queue.
+    usleep(100000);
+    return child;
+  }
+
+  // A client that keeps the device busy by holding on to its first page
+  // until it is sent a byte.
+  struct Holder
+  {
+    pid_t pid;
+    int release;
+  };
+
+  Holder StartHolder(const test::TempDir &dir)
+  {
+    int ready[2];
+    int release[2];
+    CHECK_EQ(pipe(ready), 0);
+    CHECK_EQ(pipe(release), 0);
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0)
+    {
+      close(ready[0]);
+      close(release[1]);
+      ScanBrokerClient client(dir.Child("daemon.sock"));
+      ScanAndCheck(client, BatchJob(kDevice), [&](uint32_t page)
+                   {
+        if (page == 0)
+        {
+          CHECK_EQ(write(ready[1], "h", 1), 1);
+          char byte = 0;
+          CHECK_EQ(read(release[0], &byte, 1), 1);
+        } });
+      _exit(0);
+    }
+    close(ready[1]);
+    close(release[0]);
+    char byte = 0;
+    CHECK_EQ(read(ready[0], &byte, 1), 1);
+    close(ready[0]);
+    return {child, release[1]};
+  }
+
+  void CheckFirstComeFirstServed()
+  {
+    test::TempDir dir("scan_broker_test");
+    auto daemon = StartDaemon(dir);
+    auto holder = StartHolder(dir);
+
+    std::vector<pid_t> clients;
+    std::vector<std::string> expected;
+    for (int c = 0; c < 6; c++)
+    {
+      auto name = "client " + std::to_string(c);
+      clients.push_back(StartQueuedClient(dir, name));
+      // A waiter killed in the middle of the queue loses its place without
+      // holding up the ones behind it.
+      if (c == 2)
+      {
+        kill(clients.back(), SIGKILL);
+        waitpid(clients.back(), nullptr, 0);
+        clients.pop_back();
+      }
+      else
+      {
+        expected.push_back(name);
+      }
+    }
+    // Released only once everyone is queued, so the order is the queue's.
+    CHECK_EQ(write(holder.release, "r", 1), 1);
+    close(holder.release);
+    Wait(holder.pid);
+    for (auto child : clients)
+    {
+      Wait(child);
+    }
+    CHECK(ReadLog(dir.Child("order.log")) == expected);
+    WaitDaemon(daemon);
+  }
+
+  void CheckKilledHolder()
+  {
+    test::TempDir dir("scan_broker_test");
+    auto daemon = StartDaemon(dir);
+    auto holder = StartHolder(dir);
+    auto waiter = StartQueuedClient(dir, "waiter");
+    kill(holder.pid, SIGKILL);
+    waitpid(holder.pid, nullptr, 0);
+    close(holder.release);
+    Wait(waiter);
+    CHECK(ReadLog(dir.Child("order.log")) == std::vector<std::string>{"waiter"});
+    WaitDaemon(daemon);
+  }
+
+  void CheckStaleSocket()
+  {
+    test::TempDir dir("scan_broker_test");
+    auto path = dir.Child("daemon.sock");
+    // A daemon that died without cleaning up leaves its socket file.
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0)
+    {
+      auto listener = LocalSocket::Listen(path);
+      _exit(listener.valid() ? 0 : 1);
+    }
+    Wait(child);
+    CHECK(std::filesystem::exists(path));
+    CHECK(!LocalSocket::Connect(path).valid());
+    CHECK(LocalSocket::Listen(path).valid());
+  }
+#endif
+
+} // namespace
+
+int main()
+{
+  CheckProtocol();
+  CheckSharedMemory();
+  CheckSaveScanPage();
+#if defined(__unix__)
+  // Forks before any thread of this process starts.
+  CheckSharedDevice();
+  CheckFirstComeFirstServed();
+  CheckKilledHolder();
+  CheckStaleSocket();
+#endif
+  CheckWithinProcess();
+  std::printf("scan_broker_test passed\n");
+  return 0;
+}
@@ -0,0 +1,232 @@
+// Feeds strips of gray and BGRA pages into ScanPreview and checks the
+// downsampled RGBA frame, that strips of a replaced page are ignored, that
+// CopyFrame only copies a changed frame, and that readers copying from
+// another thread, or from the update callback, never block the page pass
+// or see one page torn into the next.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "scan_preview.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  using PixelFunction = std::function<uint8_t(uint32_t x, uint32_t y, uint32_t channel)>;
+
+  // Rows |y| to |y| + |height| of a |width| pixel wide page, in tiles of
+  // |tile_width|.
+  TileRow MakeStrip(uint32_t y, uint32_t height, uint32_t width, uint32_t tile_width, PixelFormat format,
+                    const PixelFunction &pixel)
+  {
+    std::vector<std::shared_ptr<const Tile>> tiles;
+    auto bpp = static_cast<uint32_t>(BytesPerPixel(format));
+    for (uint32_t x = 0; x < width; x += tile_width)
+    {
+      auto tile = std::make_shared<Tile>();
+      tile->x = x;
+      tile->y = y;
+      tile->width = (std::min)(tile_width, width - x);
+      tile->height = height;
+      tile->format = format;
+      tile->stride = size_t{tile->width} * bpp;
+      tile->pixels = BufferPool::Shared().Acquire(tile->stride * height);
+      for (uint32_t r = 0; r < height; r++)
+      {
+        for (uint32_t c = 0; c < tile->width * bpp; c++)
+        {
+          tile->Row(r)[c] = pixel(x + c / bpp, y + r, c % bpp);
+        }
+      }
+      tiles.push_back(tile);
+    }
+    return TileRow(y, height, tiles);
+  }
+
+  const uint8_t *FramePixel(const ScanPreview::Frame &frame, uint32_t x, uint32_t y)
+  {
+    return frame.pixels.data() + (size_t{y} * frame.width + x) * 4;
+  }
+
+  void CheckGrayFrame()
+  {
+    ScanPreview preview(1024);
+    ScanPreview::Frame frame;
+    CHECK(!preview.CopyFrame(frame));
+
+    // Twice the edge limit, so every second pixel of every second row.
+    auto page = preview.BeginPage(2047, 1000);
+    CHECK(preview.CopyFrame(frame));
+    CHECK_EQ(frame.width, 1024u);
+    CHECK_EQ(frame.height, 500u);
+    CHECK(std::all_of(frame.pixels.begin(), frame.pixels.end(), [](uint8_t v)
+                      { return v == 0xFF; }));
+
+    auto value = [](uint32_t x, uint32_t y, uint32_t)
+    { return static_cast<uint8_t>(x * 3 + y * 7); };
+    // Strips with odd heights, so some start on a row that is skipped.
+    for (uint32_t y = 0; y < 301; y += 43)
+    {
+      preview.Observe(page, MakeStrip(y, 43, 2047, 256, PixelFormat::kGray8, value));
+    }
+    CHECK(preview.CopyFrame(frame));
+    for (uint32_t fy = 0; fy < frame.height; fy++)
+    {
+      for (uint32_t fx = 0; fx < frame.width; fx++)
+      {
+        const uint8_t *p = FramePixel(frame, fx, fy);
+        uint8_t expected = fy * 2 < 301 ? value(fx * 2, fy * 2, 0) : 0xFF;
+        CHECK_EQ(p[0], expected);
+        CHECK_EQ(p[1], expected);
+        CHECK_EQ(p[2], expected);
+        CHECK_EQ(p[3], 0xFF);
+      }
+    }
+  }
+
+  void CheckBgraFrame()
+  {
+    ScanPreview preview(100);
+    auto page = preview.BeginPage(90, 40);
+    preview.Observe(page, MakeStrip(0, 40, 90, 32, PixelFormat::kBgra8, [](uint32_t x, uint32_t y, uint32_t c)
+                                    { return static_cast<uint8_t>(c == 3 ? 0 : x + y + c * 50); }));
+    ScanPreview::Frame frame;
+    CHECK(preview.CopyFrame(frame));
+    CHECK_EQ(frame.width, 90u);
+    CHECK_EQ(frame.height, 40u);
+    for (uint32_t y = 0; y < 40; y++)
+    {
+      for (uint32_t x = 0; x < 90; x++)
+      {
+        const uint8_t *p = FramePixel(frame, x, y);
+        CHECK_EQ(p[0], x + y + 100);
+        CHECK_EQ(p[1], x + y + 50);
+        CHECK_EQ(p[2], x + y);
+        CHECK_EQ(p[3], 0xFF);
+      }
+    }
+  }
+
+  void CheckVersions()
+  {
+    ScanPreview preview(64);
+    size_t updates = 0;
+    preview.SetUpdateCallback([&]
+                              { updates++; });
+    auto first = preview.BeginPage(64, 64);
+    auto second = preview.BeginPage(64, 64);
+    CHECK_EQ(updates, 2u);
+
+    ScanPreview::Frame frame;
+    CHECK(preview.CopyFrame(frame));
+    auto version = frame.version;
+    // An unchanged frame is not copied again.
+    frame.pixels[0] = 7;
+    CHECK(preview.CopyFrame(frame));
+    CHECK_EQ(frame.pixels[0], 7);
+    CHECK_EQ(frame.version, version);
+
+    // Strips of the replaced page change nothing.
+    auto black = [](uint32_t, uint32_t, uint32_t)
+    { return uint8_t{0}; };
+    preview.Observe(first, MakeStrip(0, 16, 64, 64, PixelFormat::kGray8, black));
+    CHECK_EQ(updates, 2u);
+    CHECK(preview.CopyFrame(frame));
+    CHECK_EQ(frame.version, version);
+
+    preview.Observe(second, MakeStrip(0, 16, 64, 64, PixelFormat::kGray8, black));
+    CHECK_EQ(updates, 3u);
+    CHECK(preview.CopyFrame(frame));
+    CHECK(frame.version != version);
+    CHECK_EQ(frame.pixels[0], 0);
+    CHECK_EQ(FramePixel(frame, 0, 16)[0], 0xFF);
+  }
+
+  void CheckConcurrentReaders()
+  {
+    const uint32_t kEdge = 512;
+    const int kPages = 200;
+    ScanPreview preview(kEdge);
+
+    // The update callback reads the frame as the texture does.
+    ScanPreview::Frame in_callback;
+    std::atomic<size_t> callback_copies{0};
+    preview.SetUpdateCallback([&]
+                              {
+      if (preview.CopyFrame(in_callback))
+      {
+        callback_copies++;
+      } });
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> torn{0};
+    std::atomic<size_t> copies{0};
+    std::thread reader([&]
+                       {
+      ScanPreview::Frame frame;
+      while (!done)
+      {
+        if (!preview.CopyFrame(frame))
+        {
+          continue;
+        }
+        copies++;
+        // Every page is one gray value on white paper.
+        uint8_t seen = 0xFF;
+        for (size_t i = 0; i < frame.pixels.size(); i += 4)
+        {
+          uint8_t v = frame.pixels[i];
+          if (v != 0xFF)
+          {
+            if (seen != 0xFF && v != seen)
+            {
+              torn++;
+              break;
+            }
+            seen = v;
+          }
+        }
+      } });
+
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < kPages; p++)
+    {
+      auto page = preview.BeginPage(kEdge, kEdge);
+      auto value = static_cast<uint8_t>(p % 200);
+      for (uint32_t y = 0; y < kEdge; y += 64)
+      {
+        preview.Observe(page, MakeStrip(y, 64, kEdge, 256, PixelFormat::kGray8, [value](uint32_t, uint32_t, uint32_t)
+                                        { return value; }));
+      }
+    }
+    double seconds = test::SecondsSince(start);
+    done = true;
+    reader.join();
+
+    CHECK_EQ(torn.load(), 0u);
+    CHECK(copies.load() > 0);
+    CHECK_EQ(callback_copies.load(), size_t{kPages} * (1 + kEdge / 64));
+    std::printf("  %d pages with a reader copying alongside in %.2f s, %zu copies\n", kPages, seconds,
+                copies.load());
+  }
+
+} // namespace
+
+int main()
+{
+  CheckGrayFrame();
+  CheckBgraFrame();
+  CheckVersions();
+  CheckConcurrentReaders();
+  std::printf("scan_preview_test passed\n");
+  return 0;
+}
@@ -0,0 +1,104 @@
+// Fills a scan store with pages and thumbnails, then times reopening it,
+// queries and thumbnail reads.
+//
+//   scan_store_benchmark [pages] [directory]
+//
+// Defaults to 100000 pages of 40 KB with 3 KB thumbnails (4.3 GB) in the
+// system temp directory.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "scan_store.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const size_t kPageBytes = 40 * 1024;
+  const size_t kThumbnailBytes = 3 * 1024;
+  const int64_t kHourMs = 3600 * 1000;
+
+  void Report(const char *name, std::chrono::steady_clock::time_point start, size_t results)
+  {
+    std::printf("  %-28s %9.2f ms  (%zu results)\n", name, test::SecondsSince(start) * 1000, results);
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  uint64_t pages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+  std::unique_ptr<test::TempDir> temp;
+  std::string root;
+  if (argc > 2)
+  {
+    root = argv[2];
+  }
+  else
+  {
+    temp = std::make_unique<test::TempDir>("scan_store_benchmark");
+    root = temp->path().u8string();
+  }
+
+  std::vector<uint8_t> page(kPageBytes, 0x5A);
+  std::vector<uint8_t> thumbnail(kThumbnailBytes, 0xA5);
+  {
+    ScanStore store(root);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < pages; n++)
+    {
+      // 100 pages per job, 4 devices, one page a minute.
+      store.AddPage("job-" + std::to_string(n / 100), "device-" + std::to_string(n % 4), ScanFormat::kJpeg,
+                    static_cast<int64_t>(n) * 60000, page.data(), page.size(), thumbnail.data(), thumbnail.size());
+    }
+    double seconds = test::SecondsSince(start);
+    std::printf("%llu pages of %zu KB + %zu KB thumbnail:\n", static_cast<unsigned long long>(pages),
+                kPageBytes / 1024, kThumbnailBytes / 1024);
+    std::printf("  %-28s %9.1f us/page (%.0f MB/s, data and index flushed per page)\n", "add",
+                seconds * 1e6 / static_cast<double>(pages),
+                static_cast<double>(pages * (kPageBytes + kThumbnailBytes)) / 1e6 / seconds);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  ScanStore store(root);
+  Report("open", start, store.page_count());
+
+  ScanQuery query;
+  query.job_id = "job-" + std::to_string(pages / 200);
+  start = std::chrono::steady_clock::now();
+  Report("query by job", start, store.Query(query).size());
+
+  query = ScanQuery();
+  query.device_id = "device-1";
+  query.from_ms = static_cast<int64_t>(pages / 2) * 60000;
+  query.to_ms = query.from_ms + kHourMs;
+  start = std::chrono::steady_clock::now();
+  Report("device + hour", start, store.Query(query).size());
+
+  query = ScanQuery();
+  query.offset = pages > 1000 ? pages - 1000 : 0;
+  query.limit = 50;
+  start = std::chrono::steady_clock::now();
+  Report("offset near the end", start, store.Query(query).size());
+
+  start = std::chrono::steady_clock::now();
+  Report("list all", start, store.Query(ScanQuery()).size());
+
+  std::mt19937_64 random(39);
+  uint64_t checksum = 0;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 10000; i++)
+  {
+    auto thumbnail_bytes = store.ReadThumbnail(random() % pages + 1);
+    checksum += thumbnail_bytes.data()[thumbnail_bytes.size() / 2];
+  }
+  Report("10k random thumbnail reads", start, static_cast<size_t>(checksum / 0xA5));
+  return 0;
+}
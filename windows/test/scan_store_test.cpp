@@ -0,0 +1,148 @@
+// Stores, queries and reads back pages, reopens the store, repairs a torn
+// index and checks that a store cannot be opened twice.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "scan_store.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  std::vector<uint8_t> PageBytes(uint64_t n, size_t size)
+  {
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; i++)
+    {
+      bytes[i] = static_cast<uint8_t>(n * 31 + i);
+    }
+    return bytes;
+  }
+
+  bool Equals(const StoredBytes &stored, const std::vector<uint8_t> &expected)
+  {
+    return stored.size() == expected.size() &&
+           (expected.empty() || std::memcmp(stored.data(), expected.data(), expected.size()) == 0);
+  }
+
+  void Fill(ScanStore &store)
+  {
+    for (uint64_t n = 0; n < 30; n++)
+    {
+      auto page = PageBytes(n, 1000 + n);
+      auto thumbnail = n % 3 == 0 ? std::vector<uint8_t>() : PageBytes(n + 100, 50);
+      auto id = store.AddPage(n % 2 ? "odd" : "even", n < 10 ? "scanner-a" : "scanner-b", ScanFormat::kPng,
+                              static_cast<int64_t>(1000 * n), page.data(), page.size(), thumbnail.data(),
+                              thumbnail.size());
+      CHECK_EQ(id, n + 1);
+    }
+  }
+
+  void CheckContents(const ScanStore &store)
+  {
+    CHECK_EQ(store.page_count(), 30u);
+    for (uint64_t n = 0; n < 30; n++)
+    {
+      CHECK(Equals(store.ReadPage(n + 1), PageBytes(n, 1000 + n)));
+      CHECK(Equals(store.ReadThumbnail(n + 1), n % 3 == 0 ? std::vector<uint8_t>() : PageBytes(n + 100, 50)));
+    }
+
+    ScanQuery query;
+    query.job_id = "odd";
+    auto odd = store.Query(query);
+    CHECK_EQ(odd.size(), 15u);
+    CHECK_EQ(odd[0].id, 2u);
+    CHECK_EQ(odd[0].page, 1u);
+    CHECK_EQ(odd[14].page, 15u);
+
+    query = ScanQuery();
+    query.device_id = "scanner-b";
+    query.from_ms = 12000;
+    query.to_ms = 14000;
+    auto range = store.Query(query);
+    CHECK_EQ(range.size(), 3u);
+    CHECK_EQ(range[0].time_ms, 12000);
+    CHECK_EQ(range[2].time_ms, 14000);
+
+    query = ScanQuery();
+    query.offset = 25;
+    query.limit = 10;
+    CHECK_EQ(store.Query(query).size(), 5u);
+
+    query = ScanQuery();
+    query.job_id = "unknown";
+    CHECK(store.Query(query).empty());
+    CHECK(!store.Find(31));
+  }
+
+  void CheckRoundTrip()
+  {
+    test::TempDir dir("scan_store_test");
+    {
+      ScanStore store(dir.path().u8string());
+      Fill(store);
+      CheckContents(store);
+    }
+    ScanStore store(dir.path().u8string());
+    CheckContents(store);
+    auto page = PageBytes(99, 10);
+    CHECK_EQ(store.AddPage("even", "scanner-a", ScanFormat::kJpeg, 0, page.data(), page.size()), 31u);
+    CHECK_EQ(store.Find(31)->page, 16u);
+  }
+
+  void CheckTornIndex()
+  {
+    test::TempDir dir("scan_store_test");
+    {
+      ScanStore store(dir.path().u8string());
+      Fill(store);
+    }
+    auto index = dir.path() / "index.qsidx";
+    std::filesystem::resize_file(index, std::filesystem::file_size(index) - 20);
+    {
+      ScanStore store(dir.path().u8string());
+      CHECK_EQ(store.page_count(), 29u);
+      auto page = PageBytes(29, 1029);
+      store.AddPage("odd", "scanner-b", ScanFormat::kPng, 29000, page.data(), page.size());
+      CHECK(Equals(store.ReadPage(30), page));
+    }
+    ScanStore store(dir.path().u8string());
+    CHECK_EQ(store.page_count(), 30u);
+  }
+
+  void CheckSingleOwner()
+  {
+    test::TempDir dir("scan_store_test");
+    {
+      ScanStore store(dir.path().u8string());
+      bool refused = false;
+      try
+      {
+        ScanStore second(dir.path().u8string());
+      }
+      catch (const std::runtime_error &)
+      {
+        refused = true;
+      }
+      CHECK(refused);
+    }
+    // Closing the first one lets it be opened again.
+    ScanStore store(dir.path().u8string());
+  }
+
+} // namespace
+
+int main()
+{
+  CheckRoundTrip();
+  CheckTornIndex();
+  CheckSingleOwner();
+  std::printf("scan_store_test passed\n");
+  return 0;
+}
@@ -0,0 +1,333 @@
+// Replays a recorded session and runs every page through ProcessPage with
+// the stages scanBatch enables, up to four pages at a time as scanBatch
+// does, and reports where the time went.
+//
+//   session_replay_benchmark [trace] [--realtime]
+//
+// Without a trace, a synthetic session is recorded first: 24 A4 pages at
+// 200 dpi from one feeder, mostly black text with a color page and a blank
+// back every few sheets. --realtime keeps the recorded pauses between
+// pages, so the result includes how well processing keeps up with the
+// device.
+//
+// Only page delivery and ProcessPage are the plugin's own code here.
+// Capability and format negotiation are not replayed, and pages are decoded
+// with libpng (and libjpeg when built with it) instead of WIC.
+
+#include <png.h>
+
+#ifdef QUICK_SCANNER_PLUS_HAVE_JPEG
+#include <cstdio>
+#include <jpeglib.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "page_pipeline.h"
+#include "png_writer.h"
+#include "session_trace.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const size_t kPagesInFlight = 4;
+  const uint32_t kWidth = 1654;
+  const uint32_t kHeight = 2339;
+  const int kSyntheticPages = 24;
+  const auto kSyntheticPageInterval = std::chrono::milliseconds(60);
+
+  struct DecodedPage
+  {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    PixelFormat format = PixelFormat::kGray8;
+    std::vector<uint8_t> pixels;
+  };
+
+  bool DecodePng(const std::string &path, DecodedPage &page)
+  {
+    png_image image{};
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path.c_str()))
+    {
+      return false;
+    }
+    bool color = (image.format & PNG_FORMAT_FLAG_COLOR) != 0;
+    image.format = color ? PNG_FORMAT_BGRA : PNG_FORMAT_GRAY;
+    page.width = image.width;
+    page.height = image.height;
+    page.format = color ? PixelFormat::kBgra8 : PixelFormat::kGray8;
+    page.pixels.resize(PNG_IMAGE_SIZE(image));
+    return png_image_finish_read(&image, nullptr, page.pixels.data(), 0, nullptr) != 0;
+  }
+
+#ifdef QUICK_SCANNER_PLUS_HAVE_JPEG
+  bool DecodeJpeg(const std::string &path, DecodedPage &page)
+  {
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+      return false;
+    }
+    unsigned char magic[2] = {0, 0};
+    if (std::fread(magic, 1, 2, file) != 2 || magic[0] != 0xFF || magic[1] != 0xD8)
+    {
+      std::fclose(file);
+      return false;
+    }
+    std::rewind(file);
+    // libjpeg's default error handler exits on a corrupt file, which is
+    // good enough for a benchmark.
+    jpeg_decompress_struct info{};
+    jpeg_error_mgr errors{};
+    info.err = jpeg_std_error(&errors);
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+    bool color = info.num_components > 1;
+    info.out_color_space = color ? JCS_EXT_BGRA : JCS_GRAYSCALE;
+    jpeg_start_decompress(&info);
+    page.width = info.output_width;
+    page.height = info.output_height;
+    page.format = color ? PixelFormat::kBgra8 : PixelFormat::kGray8;
+    size_t stride = size_t{page.width} * BytesPerPixel(page.format);
+    page.pixels.resize(stride * page.height);
+    while (info.output_scanline < info.output_height)
+    {
+      JSAMPROW row = page.pixels.data() + info.output_scanline * stride;
+      jpeg_read_scanlines(&info, &row, 1);
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    std::fclose(file);
+    return true;
+  }
+#endif
+
+  // Returns null for formats this driver cannot decode.
+  std::unique_ptr<TiledImage> OpenPage(const std::string &path)
+  {
+    auto page = std::make_shared<DecodedPage>();
+    bool decoded = DecodePng(path, *page);
+#ifdef QUICK_SCANNER_PLUS_HAVE_JPEG
+    decoded = decoded || DecodeJpeg(path, *page);
+#endif
+    if (!decoded)
+    {
+      return nullptr;
+    }
+    auto bpp = BytesPerPixel(page->format);
+    return std::make_unique<TiledImage>(page->width, page->height, page->format, [page, bpp](Tile &tile)
+                                        {
+      for (uint32_t r = 0; r < tile.height; r++)
+      {
+        std::memcpy(tile.Row(r), page->pixels.data() + ((size_t{tile.y} + r) * page->width + tile.x) * bpp,
+                    tile.width * bpp);
+      } });
+  }
+
+  void WriteSyntheticPage(const std::string &path, int n)
+  {
+    std::mt19937 random(static_cast<unsigned>(n));
+    bool blank = n % 6 == 5;
+    bool color = n % 8 == 2;
+    PngWriter writer(path, kWidth, kHeight, color ? PngColorType::kRgb8 : PngColorType::kGray8);
+    std::vector<uint8_t> row(writer.row_bytes());
+    size_t channels = color ? 3 : 1;
+    for (uint32_t y = 0; y < kHeight; y++)
+    {
+      for (uint32_t x = 0; x < kWidth; x++)
+      {
+        bool ink = !blank && (y / 28) % 2 == 0 && y % 28 < 20 && x > 100 && x < 1550 &&
+                   (x / 10) % 4 != 0 && (x * 7 + y * 3) % 11 < 4;
+        bool photo = color && y > 1200 && y < 1800 && x > 200 && x < 1000;
+        for (size_t c = 0; c < channels; c++)
+        {
+          row[x * channels + c] = static_cast<uint8_t>(
+              photo ? (x * (c + 1) + y) % 256 : ink ? 20 + random() % 20 : 244 + random() % 8);
+        }
+      }
+      writer.WriteRow(row.data());
+    }
+    writer.Finish();
+  }
+
+  void RecordSyntheticSession(const test::TempDir &dir, const std::string &trace_path)
+  {
+    auto recorder = std::make_shared<SessionRecorder>(trace_path);
+    recorder->DeviceAdded("synthetic-feeder", "Synthetic Feeder");
+    RecordedScan scan(recorder, "synthetic-feeder");
+    scan.Formats([](ScanFormat format)
+                 { return format == ScanFormat::kPng; },
+                 ScanFormat::kPng);
+    for (int n = 0; n < kSyntheticPages; n++)
+    {
+      auto start = std::chrono::steady_clock::now();
+      auto path = dir.Child("page.png");
+      WriteSyntheticPage(path, n);
+      std::this_thread::sleep_until(start + kSyntheticPageInterval);
+      scan.Page(path);
+    }
+    scan.Succeeded();
+  }
+
+  struct PageTiming
+  {
+    double decode = 0;
+    double process = 0;
+    bool decoded = false;
+    PageResult result;
+  };
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  std::string trace_path;
+  bool realtime = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::string(argv[i]) == "--realtime")
+    {
+      realtime = true;
+    }
+    else
+    {
+      trace_path = argv[i];
+    }
+  }
+
+  test::TempDir dir("session_replay_benchmark");
+  if (trace_path.empty())
+  {
+    trace_path = dir.Child("synthetic.qstrace");
+    auto start = std::chrono::steady_clock::now();
+    RecordSyntheticSession(dir, trace_path);
+    std::printf("recorded %d synthetic pages in %.2f s\n", kSyntheticPages, test::SecondsSince(start));
+  }
+
+  auto trace = SessionTrace::Load(trace_path);
+  SessionReplayer replayer(trace, realtime);
+  int devices = 0;
+  replayer.ReplayEnumeration([&](const std::string &, const std::string &)
+                             { devices++; },
+                             [](const std::string &) {});
+
+  PageOptions options;
+  options.detect_separators = true;
+  options.auto_color = true;
+  options.detect_blank = true;
+  options.thumbnail_edge = 256;
+
+  std::deque<std::future<PageTiming>> in_flight;
+  std::vector<PageTiming> pages;
+  auto collect = [&](size_t keep)
+  {
+    while (in_flight.size() > keep)
+    {
+      pages.push_back(in_flight.front().get());
+      in_flight.pop_front();
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  int scans = 0;
+  int failed_scans = 0;
+  for (const auto &event : trace->events())
+  {
+    if (event.type != TraceEventType::kScanStart)
+    {
+      continue;
+    }
+    scans++;
+    auto scan_dir = dir.Child("scan-" + std::to_string(scans));
+    std::filesystem::create_directories(std::filesystem::u8path(scan_dir));
+    try
+    {
+      replayer.ReplayScan(event.device_id, scan_dir, [&](const std::string &path)
+                          {
+        collect(kPagesInFlight - 1);
+        in_flight.push_back(std::async(std::launch::async, [path, &options]
+                                       {
+          PageTiming timing;
+          auto page_start = std::chrono::steady_clock::now();
+          auto page = OpenPage(path);
+          timing.decode = test::SecondsSince(page_start);
+          if (page)
+          {
+            timing.decoded = true;
+            page_start = std::chrono::steady_clock::now();
+            timing.result = ProcessPage(std::move(page), path, options);
+            timing.process = test::SecondsSince(page_start);
+          }
+          return timing; })); });
+    }
+    catch (const std::runtime_error &)
+    {
+      failed_scans++;
+    }
+  }
+  collect(0);
+  double seconds = test::SecondsSince(start);
+
+  double decode = 0;
+  double process = 0;
+  double slowest = 0;
+  size_t processed = 0;
+  std::map<std::string, int> outcomes;
+  for (const auto &page : pages)
+  {
+    if (!page.decoded)
+    {
+      outcomes["not decodable here"]++;
+      continue;
+    }
+    processed++;
+    decode += page.decode;
+    process += page.process;
+    slowest = (std::max)(slowest, page.process);
+    if (page.result.is_blank)
+    {
+      outcomes["blank"]++;
+    }
+    else if (page.result.separator.is_separator)
+    {
+      outcomes["separator"]++;
+    }
+    else
+    {
+      outcomes[page.result.color_class == ColorClass::kMono   ? "mono"
+               : page.result.color_class == ColorClass::kGray ? "gray"
+                                                             : "color"]++;
+    }
+  }
+
+  std::printf("%d devices, %d scans (%d failed as recorded), %zu pages, %s\n", devices, scans, failed_scans,
+              pages.size(), realtime ? "recorded pauses kept" : "recorded pauses skipped");
+  std::printf("  wall time      %8.2f s  (%.1f pages/s)\n", seconds, static_cast<double>(pages.size()) / seconds);
+  if (processed > 0)
+  {
+    std::printf("  decode         %8.1f ms/page\n", decode * 1000 / static_cast<double>(processed));
+    std::printf("  ProcessPage    %8.1f ms/page, slowest %.1f ms\n", process * 1000 / static_cast<double>(processed),
+                slowest * 1000);
+  }
+  for (const auto &outcome : outcomes)
+  {
+    std::printf("  %-14s %8d\n", outcome.first.c_str(), outcome.second);
+  }
+  return 0;
+}
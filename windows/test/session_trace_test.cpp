@@ -0,0 +1,215 @@
+// Records a session with two devices, loads it back and replays it: the
+// enumeration events, each scan's pages byte for byte, the recorded format,
+// failed scans, recorded pauses and a trace cut off by a crash.
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "session_trace.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  std::vector<uint8_t> PageBytes(int n, size_t size)
+  {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(size);
+    for (size_t i = 0; i < size; i++)
+    {
+      bytes.push_back(static_cast<uint8_t>(n * 13 + i * 7));
+    }
+    return bytes;
+  }
+
+  std::string WriteFile(const std::string &path, const std::vector<uint8_t> &bytes)
+  {
+    std::ofstream out(std::filesystem::u8path(path), std::ios::binary);
+    out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return path;
+  }
+
+  std::vector<uint8_t> ReadFile(const std::string &path)
+  {
+    std::ifstream in(std::filesystem::u8path(path), std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  }
+
+  // Two scans of scanner-a, the second one failing after a page, and one of
+  // scanner-b overlapping the first.
+  void RecordSession(const test::TempDir &dir, const std::string &trace_path,
+                     std::chrono::milliseconds page_interval)
+  {
+    auto recorder = std::make_shared<SessionRecorder>(trace_path);
+    recorder->DeviceAdded("scanner-a", "Flatbed A");
+    recorder->DeviceAdded("scanner-b", "Feeder B");
+    {
+      RecordedScan a(recorder, "scanner-a");
+      a.Formats([](ScanFormat format)
+                { return format == ScanFormat::kPng || format == ScanFormat::kJpeg; },
+                ScanFormat::kPng);
+      RecordedScan b(recorder, "scanner-b");
+      b.Capability("duplex", "true");
+      for (int n = 0; n < 3; n++)
+      {
+        std::this_thread::sleep_for(page_interval);
+        a.Page(WriteFile(dir.Child("page.png"), PageBytes(n, 5000 + static_cast<size_t>(n))));
+      }
+      b.Page(WriteFile(dir.Child("sheet.jpg"), PageBytes(9, 100)));
+      a.Succeeded();
+      b.Succeeded();
+    }
+    {
+      RecordedScan a(recorder, "scanner-a");
+      a.Page(WriteFile(dir.Child("page.png"), PageBytes(3, 10)));
+    }
+    recorder->DeviceRemoved("scanner-b");
+  }
+
+  void CheckEvents()
+  {
+    test::TempDir dir("session_trace_test");
+    auto trace_path = dir.Child("session.qstrace");
+    RecordSession(dir, trace_path, std::chrono::milliseconds(0));
+
+    auto trace = SessionTrace::Load(trace_path);
+    const auto &events = trace->events();
+    CHECK_EQ(events.size(), 17u);
+    CHECK(events[0].type == TraceEventType::kDeviceAdded);
+    CHECK_EQ(events[0].value, "Flatbed A");
+    CHECK(events[2].type == TraceEventType::kScanStart);
+    CHECK(events[3].type == TraceEventType::kCapability);
+    CHECK_EQ(events[3].key, "formats");
+    CHECK_EQ(events[3].value, "jpeg,png");
+    CHECK(events.back().type == TraceEventType::kDeviceRemoved);
+    for (size_t i = 1; i < events.size(); i++)
+    {
+      CHECK(events[i].time_us >= events[i - 1].time_us);
+    }
+
+    std::vector<std::string> enumeration;
+    SessionReplayer replayer(trace, false);
+    replayer.ReplayEnumeration([&](const std::string &id, const std::string &name)
+                               { enumeration.push_back("+" + id + " " + name); },
+                               [&](const std::string &id)
+                               { enumeration.push_back("-" + id); });
+    CHECK((enumeration == std::vector<std::string>{"+scanner-a Flatbed A", "+scanner-b Feeder B", "-scanner-b"}));
+  }
+
+  void CheckScans()
+  {
+    test::TempDir dir("session_trace_test");
+    auto trace_path = dir.Child("session.qstrace");
+    RecordSession(dir, trace_path, std::chrono::milliseconds(0));
+    test::TempDir out("session_trace_test");
+
+    SessionReplayer replayer(SessionTrace::Load(trace_path), false);
+    std::vector<std::string> pages;
+    auto scan = replayer.ReplayScan("scanner-a", out.path().u8string(), [&](const std::string &path)
+                                    { pages.push_back(path); });
+    CHECK(scan.format == ScanFormat::kPng);
+    CHECK_EQ(pages.size(), 3u);
+    // Pages keep their recorded names, numbered when taken.
+    CHECK_EQ(pages[0], out.Child("page.png"));
+    CHECK_EQ(pages[1], out.Child("page (2).png"));
+    for (int n = 0; n < 3; n++)
+    {
+      CHECK(ReadFile(pages[static_cast<size_t>(n)]) == PageBytes(n, 5000 + static_cast<size_t>(n)));
+    }
+
+    pages.clear();
+    replayer.ReplayScan("scanner-b", out.path().u8string(), [&](const std::string &path)
+                        { pages.push_back(path); });
+    CHECK_EQ(pages.size(), 1u);
+    CHECK(ReadFile(pages[0]) == PageBytes(9, 100));
+
+    // The failed scan delivers its page, then fails as it did.
+    pages.clear();
+    bool failed = false;
+    try
+    {
+      replayer.ReplayScan("scanner-a", out.path().u8string(), [&](const std::string &path)
+                          { pages.push_back(path); });
+    }
+    catch (const std::runtime_error &)
+    {
+      failed = true;
+    }
+    CHECK(failed);
+    CHECK_EQ(pages.size(), 1u);
+
+    bool none_left = false;
+    try
+    {
+      replayer.ReplayScan("scanner-a", out.path().u8string(), [](const std::string &) {});
+    }
+    catch (const std::runtime_error &)
+    {
+      none_left = true;
+    }
+    CHECK(none_left);
+  }
+
+  void CheckRealtimePauses()
+  {
+    test::TempDir dir("session_trace_test");
+    auto trace_path = dir.Child("session.qstrace");
+    RecordSession(dir, trace_path, std::chrono::milliseconds(30));
+    test::TempDir out("session_trace_test");
+
+    SessionReplayer fast(SessionTrace::Load(trace_path), false);
+    auto start = std::chrono::steady_clock::now();
+    fast.ReplayScan("scanner-a", out.path().u8string(), [](const std::string &) {});
+    CHECK(test::SecondsSince(start) < 0.05);
+
+    // The first page came 30 ms after the scan started, then one every 30.
+    SessionReplayer realtime(SessionTrace::Load(trace_path), true);
+    start = std::chrono::steady_clock::now();
+    realtime.ReplayScan("scanner-a", out.path().u8string(), [](const std::string &) {});
+    CHECK(test::SecondsSince(start) >= 0.085);
+  }
+
+  void CheckCutOffTrace()
+  {
+    test::TempDir dir("session_trace_test");
+    auto trace_path = dir.Child("session.qstrace");
+    RecordSession(dir, trace_path, std::chrono::milliseconds(0));
+    auto full = SessionTrace::Load(trace_path)->events().size();
+
+    // Half of the last record, as a crash leaves it.
+    std::filesystem::resize_file(std::filesystem::u8path(trace_path),
+                                 std::filesystem::file_size(std::filesystem::u8path(trace_path)) - 10);
+    CHECK_EQ(SessionTrace::Load(trace_path)->events().size(), full - 1);
+
+    WriteFile(trace_path, PageBytes(0, 100));
+    bool rejected = false;
+    try
+    {
+      SessionTrace::Load(trace_path);
+    }
+    catch (const std::runtime_error &)
+    {
+      rejected = true;
+    }
+    CHECK(rejected);
+  }
+
+} // namespace
+
+int main()
+{
+  CheckEvents();
+  CheckScans();
+  CheckRealtimePauses();
+  CheckCutOffTrace();
+  std::printf("session_trace_test passed\n");
+  return 0;
+}
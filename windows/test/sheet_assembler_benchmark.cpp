@@ -0,0 +1,196 @@
+// Scans a stack of two-sided sheets from a simulated feeder and runs every
+// page through ProcessPage as scanBatch does, three ways:
+//
+//   two passes       simplex, fronts then backs, pipelined
+//   duplex, serial   one pass, each page processed before the next is taken
+//   duplex           one pass through SheetAssembler, four pages in flight
+//
+//   sheet_assembler_benchmark [sheets] [sheet_ms]
+//
+// Defaults to 20 A4 sheets at 200 dpi in grayscale and a feeder that takes
+// 150 ms per sheet and side, or per sheet for both sides in duplex. Pages
+// come from memory, so WIC decoding is not part of the processing time.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "page_pipeline.h"
+#include "sheet_assembler.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  const uint32_t kWidth = 1654;
+  const uint32_t kHeight = 2339;
+
+  // Text on the front, every third back blank.
+  std::shared_ptr<const std::vector<uint8_t>> SyntheticSide(size_t sheet, bool back)
+  {
+    std::mt19937 random(static_cast<unsigned>(sheet * 2 + back));
+    bool blank = back && sheet % 3 == 0;
+    auto pixels = std::make_shared<std::vector<uint8_t>>(size_t{kWidth} * kHeight);
+    for (uint32_t y = 0; y < kHeight; y++)
+    {
+      for (uint32_t x = 0; x < kWidth; x++)
+      {
+        bool ink = !blank && (y / 28) % 2 == 0 && y % 28 < 20 && x > 100 && x < 1550 && (x / 10) % 4 != 0 &&
+                   (x * 7 + y * 3) % 11 < 4;
+        (*pixels)[size_t{y} * kWidth + x] = static_cast<uint8_t>(ink ? 20 + random() % 20 : 236 + random() % 12);
+      }
+    }
+    return pixels;
+  }
+
+  PageResult Process(const std::shared_ptr<const std::vector<uint8_t>> &pixels, const PageOptions &options)
+  {
+    auto page = std::make_unique<TiledImage>(kWidth, kHeight, PixelFormat::kGray8, [pixels](Tile &tile)
+                                             {
+      for (uint32_t r = 0; r < tile.height; r++)
+      {
+        std::memcpy(tile.Row(r), pixels->data() + (size_t{tile.y} + r) * kWidth + tile.x, tile.width);
+      } });
+    return ProcessPage(std::move(page), "page.png", options);
+  }
+
+  // Delivers pages |interval| apart, later when the consumer held it up.
+  class Feeder
+  {
+  public:
+    explicit Feeder(std::chrono::microseconds interval)
+        : interval_(interval), next_(std::chrono::steady_clock::now() + interval) {}
+
+    void Deliver(const std::function<void()> &take)
+    {
+      std::this_thread::sleep_until(next_);
+      take();
+      next_ = (std::max)(next_, std::chrono::steady_clock::now()) + interval_;
+    }
+
+  private:
+    std::chrono::microseconds interval_;
+    std::chrono::steady_clock::time_point next_;
+  };
+
+  struct Run
+  {
+    double seconds = 0;
+    size_t kept = 0;
+    size_t dropped = 0;
+  };
+
+  PageOptions ScanBatchOptions()
+  {
+    PageOptions options;
+    options.detect_separators = true;
+    return options;
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  size_t sheets = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20;
+  auto sheet_time = std::chrono::milliseconds(argc > 2 ? std::atoi(argv[2]) : 150);
+
+  std::vector<std::shared_ptr<const std::vector<uint8_t>>> fronts, backs;
+  for (size_t i = 0; i < sheets; i++)
+  {
+    fronts.push_back(SyntheticSide(i, false));
+    backs.push_back(SyntheticSide(i, true));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto options = ScanBatchOptions();
+  options.detect_blank = true;
+  for (size_t i = 0; i < 5; i++)
+  {
+    Process(backs[i % sheets], options);
+  }
+  double page_ms = test::SecondsSince(start) * 1000 / 5;
+
+  auto count = [](Run &run)
+  {
+    return [&run](const Sheet &sheet)
+    {
+      for (const auto &side : sheet.sides)
+      {
+        side.keep ? run.kept++ : run.dropped++;
+      }
+    };
+  };
+
+  // Two simplex passes; blank backs are checked on the second.
+  Run two_passes;
+  start = std::chrono::steady_clock::now();
+  for (auto *pass : {&fronts, &backs})
+  {
+    auto pass_options = ScanBatchOptions();
+    pass_options.detect_blank = pass == &backs;
+    SheetAssembler assembler(false, false, 4, pass_options, count(two_passes));
+    Feeder feeder(sheet_time);
+    for (const auto &side : *pass)
+    {
+      feeder.Deliver([&]
+                     { assembler.Add("page.png", [side](const PageOptions &page_options)
+                                     { return Process(side, page_options); }); });
+    }
+    assembler.Finish();
+  }
+  two_passes.seconds = test::SecondsSince(start);
+
+  // One duplex pass, processing each side as it arrives.
+  Run serial;
+  start = std::chrono::steady_clock::now();
+  {
+    Feeder feeder(sheet_time / 2);
+    for (size_t i = 0; i < sheets * 2; i++)
+    {
+      feeder.Deliver([&]
+                     {
+        auto page_options = ScanBatchOptions();
+        page_options.detect_blank = i % 2 == 1;
+        auto result = Process(i % 2 == 0 ? fronts[i / 2] : backs[i / 2], page_options);
+        result.is_blank ? serial.dropped++ : serial.kept++; });
+    }
+  }
+  serial.seconds = test::SecondsSince(start);
+
+  Run duplex;
+  start = std::chrono::steady_clock::now();
+  {
+    SheetAssembler assembler(true, true, 4, ScanBatchOptions(), count(duplex));
+    Feeder feeder(sheet_time / 2);
+    for (size_t i = 0; i < sheets * 2; i++)
+    {
+      auto side = i % 2 == 0 ? fronts[i / 2] : backs[i / 2];
+      feeder.Deliver([&]
+                     { assembler.Add("page.png", [side](const PageOptions &page_options)
+                                     { return Process(side, page_options); }); });
+    }
+    assembler.Finish();
+  }
+  duplex.seconds = test::SecondsSince(start);
+
+  std::printf("%zu sheets, feeder %lld ms per sheet, ProcessPage %.1f ms per page, %u cores\n", sheets,
+              static_cast<long long>(sheet_time.count()), page_ms, std::thread::hardware_concurrency());
+  for (auto run : {std::make_pair("two passes", two_passes), std::make_pair("duplex, serial", serial),
+                   std::make_pair("duplex", duplex)})
+  {
+    std::printf("  %-15s %7.2f s  %5.1f sheets/min  (%zu pages kept, %zu blank backs dropped)  %.2fx\n",
+                run.first, run.second.seconds, static_cast<double>(sheets) * 60 / run.second.seconds,
+                run.second.kept, run.second.dropped, two_passes.seconds / run.second.seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,229 @@
+// Feeds simulated simplex and duplex scans through SheetAssembler: sheets
+// come out whole and in feeder order however long each side takes, an odd
+// page count ends with a front-only sheet, blank backs are dropped but blank
+// fronts are not, separator sheets keep neither side, the in-flight bound
+// holds, and processing errors reach the caller.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sheet_assembler.h"
+#include "test_support.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  struct FakePage
+  {
+    bool blank = false;
+    bool separator = false;
+    // How long processing takes, so later pages can finish first.
+    int milliseconds = 0;
+  };
+
+  struct Committed
+  {
+    std::vector<std::string> sources;
+    std::vector<bool> kept;
+    bool separator = false;
+  };
+
+  // Adds |pages| named p0, p1, ... and returns the sheets handed over.
+  std::vector<Committed> Assemble(bool duplex, bool drop_blank_backs, const std::vector<FakePage> &pages,
+                                  std::vector<bool> *checked_blank = nullptr)
+  {
+    std::vector<Committed> sheets;
+    std::mutex mutex;
+    SheetAssembler assembler(duplex, drop_blank_backs, 4, PageOptions(), [&](const Sheet &sheet)
+                             {
+      Committed committed;
+      for (const auto &side : sheet.sides)
+      {
+        committed.sources.push_back(side.source);
+        committed.kept.push_back(side.keep);
+        CHECK_EQ(side.result.path, side.source + ".out");
+      }
+      committed.separator = sheet.separator() != nullptr;
+      sheets.push_back(committed); });
+    if (checked_blank)
+    {
+      checked_blank->assign(pages.size(), false);
+    }
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+      auto source = "p" + std::to_string(i);
+      auto page = pages[i];
+      assembler.Add(source, [&, source, page, i](const PageOptions &options)
+                    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(page.milliseconds));
+        if (checked_blank)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          (*checked_blank)[i] = options.detect_blank;
+        }
+        PageResult result;
+        result.path = source + ".out";
+        result.is_blank = options.detect_blank && page.blank;
+        result.separator.is_separator = page.separator;
+        return result; });
+    }
+    assembler.Finish();
+    return sheets;
+  }
+
+  void CheckSimplexOrder()
+  {
+    std::vector<FakePage> pages;
+    for (int i = 0; i < 9; i++)
+    {
+      pages.push_back({false, false, (9 - i) * 3});
+    }
+    auto sheets = Assemble(false, true, pages);
+    CHECK_EQ(sheets.size(), 9u);
+    for (size_t i = 0; i < sheets.size(); i++)
+    {
+      CHECK((sheets[i].sources == std::vector<std::string>{"p" + std::to_string(i)}));
+      CHECK(sheets[i].kept[0]);
+    }
+  }
+
+  void CheckDuplexPairs()
+  {
+    // Backs finish before their fronts, and five pages leave the last sheet
+    // without a back.
+    std::vector<FakePage> pages = {{false, false, 20}, {false, false, 0}, {false, false, 15},
+                                   {false, false, 1}, {false, false, 5}};
+    std::vector<bool> checked_blank;
+    auto sheets = Assemble(true, false, pages, &checked_blank);
+    CHECK_EQ(sheets.size(), 3u);
+    CHECK((sheets[0].sources == std::vector<std::string>{"p0", "p1"}));
+    CHECK((sheets[1].sources == std::vector<std::string>{"p2", "p3"}));
+    CHECK((sheets[2].sources == std::vector<std::string>{"p4"}));
+    CHECK(std::none_of(checked_blank.begin(), checked_blank.end(), [](bool checked)
+                       { return checked; }));
+  }
+
+  void CheckBlankBacks()
+  {
+    // Sheet 0: blank front, printed back. Sheet 1: printed front, blank
+    // back. Sheet 2: both blank. Sheet 3: a blank front only.
+    std::vector<FakePage> pages = {{true}, {false}, {false}, {true}, {true}, {true}, {true}};
+    std::vector<bool> checked_blank;
+    auto sheets = Assemble(true, true, pages, &checked_blank);
+    CHECK((checked_blank == std::vector<bool>{false, true, false, true, false, true, false}));
+    CHECK_EQ(sheets.size(), 4u);
+    CHECK((sheets[0].kept == std::vector<bool>{true, true}));
+    CHECK((sheets[1].kept == std::vector<bool>{true, false}));
+    CHECK((sheets[2].kept == std::vector<bool>{true, false}));
+    CHECK((sheets[3].kept == std::vector<bool>{true}));
+
+    // Without duplex there are no backs to drop.
+    sheets = Assemble(false, true, {{true}, {true}}, &checked_blank);
+    CHECK((checked_blank == std::vector<bool>{false, false}));
+    CHECK(sheets[0].kept[0] && sheets[1].kept[0]);
+  }
+
+  void CheckSeparatorSheets()
+  {
+    // A separator on the front of sheet 1 and on the back of sheet 2.
+    std::vector<FakePage> pages = {{false}, {false}, {false, true}, {false},
+                                   {false}, {true, true}, {false}, {false}};
+    auto sheets = Assemble(true, true, pages);
+    CHECK_EQ(sheets.size(), 4u);
+    CHECK(!sheets[0].separator);
+    CHECK(sheets[1].separator);
+    CHECK((sheets[1].kept == std::vector<bool>{false, false}));
+    CHECK(sheets[2].separator);
+    CHECK((sheets[2].kept == std::vector<bool>{false, false}));
+    CHECK((sheets[3].kept == std::vector<bool>{true, true}));
+  }
+
+  void CheckInFlightBound()
+  {
+    CHECK_EQ(SheetAssembler(false, false, 4, PageOptions(), [](const Sheet &) {}).max_pages_in_flight(), 4u);
+    CHECK_EQ(SheetAssembler(true, false, 5, PageOptions(), [](const Sheet &) {}).max_pages_in_flight(), 4u);
+    CHECK_EQ(SheetAssembler(true, false, 1, PageOptions(), [](const Sheet &) {}).max_pages_in_flight(), 2u);
+
+    std::atomic<int> running{0};
+    std::atomic<int> most_running{0};
+    size_t most_in_flight = 0;
+    SheetAssembler assembler(true, false, 4, PageOptions(), [](const Sheet &) {});
+    for (int i = 0; i < 24; i++)
+    {
+      assembler.Add("p", [&](const PageOptions &)
+                    {
+        int now = ++running;
+        int most = most_running.load();
+        while (now > most && !most_running.compare_exchange_weak(most, now))
+        {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        running--;
+        return PageResult(); });
+      most_in_flight = (std::max)(most_in_flight, assembler.pages_in_flight());
+    }
+    CHECK(most_in_flight <= 4);
+    CHECK(most_running.load() <= 4);
+
+    // Commit(sides - 1) hands over whole sheets and leaves a lone front.
+    size_t committed = 0;
+    SheetAssembler partial(true, false, 4, PageOptions(), [&](const Sheet &)
+                           { committed++; });
+    for (int i = 0; i < 3; i++)
+    {
+      partial.Add("p", [](const PageOptions &)
+                  { return PageResult(); });
+    }
+    partial.Commit(partial.sides() - 1);
+    CHECK_EQ(committed, 1u);
+    CHECK_EQ(partial.pages_in_flight(), 1u);
+    partial.Finish();
+    CHECK_EQ(committed, 2u);
+    CHECK_EQ(partial.pages_in_flight(), 0u);
+  }
+
+  void CheckErrors()
+  {
+    size_t committed = 0;
+    SheetAssembler assembler(true, false, 4, PageOptions(), [&](const Sheet &)
+                             { committed++; });
+    assembler.Add("p0", [](const PageOptions &)
+                  { return PageResult(); });
+    assembler.Add("p1", [](const PageOptions &) -> PageResult
+                  { throw std::runtime_error("decode failed"); });
+    bool thrown = false;
+    try
+    {
+      assembler.Finish();
+    }
+    catch (const std::runtime_error &)
+    {
+      thrown = true;
+    }
+    CHECK(thrown);
+    CHECK_EQ(committed, 0u);
+    CHECK_EQ(assembler.pages_in_flight(), 0u);
+  }
+
+} // namespace
+
+int main()
+{
+  CheckSimplexOrder();
+  CheckDuplexPairs();
+  CheckBlankBacks();
+  CheckSeparatorSheets();
+  CheckInFlightBound();
+  CheckErrors();
+  std::printf("sheet_assembler_test passed\n");
+  return 0;
+}
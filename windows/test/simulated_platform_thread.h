@@ -0,0 +1,99 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SIMULATED_PLATFORM_THREAD_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SIMULATED_PLATFORM_THREAD_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "platform_dispatcher.h"
+
+namespace quick_scanner_plus
+{
+  namespace test
+  {
+
+    // Stands in for the Windows message loop: a thread that drains the
+    // dispatcher when woken, as for the registered window message, and again
+    // when held frames are due, as for the WM_TIMER.
+    class SimulatedPlatformThread
+    {
+    public:
+      explicit SimulatedPlatformThread(std::chrono::milliseconds frame = PlatformDispatcher::kDefaultFrame)
+          : dispatcher_([this]
+                        { Wake(); },
+                        frame),
+            thread_(&SimulatedPlatformThread::Run, this) {}
+
+      ~SimulatedPlatformThread()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          stopping_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+      }
+
+      SimulatedPlatformThread(const SimulatedPlatformThread &) = delete;
+      SimulatedPlatformThread &operator=(const SimulatedPlatformThread &) = delete;
+
+      PlatformDispatcher &dispatcher() { return dispatcher_; }
+      std::thread::id id() const { return thread_.get_id(); }
+
+    private:
+      void Wake()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          woken_ = true;
+        }
+        wake_.notify_one();
+      }
+
+      void Run()
+      {
+        std::chrono::milliseconds due{0};
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+          auto ready = [this]
+          { return woken_ || stopping_; };
+          if (due.count() > 0)
+          {
+            wake_.wait_for(lock, due, ready);
+          }
+          else
+          {
+            wake_.wait(lock, ready);
+          }
+          if (stopping_)
+          {
+            // Runs whatever is left, held frames included.
+            lock.unlock();
+            while (dispatcher_.Drain().count() > 0)
+            {
+              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return;
+          }
+          woken_ = false;
+          lock.unlock();
+          due = dispatcher_.Drain();
+          lock.lock();
+        }
+      }
+
+      std::mutex mutex_;
+      std::condition_variable wake_;
+      bool woken_ = false;
+      bool stopping_ = false;
+      PlatformDispatcher dispatcher_;
+      std::thread thread_;
+    };
+
+  } // namespace test
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_SIMULATED_PLATFORM_THREAD_H_
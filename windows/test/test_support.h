@@ -0,0 +1,66 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_TEST_SUPPORT_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_TEST_SUPPORT_H_
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+
+// Minimal checks for the native tests: a failed CHECK prints where and
+// exits, which ctest reports as a failure.
+#define CHECK(condition)                                                         \
+  do                                                                             \
+  {                                                                              \
+    if (!(condition))                                                            \
+    {                                                                            \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      std::exit(1);                                                              \
+    }                                                                            \
+  } while (false)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+namespace quick_scanner_plus
+{
+  namespace test
+  {
+
+    // A fresh directory under the system temp directory, removed again when
+    // the test ends.
+    class TempDir
+    {
+    public:
+      explicit TempDir(const std::string &name)
+      {
+        std::random_device random;
+        path_ = std::filesystem::temp_directory_path() /
+                (name + "-" + std::to_string(random()));
+        std::filesystem::create_directories(path_);
+      }
+      ~TempDir()
+      {
+        std::error_code ignored;
+        std::filesystem::remove_all(path_, ignored);
+      }
+
+      TempDir(const TempDir &) = delete;
+      TempDir &operator=(const TempDir &) = delete;
+
+      const std::filesystem::path &path() const { return path_; }
+      std::string Child(const std::string &name) const { return (path_ / name).u8string(); }
+
+    private:
+      std::filesystem::path path_;
+    };
+
+    inline double SecondsSince(std::chrono::steady_clock::time_point start)
+    {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+  } // namespace test
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_TEST_SUPPORT_H_
@@ -0,0 +1,169 @@
+// Walks a synthetic 1 gigapixel page under a fixed memory cap, and checks
+// that concurrent readers share tile loads without blocking cache hits.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <thread>
+
+#if defined(__unix__)
+#include <sys/resource.h>
+#endif
+
+#include "buffer_pool.h"
+#include "test_support.h"
+#include "tiled_image.h"
+
+using namespace quick_scanner_plus;
+
+namespace
+{
+
+  uint8_t PixelValue(uint32_t x, uint32_t y)
+  {
+    return static_cast<uint8_t>((x / 7) ^ (y / 5));
+  }
+
+  // Fills every row with its pattern; cheap enough for a billion pixels.
+  void LoadPattern(Tile &tile)
+  {
+    auto bpp = BytesPerPixel(tile.format);
+    for (uint32_t r = 0; r < tile.height; r++)
+    {
+      std::memset(tile.Row(r), PixelValue(tile.x, tile.y + r), tile.width * bpp);
+    }
+  }
+
+  void CheckGigapixelPass()
+  {
+    const uint32_t kWidth = 40000;
+    const uint32_t kHeight = 25000;
+    // A full-height strip of this page would be 40 MB.
+    const size_t kCap = TiledImage::kDefaultMaxResidentBytes;
+
+    TiledImage page(kWidth, kHeight, PixelFormat::kBgra8, LoadPattern);
+    CHECK(page.strip_rows() < page.tile_size());
+    CHECK(size_t{page.strip_rows()} * kWidth * 4 <= kCap);
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t next_row = 0;
+    page.ForEachTileRow([&](const TileRow &strip)
+                        {
+      CHECK_EQ(strip.y(), next_row);
+      size_t bytes = 0;
+      uint32_t x = 0;
+      for (const auto &tile : strip.tiles())
+      {
+        CHECK_EQ(tile->x, x);
+        CHECK_EQ(tile->height, strip.height());
+        CHECK_EQ(tile->Row(strip.height() - 1)[0], PixelValue(tile->x, strip.y() + strip.height() - 1));
+        bytes += tile->ByteSize();
+        x += tile->width;
+      }
+      CHECK_EQ(x, kWidth);
+      CHECK(bytes <= kCap);
+      next_row += strip.height(); });
+    CHECK_EQ(next_row, kHeight);
+    std::printf("1 Gpx BGRA pass: %.2f s, %u rows per strip\n", test::SecondsSince(start), page.strip_rows());
+
+#if defined(__unix__)
+    // The strip, the pooled buffers it recycles and the test itself.
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    std::printf("peak RSS: %ld KB\n", usage.ru_maxrss);
+    CHECK(usage.ru_maxrss < 64 * 1024);
+#endif
+  }
+
+  void CheckNarrowPageKeepsTileStrips()
+  {
+    TiledImage page(2550, 3300, PixelFormat::kBgra8, LoadPattern);
+    CHECK_EQ(page.strip_rows(), page.tile_size());
+  }
+
+  void CheckCacheBounded()
+  {
+    TiledImage page(4096, 4096, PixelFormat::kGray8, LoadPattern, 256, 4 * 256 * 256);
+    for (uint32_t ty = 0; ty < page.tiles_down(); ty++)
+    {
+      for (uint32_t tx = 0; tx < page.tiles_across(); tx++)
+      {
+        auto tile = page.GetTile(tx, ty);
+        CHECK_EQ(tile->Row(3)[5], PixelValue(tx * 256, ty * 256 + 3));
+      }
+    }
+    CHECK(page.peak_resident_bytes() <= 4 * 256 * 256);
+  }
+
+  void CheckConcurrentReaders()
+  {
+    std::atomic<int> loads{0};
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::atomic<bool> blocked_load_started{false};
+    TiledImage page(1024, 1024, PixelFormat::kGray8, [&](Tile &tile)
+                    {
+      loads++;
+      if (tile.x == 0 && tile.y == 0)
+      {
+        blocked_load_started = true;
+        released.wait();
+      }
+      LoadPattern(tile); });
+
+    page.GetTile(1, 0);
+    CHECK_EQ(loads.load(), 1);
+
+    // Several readers of a tile that is still loading wait for that load.
+    std::vector<std::future<std::shared_ptr<const Tile>>> readers;
+    for (int i = 0; i < 4; i++)
+    {
+      readers.push_back(std::async(std::launch::async, [&page]
+                                   { return page.GetTile(0, 0); }));
+    }
+    while (!blocked_load_started)
+    {
+      std::this_thread::yield();
+    }
+
+    // A cached tile is served while the load is blocked.
+    auto cached = std::async(std::launch::async, [&page]
+                             { return page.GetTile(1, 0); });
+    CHECK(cached.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+
+    release.set_value();
+    auto first = readers[0].get();
+    for (size_t i = 1; i < readers.size(); i++)
+    {
+      CHECK(readers[i].get() == first);
+    }
+    CHECK_EQ(loads.load(), 2);
+  }
+
+  void CheckStagesApplyToLaterReads()
+  {
+    TiledImage page(512, 512, PixelFormat::kGray8, LoadPattern);
+    auto before = page.GetTile(0, 0);
+    page.AddStage([](Tile &tile)
+                  { tile.Row(0)[0] = 42; });
+    auto after = page.GetTile(0, 0);
+    CHECK(before != after);
+    CHECK_EQ(after->Row(0)[0], 42);
+    page.ForEachTileRow([](const TileRow &strip)
+                        { CHECK_EQ(strip.tiles().front()->Row(0)[0], 42); });
+  }
+
+} // namespace
+
+int main()
+{
+  CheckNarrowPageKeepsTileStrips();
+  CheckCacheBounded();
+  CheckConcurrentReaders();
+  CheckStagesApplyToLaterReads();
+  CheckGigapixelPass();
+  std::printf("tiled_image_test passed\n");
+  return 0;
+}
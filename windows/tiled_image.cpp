@@ -0,0 +1,196 @@
+#include "tiled_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace quick_scanner_plus
+{
+
+  size_t BytesPerPixel(PixelFormat format)
+  {
+    switch (format)
+    {
+    case PixelFormat::kGray8:
+      return 1;
+    case PixelFormat::kBgra8:
+      return 4;
+    }
+    return 4;
+  }
+
+  TileRow::TileRow(uint32_t y, uint32_t height, std::vector<std::shared_ptr<const Tile>> tiles)
+      : y_(y), height_(height), tiles_(std::move(tiles)) {}
+
+  void TileRow::CopyRow(uint32_t row, uint8_t *dst) const
+  {
+    for (const auto &tile : tiles_)
+    {
+      auto row_bytes = tile->width * BytesPerPixel(tile->format);
+      std::memcpy(dst, tile->Row(row), row_bytes);
+      dst += row_bytes;
+    }
+  }
+
+  TiledImage::TiledImage(uint32_t width, uint32_t height, PixelFormat format, TileLoader loader,
+                         uint32_t tile_size, size_t max_resident_bytes)
+      : width_(width),
+        height_(height),
+        format_(format),
+        loader_(std::move(loader)),
+        tile_size_(tile_size),
+        max_resident_bytes_(max_resident_bytes),
+        stages_(std::make_shared<const Stages>())
+  {
+    if (width_ == 0 || height_ == 0 || tile_size_ == 0)
+    {
+      throw std::invalid_argument("Tiled image dimensions must be non-zero.");
+    }
+  }
+
+  void TiledImage::AddStage(TileStage stage)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto stages = std::make_shared<Stages>(*stages_);
+    stages->push_back(std::move(stage));
+    stages_ = std::move(stages);
+    generation_++;
+    cache_.clear();
+    lru_.clear();
+    resident_bytes_ = 0;
+  }
+
+  std::shared_ptr<const Tile> TiledImage::GetTile(uint32_t tx, uint32_t ty)
+  {
+    if (tx >= tiles_across() || ty >= tiles_down())
+    {
+      throw std::out_of_range("Tile index outside of image.");
+    }
+
+    TileKey key{tx, ty};
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+      auto it = cache_.find(key);
+      if (it != cache_.end())
+      {
+        lru_.splice(lru_.begin(), lru_, it->second.second);
+        return it->second.first;
+      }
+      if (loading_.count(key) == 0)
+      {
+        break;
+      }
+      loaded_.wait(lock);
+    }
+    loading_.insert(key);
+    auto stages = stages_;
+    auto generation = generation_;
+    lock.unlock();
+
+    std::shared_ptr<const Tile> tile;
+    try
+    {
+      uint32_t x = tx * tile_size_;
+      uint32_t y = ty * tile_size_;
+      tile = Materialize(x, y, std::min(tile_size_, width_ - x), std::min(tile_size_, height_ - y), *stages);
+    }
+    catch (...)
+    {
+      lock.lock();
+      loading_.erase(key);
+      loaded_.notify_all();
+      throw;
+    }
+
+    lock.lock();
+    loading_.erase(key);
+    loaded_.notify_all();
+    if (generation == generation_)
+    {
+      EvictLocked(tile->ByteSize());
+      lru_.push_front(key);
+      cache_.emplace(key, std::make_pair(tile, lru_.begin()));
+      resident_bytes_ += tile->ByteSize();
+      peak_resident_bytes_ = std::max(peak_resident_bytes_, resident_bytes_);
+    }
+    return tile;
+  }
+
+  void TiledImage::ForEachTileRow(const std::function<void(const TileRow &row)> &visitor)
+  {
+    std::shared_ptr<const Stages> stages;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stages = stages_;
+    }
+
+    // Strips bypass the cache: a sequential pass would only evict the tiles
+    // random-access readers are working on.
+    auto rows = strip_rows();
+    for (uint32_t y = 0; y < height_; y += rows)
+    {
+      auto height = std::min(rows, height_ - y);
+      std::vector<std::shared_ptr<const Tile>> tiles;
+      tiles.reserve(tiles_across());
+      for (uint32_t x = 0; x < width_; x += tile_size_)
+      {
+        tiles.push_back(Materialize(x, y, std::min(tile_size_, width_ - x), height, *stages));
+      }
+      visitor(TileRow(y, height, std::move(tiles)));
+    }
+  }
+
+  uint32_t TiledImage::strip_rows() const
+  {
+    size_t row_bytes = static_cast<size_t>(width_) * BytesPerPixel(format_);
+    return static_cast<uint32_t>(std::max<size_t>(std::min<size_t>(max_resident_bytes_ / row_bytes, tile_size_), 1));
+  }
+
+  size_t TiledImage::resident_bytes() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_bytes_;
+  }
+
+  size_t TiledImage::peak_resident_bytes() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_resident_bytes_;
+  }
+
+  std::shared_ptr<Tile> TiledImage::Materialize(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                                                const Stages &stages)
+  {
+    auto tile = std::make_shared<Tile>();
+    tile->x = x;
+    tile->y = y;
+    tile->width = width;
+    tile->height = height;
+    tile->format = format_;
+    tile->stride = tile->width * BytesPerPixel(format_);
+    tile->pixels = BufferPool::Shared().Acquire(tile->stride * tile->height);
+
+    {
+      std::lock_guard<std::mutex> lock(loader_mutex_);
+      loader_(*tile);
+    }
+    for (const auto &stage : stages)
+    {
+      stage(*tile);
+    }
+    return tile;
+  }
+
+  void TiledImage::EvictLocked(size_t incoming_bytes)
+  {
+    while (!lru_.empty() && resident_bytes_ + incoming_bytes > max_resident_bytes_)
+    {
+      auto it = cache_.find(lru_.back());
+      resident_bytes_ -= it->second.first->ByteSize();
+      cache_.erase(it);
+      lru_.pop_back();
+    }
+  }
+
+} // namespace quick_scanner_plus
@@ -0,0 +1,155 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_TILED_IMAGE_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_TILED_IMAGE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+
+namespace quick_scanner_plus
+{
+
+  enum class PixelFormat
+  {
+    kGray8,
+    kBgra8,
+  };
+
+  size_t BytesPerPixel(PixelFormat format);
+
+  // A fixed-size rectangle of page pixels. Tiles on the right and bottom edges
+  // are clipped to the page, so width/height may be smaller than the tile size.
+  struct Tile
+  {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    PixelFormat format = PixelFormat::kBgra8;
+    size_t stride = 0;
+    // Drawn from BufferPool::Shared(), so tiles recycle each other's memory.
+    PooledBuffer pixels;
+
+    uint8_t *Row(uint32_t row) { return pixels.data() + row * stride; }
+    const uint8_t *Row(uint32_t row) const { return pixels.data() + row * stride; }
+    size_t ByteSize() const { return pixels.size(); }
+  };
+
+  // The tiles covering one horizontal strip of the page, left to right.
+  class TileRow
+  {
+  public:
+    TileRow(uint32_t y, uint32_t height, std::vector<std::shared_ptr<const Tile>> tiles);
+
+    uint32_t y() const { return y_; }
+    uint32_t height() const { return height_; }
+    const std::vector<std::shared_ptr<const Tile>> &tiles() const { return tiles_; }
+
+    // Copies image row |row| (relative to y()) into |dst|, which must hold a
+    // full page row.
+    void CopyRow(uint32_t row, uint8_t *dst) const;
+
+  private:
+    uint32_t y_;
+    uint32_t height_;
+    std::vector<std::shared_ptr<const Tile>> tiles_;
+  };
+
+  // A page image split into fixed-size tiles that are only materialized when
+  // they are asked for. Pixels come from |loader|, then every registered stage
+  // runs over the tile, so no stage ever sees more than one tile at a time.
+  // Materialized tiles are kept in an LRU cache bounded by |max_resident_bytes|,
+  // and sequential strips are bounded by the same amount; a full page is never
+  // held in memory.
+  //
+  // Tiles are loaded and processed without holding the cache lock, so cache
+  // hits and other readers are not held up by a decode. Readers asking for a
+  // tile that is being loaded wait for it instead of loading it again.
+  class TiledImage
+  {
+  public:
+    // Fills |tile.pixels| for the bounds in |tile|. Buffers are pre-sized.
+    // Calls are serialized, so the loader need not be thread-safe.
+    using TileLoader = std::function<void(Tile &tile)>;
+    // Transforms a tile in place. Must not change its size or format.
+    using TileStage = std::function<void(Tile &tile)>;
+
+    static constexpr uint32_t kDefaultTileSize = 256;
+    static constexpr size_t kDefaultMaxResidentBytes = 8 * 1024 * 1024;
+
+    TiledImage(uint32_t width, uint32_t height, PixelFormat format, TileLoader loader,
+               uint32_t tile_size = kDefaultTileSize,
+               size_t max_resident_bytes = kDefaultMaxResidentBytes);
+
+    TiledImage(const TiledImage &) = delete;
+    TiledImage &operator=(const TiledImage &) = delete;
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    PixelFormat format() const { return format_; }
+    uint32_t tile_size() const { return tile_size_; }
+    uint32_t tiles_across() const { return (width_ + tile_size_ - 1) / tile_size_; }
+    uint32_t tiles_down() const { return (height_ + tile_size_ - 1) / tile_size_; }
+
+    // Appends a stage to the per-tile pipeline. Already cached tiles are
+    // dropped so the next read sees the new stage.
+    void AddStage(TileStage stage);
+
+    // Returns tile (|tx|, |ty|), loading and processing it on a cache miss.
+    std::shared_ptr<const Tile> GetTile(uint32_t tx, uint32_t ty);
+
+    // Visits the page top to bottom one strip of tiles at a time. Each strip is
+    // released before the next is materialized. Strips are one tile high, or
+    // fewer rows on pages so wide that a full-height strip would exceed
+    // max_resident_bytes; never less than one row.
+    void ForEachTileRow(const std::function<void(const TileRow &row)> &visitor);
+
+    // Rows per strip in ForEachTileRow.
+    uint32_t strip_rows() const;
+
+    size_t resident_bytes() const;
+    size_t peak_resident_bytes() const;
+
+  private:
+    using TileKey = std::pair<uint32_t, uint32_t>;
+    using Stages = std::vector<TileStage>;
+
+    // Loads and processes the given bounds. Called without |mutex_|.
+    std::shared_ptr<Tile> Materialize(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                                      const Stages &stages);
+    void EvictLocked(size_t incoming_bytes);
+
+    uint32_t width_;
+    uint32_t height_;
+    PixelFormat format_;
+    TileLoader loader_;
+    std::mutex loader_mutex_;
+    uint32_t tile_size_;
+    size_t max_resident_bytes_;
+
+    mutable std::mutex mutex_;
+    // Replaced, never modified, so loads in progress keep a consistent set.
+    std::shared_ptr<const Stages> stages_;
+    // Bumped by AddStage; tiles loaded under an older one are not cached.
+    uint64_t generation_ = 0;
+    // Tiles being loaded by GetTile, and the signal that one finished.
+    std::set<TileKey> loading_;
+    std::condition_variable loaded_;
+    std::list<TileKey> lru_;
+    std::map<TileKey, std::pair<std::shared_ptr<const Tile>, std::list<TileKey>::iterator>> cache_;
+    size_t resident_bytes_ = 0;
+    size_t peak_resident_bytes_ = 0;
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_TILED_IMAGE_H_
@@ -0,0 +1,430 @@
+#include "winrt_scan_backend.h"
+
+// This must be included before many other Windows headers.
+#include <windows.h>
+
+#include <winrt/Windows.Devices.Scanners.h>
+#include <winrt/Windows.Foundation.Collections.h>
+#include <winrt/Windows.Storage.h>
+
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <thread>
+
+#include "escl_client.h"
+
+using namespace winrt;
+using namespace Windows::Devices::Enumeration;
+using namespace Windows::Devices::Scanners;
+using namespace Windows::Foundation;
+using namespace Windows::Storage;
+
+namespace quick_scanner_plus
+{
+
+  namespace
+  {
+
+    // WIA_ERROR_PAPER_EMPTY, reported when a feeder run starts without paper.
+    const winrt::hresult kFeederEmpty{static_cast<int32_t>(0x80210003)};
+
+    ImageScannerFormat ToImageScannerFormat(ScanFormat format)
+    {
+      switch (format)
+      {
+      case ScanFormat::kJpeg:
+        return ImageScannerFormat::Jpeg;
+      case ScanFormat::kPng:
+        return ImageScannerFormat::Png;
+      case ScanFormat::kTiff:
+        return ImageScannerFormat::Tiff;
+      case ScanFormat::kPdf:
+        return ImageScannerFormat::Pdf;
+      case ScanFormat::kDib:
+        return ImageScannerFormat::DeviceIndependentBitmap;
+      case ScanFormat::kXps:
+        return ImageScannerFormat::Xps;
+      }
+      return ImageScannerFormat::Jpeg;
+    }
+
+    ScanFormat FromImageScannerFormat(ImageScannerFormat format)
+    {
+      switch (format)
+      {
+      case ImageScannerFormat::Png:
+        return ScanFormat::kPng;
+      case ImageScannerFormat::Tiff:
+        return ScanFormat::kTiff;
+      case ImageScannerFormat::Pdf:
+        return ScanFormat::kPdf;
+      case ImageScannerFormat::DeviceIndependentBitmap:
+        return ScanFormat::kDib;
+      case ImageScannerFormat::Xps:
+      case ImageScannerFormat::OpenXps:
+        return ScanFormat::kXps;
+      default:
+        return ScanFormat::kJpeg;
+      }
+    }
+
+    // Tells the client which formats the device accepts and which one the
+    // pages arrive in.
+    void ReportFormats(const ScanBackend::Events &events, const std::function<bool(ScanFormat)> &is_supported,
+                       ScanFormat chosen)
+    {
+      events.capability("formats", SupportedScanFormatNames(is_supported));
+      events.capability("format", ScanFormatName(chosen));
+      events.format(chosen);
+    }
+
+    // Selects the device-native format closest to |requested| on a flatbed,
+    // feeder or auto configuration. Without a request the driver default is
+    // kept, unless pages must be decoded and the default cannot be.
+    template <typename FormatConfiguration>
+    ScanFormat ConfigureFormat(FormatConfiguration const &config, const BrokerScanJob &job,
+                               const ScanBackend::Events &events)
+    {
+      auto is_supported = [&](ScanFormat format)
+      { return config.IsFormatSupported(ToImageScannerFormat(format)); };
+      auto current = FromImageScannerFormat(config.Format());
+      auto requested = job.format;
+      if (!requested)
+      {
+        if (!job.decodable || IsDecodableScanFormat(current))
+        {
+          ReportFormats(events, is_supported, current);
+          return current;
+        }
+        requested = ScanFormat::kPng;
+      }
+
+      auto chosen = NegotiateScanFormat(*requested, job.decodable, is_supported);
+      if (!chosen)
+      {
+        throw BrokerError("UnsupportedFormat", "Scanner cannot produce a usable output format.");
+      }
+      config.Format(ToImageScannerFormat(*chosen));
+      ReportFormats(events, is_supported, *chosen);
+      return *chosen;
+    }
+
+    template <typename ColorConfiguration>
+    void ConfigureColorMode(ColorConfiguration const &config, const char *source)
+    {
+      if (config.IsColorModeSupported(ImageScannerColorMode::Color))
+      {
+        config.ColorMode(ImageScannerColorMode::Color);
+      }
+      else if (config.IsColorModeSupported(ImageScannerColorMode::Grayscale))
+      {
+        config.ColorMode(ImageScannerColorMode::Grayscale);
+      }
+      else
+      {
+        throw BrokerError("UnsupportedScanModes", std::string(source) + " does not support required color modes.");
+      }
+    }
+
+    ImageScanner OpenScanner(const std::string &device_id)
+    {
+      auto scanner = ImageScanner::FromIdAsync(winrt::to_hstring(device_id)).get();
+      if (!scanner)
+      {
+        throw BrokerError("ScannerInitializationFailed", "Scanner could not be initialized.");
+      }
+      return scanner;
+    }
+
+    // One scan from the flatbed, or the feeder or automatic source of a
+    // scanner without one.
+    void ScanOnce(const BrokerScanJob &job, StorageFolder const &folder, const ScanBackend::Events &events)
+    {
+      auto scanner = OpenScanner(job.device_id);
+
+      ImageScannerScanSource scanSource = ImageScannerScanSource::Flatbed;
+      if (scanner.IsScanSourceSupported(ImageScannerScanSource::Flatbed))
+      {
+        scanSource = ImageScannerScanSource::Flatbed;
+      }
+      else if (scanner.IsScanSourceSupported(ImageScannerScanSource::Feeder))
+      {
+        scanSource = ImageScannerScanSource::Feeder;
+      }
+      else if (scanner.IsScanSourceSupported(ImageScannerScanSource::AutoConfigured))
+      {
+        scanSource = ImageScannerScanSource::AutoConfigured;
+      }
+      else
+      {
+        throw BrokerError("ScanSourceNotSupported", "No supported scan source available on this scanner.");
+      }
+
+      events.capability("source", scanSource == ImageScannerScanSource::Flatbed  ? "flatbed"
+                                  : scanSource == ImageScannerScanSource::Feeder ? "feeder"
+                                                                                 : "auto");
+
+      // Ask the device for the wanted format instead of transcoding later
+      if (scanSource == ImageScannerScanSource::Flatbed)
+      {
+        ConfigureColorMode(scanner.FlatbedConfiguration(), "Flatbed");
+        ConfigureFormat(scanner.FlatbedConfiguration(), job, events);
+      }
+      else if (scanSource == ImageScannerScanSource::Feeder)
+      {
+        ConfigureColorMode(scanner.FeederConfiguration(), "Feeder");
+        ConfigureFormat(scanner.FeederConfiguration(), job, events);
+      }
+      else
+      {
+        ConfigureFormat(scanner.AutoConfiguration(), job, events);
+      }
+
+      auto scanResult = scanner.ScanFilesToFolderAsync(scanSource, folder).get();
+
+      // Wait until files are accessible (confirm the scanning process is fully complete)
+      int maxRetries = 5;
+      int retries = 0;
+      while (!scanResult.ScannedFiles().Size() && retries < maxRetries)
+      {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        retries++;
+      }
+      if (!scanResult.ScannedFiles().Size())
+      {
+        throw BrokerError("ScanFailed", "No files were scanned after waiting.");
+      }
+      for (auto const &file : scanResult.ScannedFiles())
+      {
+        events.page(winrt::to_string(file.Path()));
+      }
+    }
+
+    // Scans the feeder in runs of |job.pages_per_run| pages until it is
+    // empty.
+    void ScanFeeder(const BrokerScanJob &job, StorageFolder const &folder, const ScanBackend::Events &events)
+    {
+      auto scanner = OpenScanner(job.device_id);
+      if (!scanner.IsScanSourceSupported(ImageScannerScanSource::Feeder))
+      {
+        throw BrokerError("ScanSourceNotSupported", "Batch scanning requires a document feeder.");
+      }
+
+      auto feederConfig = scanner.FeederConfiguration();
+      ConfigureColorMode(feederConfig, "Feeder");
+      if (job.duplex)
+      {
+        if (!feederConfig.CanScanDuplex())
+        {
+          throw BrokerError("DuplexNotSupported", "Feeder cannot scan both sides of a sheet.");
+        }
+        feederConfig.Duplex(true);
+      }
+      ConfigureFormat(feederConfig, job, events);
+
+      // Zero scans until the feeder runs empty.
+      feederConfig.MaxNumberOfPages(job.pages_per_run);
+      for (int run = 0;; run++)
+      {
+        ImageScannerScanResult scanResult{nullptr};
+        try
+        {
+          scanResult = scanner.ScanFilesToFolderAsync(ImageScannerScanSource::Feeder, folder).get();
+        }
+        catch (winrt::hresult_error const &ex)
+        {
+          // The previous run took the last sheet.
+          if (run > 0 && ex.code() == kFeederEmpty)
+          {
+            break;
+          }
+          throw;
+        }
+
+        // A whole run arrives at once; the client holds back further pages
+        // while it is behind.
+        for (auto const &file : scanResult.ScannedFiles())
+        {
+          events.page(winrt::to_string(file.Path()));
+        }
+        events.run_end();
+
+        if (job.pages_per_run == 0 || scanResult.ScannedFiles().Size() < job.pages_per_run)
+        {
+          break;
+        }
+      }
+    }
+
+    void ScanEscl(const BrokerScanJob &job, StorageFolder const &folder, const ScanBackend::Events &events)
+    {
+      EsclClient client(job.device_id);
+      auto capabilities = winrt::to_string(client.CapabilitiesAsync().get());
+      // eSCL scanners default to JPEG.
+      auto is_supported = [&](ScanFormat format)
+      { return EsclSupportsFormat(capabilities, format); };
+      auto chosen = NegotiateScanFormat(job.format.value_or(ScanFormat::kJpeg), job.decodable, is_supported);
+      if (!chosen)
+      {
+        throw BrokerError("UnsupportedFormat", "Scanner cannot produce a usable output format.");
+      }
+      ReportFormats(events, is_supported, *chosen);
+
+      EsclScanSettings settings;
+      if (job.batch)
+      {
+        if (job.duplex && !EsclSupportsDuplex(capabilities))
+        {
+          throw BrokerError("DuplexNotSupported", "Feeder cannot scan both sides of a sheet.");
+        }
+        settings.input_source = "Feeder";
+        settings.duplex = job.duplex;
+      }
+      settings.document_format = ScanFormatMimeType(*chosen);
+      // A device busy with another client's job also answers 503.
+      settings.busy_timeout = (std::max)(settings.busy_timeout, job.device_timeout);
+      client.ScanAsync(settings, folder, [&](const std::string &path)
+                       { events.page(path); })
+          .get();
+    }
+
+    void StopWatcher(DeviceWatcher const &watcher)
+    {
+      // Stop throws in any other state.
+      auto status = watcher.Status();
+      if (status == DeviceWatcherStatus::Started || status == DeviceWatcherStatus::EnumerationCompleted)
+      {
+        watcher.Stop();
+      }
+    }
+
+  } // namespace
+
+  WinrtScanBackend::WinrtScanBackend(std::string pages_directory) : pages_directory_(std::move(pages_directory)) {}
+
+  WinrtScanBackend::~WinrtScanBackend()
+  {
+    StopDiscovery();
+  }
+
+  void WinrtScanBackend::StopDiscovery()
+  {
+    if (deviceWatcher)
+    {
+      deviceWatcher.Added(deviceWatcherAddedToken);
+      deviceWatcher.Removed(deviceWatcherRemovedToken);
+      deviceWatcher.EnumerationCompleted(deviceWatcherCompletedToken);
+      StopWatcher(deviceWatcher);
+      deviceWatcher = nullptr;
+    }
+    if (esclWatcher)
+    {
+      esclWatcher.Added(esclWatcherAddedToken);
+      esclWatcher.Removed(esclWatcherRemovedToken);
+      esclWatcher.EnumerationCompleted(esclWatcherCompletedToken);
+      StopWatcher(esclWatcher);
+      esclWatcher = nullptr;
+    }
+  }
+
+  void WinrtScanBackend::StartDiscovery(ScanBroker &broker)
+  {
+    broker_ = &broker;
+    deviceWatcher = DeviceInformation::CreateWatcher(DeviceClass::ImageScanner);
+    esclWatcher = DeviceInformation::CreateWatcher(EsclServiceSelector(), EsclServiceProperties(),
+                                                   DeviceInformationKind::AssociationEndpointService);
+
+    deviceWatcherAddedToken = deviceWatcher.Added({this, &WinrtScanBackend::DeviceWatcher_Added});
+    deviceWatcherRemovedToken = deviceWatcher.Removed({this, &WinrtScanBackend::DeviceWatcher_Removed});
+    deviceWatcherCompletedToken =
+        deviceWatcher.EnumerationCompleted({this, &WinrtScanBackend::Watcher_EnumerationCompleted});
+
+    esclWatcherAddedToken = esclWatcher.Added({this, &WinrtScanBackend::EsclWatcher_Added});
+    esclWatcherRemovedToken = esclWatcher.Removed({this, &WinrtScanBackend::EsclWatcher_Removed});
+    esclWatcherCompletedToken =
+        esclWatcher.EnumerationCompleted({this, &WinrtScanBackend::Watcher_EnumerationCompleted});
+
+    // Counted before starting, as a watcher can complete before Start
+    // returns.
+    pendingEnumerations_ = 2;
+    deviceWatcher.Start();
+    esclWatcher.Start();
+  }
+
+  void WinrtScanBackend::Scan(const BrokerScanJob &job, const Events &events)
+  {
+    try
+    {
+      auto folder = StorageFolder::GetFolderFromPathAsync(winrt::to_hstring(pages_directory_)).get();
+      if (IsEsclDeviceId(job.device_id))
+      {
+        ScanEscl(job, folder, events);
+      }
+      else if (job.batch)
+      {
+        ScanFeeder(job, folder, events);
+      }
+      else
+      {
+        ScanOnce(job, folder, events);
+      }
+    }
+    catch (winrt::hresult_error const &ex)
+    {
+      std::string message = "WinRT error occurred: " + winrt::to_string(ex.message());
+      OutputDebugStringA(message.c_str()); // Log error
+      throw BrokerError(std::to_string(ex.code()), winrt::to_string(ex.message()));
+    }
+  }
+
+  void WinrtScanBackend::Watcher_EnumerationCompleted(DeviceWatcher sender,
+                                                      winrt::Windows::Foundation::IInspectable const &)
+  {
+    if (--pendingEnumerations_ == 0)
+    {
+      broker_->EnumerationCompleted();
+    }
+  }
+
+  void WinrtScanBackend::DeviceWatcher_Added(DeviceWatcher sender, DeviceInformation info)
+  {
+    broker_->AddDevice(winrt::to_string(info.Id()), winrt::to_string(info.Name()));
+  }
+
+  void WinrtScanBackend::DeviceWatcher_Removed(DeviceWatcher sender, DeviceInformationUpdate infoUpdate)
+  {
+    broker_->RemoveDevice(winrt::to_string(infoUpdate.Id()));
+  }
+
+  void WinrtScanBackend::EsclWatcher_Added(DeviceWatcher sender, DeviceInformation info)
+  {
+    auto device_id = EsclDeviceIdFromService(info);
+    if (device_id.empty())
+    {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(esclMutex_);
+      esclServices_[winrt::to_string(info.Id())] = device_id;
+    }
+    broker_->AddDevice(device_id, EsclNameFromService(info));
+  }
+
+  void WinrtScanBackend::EsclWatcher_Removed(DeviceWatcher sender, DeviceInformationUpdate infoUpdate)
+  {
+    std::string device_id;
+    {
+      std::lock_guard<std::mutex> lock(esclMutex_);
+      auto service = esclServices_.find(winrt::to_string(infoUpdate.Id()));
+      if (service == esclServices_.end())
+      {
+        return;
+      }
+      device_id = service->second;
+      esclServices_.erase(service);
+    }
+    broker_->RemoveDevice(device_id);
+  }
+
+} // namespace quick_scanner_plus
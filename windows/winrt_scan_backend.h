@@ -0,0 +1,70 @@
+#ifndef FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_WINRT_SCAN_BACKEND_H_
+#define FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_WINRT_SCAN_BACKEND_H_
+
+#include <winrt/Windows.Devices.Enumeration.h>
+#include <winrt/Windows.Foundation.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "scan_broker.h"
+
+namespace quick_scanner_plus
+{
+
+  // The scan daemon's devices: WinRT image scanners and eSCL network
+  // scanners found over mDNS.
+  class WinrtScanBackend : public ScanBackend
+  {
+  public:
+    // Scanned pages are written to |pages_directory| (UTF-8) until the
+    // daemon hands them over.
+    explicit WinrtScanBackend(std::string pages_directory);
+    ~WinrtScanBackend() override;
+
+    WinrtScanBackend(const WinrtScanBackend &) = delete;
+    WinrtScanBackend &operator=(const WinrtScanBackend &) = delete;
+
+    // Starts the device watchers, which report to |broker| until
+    // StopDiscovery.
+    void StartDiscovery(ScanBroker &broker);
+    void StopDiscovery();
+
+    void Scan(const BrokerScanJob &job, const Events &events) override;
+
+  private:
+    using DeviceWatcher = winrt::Windows::Devices::Enumeration::DeviceWatcher;
+    using DeviceInformation = winrt::Windows::Devices::Enumeration::DeviceInformation;
+    using DeviceInformationUpdate = winrt::Windows::Devices::Enumeration::DeviceInformationUpdate;
+
+    void Watcher_EnumerationCompleted(DeviceWatcher sender, winrt::Windows::Foundation::IInspectable const &);
+    void DeviceWatcher_Added(DeviceWatcher sender, DeviceInformation info);
+    void DeviceWatcher_Removed(DeviceWatcher sender, DeviceInformationUpdate infoUpdate);
+    void EsclWatcher_Added(DeviceWatcher sender, DeviceInformation info);
+    void EsclWatcher_Removed(DeviceWatcher sender, DeviceInformationUpdate infoUpdate);
+
+    std::string pages_directory_;
+    ScanBroker *broker_ = nullptr;
+
+    DeviceWatcher deviceWatcher{nullptr};
+    winrt::event_token deviceWatcherAddedToken;
+    winrt::event_token deviceWatcherRemovedToken;
+    winrt::event_token deviceWatcherCompletedToken;
+
+    // Network scanners advertising eSCL over mDNS.
+    DeviceWatcher esclWatcher{nullptr};
+    winrt::event_token esclWatcherAddedToken;
+    winrt::event_token esclWatcherRemovedToken;
+    winrt::event_token esclWatcherCompletedToken;
+
+    // Watchers yet to finish their initial enumeration.
+    std::atomic<int> pendingEnumerations_{0};
+    std::mutex esclMutex_;
+    std::map<std::string, std::string> esclServices_{}; // mDNS service ID -> eSCL device ID
+  };
+
+} // namespace quick_scanner_plus
+
+#endif // FLUTTER_PLUGIN_QUICK_SCANNER_PLUS_WINRT_SCAN_BACKEND_H_